@@ -141,6 +141,27 @@ class Handle {
          */
         virtual bool check_cross_dev_copy_constraint(const TensorLayout &src);
 
+        /*!
+         * \brief enable deterministic parallelism on CPU handles
+         *
+         * When \p nr is non-zero, multi-threaded CPU algorithms decide their
+         * work partition (tile sizes, blocking and algo usability) as if
+         * max(nr, nr_threads) threads were available, so the order of
+         * floating-point accumulation and thus the result no longer
+         * depends on the number of threads of the dispatcher. Setting it
+         * to 0 (the default) restores the thread-count driven partition.
+         *
+         * It should be set before any operator is created on this handle.
+         */
+        void set_deterministic_nr_partition(size_t nr) {
+            m_deterministic_nr_partition = nr;
+        }
+
+        //! see set_deterministic_nr_partition(); 0 means disabled
+        size_t deterministic_nr_partition() const {
+            return m_deterministic_nr_partition;
+        }
+
     private:
         static constexpr uint32_t ALIVE_MAGIC = 0x8595e9d2u;
         volatile uint32_t m_alive_magic = ALIVE_MAGIC;
@@ -148,6 +169,7 @@ class Handle {
         const HandleType m_handle_type;
         thin_function<void()> m_destructor;
         thin_function<void(OperatorBase*)> m_on_opr_destructed;
+        size_t m_deterministic_nr_partition = 0;
 
         Handle() = delete;
         Handle(const Handle &rhs) = delete;
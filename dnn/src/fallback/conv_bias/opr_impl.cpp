@@ -368,9 +368,8 @@ ConvBiasImpl::NCBKernSizeParam ConvBiasImpl::make_ncb_kern_size_param(
     auto&& fm = check_layout_fwd(src, filter, dst);
     auto& conv_fm = reinterpret_cast<ConvolutionImpl::CanonizedFilterMeta&>(fm);
     
-    size_t nr_threads = static_cast<naive::HandleImpl*>(handle())
-                                ->megcore_dispatcher()
-                                ->nr_threads();
+    size_t nr_threads =
+            static_cast<naive::HandleImpl*>(handle())->nr_partition();
     return {{safe_u32(src[0]),
              {{safe_u32(src[spatial_pos]), safe_u32(src[spatial_pos + 1])}},
              {{safe_u32(dst[spatial_pos]), safe_u32(dst[spatial_pos + 1])}},
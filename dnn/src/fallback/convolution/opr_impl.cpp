@@ -233,9 +233,8 @@ ConvolutionImpl::NCBKernSizeParam ConvolutionImpl::make_ncb_kern_size_param(
         megdnn_assert(0, "invalid conv format %d",
                       static_cast<int>(param().format));
     }
-    size_t nr_threads = static_cast<naive::HandleImpl*>(handle())
-                                ->megcore_dispatcher()
-                                ->nr_threads();
+    size_t nr_threads =
+            static_cast<naive::HandleImpl*>(handle())->nr_partition();
 
     return {safe_u32(src[0]),
             {{safe_u32(src[spatial_pos]), safe_u32(src[spatial_pos + 1])}},
@@ -70,9 +70,8 @@ void WarpPerspectiveImpl::exec(_megdnn_tensor_in src, _megdnn_tensor_in mat,
                                _megdnn_workspace workspace) {
     check_exec_allow_nhwc_mat_idx(src.layout, mat.layout, mat_idx.layout,
                                   dst.layout, workspace.size);
-    size_t nr_threads = static_cast<naive::HandleImpl*>(handle())
-                                ->megcore_dispatcher()
-                                ->nr_threads();
+    size_t nr_threads =
+            static_cast<naive::HandleImpl*>(handle())->nr_partition();
     //! When single thread, it will optimize when resize is usable
     //! When multi threads, it can't use the resize optimizaion, because
     //! not all N can use resize optimizaion, so it can't use the same
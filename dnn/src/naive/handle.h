@@ -16,6 +16,7 @@
 #include "src/naive/local_share/algorithms.h"
 #include "src/naive/convolution3d/algorithms.h"
 
+#include <algorithm>
 #include <functional>
 #include <mutex>
 #include <type_traits>
@@ -144,6 +145,20 @@ public:
 
     MegcoreCPUDispatcher* megcore_dispatcher() const { return m_dispatcher; }
 
+    /*!
+     * \brief number of threads that algorithms should partition their work
+     *      for
+     *
+     * This equals nr_threads of the dispatcher, unless deterministic
+     * parallelism is enabled by set_deterministic_nr_partition(), in which
+     * case the larger of the two is returned so the partition (and the
+     * workspace computed from it) is independent of the actual thread count
+     */
+    size_t nr_partition() const {
+        size_t nr_threads = m_dispatcher->nr_threads();
+        return std::max(deterministic_nr_partition(), nr_threads);
+    }
+
     //! note: the impl requires the handle type to be exactly NAIVE
     size_t image2d_pitch_alignment() const override;
 
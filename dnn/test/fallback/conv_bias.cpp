@@ -14,8 +14,10 @@
 #include "megdnn/oprs.h"
 #include "test/common/benchmarker.h"
 #include "test/common/checker.h"
+#include "test/common/random_state.h"
 #include "test/common/rng.h"
 #include "test/common/tensor.h"
+#include "test/common/workspace_wrapper.h"
 #include "test/fallback/fixture.h"
 
 #if MEGDNN_X86
@@ -236,6 +238,52 @@ TEST_F(FALLBACK_MULTI_THREADS, CONV_BIAS_FORWARD_QUANTIZED) {
                       "FALLBACK_NAIVE");
 }
 
+#if MEGDNN_ENABLE_MULTI_THREADS
+TEST(FALLBACK_MULTI_THREADS_DETERMINISTIC, CONV_BIAS_FORWARD) {
+    constexpr size_t NR_PARTITION = 4;
+    TensorLayout src{{2, 16, 23, 21}, dtype::Float32()},
+            filter{{32, 16, 3, 3}, dtype::Float32()},
+            bias{{1, 32, 1, 1}, dtype::Float32()}, z, dst;
+    param::ConvBias param;
+    param.pad_h = param.pad_w = 1;
+
+    std::vector<dt_float32> expect;
+    NormalRNG rng;
+    for (size_t nr_thread : {1, 2, 3, 4}) {
+        RandomState::reset();
+        TaskExecutorConfig config;
+        config.nr_thread = nr_thread;
+        auto handle = create_cpu_handle(0, true, &config);
+        handle->set_deterministic_nr_partition(NR_PARTITION);
+        auto opr = handle->create_operator<ConvBias>();
+        opr->param() = param;
+        opr->deduce_layout(src, filter, bias, z, dst);
+        Tensor<> t_src(handle.get(), src), t_filter(handle.get(), filter),
+                t_bias(handle.get(), bias), t_dst(handle.get(), dst);
+        rng.gen(t_src.tensornd());
+        rng.gen(t_filter.tensornd());
+        rng.gen(t_bias.tensornd());
+        WorkspaceWrapper workspace(
+                handle.get(), opr->get_workspace_in_bytes(
+                                      src, filter, bias, z, dst, nullptr));
+        opr->exec(t_src.tensornd(), t_filter.tensornd(), t_bias.tensornd(),
+                  {nullptr, z}, t_dst.tensornd(), nullptr,
+                  workspace.workspace());
+        megcoreSynchronize(handle->megcore_computing_handle());
+
+        auto ptr = t_dst.ptr();
+        if (expect.empty()) {
+            expect.assign(ptr, ptr + dst.total_nr_elems());
+            continue;
+        }
+        // bitwise identical rather than close within an epsilon
+        ASSERT_EQ(0, memcmp(expect.data(), ptr,
+                            sizeof(dt_float32) * expect.size()))
+                << "nr_thread=" << nr_thread;
+    }
+}
+#endif
+
 
 #if MEGDNN_WITH_BENCHMARK
 TEST_F(FALLBACK, BENCHMARK_CONVBIAS) {
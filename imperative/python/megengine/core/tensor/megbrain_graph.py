@@ -307,8 +307,10 @@ def dump_graph(
     keep_var_name: int = 1,
     keep_param_name: bool = False,
     keep_opr_priority: bool = False,
+    tensor_value_align: int = 0,
     strip_info_file=None,
-    append_json=False
+    append_json=False,
+    file=None
 ):
     """
     serialize the computing graph of `output_vars` and get byte result.
@@ -328,11 +330,20 @@ def dump_graph(
     :param keep_param_name: whether to keep param names, so param values can be
         easily manipulated after loading model
     :param keep_opr_priority: whether to keep priority setting for operators
+    :param tensor_value_align: if non-zero, pad tensor values to offsets that
+        are multiples of it (e.g. 4096), so they can be used in place when the
+        model file is memory mapped by the loader
     :param strip_info_file: a string for path or a file handler. if is not None,
         then the dump information for code strip would be written to ``strip_info_file``
     :param append_json: will be check when `strip_info_file` is not None. if set
         true, the information for code strip will be append to strip_info_file.
         if set false, will rewrite strip_info_file
+    :param file: if not None, a file object opened in binary mode; the graph is
+        written to it while being dumped, so the whole model is not kept in
+        memory (except for files opened in append mode), and None is returned
+        in place of the byte string. Files that are not seekable (e.g. pipes)
+        are written in a stream layout that can only be loaded by this version
+        or later
     :return: dump result as byte string, and an instance of namedtuple
         :class:`CompGraphDumpResult`, whose fields are:
 
@@ -370,10 +381,12 @@ def dump_graph(
         keep_var_name,
         keep_param_name,
         keep_opr_priority,
+        tensor_value_align,
         stat,
         inputs,
         outputs,
         params,
+        file,
     )
 
     dump_info = CompGraphDumpResult(*stat, inputs, outputs, params)
@@ -29,6 +29,10 @@ class SublinearMemoryConfig:
         in sublinear memory optimization. Default: half of cpu number in the system.
         Note: the value must be greater or equal to one.
         It can also be set through the environmental variable 'MGB_SUBLINEAR_MEMORY_WORKERS'.
+    :param remat_budget: memory budget in bytes for the cost-model driven rematerialization
+        planner. If it is non-zero, checkpoints are chosen by per-operator computation cost so
+        that the peak memory fits the budget while only cheap operators are recomputed. Default: 0.
+        It can also be set (in MB) through the environmental variable 'MGB_SUBLINEAR_MEMORY_REMAT_BUDGET_MB'.
 
     Note that the environmental variable MGB_COMP_GRAPH_OPT must be set to 'enable_sublinear_memory_opt=1'
     in order for the above environmental variable to be effective.
@@ -41,6 +45,7 @@ class SublinearMemoryConfig:
         genetic_pool_size: int = 20,
         lb_memory: int = 0,
         num_worker: int = max(1, get_device_count("cpu") // 2),
+        remat_budget: int = 0,
     ):
         assert thresh_nr_try >= 0, "thresh_nr_try must be greater or equal to zero"
         self.thresh_nr_try = thresh_nr_try
@@ -53,3 +58,5 @@ class SublinearMemoryConfig:
         self.lb_memory = lb_memory
         assert num_worker > 0, "num_worker must be greater or equal to one"
         self.num_worker = num_worker
+        assert remat_budget >= 0, "remat_budget must be greater or equal to zero"
+        self.remat_budget = remat_budget
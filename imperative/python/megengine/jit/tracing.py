@@ -507,6 +507,9 @@ class trace:
             )
             sublinear_config.thresh_nr_try = self._sublinear_memory_config.thresh_nr_try
             sublinear_config.num_worker = self._sublinear_memory_config.num_worker
+            sublinear_config.remat_budget = (
+                self._sublinear_memory_config.remat_budget
+            )
         # profile
         if self._profiling:
             self._profiler = GraphProfiler(graph)
@@ -811,8 +814,7 @@ class trace:
         if isinstance(file, str):
             permission = "wb" if append == False else "ab"
             file = open(file, permission)
-        dump_content, dump_info = G.dump_graph(dest_vars)
-        file.write(dump_content)
+        _, dump_info = G.dump_graph(dest_vars, file=file)
         return dump_info
 
     def _process_inputs(self, *args, **kwargs):
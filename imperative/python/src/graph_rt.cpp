@@ -51,6 +51,25 @@ class _CompGraphProfilerImpl {
         }
 };
 
+//! write to a seekable python file object
+class _PyFileOutput final : public ser::OutputFile {
+    py::object m_write, m_seek, m_tell;
+
+public:
+    explicit _PyFileOutput(py::object file)
+            : m_write{file.attr("write")},
+              m_seek{file.attr("seek")},
+              m_tell{file.attr("tell")} {}
+
+    void write(const void* src, size_t size) override {
+        m_write(py::bytes(static_cast<const char*>(src), size));
+    }
+
+    void seek(size_t offset) override { m_seek(offset); }
+
+    size_t tell() override { return m_tell().cast<size_t>(); }
+};
+
 struct WeakRendezvousArray:
     public std::vector<std::weak_ptr<RendezvousBase>>,
     public UserDataContainer::UserData {
@@ -296,17 +315,41 @@ void init_graph_rt(py::module m) {
         int keep_var_name,
         bool keep_param_name,
         bool keep_opr_priority,
+        size_t tensor_value_align,
         py::list& stat,
         py::list& inputs,
         py::list& outputs,
-        py::list& params
-    ) {
+        py::list& params,
+        py::object file
+    ) -> py::object {
         std::vector<uint8_t> buf;
-        auto dumper = ser::GraphDumper::make(ser::OutputFile::make_vector_proxy(&buf));
+        std::unique_ptr<ser::OutputFile> output;
+        // files in append mode ignore seek() when writing
+        bool append = !file.is_none() && py::hasattr(file, "mode") &&
+                      py::str(file.attr("mode")).cast<std::string>().find(
+                              'a') != std::string::npos;
+        bool seekable = !file.is_none() && file.attr("seekable")().cast<bool>();
+        if (file.is_none() || (seekable && append)) {
+            output = ser::OutputFile::make_vector_proxy(&buf);
+        } else if (seekable) {
+            // write to the python file as the graph is dumped, so the
+            // whole model is not kept in memory
+            output = std::make_unique<_PyFileOutput>(file);
+        } else {
+            // the stream layout can only be loaded by this version or later,
+            // so it is only used when the file can not seek back
+            py::object write = file.attr("write");
+            output = ser::OutputFile::make_stream(
+                    [write](const void* ptr, size_t size) {
+                        write(py::bytes(static_cast<const char*>(ptr), size));
+                    });
+        }
+        auto dumper = ser::GraphDumper::make(std::move(output));
         SymbolVarArray symvars(dest_vars.begin(), dest_vars.end());
 
         ser::GraphDumper::DumpConfig config{keep_var_name, keep_param_name,
                                        keep_opr_priority};
+        config.tensor_value_align = tensor_value_align;
 
         auto rst = dumper->dump(symvars, config);
         for (auto i : rst.inputs) {
@@ -324,6 +367,13 @@ void init_graph_rt(py::module m) {
         for (auto i : rst_stat) {
             stat.append(py::cast(i));
         }
+        if (!file.is_none()) {
+            if (!buf.empty()) {
+                file.attr("write")(py::bytes(
+                        reinterpret_cast<const char*>(buf.data()), buf.size()));
+            }
+            return py::none();
+        }
         return py::bytes(reinterpret_cast<const char*>(&buf[0]), buf.size());
     });
 
@@ -415,7 +465,8 @@ void init_graph_rt(py::module m) {
         DEF_READWRITE(genetic_nr_iter)
         DEF_READWRITE(genetic_pool_size)
         DEF_READWRITE(lb_memory)
-        DEF_READWRITE(num_worker);
+        DEF_READWRITE(num_worker)
+        DEF_READWRITE(remat_budget);
 
 #undef CURRENT_CLASS
     auto common = rel_import("common", m, 1);
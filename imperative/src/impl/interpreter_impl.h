@@ -206,12 +206,14 @@ private:
     std::exception_ptr m_worker_exc;
     size_t m_enable_evict = 0;
 
-    struct WorkQueue : AsyncQueueSC<Command, WorkQueue> {
-        // set max_spin=0 to prevent Queue fetch task in busy wait manner.
-        // this won't affect throughput when python interpreter is sending enough task,
-        // but will significantly save CPU time when waiting for task, e.g. wait for data input
+    struct WorkQueue : AsyncQueueMPSC<Command, WorkQueue> {
+        // only poll a few microseconds before sleeping on futex, so that
+        // commands sent back to back skip the wakeup while little CPU time
+        // is spent when waiting for task, e.g. wait for data input
+        static constexpr size_t QUEUE_CAPACITY = 1024, MAX_SPIN = 4096;
         WorkQueue(ChannelImpl* owner)
-                : AsyncQueueSC<Command, WorkQueue>(0), m_owner(owner) {
+                : AsyncQueueMPSC<Command, WorkQueue>(QUEUE_CAPACITY, MAX_SPIN),
+                  m_owner(owner) {
             sys::set_thread_name("interpreter");
         }
         void process_one_task(Command& cmd) {
@@ -0,0 +1,345 @@
+/**
+ * \file sdk/load-and-run/src/batching_server.cpp
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "./batching_server.h"
+
+#if MGB_HAVE_THREAD
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using namespace mgb;
+
+/* ===================== LogHistogram ===================== */
+
+void LogHistogram::add(double val) {
+    size_t idx = 0;
+    if (val > 1e-9) {
+        auto f = std::ceil(std::log2(val) * 4);
+        // values below 2^-16 are all put in the first bucket
+        idx = std::min<double>(std::max<double>(f + 64, 0), NR_BUCKET - 1);
+    }
+    ++m_count[idx];
+    ++m_tot;
+    m_sum += val;
+    m_max = std::max(m_max, val);
+}
+
+void LogHistogram::merge(const LogHistogram& rhs) {
+    for (size_t i = 0; i < NR_BUCKET; ++i) {
+        m_count[i] += rhs.m_count[i];
+    }
+    m_tot += rhs.m_tot;
+    m_sum += rhs.m_sum;
+    m_max = std::max(m_max, rhs.m_max);
+}
+
+double LogHistogram::percentile(double p) const {
+    if (!m_tot) {
+        return 0;
+    }
+    size_t target = std::ceil(std::min(std::max(p, 0.), 1.) * m_tot), acc = 0;
+    target = std::max<size_t>(target, 1);
+    for (size_t i = 0; i < NR_BUCKET; ++i) {
+        acc += m_count[i];
+        if (acc >= target) {
+            return std::min(
+                    std::exp2((static_cast<double>(i) - 64) / 4), m_max);
+        }
+    }
+    return m_max;
+}
+
+std::string LogHistogram::summary(const char* unit) const {
+    return ssprintf("avg=%.3f%s p50=%.3f%s p90=%.3f%s p99=%.3f%s max=%.3f%s",
+                    mean(), unit, percentile(.5), unit, percentile(.9), unit,
+                    percentile(.99), unit, max(), unit);
+}
+
+/* ===================== BatchingServer ===================== */
+
+namespace {
+double msecs_between(BatchingServer::Clock::time_point begin,
+                     BatchingServer::Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - begin).count();
+}
+
+//! shape of a single sample, i.e. the shape without batch axis
+TensorShape sample_shape(const TensorShape& shape) {
+    mgb_assert(shape.ndim >= 1);
+    TensorShape ret;
+    ret.ndim = shape.ndim - 1;
+    for (size_t i = 0; i < ret.ndim; ++i) {
+        ret[i] = shape[i + 1];
+    }
+    return ret;
+}
+
+TensorShape batched_shape(const TensorShape& sample, size_t batch) {
+    mgb_assert(sample.ndim < TensorShape::MAX_NDIM);
+    TensorShape ret;
+    ret.ndim = sample.ndim + 1;
+    ret[0] = batch;
+    for (size_t i = 0; i < sample.ndim; ++i) {
+        ret[i + 1] = sample[i];
+    }
+    return ret;
+}
+}  // anonymous namespace
+
+BatchingServer::BatchingServer(const LoadResult& model, Config config)
+        : m_config{std::move(config)} {
+    auto batch_sizes = m_config.batch_sizes;
+    std::sort(batch_sizes.begin(), batch_sizes.end());
+    batch_sizes.erase(std::unique(batch_sizes.begin(), batch_sizes.end()),
+                      batch_sizes.end());
+    mgb_assert(!batch_sizes.empty() && batch_sizes[0] > 0,
+               "batch sizes must be positive and non-empty");
+    mgb_assert(m_config.max_latency >= 0);
+
+    for (auto&& i : model.tensor_map) {
+        auto&& shp = i.second->shape();
+        mgb_assert(shp.ndim >= 1, "input %s has no batch axis",
+                   i.first.c_str());
+        m_inputs.push_back({i.first, sample_shape(shp), i.second->dtype()});
+    }
+    std::sort(m_inputs.begin(), m_inputs.end(),
+              [](const Input& a, const Input& b) { return a.name < b.name; });
+
+    for (size_t batch_size : batch_sizes) {
+        m_buckets.emplace_back();
+        auto&& bucket = m_buckets.back();
+        bucket.batch_size = batch_size;
+        bucket.inst = model.make_instance();
+        for (auto&& i : m_inputs) {
+            auto&& hv = *bucket.inst.tensor_map.at(i.name);
+            hv.resize(batched_shape(i.sample_shape, batch_size));
+            memset(hv.raw_ptr(), 0, hv.layout().span().dist_byte());
+        }
+
+        ComputingGraph::OutputSpec out_spec;
+        SymbolVarArray vars;
+        bucket.outputs.resize(bucket.inst.output_var_map.size());
+        size_t idx = 0;
+        for (auto&& i : bucket.inst.output_var_map) {
+            auto&& dest = bucket.outputs[idx++];
+            dest.first = i.first;
+            auto cb = [&hv = dest.second](const DeviceTensorND& dv) {
+                hv.copy_from(dv);
+            };
+            out_spec.emplace_back(i.second, cb);
+            vars.push_back(i.second);
+        }
+        if (m_config.on_compile) {
+            m_config.on_compile(vars);
+        }
+        bucket.func = bucket.inst.graph_compile(out_spec);
+    }
+
+    m_start_time = Clock::now();
+    m_worker = std::thread{&BatchingServer::worker, this};
+}
+
+BatchingServer::~BatchingServer() {
+    stop();
+}
+
+void BatchingServer::stop() {
+    {
+        MGB_LOCK_GUARD(m_mtx);
+        m_stopped = true;
+    }
+    m_cv.notify_all();
+    if (m_worker.joinable()) {
+        m_worker.join();
+    }
+}
+
+std::future<BatchingServer::TensorMap> BatchingServer::submit(
+        TensorMap inputs) {
+    mgb_assert(inputs.size() == m_inputs.size(),
+               "request has %zu inputs, but model requires %zu",
+               inputs.size(), m_inputs.size());
+    size_t nr_sample = 0;
+    for (auto&& i : m_inputs) {
+        auto iter = inputs.find(i.name);
+        mgb_assert(iter != inputs.end(), "input %s not given",
+                   i.name.c_str());
+        auto&& hv = iter->second;
+        auto&& shp = hv.shape();
+        mgb_assert(shp.ndim == i.sample_shape.ndim + 1 &&
+                           sample_shape(shp).eq_shape(i.sample_shape) &&
+                           hv.layout().is_contiguous(),
+                   "bad shape for input %s: expect (N, %s), got %s",
+                   i.name.c_str(), i.sample_shape.to_string().c_str(),
+                   hv.layout().to_string().c_str());
+        mgb_assert(hv.dtype() == i.dtype,
+                   "dtype mismatch for input %s: expect %s, got %s",
+                   i.name.c_str(), i.dtype.name(), hv.dtype().name());
+        mgb_assert(!nr_sample || nr_sample == shp[0],
+                   "inputs have different number of samples");
+        nr_sample = shp[0];
+    }
+    mgb_assert(nr_sample && nr_sample <= max_batch_size(),
+               "bad number of samples: %zu (max batch size %zu)", nr_sample,
+               max_batch_size());
+
+    Request req;
+    req.inputs = std::move(inputs);
+    req.nr_sample = nr_sample;
+    req.submit_time = Clock::now();
+    auto ret = req.promise.get_future();
+    {
+        MGB_LOCK_GUARD(m_mtx);
+        mgb_assert(!m_stopped, "submit to a stopped BatchingServer");
+        m_pending.emplace_back(std::move(req));
+    }
+    m_cv.notify_one();
+    return ret;
+}
+
+BatchingServer::Stats BatchingServer::stats() const {
+    MGB_LOCK_GUARD(m_mtx);
+    auto ret = m_stats;
+    ret.elapsed =
+            std::chrono::duration<double>(Clock::now() - m_start_time).count();
+    return ret;
+}
+
+BatchingServer::Bucket& BatchingServer::get_bucket(size_t nr_sample) {
+    for (auto&& i : m_buckets) {
+        if (i.batch_size >= nr_sample) {
+            return i;
+        }
+    }
+    mgb_throw(InternalError, "no bucket for %zu samples", nr_sample);
+}
+
+void BatchingServer::worker() {
+    auto max_latency = std::chrono::duration_cast<Clock::duration>(
+            std::chrono::duration<double>(m_config.max_latency));
+    std::vector<Request> batch;
+    for (;;) {
+        batch.clear();
+        {
+            std::unique_lock<std::mutex> lock{m_mtx};
+            m_cv.wait(lock,
+                      [this]() { return m_stopped || !m_pending.empty(); });
+            if (m_pending.empty()) {
+                // stopped and drained
+                return;
+            }
+
+            // take requests in arrival order until the largest bucket is
+            // full, or the oldest one reaches its deadline
+            auto deadline = m_pending.front().submit_time + max_latency;
+            size_t nr_sample = 0;
+            for (;;) {
+                while (!m_pending.empty() &&
+                       nr_sample + m_pending.front().nr_sample <=
+                               max_batch_size()) {
+                    nr_sample += m_pending.front().nr_sample;
+                    batch.emplace_back(std::move(m_pending.front()));
+                    m_pending.pop_front();
+                }
+                if (m_stopped || !m_pending.empty() ||
+                    nr_sample == max_batch_size()) {
+                    break;
+                }
+                if (!m_cv.wait_until(lock, deadline, [this]() {
+                        return m_stopped || !m_pending.empty();
+                    })) {
+                    break;
+                }
+            }
+        }
+        run_batch(batch);
+    }
+}
+
+void BatchingServer::run_batch(std::vector<Request>& batch) {
+    auto start = Clock::now();
+    size_t nr_sample = 0;
+    for (auto&& i : batch) {
+        nr_sample += i.nr_sample;
+    }
+    auto&& bucket = get_bucket(nr_sample);
+
+    MGB_TRY {
+        // gather inputs and pad remaining rows with zero
+        for (auto&& inp : m_inputs) {
+            auto&& dest = *bucket.inst.tensor_map.at(inp.name);
+            auto row_size =
+                    dest.layout().span().dist_byte() / bucket.batch_size;
+            auto ptr = dest.raw_ptr();
+            for (auto&& req : batch) {
+                auto&& src = req.inputs.at(inp.name);
+                memcpy(ptr, src.raw_ptr(), row_size * req.nr_sample);
+                ptr += row_size * req.nr_sample;
+            }
+            memset(ptr, 0,
+                   dest.raw_ptr() + row_size * bucket.batch_size - ptr);
+        }
+
+        bucket.func->execute().wait();
+
+        // scatter outputs
+        std::vector<TensorMap> results(batch.size());
+        for (auto&& out : bucket.outputs) {
+            auto&& hv = out.second;
+            mgb_assert(hv.shape().ndim >= 1 &&
+                               hv.shape(0) == bucket.batch_size &&
+                               hv.layout().is_contiguous(),
+                       "output %s has no batch axis: expect batch size %zu, "
+                       "got %s",
+                       out.first.c_str(), bucket.batch_size,
+                       hv.layout().to_string().c_str());
+            auto row_size = hv.layout().span().dist_byte() / bucket.batch_size;
+            auto ptr = hv.raw_ptr();
+            auto shp = sample_shape(hv.shape());
+            for (size_t i = 0; i < batch.size(); ++i) {
+                auto&& dest = results[i][out.first];
+                dest.comp_node(hv.comp_node())
+                        .dtype(hv.dtype())
+                        .resize(batched_shape(shp, batch[i].nr_sample));
+                memcpy(dest.raw_ptr(), ptr, row_size * batch[i].nr_sample);
+                ptr += row_size * batch[i].nr_sample;
+            }
+        }
+
+        auto end = Clock::now();
+        {
+            MGB_LOCK_GUARD(m_mtx);
+            ++m_stats.nr_batch;
+            m_stats.nr_request += batch.size();
+            m_stats.exec_time.add(msecs_between(start, end));
+            m_stats.batch_size.add(nr_sample);
+            for (auto&& i : batch) {
+                m_stats.latency.add(msecs_between(i.submit_time, end));
+                m_stats.queue_time.add(msecs_between(i.submit_time, start));
+            }
+        }
+        for (size_t i = 0; i < batch.size(); ++i) {
+            batch[i].promise.set_value(std::move(results[i]));
+        }
+    }
+    MGB_CATCH(..., {
+        auto exc = std::current_exception();
+        for (auto&& i : batch) {
+            i.promise.set_exception(exc);
+        }
+    });
+}
+
+#endif  // MGB_HAVE_THREAD
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -0,0 +1,176 @@
+/**
+ * \file sdk/load-and-run/src/batching_server.h
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+#pragma once
+
+#include "megbrain/serialization/serializer.h"
+
+#if MGB_HAVE_THREAD
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <thread>
+
+namespace mgb {
+
+/*!
+ * \brief histogram with log-scaled buckets, used for latency and batch size
+ *      statistics
+ *
+ * Bucket i covers values in (2^((i-65)/4), 2^((i-64)/4)], where the offset
+ * of 64 buckets makes the range 2^-16 to 2^15.75; smaller values are
+ * counted in the first bucket and larger ones in the last. Percentiles are
+ * accurate to about 19%. Not thread safe.
+ */
+class LogHistogram {
+    static constexpr size_t NR_BUCKET = 128;
+    size_t m_count[NR_BUCKET] = {0};
+    size_t m_tot = 0;
+    double m_sum = 0, m_max = 0;
+
+public:
+    void add(double val);
+    void merge(const LogHistogram& rhs);
+
+    size_t count() const { return m_tot; }
+    double mean() const { return m_tot ? m_sum / m_tot : 0; }
+    double max() const { return m_max; }
+
+    //! upper bound of the bucket containing the \p p percentile (0 <= p <= 1)
+    double percentile(double p) const;
+
+    //! format percentiles as a one-line summary
+    std::string summary(const char* unit) const;
+};
+
+/*!
+ * \brief in-process serving runtime that coalesces concurrent requests into
+ *      dynamic batches
+ *
+ * The model is loaded once and an instance is created for each batch size
+ * in Config::batch_sizes by GraphLoader::LoadResult::make_instance, so all
+ * the buckets share the params. The first axis of every input and output
+ * var is taken as the batch axis.
+ *
+ * A worker thread takes pending requests in arrival order until the largest
+ * bucket is full or the oldest request has waited for max_latency, runs the
+ * smallest bucket that fits them (padding the remaining rows with zero), and
+ * scatters output rows back to the requests.
+ */
+class BatchingServer : public NonCopyableObj {
+public:
+    using TensorMap = std::unordered_map<std::string, HostTensorND>;
+    using LoadResult = serialization::GraphLoader::LoadResult;
+    using Clock = std::chrono::steady_clock;
+
+    struct Config {
+        //! batch sizes to compile executables for
+        std::vector<size_t> batch_sizes{1, 2, 4, 8};
+
+        //! max time in seconds for a request to wait for its batch to be
+        //! formed
+        double max_latency = 2e-3;
+
+        //! called on each var array to be compiled, e.g. to set algo
+        //! strategies
+        thin_function<void(const SymbolVarArray&)> on_compile;
+    };
+
+    struct Stats {
+        size_t nr_request = 0, nr_batch = 0;
+        //! seconds since the server starts
+        double elapsed = 0;
+        //! latency in milliseconds from submit() to result being ready
+        LogHistogram latency;
+        //! time in milliseconds to wait for the batch to be formed
+        LogHistogram queue_time;
+        //! time in milliseconds to execute each batch
+        LogHistogram exec_time;
+        //! number of valid (not padded) rows in each batch
+        LogHistogram batch_size;
+
+        double throughput() const {
+            return elapsed > 0 ? nr_request / elapsed : 0;
+        }
+    };
+
+    /*!
+     * \param model loaded model; the server keeps its own instances and
+     *      the graph of \p model is not used for execution
+     */
+    BatchingServer(const LoadResult& model, Config config);
+    ~BatchingServer();
+
+    /*!
+     * \brief submit a request asynchronously
+     *
+     * \param inputs value of each input in LoadResult::tensor_map, whose
+     *      first axis is the number of samples in this request (not larger
+     *      than the max batch size) and other axes match the model
+     * \return outputs keyed by names in LoadResult::output_var_map, whose
+     *      first axis has the same number of samples as the inputs
+     */
+    std::future<TensorMap> submit(TensorMap inputs);
+
+    //! stop accepting requests, finish pending ones and join the worker
+    void stop();
+
+    //! get a snapshot of statistics
+    Stats stats() const;
+
+    size_t max_batch_size() const { return m_buckets.back().batch_size; }
+
+private:
+    struct Request {
+        TensorMap inputs;
+        size_t nr_sample;
+        Clock::time_point submit_time;
+        std::promise<TensorMap> promise;
+    };
+
+    struct Input {
+        std::string name;
+        //! shape without the batch axis
+        TensorShape sample_shape;
+        DType dtype;
+    };
+
+    struct Bucket {
+        size_t batch_size;
+        LoadResult inst;
+        std::unique_ptr<cg::AsyncExecutable> func;
+        std::vector<std::pair<std::string, HostTensorND>> outputs;
+    };
+
+    const Config m_config;
+    std::vector<Bucket> m_buckets;
+    //! inputs sorted by name
+    std::vector<Input> m_inputs;
+
+    mutable std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::deque<Request> m_pending;
+    bool m_stopped = false;
+    Clock::time_point m_start_time;
+    Stats m_stats;
+    std::thread m_worker;
+
+    void worker();
+    void run_batch(std::vector<Request>& batch);
+    Bucket& get_bucket(size_t nr_sample);
+};
+
+}  // namespace mgb
+
+#endif  // MGB_HAVE_THREAD
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -10,6 +10,7 @@
  */
 
 #include "./mgblar.h"
+#include "./batching_server.h"
 #include "./infile_persistent_cache.h"
 #include "./json_loader.h"
 #include "./npy.h"
@@ -27,6 +28,7 @@
 #include "megbrain/plugin/profiler.h"
 #include "megbrain/plugin/var_value_checker.h"
 #include "megbrain/serialization/extern_c_opr.h"
+#include "megbrain/serialization/model_bundle.h"
 #include "megbrain/serialization/serializer.h"
 #include "megbrain/utils/debug.h"
 
@@ -78,6 +80,25 @@ R"__usage__(
     will be the thread number. for example:--multi-thread-core-ids "0,1,2,3", the
     number thread if 4,the main thread binding the last core '3',
     for best performance, the main thread should binding to the fast core.
+  --multi-thread-bind-topology
+    Bind the multi threads according to the CPU topology instead of given core
+    ids: one thread per physical core before SMT siblings, faster cores first
+    with the main thread on the fastest one, and sub tasks split by measured
+    per-thread throughput when MGB_CPU_THREAD_POOL_MODE=adaptive.
+  --cpu-mem-policy <policy>
+    Control page size and NUMA placement of large allocations (such as static
+    memory and weights) on CPU comp nodes. policy is a ',' separated list of
+    thp: use transparent huge pages;
+    hugetlb: use hugetlb pages, falling back to thp if unavailable;
+    first-touch: fault in new memory on the comp node threads;
+    bind[:node]: bind new memory to given NUMA node, or the node of comp node
+    threads if not given.
+    For example: --cpu-mem-policy thp,first-touch. It should be used together
+    with --multi-thread-core-ids to keep memory local to bound cores.
+  --deterministic-partition <nr>
+    Partition the work of multi-threaded CPU kernels as if at least nr threads
+    were available, so results are bitwise identical for any --multithread
+    number not larger than nr. It may slow down the computing.
   --profile|--profile-host <output>
     Write profiling result to given file. The output file is in JSON format and
     can be processed by scripts in MegHair/utils/debug.
@@ -132,6 +153,26 @@ R"__usage__(
   --share-param-mem
     Share the memory used by model params with model storage. This can be used
     to reduce memory usage when computing on CPU.
+  --load-thread <num>
+    Number of threads to load param values concurrently with graph
+    construction when loading the model.
+  --mmap-model
+    Map the model file into memory instead of reading it. Params are used in
+    place when their addresses are properly aligned (see `tensor_value_align`
+    of the dump config), so processes serving the same model share memory
+    and loading does not copy the params.
+  --lazy-param
+    Load param values when they are used for the first time during execution,
+    so params on branches that are never executed are not loaded. Best used
+    with --mmap-model. It should not be used with options that transform params
+    at compile time, such as layout transforms and fusions.
+  --shm-cache <name>
+    Share param values and preprocessed weights (see --weight-preprocess) with
+    other processes serving the same model through a POSIX shared memory
+    segment named by <name> and the model hash. The first process fills the
+    segment and seals it after warmup; others wait for it and use the values
+    in place. The segment is kept after exit; remove it from /dev/shm when the
+    model is no longer served.
   --record-comp-seq | --record-comp-seq2
     Record the computing sequence, in level 1 or 2. It reduces overhead of API
     calls of some asynchronous computing devices, especially for OpenCL. In
@@ -167,6 +208,18 @@ R"__usage__(
     Number of threads to run concurrently. All threads perform the same work of
     loading and executing models. This is used for test thread safety, not for
     speed up on multiple cores.
+  --batching-server <batch sizes>
+    Serve the model by an in-process dynamic batching server, which compiles
+    an executable for each of the given ',' separated batch sizes (e.g.
+    1,2,4,8) sharing the same params. Requests with one sample each are sent
+    by concurrent clients, and latency, batch size and throughput statistics
+    are reported. The first axis of all inputs and outputs must be the batch.
+    Inputs are taken from the first testcase or --input if given.
+  --batching-max-latency <ms>
+    Max time for a request to wait for its batch to be formed. Default is 2.
+  --batching-clients <num>
+    Number of concurrent clients for --batching-server; each one sends
+    --iter requests after --warmup-iter ones. Default is 8.
   --disable-assert-throw
     Do not throw exception in case AssertEqual fails. Note that the exit code
     would also be zero if this option is enabled. This should only be used for
@@ -217,6 +270,13 @@ R"__usage__(
   --weight-preprocess
     Execute operators with weight preprocess, which can optimize the operator execution time with
     algo of winograd, im2col ,etc., but it may consume more memory.
+  --dump-compiled-model <path>
+    After running the model, dump it to the given path with the algorithms
+    chosen by --fast-run and the weights preprocessed by --weight-preprocess
+    embedded. Loading the dumped model on a machine with the same MegBrain
+    version and CPU features skips profiling and weight preprocessing; other
+    machines ignore the embedded data. Use the same graph optimization options
+    when running the dumped model. Testcases in the input model are not kept.
 )__usage__"
 R"__usage__(
   --enable-fuse-preprocess
@@ -510,11 +570,14 @@ struct Args {
 
     bool disable_assert_throw = false;
     bool share_param_mem = false;
+    bool mmap_model = false;
 #if MGB_ENABLE_FASTRUN
     bool use_fast_run = false;
 #endif
     bool reproducible = false;
     std::string fast_run_cache_path;
+    std::shared_ptr<InFilePersistentCache> fast_run_cache;
+    std::string compiled_model_path;
     bool copy_to_host = false;
     int nr_run = 10;
     int nr_warmup = 1;
@@ -523,6 +586,9 @@ struct Args {
     size_t workspace_limit = SIZE_MAX;
     std::vector<std::string> data_files;
     serialization::GraphLoader::LoadResult load_ret;
+    //! cache to record algorithms and preprocessed weights for
+    //! --dump-compiled-model
+    std::shared_ptr<serialization::CompiledModelCache> compiled_cache;
 #if MGB_ENABLE_JSON
     std::unique_ptr<GraphProfiler> profiler;
 #endif
@@ -536,6 +602,14 @@ struct Args {
     serialization::GraphLoader::LoadConfig load_config;
     thin_function<void(size_t)> affinity_cb;
 
+    //! options for running in BatchingServer
+    struct BatchingArgs {
+        std::vector<size_t> batch_sizes;
+        double max_latency = 2;  //!< in milliseconds
+        int nr_client = 8;
+    };
+    BatchingArgs batching;
+
     static Args from_argv(int argc, char **argv);
 };
 
@@ -617,10 +691,13 @@ public:
     }
 };
 
-void run_test_st(Args &env) {
+std::unique_ptr<serialization::GraphLoader> make_model_loader(
+        Args& env, uint32_t* nr_test) {
     std::unique_ptr<serialization::InputFile> inp_file;
 
-    if (env.share_param_mem) {
+    if (env.mmap_model) {
+        inp_file = serialization::InputFile::make_mmap(env.model_path.c_str());
+    } else if (env.share_param_mem) {
         FILE *fin = fopen(env.model_path.c_str(), "rb");
         mgb_assert(fin, "failed to open %s: %s", env.model_path.c_str(),
                 strerror(errno));
@@ -635,15 +712,124 @@ void run_test_st(Args &env) {
         inp_file = serialization::InputFile::make_fs(
                 env.model_path.c_str());
     }
-    auto nr_test = read_nr_test(*inp_file);
+    *nr_test = read_nr_test(*inp_file);
 
+    mgb_assert(!serialization::ModelBundle::is_bundle(*inp_file),
+               "model bundles can not be run by load-and-run; load a graph "
+               "from the bundle with serialization::ModelBundle and dump it "
+               "as a model");
     auto format =
             serialization::GraphLoader::identify_graph_dump_format(*inp_file);
     mgb_assert(format.valid(),
                "invalid model: unknown model format, please make sure input "
                "file is generated by GraphDumper");
-    auto loader =
-            serialization::GraphLoader::make(std::move(inp_file), format.val());
+    return serialization::GraphLoader::make(std::move(inp_file), format.val());
+}
+
+//! set algo policy and workspace limit of oprs in \p vars
+void setup_algo_policy(Args& env, const SymbolVarArray& vars) {
+    mgb::gopt::set_opr_algo_workspace_limit_inplace(vars, env.workspace_limit);
+    using S = opr::mixin::AlgoChooserHelper::ExecutionPolicy::Strategy;
+    S strategy = S::HEURISTIC;
+#if MGB_ENABLE_FASTRUN
+    if (env.use_fast_run) {
+        if (env.reproducible) {
+            strategy = S::PROFILE_REPRODUCIBLE;
+        } else {
+            strategy = S::PROFILE;
+        }
+    } else if (env.reproducible) {
+        strategy = S::HEURISTIC_REPRODUCIBLE;
+    }
+#else
+    if (env.reproducible) {
+        strategy = S::HEURISTIC_REPRODUCIBLE;
+    }
+#endif
+    mgb::gopt::modify_opr_algo_strategy_inplace(vars, strategy);
+    if (!env.fast_run_cache_path.empty()) {
+#if MGB_ENABLE_FASTRUN
+        if (!access(env.fast_run_cache_path.c_str(), F_OK)) {
+#else
+        mgb_assert(access(env.fast_run_cache_path.c_str(), F_OK) == 0,
+                   "fast-run cache file can't be accessed");
+#endif
+            FILE* fin = fopen(env.fast_run_cache_path.c_str(), "rb");
+            auto flen = get_file_size(fin);
+            std::unique_ptr<uint8_t[]> buf{new uint8_t[flen]};
+            size_t ret = fread(buf.get(), flen, 1, fin);
+            MGB_MARK_USED_VAR(ret);
+            mgb_assert(ret == 1, "read 1 block (got %zu), and block size %zu.",
+                       ret, flen);
+            fclose(fin);
+            env.fast_run_cache =
+                    std::make_shared<InFilePersistentCache>(buf.get(), flen);
+#if MGB_ENABLE_FASTRUN
+        } else {
+            mgb_assert(env.use_fast_run, "fast-run should be enabled");
+            env.fast_run_cache = std::make_shared<InFilePersistentCache>();
+        }
+#endif
+        PersistentCache::set_impl(env.fast_run_cache);
+        if (env.load_ret.compiled_cache) {
+            mgb_log_warn("cache embedded in the model is overridden by "
+                         "--fast-run-algo-policy");
+        }
+#if MGB_ENABLE_FASTRUN
+        if (!env.use_fast_run)
+#endif
+            mgb::gopt::enable_opr_use_profiling_cache_inplace(vars);
+    }
+    if (env.load_ret.compiled_cache && env.fast_run_cache_path.empty()) {
+        // use algorithms and preprocessed weights recorded in the model
+        env.load_ret.compiled_cache->install();
+        if (env.load_ret.compiled_cache->nr_entry("weight_preprocess:")) {
+            auto&& opt = env.load_ret.graph->options().graph_opt;
+            opt.weight_preprocess = true;
+            opt.weight_preprocess_cache = true;
+        }
+        if (strategy == S::HEURISTIC) {
+            mgb::gopt::enable_opr_use_profiling_cache_inplace(vars);
+        }
+    }
+    if (!env.compiled_model_path.empty()) {
+        // record algorithms and preprocessed weights during execution
+        env.compiled_cache =
+                std::make_shared<serialization::CompiledModelCache>();
+        env.compiled_cache->install();
+        env.load_ret.graph->options().graph_opt.weight_preprocess_cache = true;
+    }
+    if (auto&& shm = env.load_ret.shm_cache) {
+        // share preprocessed weights, with the caches above as fallback
+        shm->install();
+        env.load_ret.graph->options().graph_opt.weight_preprocess_cache = true;
+    }
+}
+
+//! dump the model with entries of env.compiled_cache embedded
+void dump_compiled_model(Args& env) {
+    // load the model again since params may have been released after weight
+    // preprocessing
+    uint32_t nr_test;
+    auto loader = make_model_loader(env, &nr_test);
+    serialization::GraphLoadConfig load_config;
+    load_config.ignore_compiled_cache = true;
+    auto rst = loader->load(load_config);
+
+    serialization::GraphDumpConfig dump_config{1, true};
+    dump_config.compiled_cache = env.compiled_cache;
+    auto dumper = serialization::GraphDumper::make(
+            serialization::OutputFile::make_fs(env.compiled_model_path.c_str()),
+            serialization::GraphDumpFormat::FLATBUFFERS);
+    auto dump_rst = dumper->dump(rst.output_var_list, dump_config);
+    printf("compiled model with %zu cache entries written to %s: %zu bytes\n",
+           env.compiled_cache->nr_entry(), env.compiled_model_path.c_str(),
+           dump_rst.tot_bytes);
+}
+
+void run_test_st(Args &env) {
+    uint32_t nr_test;
+    auto loader = make_model_loader(env, &nr_test);
     RealTimer timer;
     env.load_ret = loader->load(env.load_config, false);
 
@@ -691,52 +877,7 @@ void run_test_st(Args &env) {
         vars.push_back(i.first);
     }
 
-    mgb::gopt::set_opr_algo_workspace_limit_inplace(vars, env.workspace_limit);
-    using S = opr::mixin::AlgoChooserHelper::ExecutionPolicy::Strategy;
-    S strategy = S::HEURISTIC;
-#if MGB_ENABLE_FASTRUN
-    if (env.use_fast_run) {
-        if (env.reproducible) {
-            strategy = S::PROFILE_REPRODUCIBLE;
-        } else {
-            strategy = S::PROFILE;
-        }
-    } else if (env.reproducible) {
-        strategy = S::HEURISTIC_REPRODUCIBLE;
-    }
-#else
-    if (env.reproducible) {
-        strategy = S::HEURISTIC_REPRODUCIBLE;
-    }
-#endif
-    mgb::gopt::modify_opr_algo_strategy_inplace(vars, strategy);
-    if (!env.fast_run_cache_path.empty()) {
-#if MGB_ENABLE_FASTRUN
-        if (!access(env.fast_run_cache_path.c_str(), F_OK)) {
-#else
-        mgb_assert(access(env.fast_run_cache_path.c_str(), F_OK) == 0,
-                   "fast-run cache file can't be accessed");
-#endif
-            FILE* fin = fopen(env.fast_run_cache_path.c_str(), "rb");
-            auto flen = get_file_size(fin);
-            std::unique_ptr<uint8_t[]> buf{new uint8_t[flen]};
-            size_t ret = fread(buf.get(), flen, 1, fin);
-            MGB_MARK_USED_VAR(ret);
-            mgb_assert(ret == 1, "read 1 block (got %zu), and block size %zu.",
-                       ret, flen);
-            fclose(fin);
-            PersistentCache::set_impl(
-                    std::make_shared<InFilePersistentCache>(buf.get(), flen));
-#if MGB_ENABLE_FASTRUN
-        } else {
-            mgb_assert(env.use_fast_run, "fast-run should be enabled");
-            PersistentCache::set_impl(
-                    std::make_shared<InFilePersistentCache>());
-        }
-        if (!env.use_fast_run)
-#endif
-            mgb::gopt::enable_opr_use_profiling_cache_inplace(vars);
-    }
+    setup_algo_policy(env, vars);
 
     auto func = env.load_ret.graph_compile(out_spec);
     auto warmup = [&]() {
@@ -746,6 +887,12 @@ void run_test_st(Args &env) {
             func->execute().wait();
             printf("warmup %d: %.3fms\n", run, timer.get_msecs_reset());
         }
+        // preprocessed weights have been added to the segment by warmup
+        auto&& shm = env.load_ret.shm_cache;
+        if (shm && shm->is_writer() && !shm->sealed()) {
+            shm->seal();
+            printf("=== shm cache sealed: %zu bytes\n", shm->used_bytes());
+        }
     };
 
     auto run_iters = [&](uint32_t case_idx) -> float {
@@ -955,10 +1102,12 @@ void run_test_st(Args &env) {
 #endif
 #if MGB_ENABLE_FASTRUN
     if (!env.fast_run_cache_path.empty()) {
-        static_cast<InFilePersistentCache&>(PersistentCache::inst())
-                .dump_cache(env.fast_run_cache_path.c_str());
+        env.fast_run_cache->dump_cache(env.fast_run_cache_path.c_str());
     }
 #endif
+    if (env.compiled_cache) {
+        dump_compiled_model(env);
+    }
 #if MGB_ENABLE_TENSOR_RT
     if (TensorRTEngineCache::enable_engine_cache()) {
         TensorRTEngineCache::inst().dump_cache();
@@ -966,6 +1115,123 @@ void run_test_st(Args &env) {
 #endif
 }
 
+#if MGB_HAVE_THREAD
+//! run the model by BatchingServer, with requests sent by client threads
+void run_batching_server(Args& env) {
+    uint32_t nr_test;
+    auto loader = make_model_loader(env, &nr_test);
+    RealTimer timer;
+    env.load_ret = loader->load(env.load_config, false);
+    env.load_config.comp_graph.reset();
+    printf("load model: %.3fms\n", timer.get_msecs_reset());
+
+    auto&& tensor_map = env.load_ret.tensor_map;
+    mgb_assert(!tensor_map.empty(), "batching server requires model inputs");
+    if (nr_test) {
+        // use inputs of the first testcase
+        std::vector<std::pair<std::string, HostTensorND*>> inp_tensors;
+        for (auto&& i : tensor_map) {
+            inp_tensors.emplace_back(i.first, i.second.get());
+        }
+        std::sort(inp_tensors.begin(), inp_tensors.end());
+        loader = serialization::GraphLoader::make(loader->reset_file(),
+                                                  loader->format());
+        auto testcase = loader->load(env.load_config, false);
+        mgb_assert(testcase.output_var_list.size() == inp_tensors.size());
+        for (size_t i = 0; i < inp_tensors.size(); ++i) {
+            auto&& opr = testcase.output_var_list[i]
+                                 .node()
+                                 ->owner_opr()
+                                 ->cast_final_safe<opr::SharedDeviceTensor>();
+            inp_tensors[i].second->copy_from(
+                    HostTensorND::make_proxy(*opr.dev_data()));
+        }
+    } else if (!env.data_files.empty()) {
+        DataParser parser;
+        for (auto&& path : env.data_files) {
+            parser.feed(path);
+        }
+        for (auto&& i : parser.inputs) {
+            auto iter = tensor_map.find(i.first);
+            if (iter == tensor_map.end() && tensor_map.size() == 1) {
+                iter = tensor_map.begin();
+            }
+            mgb_assert(iter != tensor_map.end(), "unknown input: %s",
+                       i.first.c_str());
+            iter->second->copy_from(i.second);
+        }
+    }
+
+    // each request carries the first sample of the model inputs
+    BatchingServer::TensorMap request;
+    for (auto&& i : tensor_map) {
+        auto&& hv = *i.second;
+        mgb_assert(hv.shape().ndim >= 1 && hv.shape(0) >= 1 &&
+                           hv.layout().is_contiguous(),
+                   "bad input %s for batching: %s", i.first.c_str(),
+                   hv.layout().to_string().c_str());
+        auto shp = hv.shape();
+        shp[0] = 1;
+        auto&& dest = request[i.first];
+        dest.comp_node(hv.comp_node()).dtype(hv.dtype()).resize(shp);
+        memcpy(dest.raw_ptr(), hv.raw_ptr(), dest.layout().span().dist_byte());
+    }
+
+    BatchingServer::Config config;
+    config.batch_sizes = env.batching.batch_sizes;
+    config.max_latency = env.batching.max_latency * 1e-3;
+    config.on_compile = [&env](const SymbolVarArray& vars) {
+        setup_algo_policy(env, vars);
+    };
+    BatchingServer server{env.load_ret, config};
+    printf("=== prepare batching server: %.3fms\n", timer.get_msecs_reset());
+
+    auto run_clients = [&](int nr_iter) {
+        std::vector<std::thread> clients;
+        for (int i = 0; i < env.batching.nr_client; ++i) {
+            clients.emplace_back([&]() {
+                for (int j = 0; j < nr_iter; ++j) {
+                    server.submit(request).get();
+                }
+            });
+        }
+        for (auto&& i : clients) {
+            i.join();
+        }
+    };
+
+    run_clients(env.nr_warmup);
+    auto warmup_stats = server.stats();
+    printf("=== going to run %d requests on each of %d clients\n", env.nr_run,
+           env.batching.nr_client);
+    timer.reset();
+    run_clients(env.nr_run);
+    auto time = timer.get_secs();
+    server.stop();
+    auto stats = server.stats();
+
+    auto nr_request = stats.nr_request - warmup_stats.nr_request,
+         nr_batch = stats.nr_batch - warmup_stats.nr_batch;
+    printf("=== finished %zu requests in %zu batches: time=%.3fms "
+           "throughput=%.2f/s\n",
+           nr_request, nr_batch, time * 1e3, nr_request / time);
+    printf("latency (including warmup): %s\n",
+           stats.latency.summary("ms").c_str());
+    printf("queue time: %s\n", stats.queue_time.summary("ms").c_str());
+    printf("batch exec time: %s\n", stats.exec_time.summary("ms").c_str());
+    printf("batch size: %s\n", stats.batch_size.summary("").c_str());
+
+#if MGB_ENABLE_FASTRUN
+    if (!env.fast_run_cache_path.empty()) {
+        env.fast_run_cache->dump_cache(env.fast_run_cache_path.c_str());
+    }
+#endif
+    if (env.compiled_cache) {
+        dump_compiled_model(env);
+    }
+}
+#endif  // MGB_HAVE_THREAD
+
 }  // anonymous namespace
 
 int mgb_load_and_run_main(int argc, char** argv) {
@@ -993,7 +1259,14 @@ int mgb_load_and_run_main(int argc, char** argv) {
         return env.args_parse_ret;
     }
 
-    if (env.nr_thread == 1) {
+    if (!env.batching.batch_sizes.empty()) {
+#if MGB_HAVE_THREAD
+        run_batching_server(env);
+#else
+        mgb_log_error("batching server requested, but load-and-run was "
+                      "compiled without thread support.");
+#endif
+    } else if (env.nr_thread == 1) {
         run_test_st(env);
     } else {
 #if MGB_HAVE_THREAD
@@ -1030,6 +1303,7 @@ Args Args::from_argv(int argc, char **argv) {
     }
     set_log_level(LogLevel::WARN);
     ret.model_path = argv[1];
+    Maybe<CompNode::CpuMemPolicy> cpu_mem_policy;
     ret.load_config.comp_graph = ComputingGraph::make();
     auto &&graph_opt = ret.load_config.comp_graph->options();
     graph_opt.graph_opt_level = 0;
@@ -1105,6 +1379,60 @@ Args Args::from_argv(int argc, char **argv) {
             CompNodeEnv::from_comp_node(cn).cpu_env().set_affinity(affinity_cb);
             continue;
         }
+        if (!strcmp(argv[i], "--multi-thread-bind-topology")) {
+            mgb_assert(ret.multithread_number > 0 &&
+                               ret.load_config.comp_node_mapper,
+                       "--multi-thread-bind-topology should be set behind "
+                       "the --multithread param");
+            CompNode::Locator loc;
+            ret.load_config.comp_node_mapper(loc);
+            mgb_assert(loc.type == CompNode::DeviceType::MULTITHREAD,
+                       "topology binding only set on multithread compnode");
+            auto cpus = CompNode::load(loc).bind_cpu_topology({});
+            std::string cpus_str;
+            for (int cpu : cpus) {
+                cpus_str += (cpus_str.empty() ? "" : ",") + std::to_string(cpu);
+            }
+            mgb_log_warn("multi thread bound to cpus: %s", cpus_str.c_str());
+            continue;
+        }
+        if (!strcmp(argv[i], "--cpu-mem-policy")) {
+            ++i;
+            mgb_assert(i < argc, "value not given for --cpu-mem-policy");
+            using Policy = CompNode::CpuMemPolicy;
+            Policy policy;
+            std::stringstream input_stringstream(argv[i]);
+            std::string item;
+            while (getline(input_stringstream, item, ',')) {
+                if (item == "thp") {
+                    policy.huge_page = Policy::HugePage::MADVISE;
+                } else if (item == "hugetlb") {
+                    policy.huge_page = Policy::HugePage::HUGETLB;
+                } else if (item == "first-touch") {
+                    policy.numa = Policy::Numa::FIRST_TOUCH;
+                } else if (item == "bind") {
+                    policy.numa = Policy::Numa::BIND;
+                } else if (!item.compare(0, 5, "bind:")) {
+                    policy.numa = Policy::Numa::BIND;
+                    policy.numa_node = std::stoi(item.substr(5));
+                } else {
+                    mgb_throw(MegBrainError, "bad --cpu-mem-policy item: %s",
+                              item.c_str());
+                }
+            }
+            mgb_log_warn("cpu mem policy: %s", argv[i]);
+            cpu_mem_policy = policy;
+            continue;
+        }
+        if (!strcmp(argv[i], "--deterministic-partition")) {
+            ++i;
+            mgb_assert(i < argc,
+                       "value not given for --deterministic-partition");
+            size_t nr = std::stoul(argv[i]);
+            mgb_log_warn("use deterministic cpu partition: %zu", nr);
+            MegDNNHandle::exchange_default_deterministic_nr_partition(nr);
+            continue;
+        }
 #if MGB_ENABLE_TENSOR_RT
         if (!strcmp(argv[i], "--tensorrt")) {
             mgb_log_warn("use tensorrt mode");
@@ -1335,6 +1663,26 @@ Args Args::from_argv(int argc, char **argv) {
             ret.share_param_mem = true;
             continue;
         }
+        if (!strcmp(argv[i], "--load-thread")) {
+            ++i;
+            mgb_assert(i < argc, "value not given for --load-thread");
+            ret.load_config.nr_load_thread = std::stoul(argv[i]);
+            continue;
+        }
+        if (!strcmp(argv[i], "--mmap-model")) {
+            ret.mmap_model = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--lazy-param")) {
+            ret.load_config.lazy_param = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--shm-cache")) {
+            ++i;
+            mgb_assert(i < argc, "name not given for --shm-cache");
+            ret.load_config.shm_cache.name = argv[i];
+            continue;
+        }
         if (!strcmp(argv[i], "--disable-assert-throw")) {
             ret.disable_assert_throw = true;
             continue;
@@ -1404,6 +1752,30 @@ Args Args::from_argv(int argc, char **argv) {
             ret.nr_thread = std::stoi(argv[i]);
             continue;
         }
+        if (!strcmp(argv[i], "--batching-server")) {
+            ++i;
+            mgb_assert(i < argc, "value not given for --batching-server");
+            std::stringstream input_stringstream(argv[i]);
+            std::string item;
+            while (getline(input_stringstream, item, ',')) {
+                ret.batching.batch_sizes.push_back(std::stoul(item));
+            }
+            continue;
+        }
+        if (!strcmp(argv[i], "--batching-max-latency")) {
+            ++i;
+            mgb_assert(i < argc, "value not given for --batching-max-latency");
+            ret.batching.max_latency = std::stod(argv[i]);
+            mgb_assert(ret.batching.max_latency >= 0);
+            continue;
+        }
+        if (!strcmp(argv[i], "--batching-clients")) {
+            ++i;
+            mgb_assert(i < argc, "value not given for --batching-clients");
+            ret.batching.nr_client = std::stoi(argv[i]);
+            mgb_assert(ret.batching.nr_client > 0);
+            continue;
+        }
         if (!strcmp(argv[i], "--enable-jit")) {
             graph_opt.graph_opt.jit = 1;
             continue;
@@ -1413,12 +1785,40 @@ Args Args::from_argv(int argc, char **argv) {
             graph_opt.graph_opt.enable_weight_preprocess();
             continue;
         }
+        if (!strcmp(argv[i], "--dump-compiled-model")) {
+            ++i;
+            mgb_assert(i < argc, "output file not given for "
+                                 "--dump-compiled-model");
+            ret.compiled_model_path = argv[i];
+            continue;
+        }
 
         fprintf(stderr, "invalid arg: %s\n", argv[i]);
         ret.args_parse_ret = -1;
         return ret;
     }
 
+    if (cpu_mem_policy.valid()) {
+        // set policy on the CPU comp nodes used by the model before weights
+        // are loaded
+        auto mapper = ret.load_config.comp_node_mapper;
+        auto policy_set = std::make_shared<CompNode::UnorderedSet>();
+        ret.load_config.comp_node_mapper =
+                [mapper, policy_set,
+                 policy = cpu_mem_policy.val()](CompNode::Locator& loc) {
+                    if (mapper) {
+                        mapper(loc);
+                    }
+                    auto cn = CompNode::load(loc);
+                    auto type = cn.device_type();
+                    if ((type == CompNode::DeviceType::CPU ||
+                         type == CompNode::DeviceType::MULTITHREAD) &&
+                        policy_set->insert(cn).second) {
+                        cn.set_cpu_mem_policy(policy);
+                    }
+                };
+    }
+
     return ret;
 }
 
@@ -0,0 +1,161 @@
+/**
+ * \file sdk/load-and-run/test/batching_server_test.cpp
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "../src/batching_server.h"
+#include "megbrain/opr/basic_arith_wrapper.h"
+#include "megbrain/opr/io.h"
+
+using namespace mgb;
+
+#if MGB_HAVE_THREAD
+
+namespace {
+constexpr size_t N = 3, C = 5;
+
+//! dump and load y = x * 2 + b with x: (N, C)
+serialization::GraphLoader::LoadResult make_model() {
+    auto cn = CompNode::load("cpu0");
+    std::vector<uint8_t> buf;
+    {
+        auto graph = ComputingGraph::make();
+        auto host_x = std::make_shared<HostTensorND>(
+                cn, TensorShape{N, C}, dtype::Float32());
+        auto host_b = std::make_shared<HostTensorND>(
+                cn, TensorShape{1, C}, dtype::Float32());
+        for (size_t i = 0; i < C; ++i) {
+            host_b->ptr<float>()[i] = i;
+        }
+        auto x = opr::Host2DeviceCopy::make(*graph, host_x, {"x"}),
+             b = opr::SharedDeviceTensor::make(*graph, *host_b, {"b"}),
+             y = x * 2.f + b;
+        auto dumper = serialization::GraphDumper::make(
+                serialization::OutputFile::make_vector_proxy(&buf));
+        dumper->dump({y.rename("y")});
+    }
+    std::shared_ptr<void> model_buf{malloc(buf.size()), free};
+    memcpy(model_buf.get(), buf.data(), buf.size());
+    auto loader = serialization::GraphLoader::make(
+            serialization::InputFile::make_mem_proxy(model_buf, buf.size()));
+    return loader->load();
+}
+
+void check_result(const BatchingServer::TensorMap& inp,
+                  const BatchingServer::TensorMap& out) {
+    auto&& x = inp.at("x");
+    auto&& y = out.at("y");
+    mgb_assert(y.shape().eq_shape(x.shape()), "bad output shape: %s",
+               y.shape().to_string().c_str());
+    for (size_t i = 0; i < x.shape(0); ++i) {
+        for (size_t j = 0; j < C; ++j) {
+            auto expect = x.ptr<float>()[i * C + j] * 2.f + j,
+                 get = y.ptr<float>()[i * C + j];
+            mgb_assert(expect == get, "bad output at (%zu, %zu): %g vs %g",
+                       i, j, expect, get);
+        }
+    }
+}
+
+BatchingServer::TensorMap make_request(size_t nr_sample, float start) {
+    BatchingServer::TensorMap ret;
+    auto&& x = ret["x"];
+    x.comp_node(CompNode::load("cpu0"))
+            .dtype(dtype::Float32())
+            .resize({nr_sample, C});
+    for (size_t i = 0; i < nr_sample * C; ++i) {
+        x.ptr<float>()[i] = start + i;
+    }
+    return ret;
+}
+
+void test_concurrent_requests() {
+    auto model = make_model();
+    BatchingServer::Config config;
+    config.batch_sizes = {4, 1, 2};
+    config.max_latency = 5e-3;
+    BatchingServer server{model, config};
+    mgb_assert(server.max_batch_size() == 4);
+
+    constexpr size_t NR_CLIENT = 4, NR_ITER = 20;
+    std::vector<std::thread> clients;
+    for (size_t i = 0; i < NR_CLIENT; ++i) {
+        clients.emplace_back([&server, i]() {
+            for (size_t j = 0; j < NR_ITER; ++j) {
+                auto inp = make_request(j % 2 + 1, i * 100.f + j);
+                check_result(inp, server.submit(inp).get());
+            }
+        });
+    }
+    for (auto&& i : clients) {
+        i.join();
+    }
+
+    server.stop();
+    auto stats = server.stats();
+    mgb_assert(stats.nr_request == NR_CLIENT * NR_ITER);
+    mgb_assert(stats.nr_batch <= stats.nr_request);
+    mgb_assert(stats.latency.count() == stats.nr_request);
+    mgb_assert(stats.batch_size.count() == stats.nr_batch);
+    mgb_assert(stats.batch_size.max() <= 4);
+}
+
+void test_bad_request() {
+    auto model = make_model();
+    BatchingServer server{model, {}};
+    bool failed = false;
+    MGB_TRY { server.submit(make_request(server.max_batch_size() + 1, 0)); }
+    MGB_CATCH(MegBrainError&, { failed = true; });
+    mgb_assert(failed, "oversized request should be rejected");
+
+    // rejected on submission, so other requests in the batch are not failed
+    auto inp = make_request(1, 0);
+    inp["x"] = HostTensorND{inp["x"].comp_node(), inp["x"].shape(),
+                            dtype::Int32()};
+    failed = false;
+    MGB_TRY { server.submit(inp); }
+    MGB_CATCH(MegBrainError&, { failed = true; });
+    mgb_assert(failed, "request with wrong dtype should be rejected");
+}
+
+void test_histogram() {
+    LogHistogram hist;
+    for (int i = 1; i <= 100; ++i) {
+        hist.add(i);
+    }
+    mgb_assert(hist.count() == 100 && hist.max() == 100);
+    mgb_assert(std::abs(hist.mean() - 50.5) < 1e-6);
+    auto p50 = hist.percentile(.5), p99 = hist.percentile(.99);
+    mgb_assert(p50 >= 50 && p50 < 50 * 1.19, "p50=%g", p50);
+    mgb_assert(p99 >= 99 && p99 <= 100, "p99=%g", p99);
+}
+}  // anonymous namespace
+
+int main() {
+    test_histogram();
+    test_concurrent_requests();
+    test_bad_request();
+    printf("test passed\n");
+    return 0;
+}
+
+#else
+
+int main() {
+    printf("test skipped: no thread support\n");
+    return 0;
+}
+
+#endif  // MGB_HAVE_THREAD
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -11,9 +11,11 @@
 
 #include "./comp_node.h"
 
+#include "megbrain/comp_node/alloc.h"
 #include "megbrain/comp_node_env.h"
 #include "megbrain/system.h"
 #include "megbrain/utils/arith_helper.h"
+#include "megbrain/utils/cancel_token.h"
 #include "megbrain/utils/thread.h"
 #include "megbrain/utils/timer.h"
 #include "megbrain/utils/thread_pool.h"
@@ -23,6 +25,8 @@
 #include <cstdint>
 #include <cstring>
 #include <atomic>
+#include <deque>
+#include <future>
 
 #include <stdlib.h>
 #ifndef __APPLE__
@@ -35,6 +39,10 @@ namespace {
 bool enable_affinity = false;
 using Task = CompNodeEnv::CpuEnv::Task;
 using MultiThreadingTask = megcore::CPUDispatcher::MultiThreadingTask;
+using CpuMemPolicy = CompNode::CpuMemPolicy;
+using CpuBindPolicy = CompNode::CpuBindPolicy;
+using CpuDispatchPriority = CompNode::CpuDispatchPriority;
+using CpuLaneStat = CompNode::CpuLaneStat;
 
 struct TaskElem {
     //! the task to be execute
@@ -42,18 +50,58 @@ struct TaskElem {
     //! number of the parallelism
     size_t nr_parallelism;
 };
+
+//! task in a lane of WorkerQueue
+struct QueuedTask {
+    mgb::TaskElem elem;
+    TimeSpec enqueue_time;
+    //! the token installed when the task is added; the task would be
+    //! skipped if it is cancelled
+    std::shared_ptr<CancelToken> cancel_token;
+};
+
+std::shared_ptr<CancelToken> cur_cancel_token() {
+    auto token = CancelToken::current();
+    return token ? token->shared_from_this() : nullptr;
+}
+
+//! whether a task dispatched by current thread should be skipped
+bool skip_by_cancel_token() {
+    auto token = CancelToken::current();
+    return token && token->skip_task();
+}
+
+thread_local CpuDispatchPriority tl_cpu_dispatch_priority =
+        CpuDispatchPriority::NORMAL;
 }  // anonymous namespace
 
 using CpuCompNodeImpl = CpuCompNode::CompNodeImpl;
 
 void CpuCompNode::CpuDispatchableBase::add_callback(Task&& task) {
+    // callbacks are used for synchronization and must not be cancelled
+    CancelToken::Scope cancel_scope{nullptr};
     dispatch(std::move(task));
 }
 
 class CpuCompNode::WorkerQueue final
-        : public AsyncQueueSC<TaskElem, WorkerQueue> {
+        : public AsyncQueueSC<QueuedTask, WorkerQueue> {
     const Locator m_locator;
     ThreadPool* m_thread_pool = nullptr;
+    //! the queue whose task is being processed by current thread
+    static thread_local const WorkerQueue* sm_cur_processing;
+
+    /*!
+     * Tasks of the HIGH lane are kept in m_high_lane, and an empty marker
+     * task is added to the underlying FIFO queue for each of them. Before
+     * processing any task from the FIFO queue, the worker drains
+     * m_high_lane, so HIGH tasks overtake pending NORMAL tasks while
+     * sync and exception handling of the FIFO queue still cover them.
+     */
+    std::deque<QueuedTask> m_high_lane;
+    Spinlock m_high_lane_mtx;
+
+    CpuLaneStat m_lane_stat[CompNode::NR_CPU_DISPATCH_PRIORITY];
+    Spinlock m_lane_stat_mtx;
 
     void on_async_queue_worker_thread_start() override {
         mgb_assert(m_locator.device >= 0);
@@ -71,6 +119,39 @@ class CpuCompNode::WorkerQueue final
         }
     }
 
+    void update_lane_stat(CpuDispatchPriority priority,
+                          const TimeSpec& enqueue_time) {
+        auto delay = enqueue_time.time_until_secs(RealTimer::get_time());
+        MGB_LOCK_GUARD(m_lane_stat_mtx);
+        auto&& stat = m_lane_stat[static_cast<int>(priority)];
+        ++stat.nr_task;
+        stat.total_delay += delay;
+        stat.max_delay = std::max(stat.max_delay, delay);
+    }
+
+    void run_high_lane() {
+        for (;;) {
+            QueuedTask task;
+            {
+                MGB_LOCK_GUARD(m_high_lane_mtx);
+                if (m_high_lane.empty()) {
+                    return;
+                }
+                task = std::move(m_high_lane.front());
+                m_high_lane.pop_front();
+            }
+            update_lane_stat(CpuDispatchPriority::HIGH, task.enqueue_time);
+            run_queued_task(task);
+        }
+    }
+
+    void run_queued_task(const QueuedTask& task) {
+        if (task.cancel_token && task.cancel_token->skip_task()) {
+            return;
+        }
+        run_task(task.elem);
+    }
+
 public:
     class DispatcherImpl;
 
@@ -80,14 +161,56 @@ public:
         m_thread_pool = thread_pool;
     }
 
-    void process_one_task(const TaskElem& task_elem) {
-        if (m_thread_pool) {
-            m_thread_pool->add_task(task_elem);
+    //! add a task to the lane of given priority
+    void add_task(TaskElem&& elem, CpuDispatchPriority priority =
+                                           CpuDispatchPriority::NORMAL) {
+        auto now = RealTimer::get_time();
+        if (priority == CpuDispatchPriority::HIGH) {
+            {
+                MGB_LOCK_GUARD(m_high_lane_mtx);
+                m_high_lane.push_back(
+                        {std::move(elem), now, cur_cancel_token()});
+            }
+            AsyncQueueSC::add_task(QueuedTask{{{}, 0}, now, nullptr});
         } else {
-            for (size_t i = 0; i < task_elem.nr_parallelism; i++) {
-                task_elem.task(i, 0);
+            AsyncQueueSC::add_task(
+                    QueuedTask{std::move(elem), now, cur_cancel_token()});
+        }
+    }
+
+    void process_one_task(const QueuedTask& task) {
+        run_high_lane();
+        // nr_parallelism is zero for markers of the HIGH lane
+        if (task.elem.nr_parallelism) {
+            update_lane_stat(CpuDispatchPriority::NORMAL, task.enqueue_time);
+            run_queued_task(task);
+        }
+    }
+
+    //! execute a task in current thread
+    void run_task(const TaskElem& task_elem) {
+        auto prev = sm_cur_processing;
+        sm_cur_processing = this;
+        MGB_TRY {
+            if (m_thread_pool) {
+                m_thread_pool->add_task(task_elem);
+            } else {
+                for (size_t i = 0; i < task_elem.nr_parallelism; i++) {
+                    task_elem.task(i, 0);
+                }
             }
         }
+        MGB_FINALLY(sm_cur_processing = prev;);
+    }
+
+    /*!
+     * \brief whether current thread is executing a task of this queue;
+     *      tasks added in such case should be processed synchronously as
+     *      nested tasks, rather than being appended to the queue
+     */
+    bool in_task() const {
+        return sm_cur_processing == this ||
+               (m_thread_pool && m_thread_pool->in_task());
     }
 
     int nr_threads() {
@@ -95,15 +218,33 @@ public:
     }
 
     ThreadPool* get_thread_pool() { return m_thread_pool; }
+
+    CpuLaneStat get_lane_stat(CpuDispatchPriority priority, bool reset) {
+        MGB_LOCK_GUARD(m_lane_stat_mtx);
+        auto&& stat = m_lane_stat[static_cast<int>(priority)];
+        auto ret = stat;
+        if (reset) {
+            stat = {};
+        }
+        return ret;
+    }
 };
 
+thread_local const CpuCompNode::WorkerQueue*
+        CpuCompNode::WorkerQueue::sm_cur_processing = nullptr;
+
 class CpuCompNode::SeqRecorderImpl final : public CompNodeSeqRecorder {
     using CpuEnv = CompNodeEnv::CpuEnv;
     bool m_fake_exec = false, m_synchronized = false, m_stopped = false,
          m_first_replay = true;
     SeqRecorderImpl** const m_self_pointer;
 
-    std::vector<TaskElem> m_tasks;
+    struct RecordedTask {
+        TaskElem elem;
+        //! false for event records, which must not be skipped on replay
+        bool cancellable;
+    };
+    std::vector<RecordedTask> m_tasks;
     ThreadPool* m_thread_pool = nullptr;
     const CompNode m_record_compnode;
     /*!
@@ -158,17 +299,27 @@ public:
                        "replay");
             *m_self_pointer = this;
         }
+        auto cancel_token = CancelToken::current();
+        auto skip = [cancel_token](const RecordedTask& task) {
+            return task.cancellable && cancel_token &&
+                   cancel_token->skip_task();
+        };
         MGB_TRY {
             if (m_thread_pool) {
                 m_thread_pool->active();
                 for (auto&& i : m_tasks) {
-                    m_thread_pool->add_task(i);
+                    if (!skip(i)) {
+                        m_thread_pool->add_task(i.elem);
+                    }
                 }
                 m_thread_pool->deactive();
             }else{
                 for (auto&& task : m_tasks) {
-                    for(size_t i=0; i<task.nr_parallelism;i++){
-                        task.task(i, 0);
+                    if (skip(task)) {
+                        continue;
+                    }
+                    for(size_t i=0; i<task.elem.nr_parallelism;i++){
+                        task.elem.task(i, 0);
                     }
                 }
             }
@@ -211,7 +362,8 @@ public:
                    "dispatch should not be called after recording is stopped");
         if (!m_fake_exec) {
             auto kern = [task](size_t, size_t) { task(); };
-            m_tasks.push_back({std::move(kern), static_cast<size_t>(1_z)});
+            m_tasks.push_back(
+                    {{std::move(kern), static_cast<size_t>(1_z)}, false});
         }
     }
     void dispatch(TaskElem&& task_elem, const CompNode& comp_node) {
@@ -225,7 +377,7 @@ public:
         mgb_assert(!m_stopped,
                    "dispatch should not be called after recording is stopped");
         if (!m_fake_exec) {
-            m_tasks.push_back(task_elem);
+            m_tasks.push_back({task_elem, true});
         }
     }
     size_t nr_threads(const CompNode& comp_node) {
@@ -257,6 +409,18 @@ class CpuCompNode::CompNodeImpl final: public CpuDispatchableBase {
     Locator m_locator, m_locator_logical;
     std::unique_ptr<ThreadPool> m_thread_pool;
 
+    //! non-null if MGB_CPU_SIZE_CLASS_ALLOC is enabled
+    mem_alloc::SizeClassCachingAlloc* m_size_class_alloc = nullptr;
+
+    //! see CompNode::set_cpu_mem_policy; protected by m_mem_policy_mtx
+    CpuMemPolicy m_mem_policy;
+    int m_mem_policy_node = -1;
+    //! whether a mem policy has ever been set
+    std::atomic_bool m_mem_policy_used{false};
+    //! blocks allocated under mem policy, mapped to their sizes
+    ThinHashMap<void*, size_t> m_mem_policy_blocks;
+    Spinlock m_mem_policy_mtx;
+
     //! ptr to default cpu, only used by check_global_finalized
     static CpuCompNodeImpl *sm_default_cpu_comp_node_ptr;
 
@@ -298,6 +462,9 @@ class CpuCompNode::CompNodeImpl final: public CpuDispatchableBase {
         ThreadPool* get_thread_pool() const { return m_thread_pool.get(); }
 
         void* mgb_aligned_alloc(size_t size) {
+            if (m_size_class_alloc) {
+                return m_size_class_alloc->alloc(size);
+            }
             auto alignment = get_mem_addr_alignment();
 #ifdef WIN32
             return _aligned_malloc(size, alignment);
@@ -312,7 +479,12 @@ class CpuCompNode::CompNodeImpl final: public CpuDispatchableBase {
 #endif
         }
 
-        static void mgb_aligned_free(void* ptr) {
+        static void mgb_aligned_free(
+                mem_alloc::SizeClassCachingAlloc* size_class_alloc,
+                void* ptr) {
+            if (size_class_alloc) {
+                return size_class_alloc->free(ptr);
+            }
 #ifdef WIN32
                 _aligned_free(ptr);
 #else
@@ -320,28 +492,73 @@ class CpuCompNode::CompNodeImpl final: public CpuDispatchableBase {
 #endif
         }
 
+        //! allocate by m_mem_policy; return nullptr if not applicable
+        void* alloc_with_mem_policy(size_t size);
+
+        //! remove ptr from m_mem_policy_blocks and return its size, or 0 if
+        //! it is not allocated by alloc_with_mem_policy()
+        size_t take_mem_policy_block(void* ptr) {
+            if (!m_mem_policy_used.load(std::memory_order_acquire)) {
+                return 0;
+            }
+            MGB_LOCK_GUARD(m_mem_policy_mtx);
+            auto iter = m_mem_policy_blocks.find(ptr);
+            if (iter == m_mem_policy_blocks.end()) {
+                return 0;
+            }
+            auto size = iter->second;
+            m_mem_policy_blocks.erase(iter);
+            return size;
+        }
+
         void* alloc_device(size_t size) override {
             if (sm_cur_recorder) {
                 sm_cur_recorder->on_alloc(this);
             }
+            if (m_mem_policy_used.load(std::memory_order_acquire)) {
+                if (auto ptr = alloc_with_mem_policy(size)) {
+                    return ptr;
+                }
+            }
             return mgb_aligned_alloc(size);
         }
 
         void free_device(void *ptr) {
+            auto policy_size = take_mem_policy_block(ptr);
+            auto do_free = [alloc = m_size_class_alloc, ptr, policy_size]() {
+                if (policy_size) {
+                    sys::free_pages(ptr, policy_size);
+                } else {
+                    mgb_aligned_free(alloc, ptr);
+                }
+            };
             if (sm_cur_recorder || check_global_finalized("free_device()")) {
-                mgb_aligned_free(ptr);
+                do_free();
                 if (sm_cur_recorder) {
                     sm_cur_recorder->on_free(this);
                 }
                 return;
             } else {
-                auto do_free = [ptr]() {
-                    mgb_aligned_free(ptr);
-                };
+                // freeing in the NORMAL lane is safe for memory used by
+                // either lane: pending HIGH tasks always run before it
+                CompNode::CpuDispatchPriorityScope priority_scope{
+                        CpuDispatchPriority::NORMAL};
+                CancelToken::Scope cancel_scope{nullptr};
                 m_env.cpu_env().dispatch(do_free);
             }
         }
 
+        void set_mem_policy(const CpuMemPolicy& policy);
+
+        std::vector<int> bind_cpu_topology(const CpuBindPolicy& policy);
+
+        CpuLaneStat get_lane_stat(CpuDispatchPriority priority, bool reset) {
+            if (!m_worker_queue) {
+                return {};
+            }
+            return m_worker_queue->get_lane_stat(priority, reset);
+        }
+
         void *alloc_host(size_t size) override {
             if (m_worker_queue) {
                 m_worker_queue->check_exception();
@@ -351,13 +568,13 @@ class CpuCompNode::CompNodeImpl final: public CpuDispatchableBase {
 
         void free_host(void *ptr) {
             if (check_global_finalized("free_host()")) {
-                mgb_aligned_free(ptr);
+                mgb_aligned_free(m_size_class_alloc, ptr);
                 return;
             }
             if (m_worker_queue) {
                 m_worker_queue->check_exception();
             }
-            return mgb_aligned_free(ptr);
+            return mgb_aligned_free(m_size_class_alloc, ptr);
         }
 
         void copy_to_host(void *host_ptr,
@@ -508,19 +725,30 @@ public:
     void dispatch(Task&& task) override {
         if (auto recorder = m_comp_node->cur_recorder()) {
             recorder->dispatch(std::move(task), m_comp_node);
+        } else if (m_queue->in_task()) {
+            // nested dispatch from a running kernel
+            m_nr_task.fetch_add(1, std::memory_order_relaxed);
+            task();
         } else {
             m_nr_task.fetch_add(1, std::memory_order_relaxed);
             auto kern = [task](size_t, size_t) { task(); };
-            m_queue->add_task({kern, static_cast<size_t>(1_z)});
+            m_queue->add_task({kern, static_cast<size_t>(1_z)},
+                              tl_cpu_dispatch_priority);
         }
     }
 
     void dispatch(MultiThreadingTask&& task, size_t parallelism) override {
         if (auto recorder = m_comp_node->cur_recorder()) {
             recorder->dispatch({std::move(task), parallelism}, m_comp_node);
+        } else if (m_queue->in_task()) {
+            // nested dispatch from a running kernel: sub tasks are executed
+            // in place, and can be taken by idle threads of the pool
+            m_nr_task.fetch_add(1, std::memory_order_relaxed);
+            m_queue->run_task({std::move(task), parallelism});
         } else {
             m_nr_task.fetch_add(1, std::memory_order_relaxed);
-            m_queue->add_task({std::move(task), parallelism});
+            m_queue->add_task({std::move(task), parallelism},
+                              tl_cpu_dispatch_priority);
         }
     }
 
@@ -569,6 +797,8 @@ public:
     void dispatch(Task&& task) override {
         if (auto recorder = m_comp_node->cur_recorder()) {
             recorder->dispatch(std::move(task), m_comp_node);
+        } else if (skip_by_cancel_token()) {
+            return;
         } else if (m_thread_pool) {
             m_nr_task.fetch_add(1, std::memory_order_relaxed);
             auto kern = [task](size_t, size_t) { task(); };
@@ -582,6 +812,8 @@ public:
     void dispatch(MultiThreadingTask&& task, size_t parallelism) override {
         if (auto recorder = m_comp_node->cur_recorder()) {
             recorder->dispatch({std::move(task), parallelism}, m_comp_node);
+        } else if (skip_by_cancel_token()) {
+            return;
         } else if (m_thread_pool) {
             m_nr_task.fetch_add(1, std::memory_order_relaxed);
             m_thread_pool->add_task({task, parallelism});
@@ -653,6 +885,16 @@ CpuCompNode::CompNodeImpl::CompNodeImpl(
                            cn);
         }
     }
+
+    if (auto alloc = mem_alloc::SizeClassCachingAlloc::get_cpu_default()) {
+        if (alloc->config().alignment % get_mem_addr_alignment() == 0) {
+            m_size_class_alloc = alloc;
+        } else {
+            mgb_log_warn(
+                    "size class alloc disabled on %s: alignment %zu required",
+                    locator.to_string().c_str(), get_mem_addr_alignment());
+        }
+    }
 }
 
 class CpuCompNodeImpl::CompSeqRecEventImpl final
@@ -894,6 +1136,206 @@ bool CompNode::enable_affinity_for_cpu(bool flag) {
     return old;
 }
 
+void CompNode::enable_shared_cpu_thread_pool(size_t nr_workers) {
+#if MGB_HAVE_THREAD
+    AffinityCallBack affinity_cb;
+    if (enable_affinity) {
+        affinity_cb = [](size_t id) {
+#if !defined(ANDROID) && !defined(__ANDROID__)
+            sys::set_cpu_affinity(
+                    {static_cast<int>(id % sys::get_cpu_count())});
+#endif
+        };
+    }
+    SharedThreadPool::set_global(nr_workers, affinity_cb);
+#else
+    MGB_MARK_USED_VAR(nr_workers);
+#endif
+}
+
+void CompNode::set_cpu_mem_policy(const CpuMemPolicy& policy) const {
+    mgb_assert(m_impl && m_impl->same_type<CpuCompNodeImpl>(),
+               "set_cpu_mem_policy() called on non-CPU comp node %s",
+               to_string().c_str());
+    static_cast<CpuCompNodeImpl*>(m_impl)->set_mem_policy(policy);
+}
+
+std::vector<int> CompNode::bind_cpu_topology(
+        const CpuBindPolicy& policy) const {
+    mgb_assert(m_impl && m_impl->same_type<CpuCompNodeImpl>(),
+               "bind_cpu_topology() called on non-CPU comp node %s",
+               to_string().c_str());
+    return static_cast<CpuCompNodeImpl*>(m_impl)->bind_cpu_topology(policy);
+}
+
+/* ======================== CpuBindPolicy ========================  */
+
+std::vector<int> CpuCompNodeImpl::bind_cpu_topology(
+        const CpuBindPolicy& policy) {
+    auto&& env = m_env.cpu_env();
+    size_t nr_threads = env.dispatcher->nr_threads();
+    auto cpus = sys::select_cpus(nr_threads, policy.one_per_physical_core,
+                                 policy.prefer_fast_core);
+    // the main thread is the last one and gets the first selected CPU
+    std::vector<int> bound(nr_threads);
+    for (size_t i = 0; i < nr_threads; ++i) {
+        bound[i] = cpus[(i + 1) % nr_threads];
+    }
+    env.set_affinity([bound](size_t thread_id) {
+        sys::set_cpu_affinity({bound[thread_id]});
+    });
+
+    auto pool = get_thread_pool();
+    if (!policy.weight_by_throughput || !pool || nr_threads == 1) {
+        return bound;
+    }
+
+    // measure throughput by running a fixed amount of integer work on all
+    // threads; faster threads take more sub tasks
+    constexpr size_t NR_SUB_TASK_PER_THREAD = 64, NR_ITER = 20000;
+    std::unique_ptr<double[]> time{new double[nr_threads]()};
+    std::unique_ptr<size_t[]> cnt{new size_t[nr_threads]()};
+    auto measure = [&time, &cnt](size_t, size_t thread_id) {
+        RealTimer timer;
+        // volatile so that the loop is neither folded nor vectorized
+        volatile uint32_t acc = thread_id;
+        for (size_t i = 0; i < NR_ITER; ++i) {
+            acc = acc * 1664525u + 1013904223u;
+        }
+        time[thread_id] += timer.get_secs();
+        ++cnt[thread_id];
+    };
+    env.dispatch(std::move(measure), nr_threads * NR_SUB_TASK_PER_THREAD);
+    sync();
+
+    std::vector<float> weights(nr_threads);
+    double sum = 0;
+    size_t nr_measured = 0;
+    for (size_t i = 0; i < nr_threads; ++i) {
+        if (cnt[i] && time[i] > 0) {
+            weights[i] = cnt[i] / time[i];
+            sum += weights[i];
+            ++nr_measured;
+        }
+    }
+    if (!nr_measured) {
+        return bound;
+    }
+    // threads that took no sub task get the average throughput
+    for (auto&& i : weights) {
+        if (i <= 0) {
+            i = sum / nr_measured;
+        }
+    }
+    pool->set_thread_weights(weights);
+    return bound;
+}
+
+/* ===================== CpuDispatchPriority =====================  */
+
+CompNode::CpuDispatchPriorityScope::CpuDispatchPriorityScope(
+        CpuDispatchPriority priority)
+        : m_prev{tl_cpu_dispatch_priority} {
+    tl_cpu_dispatch_priority = priority;
+}
+
+CompNode::CpuDispatchPriorityScope::~CpuDispatchPriorityScope() {
+    tl_cpu_dispatch_priority = m_prev;
+}
+
+CompNode::CpuDispatchPriority CompNode::cur_cpu_dispatch_priority() {
+    return tl_cpu_dispatch_priority;
+}
+
+CompNode::CpuLaneStat CompNode::get_cpu_lane_stat(CpuDispatchPriority priority,
+                                                  bool reset) const {
+    mgb_assert(m_impl && m_impl->same_type<CpuCompNodeImpl>(),
+               "get_cpu_lane_stat() called on non-CPU comp node %s",
+               to_string().c_str());
+    return static_cast<CpuCompNodeImpl*>(m_impl)->get_lane_stat(priority,
+                                                                reset);
+}
+
+/* ======================== CpuMemPolicy ========================  */
+
+void CpuCompNodeImpl::set_mem_policy(const CpuMemPolicy& policy) {
+    int node = policy.numa_node;
+    if (policy.numa == CpuMemPolicy::Numa::BIND && node < 0) {
+        auto query = [&node]() { node = sys::get_cur_numa_node(); };
+        m_env.cpu_env().dispatch(query);
+        sync();
+        if (node < 0) {
+            mgb_log_warn("failed to get NUMA node of %s; mbind disabled",
+                         locator().to_string().c_str());
+        }
+    }
+    MGB_LOCK_GUARD(m_mem_policy_mtx);
+    m_mem_policy = policy;
+    m_mem_policy_node = node;
+    m_mem_policy_used.store(true, std::memory_order_release);
+}
+
+void* CpuCompNodeImpl::alloc_with_mem_policy(size_t size) {
+    using HugePage = CpuMemPolicy::HugePage;
+    using Numa = CpuMemPolicy::Numa;
+    CpuMemPolicy policy;
+    int node;
+    {
+        MGB_LOCK_GUARD(m_mem_policy_mtx);
+        policy = m_mem_policy;
+        node = m_mem_policy_node;
+    }
+    if (size < policy.min_size ||
+        (policy.huge_page == HugePage::NONE && policy.numa == Numa::DEFAULT)) {
+        return nullptr;
+    }
+
+    constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+    bool huge = policy.huge_page != HugePage::NONE;
+    size_t map_size = get_aligned_power2(
+            size, huge ? HUGE_PAGE_SIZE : sys::get_page_size());
+    auto ptr = sys::alloc_pages(
+            map_size, huge ? HUGE_PAGE_SIZE : get_mem_addr_alignment(), huge,
+            policy.huge_page == HugePage::HUGETLB,
+            policy.numa == Numa::BIND ? node : -1);
+    if (!ptr) {
+        return nullptr;
+    }
+
+#if defined(__linux__) && defined(__GNUC__)
+    // while recording, the touch would only be recorded; the pages are
+    // then faulted in by the first kernel writing them
+    if (policy.numa == Numa::FIRST_TOUCH && !cur_recorder()) {
+        // fault in the pages on the threads of this comp node, and wait for
+        // it, so the pages are neither written by the caller nor unmapped by
+        // free() before being touched
+        auto nr_threads = m_env.cpu_env().dispatcher->nr_threads();
+        auto page = sys::get_page_size(), nr_page = map_size / page;
+        auto touch = [ptr, page, nr_page, nr_threads](size_t index, size_t) {
+            auto begin = nr_page * index / nr_threads,
+                 end = nr_page * (index + 1) / nr_threads;
+            for (auto i = begin; i < end; ++i) {
+                static_cast<volatile uint8_t*>(ptr)[i * page] = 0;
+            }
+        };
+        std::promise<void> touched;
+        auto future = touched.get_future();
+        {
+            // the pages must be touched even if current execution is
+            // cancelled
+            CancelToken::Scope cancel_scope{nullptr};
+            m_env.cpu_env().dispatch(std::move(touch), nr_threads);
+        }
+        add_callback([&touched]() { touched.set_value(); });
+        future.wait();
+    }
+#endif
+
+    MGB_LOCK_GUARD(m_mem_policy_mtx);
+    m_mem_policy_blocks[ptr] = map_size;
+    return ptr;
+}
+
 
 /* ======================== EventImpl ========================  */
 
@@ -967,6 +1409,7 @@ void CpuCompNode::CpuDispatchableBase::EventImpl::do_device_wait_by(
 
 void CpuCompNode::CpuDispatchableBase::EventImpl::do_record() {
     incr_nr_req();
+    CancelToken::Scope cancel_scope{nullptr};
     auto call_on_finish = [this]() { on_finish(); };
     static_cast<CpuDispatchableBase*>(m_comp_node_impl)
             ->dispatch(call_on_finish);
@@ -0,0 +1,662 @@
+/**
+ * \file src/core/impl/comp_node/mem_alloc/size_class_alloc.cpp
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "megbrain/comp_node/alloc.h"
+#include "megbrain/system.h"
+#include "megbrain/utils/arith_helper.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+using namespace mgb;
+using namespace mem_alloc;
+
+namespace {
+
+constexpr uint32_t BLOCK_MAGIC_USED = 0x5c1a55ed,
+                   BLOCK_MAGIC_FREED = 0xdeadf1ee;
+
+//! index of size class for blocks that are directly returned to the system
+constexpr uint32_t HUGE_CLASS = ~0u;
+
+//! header at the beginning of each block; the user pointer follows it
+struct BlockHeader {
+    //! first field is overwritten by FreeNode::next while in free lists
+    size_t size;
+    uint32_t cls;
+    uint32_t magic;
+};
+
+struct FreeNode {
+    FreeNode* next;
+};
+
+/*!
+ * \brief Treiber stack with the ABA counter packed into the unused high bits
+ *      of the head pointer
+ *
+ * Nodes must stay accessible after being popped, since a concurrent pop may
+ * still read their next field; this holds because arenas are only released
+ * when the allocator is destroyed.
+ */
+class LockFreeStack {
+    static constexpr int PTR_BITS = sizeof(void*) == 8 ? 48 : 32;
+    static constexpr uint64_t PTR_MASK = (uint64_t(1) << PTR_BITS) - 1;
+
+    std::atomic<uint64_t> m_head{0};
+
+    static FreeNode* ptr(uint64_t v) {
+        return reinterpret_cast<FreeNode*>(
+                static_cast<uintptr_t>(v & PTR_MASK));
+    }
+
+    static uint64_t pack(FreeNode* p, uint64_t prev) {
+        return static_cast<uint64_t>(reinterpret_cast<uintptr_t>(p)) |
+               (((prev >> PTR_BITS) + 1) << PTR_BITS);
+    }
+
+public:
+    static bool addr_fits(const void* p) {
+        return !(static_cast<uint64_t>(reinterpret_cast<uintptr_t>(p)) &
+                 ~PTR_MASK);
+    }
+
+    //! push a chain of nodes linked by next, from first to last
+    void push(FreeNode* first, FreeNode* last) {
+        uint64_t old = m_head.load(std::memory_order_relaxed);
+        do {
+            last->next = ptr(old);
+        } while (!m_head.compare_exchange_weak(old, pack(first, old),
+                                               std::memory_order_release,
+                                               std::memory_order_relaxed));
+    }
+
+    FreeNode* pop() {
+        uint64_t old = m_head.load(std::memory_order_acquire);
+        for (;;) {
+            auto node = ptr(old);
+            if (!node) {
+                return nullptr;
+            }
+            // node->next may be stale if node has been popped by another
+            // thread; the counter in head makes the CAS fail in such case
+            auto next = node->next;
+            if (m_head.compare_exchange_weak(old, pack(next, old),
+                                             std::memory_order_acquire,
+                                             std::memory_order_acquire)) {
+                return node;
+            }
+        }
+    }
+};
+
+class SizeClassCachingAllocImpl;
+
+struct ThreadCache {
+    struct List {
+        FreeNode* head = nullptr;
+        size_t count = 0;
+    };
+    std::vector<List> lists;
+
+    //! statistics not published to the allocator yet
+    size_t nr_alloc = 0, nr_free = 0, nr_tc_hit = 0, nr_central_hit = 0,
+           nr_pending = 0;
+    ptrdiff_t used = 0;
+};
+
+//! allocators that are alive, so thread caches can be flushed at thread exit
+struct AllocRegistry {
+    std::mutex mtx;
+    std::unordered_map<uint64_t, SizeClassCachingAllocImpl*> alive;
+    uint64_t next_id = 1;
+
+    static AllocRegistry& inst() {
+        // never destroyed, since thread_local caches may be destroyed after
+        // static objects
+        static AllocRegistry* ptr = new AllocRegistry;
+        return *ptr;
+    }
+};
+
+//! thread caches of the calling thread, one for each allocator
+struct ThreadCacheSet {
+    struct Entry {
+        uint64_t id;
+        std::unique_ptr<ThreadCache> cache;
+    };
+    std::vector<Entry> entries;
+    uint64_t last_id = 0;
+    ThreadCache* last = nullptr;
+
+    ~ThreadCacheSet();
+};
+
+//! thread_local is not supported on IOS (see cpu/comp_node.cpp), where
+//! thread_cache() returns nullptr and all the blocks go through the central
+//! lists
+#ifndef IOS
+thread_local ThreadCacheSet tl_cache_set;
+#endif
+
+class SizeClassCachingAllocImpl final : public SizeClassCachingAlloc {
+    static constexpr size_t PUBLISH_INTERVAL = 256;
+
+    const Config m_config;
+    const size_t m_header_size;
+    uint64_t m_id;
+
+    //! block size (including header) of each class
+    std::vector<size_t> m_class_size;
+    //! max number of blocks of each small class in a thread cache
+    std::vector<size_t> m_tc_max_count;
+    //! classes below this are small classes
+    uint32_t m_nr_small_class;
+
+    std::unique_ptr<LockFreeStack[]> m_central;
+
+    std::mutex m_arena_mtx;
+    std::vector<std::pair<void*, size_t>> m_arenas;
+    uint8_t *m_arena_cur = nullptr, *m_arena_end = nullptr;
+
+    std::mutex m_large_mtx;
+    //! cached large blocks indexed by cls - m_nr_small_class
+    std::vector<std::vector<BlockHeader*>> m_large_cache;
+    size_t m_large_cached_size = 0;
+
+    std::atomic_size_t m_nr_alloc{0}, m_nr_free{0}, m_nr_tc_hit{0},
+            m_nr_central_hit{0}, m_reserved{0}, m_peak_used{0};
+    std::atomic<ptrdiff_t> m_used{0};
+
+    uint32_t find_class(size_t blk_size) const {
+        auto iter = std::lower_bound(m_class_size.begin(), m_class_size.end(),
+                                     blk_size);
+        mgb_assert(iter != m_class_size.end());
+        return iter - m_class_size.begin();
+    }
+
+    size_t huge_map_size(size_t size) const {
+        return get_aligned_power2(size + m_header_size, sys::get_page_size());
+    }
+
+    void* init_block(void* blk, uint32_t cls, size_t size) {
+        auto hdr = static_cast<BlockHeader*>(blk);
+        hdr->size = size;
+        hdr->cls = cls;
+        hdr->magic = BLOCK_MAGIC_USED;
+        return static_cast<uint8_t*>(blk) + m_header_size;
+    }
+
+    void update_used(ptrdiff_t delta) {
+        auto cur = m_used.fetch_add(delta, std::memory_order_relaxed) + delta;
+        if (cur <= 0) {
+            return;
+        }
+        size_t peak = m_peak_used.load(std::memory_order_relaxed);
+        while (static_cast<size_t>(cur) > peak &&
+               !m_peak_used.compare_exchange_weak(peak, cur,
+                                                  std::memory_order_relaxed)) {
+        }
+    }
+
+    void publish(ThreadCache& tc) {
+        m_nr_alloc.fetch_add(tc.nr_alloc, std::memory_order_relaxed);
+        m_nr_free.fetch_add(tc.nr_free, std::memory_order_relaxed);
+        m_nr_tc_hit.fetch_add(tc.nr_tc_hit, std::memory_order_relaxed);
+        m_nr_central_hit.fetch_add(tc.nr_central_hit,
+                                   std::memory_order_relaxed);
+        update_used(tc.used);
+        tc.nr_alloc = tc.nr_free = tc.nr_tc_hit = tc.nr_central_hit =
+                tc.nr_pending = 0;
+        tc.used = 0;
+    }
+
+    void maybe_publish(ThreadCache& tc) {
+        if (mgb_unlikely(++tc.nr_pending >= PUBLISH_INTERVAL)) {
+            publish(tc);
+        }
+    }
+
+    ThreadCache* thread_cache(bool create = true);
+
+    /*!
+     * \brief carve at most \p nr blocks of class \p cls from the arena and
+     *      link them in a chain
+     * \return head of the chain; the number of blocks is written to \p nr
+     */
+    FreeNode* carve(uint32_t cls, size_t& nr);
+
+    //! get a small block when the thread cache is empty
+    FreeNode* alloc_small_slow(uint32_t cls, ThreadCache* tc);
+
+    //! move the first \p nr blocks of a thread cache list to the central list
+    void drain(uint32_t cls, ThreadCache::List& list, size_t nr);
+
+    void* alloc_large(size_t size);
+    void free_large(BlockHeader* hdr);
+
+public:
+    explicit SizeClassCachingAllocImpl(const Config& config);
+    ~SizeClassCachingAllocImpl();
+
+    void* alloc(size_t size) override;
+    void free(void* ptr) override;
+
+    const Config& config() const override { return m_config; }
+
+    SizeClassAllocStat get_stat() override;
+    void flush_thread_cache() override;
+    void release_cached_large_blocks() override;
+
+    //! return all blocks of a thread cache and publish its statistics
+    void flush(ThreadCache& tc);
+
+    void print_memory_state() override;
+    size_t get_used_memory() override { return get_stat().used; }
+    FreeMemStat get_free_memory() override;
+    FreeMemStat get_free_memory_dev() override { return get_free_memory(); }
+};
+
+ThreadCacheSet::~ThreadCacheSet() {
+    auto&& reg = AllocRegistry::inst();
+    MGB_LOCK_GUARD(reg.mtx);
+    for (auto&& i : entries) {
+        auto iter = reg.alive.find(i.id);
+        if (iter != reg.alive.end()) {
+            iter->second->flush(*i.cache);
+        }
+    }
+}
+
+}  // anonymous namespace
+
+/* ===================== SizeClassCachingAllocImpl ===================== */
+
+SizeClassCachingAllocImpl::SizeClassCachingAllocImpl(const Config& config)
+        : m_config{config},
+          m_header_size{get_aligned_power2<size_t>(sizeof(BlockHeader),
+                                                   config.alignment)} {
+    auto align = config.alignment;
+    mgb_assert(align && !(align & (align - 1)) &&
+                       align <= sys::get_page_size(),
+               "bad alignment: %zu", align);
+    mgb_assert(config.max_small_size <= config.max_cached_size &&
+                       config.max_small_size + m_header_size <=
+                               config.arena_size,
+               "bad size class alloc config: max_small_size=%zu "
+               "max_cached_size=%zu arena_size=%zu",
+               config.max_small_size, config.max_cached_size,
+               config.arena_size);
+
+    // multiples of alignment up to 4 * alignment, then four classes for each
+    // power of two, so the internal fragmentation is at most 25%
+    for (size_t i = 1; i <= 4; ++i) {
+        m_class_size.push_back(align * i);
+    }
+    for (size_t base = align * 4;
+         m_class_size.back() < config.max_cached_size + m_header_size;
+         base *= 2) {
+        for (size_t i = 5; i <= 8; ++i) {
+            m_class_size.push_back(base / 4 * i);
+        }
+    }
+    m_nr_small_class = find_class(config.max_small_size + m_header_size) + 1;
+    for (uint32_t i = 0; i < m_nr_small_class; ++i) {
+        m_tc_max_count.push_back(std::max<size_t>(
+                config.thread_cache_size / m_class_size[i], 2));
+    }
+    m_central.reset(new LockFreeStack[m_nr_small_class]);
+    m_large_cache.resize(m_class_size.size() - m_nr_small_class);
+
+    auto&& reg = AllocRegistry::inst();
+    MGB_LOCK_GUARD(reg.mtx);
+    m_id = reg.next_id++;
+    reg.alive[m_id] = this;
+}
+
+SizeClassCachingAllocImpl::~SizeClassCachingAllocImpl() {
+    {
+        auto&& reg = AllocRegistry::inst();
+        MGB_LOCK_GUARD(reg.mtx);
+        reg.alive.erase(m_id);
+    }
+    release_cached_large_blocks();
+    for (auto&& i : m_arenas) {
+        sys::free_pages(i.first, i.second);
+    }
+}
+
+ThreadCache* SizeClassCachingAllocImpl::thread_cache(bool create) {
+#ifndef IOS
+    auto&& set = tl_cache_set;
+    if (mgb_likely(set.last_id == m_id)) {
+        return set.last;
+    }
+    for (auto&& i : set.entries) {
+        if (i.id == m_id) {
+            set.last_id = m_id;
+            set.last = i.cache.get();
+            return set.last;
+        }
+    }
+    if (!create) {
+        return nullptr;
+    }
+    {
+        // drop caches of destroyed allocators
+        auto&& reg = AllocRegistry::inst();
+        MGB_LOCK_GUARD(reg.mtx);
+        auto is_dead = [&reg](const ThreadCacheSet::Entry& e) {
+            return !reg.alive.count(e.id);
+        };
+        set.entries.erase(std::remove_if(set.entries.begin(),
+                                         set.entries.end(), is_dead),
+                          set.entries.end());
+    }
+    auto cache = std::make_unique<ThreadCache>();
+    cache->lists.resize(m_nr_small_class);
+    set.last_id = m_id;
+    set.last = cache.get();
+    set.entries.push_back({m_id, std::move(cache)});
+    return set.last;
+#else
+    MGB_MARK_USED_VAR(create);
+    return nullptr;
+#endif
+}
+
+FreeNode* SizeClassCachingAllocImpl::carve(uint32_t cls, size_t& nr) {
+    auto blk_size = m_class_size[cls];
+    MGB_LOCK_GUARD(m_arena_mtx);
+    if (static_cast<size_t>(m_arena_end - m_arena_cur) < blk_size) {
+        auto ptr = sys::alloc_pages(m_config.arena_size,
+                                    m_config.use_huge_page ? 2 << 20 : 1,
+                                    m_config.use_huge_page);
+        if (!ptr) {
+            mgb_throw(MemAllocError,
+                      "failed to allocate arena of %zu bytes for size class "
+                      "allocator",
+                      m_config.arena_size);
+        }
+        mgb_assert(LockFreeStack::addr_fits(
+                static_cast<uint8_t*>(ptr) + m_config.arena_size));
+        m_arenas.emplace_back(ptr, m_config.arena_size);
+        m_reserved.fetch_add(m_config.arena_size, std::memory_order_relaxed);
+        // the tail of previous arena is wasted, which is bounded by the max
+        // small block size
+        m_arena_cur = static_cast<uint8_t*>(ptr);
+        m_arena_end = m_arena_cur + m_config.arena_size;
+    }
+    nr = std::min<size_t>(nr, (m_arena_end - m_arena_cur) / blk_size);
+    auto head = reinterpret_cast<FreeNode*>(m_arena_cur);
+    for (size_t i = 0; i < nr; ++i) {
+        auto node = reinterpret_cast<FreeNode*>(m_arena_cur);
+        m_arena_cur += blk_size;
+        node->next = i + 1 < nr ? reinterpret_cast<FreeNode*>(m_arena_cur)
+                                : nullptr;
+    }
+    return head;
+}
+
+FreeNode* SizeClassCachingAllocImpl::alloc_small_slow(uint32_t cls,
+                                                      ThreadCache* tc) {
+    auto&& central = m_central[cls];
+    if (!tc) {
+        if (auto node = central.pop()) {
+            m_nr_central_hit.fetch_add(1, std::memory_order_relaxed);
+            return node;
+        }
+        size_t nr = 1;
+        return carve(cls, nr);
+    }
+
+    // refill half of the thread cache capacity at once
+    auto&& list = tc->lists[cls];
+    size_t batch = std::max<size_t>(m_tc_max_count[cls] / 2, 1);
+    auto ret = central.pop();
+    if (ret) {
+        ++tc->nr_central_hit;
+        for (size_t i = 1; i < batch; ++i) {
+            auto node = central.pop();
+            if (!node) {
+                break;
+            }
+            node->next = list.head;
+            list.head = node;
+            ++list.count;
+        }
+    } else {
+        size_t nr = batch;
+        ret = carve(cls, nr);
+        if (nr > 1) {
+            auto tail = ret->next;
+            while (tail->next) {
+                tail = tail->next;
+            }
+            tail->next = list.head;
+            list.head = ret->next;
+            list.count += nr - 1;
+        }
+    }
+    publish(*tc);
+    return ret;
+}
+
+void SizeClassCachingAllocImpl::drain(uint32_t cls, ThreadCache::List& list,
+                                      size_t nr) {
+    if (!nr) {
+        return;
+    }
+    auto first = list.head, last = first;
+    for (size_t i = 1; i < nr; ++i) {
+        last = last->next;
+    }
+    list.head = last->next;
+    list.count -= nr;
+    m_central[cls].push(first, last);
+}
+
+void* SizeClassCachingAllocImpl::alloc(size_t size) {
+    auto blk_size = size + m_header_size;
+    if (blk_size > m_class_size[m_nr_small_class - 1]) {
+        return alloc_large(size);
+    }
+    auto cls = find_class(blk_size);
+    FreeNode* node;
+    if (auto tc = thread_cache()) {
+        auto&& list = tc->lists[cls];
+        if (mgb_likely(list.head)) {
+            node = list.head;
+            list.head = node->next;
+            --list.count;
+            ++tc->nr_tc_hit;
+        } else {
+            node = alloc_small_slow(cls, tc);
+        }
+        ++tc->nr_alloc;
+        tc->used += size;
+        maybe_publish(*tc);
+    } else {
+        node = alloc_small_slow(cls, nullptr);
+        m_nr_alloc.fetch_add(1, std::memory_order_relaxed);
+        update_used(size);
+    }
+    return init_block(node, cls, size);
+}
+
+void SizeClassCachingAllocImpl::free(void* ptr) {
+    if (!ptr) {
+        return;
+    }
+    auto hdr = reinterpret_cast<BlockHeader*>(static_cast<uint8_t*>(ptr) -
+                                              m_header_size);
+    mgb_assert(hdr->magic != BLOCK_MAGIC_FREED, "double free: %p", ptr);
+    mgb_assert(hdr->magic == BLOCK_MAGIC_USED, "releasing bad pointer: %p",
+               ptr);
+    hdr->magic = BLOCK_MAGIC_FREED;
+    auto cls = hdr->cls;
+    if (cls >= m_nr_small_class) {
+        return free_large(hdr);
+    }
+    auto size = hdr->size;
+    auto node = reinterpret_cast<FreeNode*>(hdr);
+    if (auto tc = thread_cache()) {
+        auto&& list = tc->lists[cls];
+        node->next = list.head;
+        list.head = node;
+        ++tc->nr_free;
+        tc->used -= size;
+        if (mgb_unlikely(++list.count > m_tc_max_count[cls])) {
+            drain(cls, list, list.count / 2);
+            publish(*tc);
+        } else {
+            maybe_publish(*tc);
+        }
+    } else {
+        m_central[cls].push(node, node);
+        m_nr_free.fetch_add(1, std::memory_order_relaxed);
+        update_used(-static_cast<ptrdiff_t>(size));
+    }
+}
+
+void* SizeClassCachingAllocImpl::alloc_large(size_t size) {
+    BlockHeader* hdr = nullptr;
+    uint32_t cls = HUGE_CLASS;
+    size_t map_size;
+    if (size <= m_config.max_cached_size) {
+        cls = find_class(size + m_header_size);
+        map_size = m_class_size[cls];
+        MGB_LOCK_GUARD(m_large_mtx);
+        auto&& cache = m_large_cache[cls - m_nr_small_class];
+        if (!cache.empty()) {
+            hdr = cache.back();
+            cache.pop_back();
+            m_large_cached_size -= map_size;
+            m_nr_central_hit.fetch_add(1, std::memory_order_relaxed);
+        }
+    } else {
+        map_size = huge_map_size(size);
+    }
+    if (!hdr) {
+        hdr = static_cast<BlockHeader*>(
+                sys::alloc_pages(map_size, 1, m_config.use_huge_page));
+        if (!hdr) {
+            mgb_throw(MemAllocError,
+                      "out of memory while requesting %zu bytes", size);
+        }
+        m_reserved.fetch_add(map_size, std::memory_order_relaxed);
+    }
+    m_nr_alloc.fetch_add(1, std::memory_order_relaxed);
+    update_used(size);
+    return init_block(hdr, cls, size);
+}
+
+void SizeClassCachingAllocImpl::free_large(BlockHeader* hdr) {
+    m_nr_free.fetch_add(1, std::memory_order_relaxed);
+    update_used(-static_cast<ptrdiff_t>(hdr->size));
+    size_t map_size;
+    if (hdr->cls != HUGE_CLASS) {
+        map_size = m_class_size[hdr->cls];
+        MGB_LOCK_GUARD(m_large_mtx);
+        if (m_large_cached_size + map_size <= m_config.large_cache_limit) {
+            m_large_cache[hdr->cls - m_nr_small_class].push_back(hdr);
+            m_large_cached_size += map_size;
+            return;
+        }
+    } else {
+        map_size = huge_map_size(hdr->size);
+    }
+    sys::free_pages(hdr, map_size);
+    m_reserved.fetch_sub(map_size, std::memory_order_relaxed);
+}
+
+void SizeClassCachingAllocImpl::flush(ThreadCache& tc) {
+    for (uint32_t i = 0; i < m_nr_small_class; ++i) {
+        drain(i, tc.lists[i], tc.lists[i].count);
+    }
+    publish(tc);
+}
+
+void SizeClassCachingAllocImpl::flush_thread_cache() {
+    if (auto tc = thread_cache(false)) {
+        flush(*tc);
+    }
+}
+
+void SizeClassCachingAllocImpl::release_cached_large_blocks() {
+    MGB_LOCK_GUARD(m_large_mtx);
+    for (size_t i = 0; i < m_large_cache.size(); ++i) {
+        auto map_size = m_class_size[i + m_nr_small_class];
+        for (auto hdr : m_large_cache[i]) {
+            sys::free_pages(hdr, map_size);
+            m_reserved.fetch_sub(map_size, std::memory_order_relaxed);
+        }
+        m_large_cache[i].clear();
+    }
+    m_large_cached_size = 0;
+}
+
+SizeClassAllocStat SizeClassCachingAllocImpl::get_stat() {
+    SizeClassAllocStat ret;
+    ret.nr_alloc = m_nr_alloc.load(std::memory_order_relaxed);
+    ret.nr_free = m_nr_free.load(std::memory_order_relaxed);
+    ret.nr_thread_cache_hit = m_nr_tc_hit.load(std::memory_order_relaxed);
+    ret.nr_central_hit = m_nr_central_hit.load(std::memory_order_relaxed);
+    ret.used = std::max<ptrdiff_t>(m_used.load(std::memory_order_relaxed), 0);
+    ret.peak_used = m_peak_used.load(std::memory_order_relaxed);
+    ret.reserved = m_reserved.load(std::memory_order_relaxed);
+    return ret;
+}
+
+FreeMemStat SizeClassCachingAllocImpl::get_free_memory() {
+    // free blocks are scattered in lock-free lists, so only the total is
+    // reported
+    auto stat = get_stat();
+    return {stat.reserved - std::min(stat.used, stat.reserved), 0, 0, 0};
+}
+
+void SizeClassCachingAllocImpl::print_memory_state() {
+    auto stat = get_stat();
+    MGB_MARK_USED_VAR(stat);
+    mgb_log("size class alloc stats: used=%zu peak=%zu reserved=%zu "
+            "fragmentation=%.3f nr_alloc=%zu nr_free=%zu "
+            "cache_hit_rate=%.3f (thread:%zu central:%zu)",
+            stat.used, stat.peak_used, stat.reserved, stat.fragmentation(),
+            stat.nr_alloc, stat.nr_free, stat.cache_hit_rate(),
+            stat.nr_thread_cache_hit, stat.nr_central_hit);
+}
+
+/* ===================== SizeClassCachingAlloc ===================== */
+
+std::unique_ptr<SizeClassCachingAlloc> SizeClassCachingAlloc::make(
+        const Config& config) {
+    return std::make_unique<SizeClassCachingAllocImpl>(config);
+}
+
+SizeClassCachingAlloc* SizeClassCachingAlloc::get_cpu_default() {
+    // CPU comp nodes may free memory during global finalization, so the
+    // instance is intentionally leaked
+    static SizeClassCachingAlloc* inst = []() -> SizeClassCachingAlloc* {
+        auto env = MGB_GETENV("MGB_CPU_SIZE_CLASS_ALLOC");
+        if (!env || !std::atoi(env)) {
+            return nullptr;
+        }
+        mgb_log_debug("use size class caching allocator for CPU comp nodes");
+        return make({}).release();
+    }();
+    return inst;
+}
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -42,6 +42,7 @@ using namespace mgb;
 MGB_TYPEINFO_OBJ_IMPL(MegDNNHandle);
 
 int MegDNNHandle::sm_default_dbg_level = 0;
+size_t MegDNNHandle::sm_default_deterministic_nr_partition = 0;
 
 MegDNNHandle& MegDNNHandle::get(const CompNodeEnv& env) {
     auto maker = [&]() { return std::make_shared<MegDNNHandle>(env); };
@@ -120,6 +121,15 @@ MegDNNHandle::MegDNNHandle(const CompNodeEnv& env) {
     if (!m_megdnn_handle) {
         m_megdnn_handle = megdnn::Handle::make(m_comp_hdl, level);
     }
+    if (env.property().type == CompNode::DeviceType::CPU) {
+        size_t nr_partition = sm_default_deterministic_nr_partition;
+        if (auto set = MGB_GETENV("MGB_CPU_DETERMINISTIC_PARTITION")) {
+            nr_partition = std::stoul(set);
+            mgb_log_warn("use deterministic cpu partition: %zu",
+                         nr_partition);
+        }
+        m_megdnn_handle->set_deterministic_nr_partition(nr_partition);
+    }
 }
 
 MegDNNHandle::~MegDNNHandle() noexcept {
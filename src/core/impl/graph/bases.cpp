@@ -23,4 +23,27 @@ GraphNodeBase::GraphNodeBase(ComputingGraph *owner_graph):
 
 AsyncExecutable::~AsyncExecutable() noexcept = default;
 
+mgb::CancelToken* AsyncExecutable::start_cancellable_exec() {
+    if (!m_cancel_token) {
+        return nullptr;
+    }
+    m_cancel_token_nr_skipped = m_cancel_token->nr_skipped_task();
+    return m_cancel_token.get();
+}
+
+void AsyncExecutable::check_exec_cancelled() {
+    if (!m_cancel_token) {
+        return;
+    }
+    auto nr_skipped = m_cancel_token->nr_skipped_task();
+    if (nr_skipped > m_cancel_token_nr_skipped) {
+        auto nr = nr_skipped - m_cancel_token_nr_skipped;
+        m_cancel_token_nr_skipped = nr_skipped;
+        mgb_throw(ExecCancelledError,
+                  "execution cancelled%s: %zu kernels skipped",
+                  m_cancel_token->deadline_exceeded() ? " by deadline" : "",
+                  nr);
+    }
+}
+
 // vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -270,6 +270,9 @@ ComputingGraphImpl::ComputingSequence::check_enable_comp_node_seq_recorder() {
 
 void ComputingGraphImpl::ComputingSequence::do_execute(
         MegDNNDtorCheck* dtor_check) {
+    CompNode::CpuDispatchPriorityScope priority_scope{
+            m_owner_graph->options().cpu_dispatch_priority};
+    CancelToken::Scope cancel_scope{start_cancellable_exec()};
     ExecContext exec_ctx{this};
 
     if (dtor_check) {
@@ -383,6 +386,7 @@ void ComputingGraphImpl::ComputingSequence::do_wait(bool explicit_user_wait) {
         auto tmp_async_exc = std::move(m_async_exc);
         mgb_throw_raw(*tmp_async_exc);
     }
+    check_exec_cancelled();
 }
 
 void ComputingGraphImpl::ComputingSequence::cleanup() {
@@ -705,6 +709,7 @@ AsyncExecutable& ComputingGraphImpl::RecordedComputingSequence::execute() {
     for (auto i : m_runtime_checks) {
         i->do_runtime_check();
     }
+    CancelToken::Scope cancel_scope{start_cancellable_exec()};
     m_recorder->replay();
     return *this;
 }
@@ -715,6 +720,7 @@ AsyncExecutable& ComputingGraphImpl::RecordedComputingSequence::wait() {
     if (!m_wait_finished) {
         m_event_end->host_wait();
         m_wait_finished = true;
+        check_exec_cancelled();
     }
     return *this;
 }
@@ -151,6 +151,14 @@ public:
 
     size_t get_run_id() const override { return m_run_id; }
 
+    static_infer::CompSeqInferStat get_static_infer_stat() const override {
+        if (m_owner_graph->m_current_comp_seq != this) {
+            // static infer states have been reset by another func
+            return {};
+        }
+        return m_owner_graph->static_infer_comp_seq_manager().stat();
+    }
+
     //! get the pointer to the run id, so it can be accessed anytime
     const size_t* get_run_id_ptr() const { return &m_run_id; }
 
@@ -278,6 +286,10 @@ public:
         on_not_support(mgb_cstr_log("get_run_id"));
     }
 
+    static_infer::CompSeqInferStat get_static_infer_stat() const override {
+        on_not_support(mgb_cstr_log("get_static_infer_stat"));
+    }
+
     virtual const CompNode::UnorderedMap<size_t>&
     update_static_alloc_plan_and_get_size() override {
         on_not_support(mgb_cstr_log("update_static_alloc_plan_and_get_size"));
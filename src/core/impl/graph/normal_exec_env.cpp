@@ -84,7 +84,15 @@ void NormalExecEnv::run_task_seq_impl(const TaskSeq& seq) {
                 }
             }
 #endif
-            i.task();
+            if (m_cancel_token) {
+                // kernels of oprs are skipped by the comp node once the token
+                // is cancelled, while bookkeeping tasks always run
+                CancelToken::Scope cancel_scope{
+                        i.cancellable ? m_cancel_token : nullptr};
+                i.task();
+            } else {
+                i.task();
+            }
 
             if (check_exec_pause) {
                 wait_resume_if_paused();
@@ -111,18 +119,25 @@ void NormalExecEnv::run_task_seq(const TaskSeq& seq) {
 void NormalExecEnv::dispatch_on_comp_node(CompNode cn, Task&& task) {
     ExecutionMask* mask = nullptr;
     MGB_IF_COND_EXEC(mask = m_cur_active_opr_mask);
-    dispatch_on_comp_node_with_mask(cn, std::move(task), mask);
+    add_task(cn, std::move(task), mask, m_cur_active_opr != nullptr);
 }
 
 void NormalExecEnv::dispatch_on_comp_node_with_mask(CompNode cn, Task&& task,
                                                     ExecutionMask* mask) {
+    add_task(cn, std::move(task), mask, false);
+}
+
+void NormalExecEnv::add_task(CompNode cn, Task&& task, ExecutionMask* mask,
+                             bool cancellable) {
+    MGB_MARK_USED_VAR(mask);
     if (m_async_level) {
         normalize_comp_node(cn);
         m_worker_task_queue.at(cn).emplace_back(
-                std::move(task), m_cur_active_opr MGB_IF_COND_EXEC(, mask));
+                std::move(task), m_cur_active_opr,
+                cancellable MGB_IF_COND_EXEC(, mask));
     } else {
-        m_sync_task_queue.emplace_back(
-                std::move(task), m_cur_active_opr MGB_IF_COND_EXEC(, mask));
+        m_sync_task_queue.emplace_back(std::move(task), m_cur_active_opr,
+                                       cancellable MGB_IF_COND_EXEC(, mask));
     }
 }
 
@@ -130,14 +145,18 @@ void NormalExecEnv::start_exec() {
 #if MGB_HAVE_THREAD
     resume_exec();
 #endif
+    m_cancel_token = CancelToken::current();
 
     if (m_async_level) {
         mgb_assert(!m_worker_task_queue.empty());
         if (m_worker_task_queue.size() > 1 || (m_async_level & 0b100)) {
+            m_cpu_dispatch_priority = CompNode::cur_cpu_dispatch_priority();
             if (m_worker_set.empty()) {
                 // init async dispatch workers
                 for (auto&& i : m_worker_task_queue) {
                     auto runner = [ this, cn = i.first ]() {
+                        CompNode::CpuDispatchPriorityScope priority_scope{
+                                m_cpu_dispatch_priority};
                         run_task_seq<true>(m_worker_task_queue.at(cn));
                     };
                     m_worker_set.add_worker(
@@ -14,6 +14,7 @@
 #include "megbrain/graph/execution_mask.h"
 #include "megbrain/graph/operator_node.h"
 #include "megbrain/utils/async_worker.h"
+#include "megbrain/utils/cancel_token.h"
 
 namespace mgb {
 namespace cg {
@@ -23,25 +24,32 @@ class NormalExecEnv final : public GraphExecutable::ExecEnv {
     struct TaskSeqElem {
         Task task;
         OperatorNodeBase* opr;
+        //! whether kernels dispatched by this task are bound to the cancel
+        //! token; false for bookkeeping tasks such as event records
+        bool cancellable;
         MGB_IF_COND_EXEC(ExecutionMask* mask);
 
-        TaskSeqElem(Task task_, OperatorNodeBase* opr_ MGB_IF_COND_EXEC(
-                                        , ExecutionMask* mask_))
+        TaskSeqElem(Task task_, OperatorNodeBase* opr_, bool cancellable_
+                                MGB_IF_COND_EXEC(, ExecutionMask* mask_))
                 : task{std::move(task_)},
-                  opr{opr_} MGB_IF_COND_EXEC(, mask{mask_}) {}
+                  opr{opr_},
+                  cancellable{cancellable_} MGB_IF_COND_EXEC(, mask{mask_}) {}
 
         TaskSeqElem(const TaskSeqElem&) = default;
 
         // add noexcept so it can be moved in vector
         TaskSeqElem(TaskSeqElem&& rhs) noexcept
                 : task{std::move(rhs.task)},
-                  opr{rhs.opr} MGB_IF_COND_EXEC(, mask{rhs.mask}) {}
+                  opr{rhs.opr},
+                  cancellable{rhs.cancellable} MGB_IF_COND_EXEC(
+                          , mask{rhs.mask}) {}
 
         TaskSeqElem& operator=(const TaskSeqElem&) = default;
 
         TaskSeqElem& operator=(TaskSeqElem&& rhs) noexcept {
             task = std::move(rhs.task);
             opr = rhs.opr;
+            cancellable = rhs.cancellable;
             MGB_IF_COND_EXEC(mask = rhs.mask);
             return *this;
         }
@@ -50,6 +58,11 @@ class NormalExecEnv final : public GraphExecutable::ExecEnv {
     using TaskSeq = std::vector<TaskSeqElem>;
 
     int m_async_level = 1;
+    //! priority of the thread calling start_exec(), used by async workers
+    CompNode::CpuDispatchPriority m_cpu_dispatch_priority =
+            CompNode::CpuDispatchPriority::NORMAL;
+    //! cancel token of the thread calling start_exec()
+    CancelToken* m_cancel_token = nullptr;
 
 #if MGB_HAVE_THREAD
     std::atomic_bool m_exec_paused{false};
@@ -74,6 +87,9 @@ class NormalExecEnv final : public GraphExecutable::ExecEnv {
     template <bool check_exec_pause, bool check_exec_mask>
     void run_task_seq_impl(const TaskSeq& seq);
 
+    void add_task(CompNode cn, Task&& task, ExecutionMask* mask,
+                  bool cancellable);
+
 public:
     //! see ComputingGraph::Options::async_exec_level
     void set_async_level(int level) {
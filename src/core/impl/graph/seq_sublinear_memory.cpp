@@ -60,6 +60,16 @@ bool is_bad_opr(OperatorNodeBase* opr) {
         F::IMPURE_FUNC | F::NO_AUTOMATIC_DUP | F::FORCE_UPDATE_INPUT_VAR);
 }
 
+//! computing cost of an opr used by the rematerialization planner
+struct OprRecompCost {
+    //! number of arithmetic computations given by OprFootprint
+    uint64_t computation = 0;
+    //! computation per byte of output; oprs with high density are expensive
+    //! to recompute relative to the memory their outputs would release
+    double density = 0;
+};
+using OprRecompCostMap = ThinHashMap<OperatorNodeBase*, OprRecompCost>;
+
 }  // namespace
 /* ======================  Abstract Opr & Var ======================  */
 struct SeqModifierForSublinearMemory::Opr {
@@ -68,6 +78,10 @@ struct SeqModifierForSublinearMemory::Opr {
     const size_t time;  //!< index in opr sequence
     const bool is_endpoint;
 
+    //! whether outputs of this opr must be kept (i.e. never discarded and
+    //! recomputed); setup by mark_checkpoints()
+    bool is_checkpoint = false;
+
     //! input vars that have been discarded and need to be recomputed before
     //! this opr; for internal use by apply_discard_plan()
     std::vector<Var*> inputs_to_recompute;
@@ -208,6 +222,16 @@ public:
 
     //! get action for previous get_memory_bottleneck() call
     void get_prev_action(SeqModifyAction& action);
+
+    /*!
+     * \brief mark oprs whose computation density exceeds \p density_thresh
+     *      as checkpoints; should be called after init_seq()
+     */
+    void mark_checkpoints(const OprRecompCostMap& cost, double density_thresh);
+
+    //! total computation of oprs inserted by previous
+    //! get_memory_bottleneck() call
+    uint64_t calc_recomp_cost(const OprRecompCostMap& cost) const;
 };
 
 void SeqModifierForSublinearMemory::ModifyActionPlanner::get_prev_action(
@@ -224,6 +248,28 @@ void SeqModifierForSublinearMemory::ModifyActionPlanner::get_prev_action(
     }
 }
 
+void SeqModifierForSublinearMemory::ModifyActionPlanner::mark_checkpoints(
+        const OprRecompCostMap& cost, double density_thresh) {
+    for (auto&& opr : m_seq) {
+        auto iter = cost.find(opr->orig_opr);
+        opr->is_checkpoint =
+                iter != cost.end() && iter->second.density > density_thresh;
+    }
+}
+
+uint64_t SeqModifierForSublinearMemory::ModifyActionPlanner::calc_recomp_cost(
+        const OprRecompCostMap& cost) const {
+    uint64_t tot = 0;
+    for (auto&& opr : m_seq) {
+        for (auto&& i : opr->oprs_insert_before) {
+            auto iter = cost.find(i->orig_opr);
+            if (iter != cost.end())
+                tot += iter->second.computation;
+        }
+    }
+    return tot;
+}
+
 size_t
 SeqModifierForSublinearMemory::ModifyActionPlanner::get_memory_bottleneck(
         const SplitPointSet& split_point_set) {
@@ -593,7 +639,8 @@ void SeqModifierForSublinearMemory::ModifyActionPlanner::make_discard_plan() {
         // only recompute once, it should serach best recomputing-time in opr-level
         // rather than find best discarding-time in var-level for multi-outputs opr.
         for (auto var : cur_block_alive_vars) {
-            if (is_bad_opr(var->owner_opr()->orig_opr))
+            if (is_bad_opr(var->owner_opr()->orig_opr) ||
+                var->owner_opr()->is_checkpoint)
                 continue;
 
             Var::AccessRecord* best = nullptr;
@@ -686,12 +733,17 @@ class SeqModifierForSublinearMemory::ActionSearcherSingleCN {
     std::vector<std::future<void>> m_futures;
     std::mutex m_mtx;
 
+    //! states for the rematerialization planner
+    OprRecompCostMap m_opr_recomp_cost;
+    uint64_t m_min_recomp_cost;
+
     /*!
      * \brief check given thresh, and update states
      * \return bottleneck value for given thresh
      */
     void do_search_update_thresh(size_t thresh);
     void do_search_update_split_point_set(SplitPointSet& split_point_set);
+    void do_search_update_remat(size_t thresh, double density_thresh);
 
     //! invoke search asynchronously in m_planner_thread_pool
     void invoke_search(size_t thresh);
@@ -706,6 +758,12 @@ class SeqModifierForSublinearMemory::ActionSearcherSingleCN {
     void search_genetic();
     void search_refine();
 
+    /*!
+     * \brief cost-model driven rematerialization: choose the plan with
+     *      least recomputation whose bottleneck fits Config::remat_budget
+     */
+    void search_remat();
+
     static inline bool cmp_sps(const SplitPointSet &a, const SplitPointSet &b) {
         if (a->size() != b->size()) {
             return a->size() < b->size();
@@ -739,6 +797,10 @@ public:
         if (auto env = MGB_GETENV("MGB_SUBLINEAR_MEMORY_LOWER_BOUND_MB")) {
             m_config->lb_memory = std::stoi(env) * 1024 * 1024;
         }
+        if (auto env = MGB_GETENV("MGB_SUBLINEAR_MEMORY_REMAT_BUDGET_MB")) {
+            m_config->remat_budget =
+                    static_cast<size_t>(std::stoull(env)) * 1024 * 1024;
+        }
     }
 
     const SeqModifyAction& search(CompNode comp_node, const OprNodeArray* seq);
@@ -784,6 +846,41 @@ void SeqModifierForSublinearMemory::ActionSearcherSingleCN::
     m_cur_records.emplace_back(std::move(split_point_set), cur);
 }
 
+void SeqModifierForSublinearMemory::ActionSearcherSingleCN::
+        do_search_update_remat(size_t thresh, double density_thresh) {
+    ModifyActionPlanner* planner =
+            m_par_modifier->m_thread2planner.at(std::this_thread::get_id())
+                    .get();
+
+    planner->init_seq(*m_cur_opr_seq);
+    planner->mark_checkpoints(m_opr_recomp_cost, density_thresh);
+    SplitPointSet split_point_set = planner->get_split_point_set(thresh);
+    auto cur = planner->get_memory_bottleneck(split_point_set);
+    auto cost = planner->calc_recomp_cost(m_opr_recomp_cost);
+
+    size_t budget = m_par_modifier->m_config->remat_budget;
+    MGB_LOCK_GUARD(m_mtx);
+    bool fit = cur <= budget, best_fit = m_min_bottleneck <= budget, better;
+    if (fit != best_fit) {
+        better = fit;
+    } else if (fit) {
+        // both fit into budget: prefer less recomputation
+        better = cost < m_min_recomp_cost ||
+                 (cost == m_min_recomp_cost && cur < m_min_bottleneck);
+    } else {
+        better = cur < m_min_bottleneck ||
+                 (cur == m_min_bottleneck && cost < m_min_recomp_cost);
+    }
+    if (better) {
+        m_best_thresh = thresh;
+        m_min_bottleneck = cur;
+        m_min_recomp_cost = cost;
+        m_best_sps = split_point_set;
+        planner->get_prev_action(m_action);
+    }
+    m_history.emplace_back(thresh, cur);
+}
+
 void SeqModifierForSublinearMemory::ActionSearcherSingleCN::invoke_search(
         size_t thresh) {
     m_futures.emplace_back(m_par_modifier->m_planner_thread_pool.launch(
@@ -1003,6 +1100,77 @@ void SeqModifierForSublinearMemory::ActionSearcherSingleCN::search_refine() {
     }
 }
 
+void SeqModifierForSublinearMemory::ActionSearcherSingleCN::search_remat() {
+    auto var2memsize = m_par_modifier->m_mem_opt.var2memsize();
+    OprFootprint footprint;
+    std::vector<double> densities;
+    m_opr_recomp_cost.clear();
+    for (auto opr : *m_cur_opr_seq) {
+        size_t out_size = 0;
+        for (auto i : opr->output()) {
+            auto iter = var2memsize->find(i);
+            if (iter != var2memsize->end())
+                out_size += iter->second;
+        }
+        auto comp = footprint.get_computation(opr);
+        if (!comp || !out_size)
+            continue;
+        auto&& cost = m_opr_recomp_cost[opr];
+        cost.computation = comp;
+        cost.density = static_cast<double>(comp) / out_size;
+        densities.push_back(cost.density);
+    }
+    std::sort(densities.begin(), densities.end());
+    densities.erase(std::unique(densities.begin(), densities.end()),
+                    densities.end());
+
+    size_t NR_TRY = std::max(m_par_modifier->m_config->thresh_nr_try, 1);
+
+    // candidate density thresholds: oprs denser than the thresh would be
+    // checkpointed; infinity means no opr is forced to be kept
+    std::vector<double> density_threshes;
+    for (size_t i = 0; i < NR_TRY && !densities.empty(); ++i) {
+        auto d = densities[densities.size() * i / NR_TRY];
+        if (density_threshes.empty() || density_threshes.back() != d)
+            density_threshes.push_back(d);
+    }
+    density_threshes.push_back(std::numeric_limits<double>::infinity());
+
+    // candidate block size thresholds, similar to search_preset()
+    std::vector<size_t> block_threshes{std::numeric_limits<size_t>::max()};
+    auto init_thresh = m_min_bottleneck;
+    for (size_t thresh = init_thresh >> 1; thresh >= 1024; thresh >>= 1) {
+        block_threshes.push_back(thresh);
+    }
+    auto step = init_thresh / (NR_TRY + 1);
+    for (size_t i = 1; i <= NR_TRY; ++i) {
+        block_threshes.push_back(step * i);
+    }
+
+    m_min_bottleneck = std::numeric_limits<size_t>::max();
+    m_min_recomp_cost = std::numeric_limits<uint64_t>::max();
+    m_history.clear();
+    for (auto d : density_threshes) {
+        for (auto t : block_threshes) {
+            m_futures.emplace_back(m_par_modifier->m_planner_thread_pool.launch(
+                    &ActionSearcherSingleCN::do_search_update_remat, this, t,
+                    d));
+        }
+    }
+    wait_all();
+
+    if (m_min_bottleneck > m_par_modifier->m_config->remat_budget) {
+        mgb_log_warn(
+                "sublinear memory: can not fit into remat budget %.2fMiB on "
+                "%zu oprs; use plan with bottleneck %.2fMiB",
+                m_par_modifier->m_config->remat_budget / 1024.0 / 1024,
+                m_cur_opr_seq->size(), m_min_bottleneck / 1024.0 / 1024);
+    }
+    mgb_log_debug("sublinear memory: remat plan with bottleneck %.2fMiB, "
+                  "recomputation %.3fGOps",
+                  m_min_bottleneck / 1024.0 / 1024, m_min_recomp_cost / 1e9);
+}
+
 const SeqModifierForSublinearMemory::SeqModifyAction&
 SeqModifierForSublinearMemory::ActionSearcherSingleCN::search(
         CompNode comp_node, const OprNodeArray* seq) {
@@ -1025,12 +1193,20 @@ SeqModifierForSublinearMemory::ActionSearcherSingleCN::search(
     invoke_search(m_best_thresh);
     wait_all();
 
-    search_preset();
-    auto t0 = timer.get_msecs_reset();
-    search_genetic();
-    auto t1 = timer.get_msecs_reset();
-    search_refine();
-    auto t2 = timer.get_msecs_reset();
+    double t0, t1 = 0, t2 = 0;
+    bool remat = m_par_modifier->m_config->remat_budget;
+    if (remat) {
+        t0 = timer.get_msecs_reset();
+        search_remat();
+        t1 = timer.get_msecs_reset();
+    } else {
+        search_preset();
+        t0 = timer.get_msecs_reset();
+        search_genetic();
+        t1 = timer.get_msecs_reset();
+        search_refine();
+        t2 = timer.get_msecs_reset();
+    }
 
     std::sort(m_history.begin(), m_history.end());
     m_par_modifier->m_prev_min_bottleneck.at(comp_node) = m_min_bottleneck;
@@ -1039,11 +1215,15 @@ SeqModifierForSublinearMemory::ActionSearcherSingleCN::search(
     constexpr double SIZE2MB = 1.0 / 1024 / 1024;
     std::string msg{
             ssprintf("finished searching for sublinear memory: "
-                     "comp_node=%s seq_len=%zu nr_search=%zu "
-                     "time=%.1fms(init%.2f genetic%.2f refine%.2f)\n"
-                     "thresh     bottleneck",
+                     "comp_node=%s seq_len=%zu nr_search=%zu time=%.1fms",
                      comp_node.to_string().c_str(), seq->size(),
-                     m_history.size(), t0 + t1 + t2, t0, t1, t2)};
+                     m_history.size(), t0 + t1 + t2)};
+    if (remat) {
+        msg.append(ssprintf("(init%.2f remat%.2f)", t0, t1));
+    } else {
+        msg.append(ssprintf("(init%.2f genetic%.2f refine%.2f)", t0, t1, t2));
+    }
+    msg.append("\nthresh     bottleneck");
     for (auto&& i : m_history) {
         msg.push_back('\n');
         msg.append(ssprintf("%-10.2f %-10.2f", i.first * SIZE2MB,
@@ -1055,7 +1235,7 @@ SeqModifierForSublinearMemory::ActionSearcherSingleCN::search(
     msg.push_back('\n');
     msg.append(ssprintf("m_min_bottleneck: %-10.2f\n",
                         m_min_bottleneck * SIZE2MB));
-    if(!m_par_modifier->m_config->genetic_nr_iter) {
+    if (!remat && !m_par_modifier->m_config->genetic_nr_iter) {
         msg.append(ssprintf(
             "\nGenetic algorithm is currently DISABLED, "
             "set MGB_SUBLINEAR_MEMORY_GENETIC_NR_ITER [default = 0]"
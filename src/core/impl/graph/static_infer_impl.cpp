@@ -19,13 +19,17 @@
 #include "megbrain/graph/helper.h"
 #include "megbrain/graph/exc_extra_info.h"
 #include "megbrain/utils/shared_set.h"
+#include "megbrain/utils/hash.h"
+#include "megbrain/utils/timer.h"
 
 #if LOG_INFER_RESULT
 #include "megbrain/tensor_iter.h"
 #endif
 
+#include <algorithm>
 #include <deque>
 #include <cstring>
+#include <limits>
 
 using namespace mgb;
 using namespace cg;
@@ -35,7 +39,8 @@ namespace {
 
 constexpr size_t
     INFER_VALUE_SIZE_THRESH_FOR_WARNING = 1024,
-    INFER_VALUE_CHECK_UNCHANGE_MAX_SIZE = TensorLayout::MAX_NDIM;
+    INFER_VALUE_CHECK_UNCHANGE_MAX_SIZE = TensorLayout::MAX_NDIM,
+    INFER_RESULT_CACHE_VALUE_MAX_BYTE = 1024;
 
 constexpr bool is_static_infer_type(InferType::Flag t) {
     return t & (InferType::RT_STATIC | InferType::CONST);
@@ -1040,6 +1045,7 @@ DepVal StaticInferManagerImpl::get_deps(const DepElement &elem) {
 class CompSeqManager::VersionedTagTrait {
     TagTraitBase * const m_trait;
     size_t m_version = 0;
+    const InpElement *m_result = nullptr;
 
     public:
         VersionedTagTrait(TagTraitBase *trait):
@@ -1052,9 +1058,22 @@ class CompSeqManager::VersionedTagTrait {
          */
         std::pair<bool, bool> update(bool recomp_mutable_srcnode);
 
+        /*!
+         * \brief force next update() to re-assign the shape; used when the
+         *      shape is assigned from cache without re-inferring
+         */
+        void invalidate() {
+            m_version = std::numeric_limits<size_t>::max();
+        }
+
         TagTraitBase* trait() const {
             return m_trait;
         }
+
+        //! result of most recent update()
+        const InpElement* result() const {
+            return m_result;
+        }
 };
 
 std::pair<bool, bool> CompSeqManager::VersionedTagTrait::update(
@@ -1062,6 +1081,7 @@ std::pair<bool, bool> CompSeqManager::VersionedTagTrait::update(
 
     auto rst = m_trait->infer(recomp_mutable_srcnode, false);
     auto version = m_trait->infer_result_version();
+    m_result = rst;
 
     if (version != m_version) {
         bool shp = false;
@@ -1136,6 +1156,8 @@ void CompSeqManager::add_dest(CompSeqExtraInfo &info, TagTraitBase *dest) {
 
 void CompSeqManager::reset_dest(CompSeqExtraInfo &info) {
     m_static_first_run = true;
+    m_infer_result_cache.clear();
+    m_stat = {};
     m_added.clear();
     m_static_infer_const_needed.clear();
     m_static_srcnode.clear();
@@ -1158,7 +1180,92 @@ void CompSeqManager::reset_dest(CompSeqExtraInfo &info) {
     }
 }
 
+bool CompSeqManager::make_src_key() {
+    auto&& key = m_cur_src_key;
+    key.clear();
+    auto append = [&key](const void* ptr, size_t size) {
+        key.append(static_cast<const char*>(ptr), size);
+    };
+    auto append_shape = [&append](const TensorShape& shape) {
+        append(&shape.ndim, sizeof(shape.ndim));
+        append(shape.shape, sizeof(shape.shape[0]) * shape.ndim);
+    };
+    for (auto&& i : m_static_srcnode) {
+        auto rst = i.result();
+        if (i.trait()->handler_type() == TagHandlerType::SHAPE) {
+            append_shape(rst->shape());
+            continue;
+        }
+        auto&& val = rst->value();
+        auto&& layout = val.layout();
+        if (!layout.is_contiguous() ||
+            layout.span().dist_byte() > INFER_RESULT_CACHE_VALUE_MAX_BYTE) {
+            return false;
+        }
+        auto dtype_enum = layout.dtype.enumv();
+        append(&dtype_enum, sizeof(dtype_enum));
+        append_shape(layout);
+        append(val.raw_ptr(), layout.span().dist_byte());
+    }
+    return true;
+}
+
+bool CompSeqManager::apply_cached_result(const InferResultCacheEntry& entry) {
+    bool shape_changed = false;
+    size_t idx = 0;
+    for (auto&& i : m_static_mid) {
+        // the traits are left out of sync, and would be lazily re-inferred if
+        // their results are actually requested
+        i.invalidate();
+        if (i.trait()->handler_type() == TagHandlerType::SHAPE) {
+            auto&& shp = entry.shapes.at(idx++);
+            auto var = i.trait()->tag();
+            if (var->contain_flag(VarNode::Flag::VOLATILE_CONTENT)) {
+                // infer funcs of workspaces also choose the algorithms of
+                // the oprs (see AlgoChooser::setup_algo), so they are re-run
+                // to keep the algorithms in sync with current shapes
+                TensorShape prev = var->shape();
+                i.update(false);
+                shape_changed |= !prev.eq_shape(var->shape());
+                continue;
+            }
+            if (!var->shape().eq_shape(shp)) {
+                var->shape(shp);
+                shape_changed = true;
+            }
+        }
+    }
+    mgb_assert(idx == entry.shapes.size());
+    return shape_changed;
+}
+
+void CompSeqManager::insert_cached_result(uint64_t hash) {
+    size_t cache_size = m_owner_graph->options().static_infer_cache_size;
+    auto&& cache = m_infer_result_cache;
+    InferResultCacheEntry* entry;
+    if (cache.size() < cache_size) {
+        cache.emplace_back();
+        entry = &cache.back();
+    } else {
+        entry = &*std::min_element(
+                cache.begin(), cache.end(), [](const auto& a, const auto& b) {
+                    return a.last_use < b.last_use;
+                });
+    }
+    entry->hash = hash;
+    entry->last_use = ++m_infer_result_cache_clock;
+    entry->key = m_cur_src_key;
+    entry->shapes.clear();
+    for (auto&& i : m_static_mid) {
+        if (i.trait()->handler_type() == TagHandlerType::SHAPE) {
+            entry->shapes.push_back(i.trait()->tag()->shape());
+        }
+    }
+}
+
 bool CompSeqManager::update_static_check_shape_change() {
+    RealTimer timer;
+    ++m_stat.nr_check;
     if (m_static_first_run) {
         for (auto &&i: m_static_infer_const_needed)
             i.update(false);
@@ -1169,13 +1276,42 @@ bool CompSeqManager::update_static_check_shape_change() {
         src_changed |= cur.first;
         shape_changed |= cur.second;
     }
-    if (!src_changed && !m_static_first_run)
+    if (!src_changed && !m_static_first_run) {
+        m_stat.time += timer.get_secs();
         return false;
+    }
+    ++m_stat.nr_src_changed;
+
+    uint64_t hash = 0;
+    bool cacheable = m_owner_graph->options().static_infer_cache_size &&
+                     !m_static_mid.empty() && make_src_key();
+    if (cacheable) {
+        hash = XXHash{}.update(m_cur_src_key.data(), m_cur_src_key.size())
+                       .digest();
+        for (auto&& i : m_infer_result_cache) {
+            if (i.hash == hash && i.key == m_cur_src_key) {
+                i.last_use = ++m_infer_result_cache_clock;
+                shape_changed |= apply_cached_result(i);
+                m_static_first_run = false;
+                ++m_stat.nr_cache_hit;
+                m_stat.time += timer.get_secs();
+                return shape_changed;
+            }
+        }
+    }
 
+    auto full_infer_start = timer.get_secs();
     for (auto &&i: m_static_mid) {
         shape_changed |= i.update(false).second;
     }
     m_static_first_run = false;
+    if (cacheable) {
+        insert_cached_result(hash);
+    }
+    auto time = timer.get_secs();
+    ++m_stat.nr_full_infer;
+    m_stat.full_infer_time += time - full_infer_start;
+    m_stat.time += time;
     return shape_changed;
 }
 
@@ -193,8 +193,35 @@ class CompSeqManager {
 
     bool m_static_first_run = false;
 
+    //! shapes of m_static_mid inferred from given src results
+    struct InferResultCacheEntry {
+        uint64_t hash;
+        size_t last_use;
+        std::string key;
+        TensorShapeArray shapes;
+    };
+
+    //! LRU cache of at most Options::static_infer_cache_size entries
+    std::vector<InferResultCacheEntry> m_infer_result_cache;
+    size_t m_infer_result_cache_clock = 0;
+    std::string m_cur_src_key;
+
+    CompSeqInferStat m_stat;
+
     void add_dest(CompSeqExtraInfo &info, TagTraitBase* dest);
 
+    /*!
+     * \brief serialize the results of m_static_srcnode into m_cur_src_key
+     * \return whether the results could be used as cache key
+     */
+    bool make_src_key();
+
+    //! update shapes of m_static_mid from the cache
+    bool apply_cached_result(const InferResultCacheEntry &entry);
+
+    //! insert shapes of m_static_mid into the cache
+    void insert_cached_result(uint64_t hash);
+
     public:
         CompSeqManager(ComputingGraph *graph);
         ~CompSeqManager() noexcept;
@@ -215,6 +242,11 @@ class CompSeqManager {
          */
         bool update_static_check_shape_change();
 
+        //! statistics since last reset_dest()
+        const CompSeqInferStat& stat() const {
+            return m_stat;
+        }
+
 };
 
 } // static_infer
@@ -16,6 +16,7 @@
 
 #include "megbrain/gopt/framework.h"
 #include "megbrain/opr/io.h"
+#include "megbrain/plugin/opr_footprint.h"
 #include "megbrain/serialization/serializer.h"
 #include "megbrain/serialization/opr_shallow_copy.h"
 
@@ -148,6 +149,31 @@ MemorySwap::MemorySwap(ComputingGraph* graph) : m_owner_graph(graph){};
 
 MemorySwap::~MemorySwap() noexcept = default;
 
+void MemorySwap::init_opr_time(const cg::OprNodeArray& opr_seq) {
+    OprFootprint footprint;
+    m_opr_time.resize(opr_seq.size());
+    for (size_t i = 0; i < opr_seq.size(); ++i) {
+        m_opr_time[i] = footprint.get_computation(opr_seq[i]) /
+                                m_compute_throughput +
+                        m_opr_latency;
+    }
+}
+
+int MemorySwap::prefetch_distance(size_t consumer_pos, size_t producer_pos,
+                                  size_t nbytes) const {
+    mgb_assert(producer_pos < consumer_pos);
+    double need = nbytes / m_cpu_gpu_bandwidth + m_copy_latency, acc = 0;
+    int dist = 1;
+    // the swap-in must be issued after the var has been produced
+    int max_dist = std::min<int>(m_max_prefetch, consumer_pos - producer_pos - 1);
+    for (; dist < max_dist; ++dist) {
+        acc += m_opr_time[consumer_pos - dist];
+        if (acc >= need)
+            break;
+    }
+    return std::max(1, std::min(std::max(dist, m_swap_in_prev), max_dist));
+}
+
 void MemorySwap::determine_swap_edge(PIPSet& heap, size_t loss_idx,
                                      const cg::OprNodeArray& opr_seq,
                                      std::vector<std::vector<size_t>>& g,
@@ -493,8 +519,28 @@ void MemorySwap::modify_dest_var_inplace(VarNodeArray& vars) {
         m_lb_for_distance =
                 std::min(m_lb_for_distance, (long long)opr_seq.size() / 20);
     }
+    auto env_bandwidth = MGB_GETENV("MGB_MEMORY_SWAP_PARAM_BANDWIDTH");
+    if (env_bandwidth) {
+        sscanf(env_bandwidth, "%lf", &m_cpu_gpu_bandwidth);
+        mgb_assert(m_cpu_gpu_bandwidth > 0);
+    }
+
+    auto env_compute_throughput =
+            MGB_GETENV("MGB_MEMORY_SWAP_PARAM_COMPUTE_THROUGHPUT");
+    if (env_compute_throughput) {
+        sscanf(env_compute_throughput, "%lf", &m_compute_throughput);
+        mgb_assert(m_compute_throughput > 0);
+    }
+
+    auto env_max_prefetch = MGB_GETENV("MGB_MEMORY_SWAP_PARAM_MAX_PREFETCH");
+    if (env_max_prefetch) {
+        sscanf(env_max_prefetch, "%d", &m_max_prefetch);
+        mgb_assert(m_max_prefetch > 0);
+    }
     if (!m_bucket_implement)
         m_swap_in_prev = 1;
+    else
+        init_opr_time(opr_seq);
 
     std::queue<OperatorNodeBase*> rst;
     std::queue<VarNode*> lst;
@@ -713,6 +759,7 @@ void MemorySwap::modify_dest_var_inplace(VarNodeArray& vars) {
         cur.push_back(m_var_map[arr[i].first]);
     }
 
+    auto&& infer_mgr = m_owner_graph->static_infer_manager();
     int fail_counter = 0;
     for (auto x : fuse_swap) {
         sort((x.second).begin(), (x.second).end(),
@@ -721,8 +768,21 @@ void MemorySwap::modify_dest_var_inplace(VarNodeArray& vars) {
              });
         for (size_t i = 0; i < x.second.size(); ++i) {
             int dep_idx = 0;
-            if (m_opr_seq_dist[x.second[i]] >= m_swap_in_prev)
-                dep_idx = opr_seq[m_opr_seq_dist[x.second[i]] - m_swap_in_prev]
+            long long swap_in_prev = m_swap_in_prev;
+            if (m_bucket_implement &&
+                m_opr_seq_dist[x.second[i]] > m_opr_seq_dist[x.first]) {
+                // issue the swap-in early enough to hide the copy
+                auto var = m_var_map[x.first];
+                auto shp = infer_mgr.infer_shape_fallible(var);
+                if (shp) {
+                    swap_in_prev = prefetch_distance(
+                            m_opr_seq_dist[x.second[i]],
+                            m_opr_seq_dist[x.first],
+                            var->dtype().size(shp->total_nr_elems()));
+                }
+            }
+            if (m_opr_seq_dist[x.second[i]] >= swap_in_prev)
+                dep_idx = opr_seq[m_opr_seq_dist[x.second[i]] - swap_in_prev]
                                   ->output(0)
                                   ->id() +
                           1;
@@ -127,7 +127,22 @@ class MemorySwap {
      */
     size_t m_max_swap_out_var_size = 0;
 
-    const double m_cpu_gpu_bandwidth = 10000000000.0;
+    //! host-device copy bandwidth in bytes per second
+    double m_cpu_gpu_bandwidth = 10000000000.0;
+
+    /*!
+     * cost model for scheduling swap-in ahead of use in bucket mode: the
+     * arithmetic throughput (ops per second) of the comp node, the fixed
+     * overhead of an opr and of a copy (both in seconds), and the upper
+     * bound of prefetch distance in opr seq; see prefetch_distance()
+     */
+    double m_compute_throughput = 10000000000000.0;
+    double m_opr_latency = 5e-6;
+    double m_copy_latency = 1e-5;
+    int m_max_prefetch = 100;
+
+    //! estimated execution time in seconds of each opr in opr seq
+    std::vector<double> m_opr_time;
 
     ComputingGraph* m_owner_graph;
     /*!
@@ -160,6 +175,18 @@ class MemorySwap {
     ThinHashMap<size_t, int> m_color;
     PSSSet m_swapped_pair;
 
+    //! setup m_opr_time by the computation given by OprFootprint
+    void init_opr_time(const cg::OprNodeArray& opr_seq);
+
+    /*!
+     * \brief number of oprs ahead of the consumer that swap-in of \p nbytes
+     *      should be issued, so the copy can be overlapped by computing
+     * \param consumer_pos position of the consumer opr in opr seq
+     * \param producer_pos position of the opr producing the swapped var
+     */
+    int prefetch_distance(size_t consumer_pos, size_t producer_pos,
+                          size_t nbytes) const;
+
     void determine_swap_edge(PIPSet& edges, size_t loss_idx,
                              const cg::OprNodeArray& opr_seq,
                              std::vector<std::vector<size_t>>&,
@@ -12,11 +12,20 @@
 #include "./swap_helper.h"
 #include "megbrain/comp_node_env.h"
 
+#include <map>
+
+#ifdef __unix__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #if MGB_ENABLE_MEMORY_SWAP
 
 using namespace mgb;
 using namespace swap;
 
+MGB_TYPEINFO_OBJ_IMPL(SwapHostBufferPool);
+
 /* ===================== SwapCopyThreadPool ===================== */
 
 SwapCopyThreadPool& SwapCopyThreadPool::inst(CompNode cn) {
@@ -45,6 +54,127 @@ FutureThreadPool<void>::Future SwapCopyThreadPool::launch(Func&& func,
     return m_pool.launch(std::forward<Func>(func), std::forward<Args>(args)...);
 }
 
+/* ===================== SwapHostBufferPool ===================== */
+
+struct SwapHostBufferPool::State {
+    CompNode cn;
+    std::mutex mtx;
+    size_t host_limit = std::numeric_limits<size_t>::max(),
+           pinned_size = 0, file_size = 0;
+    std::string file_dir = "/tmp";
+
+    //! free page-locked buffers keyed by their sizes
+    std::multimap<size_t, void*> free_pinned;
+
+    ~State() {
+        for (auto&& i : free_pinned)
+            cn.free_host(i.second);
+    }
+};
+
+SwapHostBufferPool::SwapHostBufferPool(CompNode cn)
+        : m_state{std::make_shared<State>()} {
+    m_state->cn = cn;
+    if (auto env = MGB_GETENV("MGB_MEMORY_SWAP_PARAM_HOST_LIMIT_MB")) {
+        m_state->host_limit =
+                static_cast<size_t>(std::stoull(env)) * 1024 * 1024;
+    }
+    if (auto env = MGB_GETENV("MGB_MEMORY_SWAP_PARAM_FILE_DIR")) {
+        m_state->file_dir = env;
+    }
+}
+
+SwapHostBufferPool::~SwapHostBufferPool() = default;
+
+SwapHostBufferPool& SwapHostBufferPool::inst(CompNode cn) {
+    auto maker = [cn]() { return std::make_shared<SwapHostBufferPool>(cn); };
+    return CompNodeEnv::from_comp_node(cn).get_user_data<SwapHostBufferPool>(
+            maker);
+}
+
+HostTensorStorage SwapHostBufferPool::alloc(size_t size) {
+    auto state = m_state;
+    void* ptr = nullptr;
+    size_t alloc_size = size;
+    {
+        MGB_LOCK_GUARD(state->mtx);
+        // reuse a free buffer which would not waste more than half of it
+        auto iter = state->free_pinned.lower_bound(size);
+        if (iter != state->free_pinned.end() && iter->first / 2 <= size) {
+            alloc_size = iter->first;
+            ptr = iter->second;
+            state->free_pinned.erase(iter);
+        } else if (state->pinned_size + size > state->host_limit) {
+            return alloc_file_backed(size);
+        } else {
+            state->pinned_size += size;
+        }
+    }
+    if (!ptr) {
+        ptr = state->cn.alloc_host(size);
+    }
+    auto deleter = [state, alloc_size](dt_byte* ptr) {
+        MGB_LOCK_GUARD(state->mtx);
+        state->free_pinned.emplace(alloc_size, ptr);
+    };
+    HostTensorStorage ret;
+    ret.reset(state->cn, alloc_size,
+              {static_cast<dt_byte*>(ptr), std::move(deleter)});
+    return ret;
+}
+
+HostTensorStorage SwapHostBufferPool::alloc_file_backed(size_t size) {
+    // called with m_state->mtx held
+#ifdef __unix__
+    auto&& state = *m_state;
+    std::string fpath = state.file_dir + "/mgb_swap_XXXXXX";
+    int fd = mkstemp(&fpath[0]);
+    mgb_throw_if(fd < 0, SystemError,
+                 "failed to create swap file in %s: %s",
+                 state.file_dir.c_str(), strerror(errno));
+    // the file is removed after all the buffers are unmapped
+    unlink(fpath.c_str());
+    if (ftruncate(fd, size)) {
+        close(fd);
+        mgb_throw(SystemError, "failed to resize swap file to %zu: %s", size,
+                  strerror(errno));
+    }
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    mgb_throw_if(ptr == MAP_FAILED, SystemError,
+                 "failed to mmap swap file of size %zu: %s", size,
+                 strerror(errno));
+    state.file_size += size;
+    auto deleter = [size](dt_byte* ptr) { munmap(ptr, size); };
+    HostTensorStorage ret;
+    ret.reset(state.cn, size, {static_cast<dt_byte*>(ptr), deleter});
+    return ret;
+#else
+    mgb_throw(MegBrainError,
+              "swap host memory limit exceeded (%zu bytes), and file backed "
+              "swap buffers are not supported on this platform",
+              m_state->host_limit);
+#endif
+}
+
+void SwapHostBufferPool::ensure_host_tensor(HostTensorND& dest,
+                                            const DeviceTensorND& src) {
+    TensorLayout layout{src.shape(), src.dtype()};
+    size_t size = layout.span().dist_byte();
+    if (!dest.storage().empty() && dest.storage().size() >= size) {
+        if (!dest.layout().eq_layout(layout)) {
+            dest.reset(dest.storage(), layout);
+        }
+        return;
+    }
+    dest.reset(alloc(size), layout);
+}
+
+std::pair<size_t, size_t> SwapHostBufferPool::usage() const {
+    MGB_LOCK_GUARD(m_state->mtx);
+    return {m_state->pinned_size, m_state->file_size};
+}
+
 /* ===================== SwapVarRecorder ===================== */
 
 void SwapVarRecorder::copy_host_to_bucket(size_t id, Bucket& dest) {
@@ -74,23 +204,22 @@ void SwapVarRecorder::copy_bucket_to_host(size_t id, Bucket& src,
         auto p = src.copy_task_running.exchange(true);
         mgb_assert(!p);
     }
-    bool flag = false;
-    if (m_saved_buckets.find(id) == m_saved_buckets.end()) {
-        auto ptr = new HostTensorND;
-        m_saved_buckets[id].reset(ptr);
-        flag = true;
+    HostTensorND* dest;
+    {
+        MGB_LOCK_GUARD(m_saved_buckets_mtx);
+        auto&& ptr = m_saved_buckets[id];
+        if (!ptr) {
+            ptr = std::make_shared<HostTensorND>();
+        }
+        dest = ptr.get();
     }
-    auto do_copy = [&src, this, id, flag]() {
+    auto do_copy = [&src, this, dest]() {
         src.buf_on_copy_stream.comp_node().device_wait_event(
                 src.ev_comp2copy());
         src.ev_hd().record();
         src.ev_hd().host_wait();
-        if (flag)
-            (m_saved_buckets[id].get())->copy_from(src.buf_on_copy_stream);
-        else {
-            (m_saved_buckets[id].get())
-                    ->copy_from_fixlayout(src.buf_on_copy_stream);
-        }
+        m_host_buf_pool.ensure_host_tensor(*dest, src.buf_on_copy_stream);
+        dest->copy_from_fixlayout(src.buf_on_copy_stream);
         auto p = src.copy_task_running.exchange(false);
         mgb_assert(p);
     };
@@ -101,6 +230,8 @@ void SwapVarRecorder::copy_bucket_to_host(size_t id, Bucket& src,
 SwapVarRecorder::SwapVarRecorder(SwapVarInfo* swap_var_info, size_t ensure_size)
         : m_copy_threadpool{SwapCopyThreadPool::inst(
                   swap_var_info->var->comp_node())},
+          m_host_buf_pool{SwapHostBufferPool::inst(
+                  swap_var_info->var->comp_node())},
           m_swap_var_info{swap_var_info},
           m_ensure_size{ensure_size} {
     m_copy_threadpool.start();
@@ -48,6 +48,46 @@ public:
     FutureThreadPool<void>::Future launch(Func&& func, Args&&... args);
 };
 
+/* ===================== SwapHostBufferPool ===================== */
+/*!
+ * \brief host buffers to hold the values of swapped-out vars
+ *
+ * Buffers are page-locked host memory allocated from the comp node, so copies
+ * on the swap stream can be truly asynchronous; freed buffers are kept in the
+ * pool and reused. After \p host_limit bytes of page-locked memory have been
+ * used, later buffers are backed by an unlinked mmap'd file, so vars that do
+ * not fit into host RAM can still be swapped.
+ *
+ * The limit and the directory for the file-backed tier can be set by env vars
+ * MGB_MEMORY_SWAP_PARAM_HOST_LIMIT_MB and MGB_MEMORY_SWAP_PARAM_FILE_DIR.
+ */
+class SwapHostBufferPool final : public UserDataContainer::UserData {
+    MGB_TYPEINFO_OBJ_DECL;
+
+    struct State;
+    std::shared_ptr<State> m_state;
+
+    HostTensorStorage alloc_file_backed(size_t size);
+
+public:
+    SwapHostBufferPool(CompNode cn);
+    ~SwapHostBufferPool();
+
+    static SwapHostBufferPool& inst(CompNode cn);
+
+    //! allocate a host storage with at least \p size bytes
+    HostTensorStorage alloc(size_t size);
+
+    /*!
+     * \brief setup \p dest to hold a copy of \p src, allocating storage
+     *      from this pool if current storage is not large enough
+     */
+    void ensure_host_tensor(HostTensorND& dest, const DeviceTensorND& src);
+
+    //! total bytes of page-locked and file-backed buffers
+    std::pair<size_t, size_t> usage() const;
+};
+
 /* ===================== SwapVarRecorder ===================== */
 class SwapVarRecorder final : public NonCopyableObj {
 private:
@@ -125,6 +165,7 @@ private:
     };  // Bucket
 
     SwapCopyThreadPool& m_copy_threadpool;
+    SwapHostBufferPool& m_host_buf_pool;
     SwapVarInfo* const m_swap_var_info;
     Bucket m_buckets_in[Bucket::nr_buckets_in];
     Bucket m_buckets_out[Bucket::nr_buckets_out];
@@ -258,7 +258,9 @@ SwapOut::SwapOut(ComputingGraph& graph, VarNode* inp, const Param& param,
 
 void SwapOut::scn_do_execute() {
     auto&& id = input(0)->dev_tensor();
-    (m_host_data.get())->copy_from(id);
+    swap::SwapHostBufferPool::inst(id.comp_node())
+            .ensure_host_tensor(*m_host_data, id);
+    m_host_data->copy_from_fixlayout(id);
 }
 
 void SwapOut::init_output_static_infer_desc() {
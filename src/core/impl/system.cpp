@@ -13,6 +13,9 @@
 #include "megbrain/common.h"
 #include "megbrain/utils/thin/hash_table.h"
 
+#include <algorithm>
+#include <cstring>
+#include <map>
 #include <thread>
 
 using namespace mgb;
@@ -24,6 +27,7 @@ int sys::get_cpu_count() {
 
 #if defined(WIN32)
 
+#include <malloc.h>
 #include <windows.h>
 void sys::set_cpu_affinity(const std::vector<int> &cpuset) {
     mgb_log_warn("Set_cpu_affinity will not support later");
@@ -50,6 +54,28 @@ std::pair<size_t, size_t> sys::get_ram_status_bytes() {
     return ret;
 }
 
+int sys::get_cur_numa_node() {
+    return -1;
+}
+
+void* sys::alloc_pages(size_t size, size_t alignment, bool, bool, int) {
+    auto ptr = _aligned_malloc(size, std::max(alignment, get_page_size()));
+    if (ptr) {
+        memset(ptr, 0, size);
+    }
+    return ptr;
+}
+
+void sys::free_pages(void* ptr, size_t) {
+    _aligned_free(ptr);
+}
+
+size_t sys::get_page_size() {
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwPageSize;
+}
+
 
 #else // not WIN32
 
@@ -60,6 +86,11 @@ std::pair<size_t, size_t> sys::get_ram_status_bytes() {
 #include <sys/sysinfo.h>
 #include <sched.h>
 #endif
+#include <sys/mman.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 void sys::set_cpu_affinity(const std::vector<int> &cpuset) {
 #if defined(__APPLE__) || !MGB_HAVE_THREAD
@@ -131,8 +162,251 @@ std::pair<size_t, size_t> sys::get_ram_status_bytes() {
     return ret;
 #endif
 }
+
+int sys::get_cur_numa_node() {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu, node;
+    if (!syscall(SYS_getcpu, &cpu, &node, nullptr)) {
+        return node;
+    }
+#endif
+    return -1;
+}
+
+void* sys::alloc_pages(size_t size, size_t alignment, bool huge_page,
+                       bool hugetlb, int numa_node) {
+    void* ptr = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (hugetlb) {
+        ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (ptr == MAP_FAILED) {
+            mgb_log_debug("MAP_HUGETLB for %zu bytes failed: %s", size,
+                          strerror(errno));
+        }
+    }
+#else
+    MGB_MARK_USED_VAR(hugetlb);
+#endif
+    if (ptr == MAP_FAILED) {
+        // over-allocate and trim so the result is aligned; huge pages also
+        // require 2MiB-aligned ranges
+        auto page = get_page_size();
+        alignment = std::max(alignment, page);
+        size = (size + page - 1) / page * page;
+        size_t map_size = size + alignment - page;
+        ptr = mmap(nullptr, map_size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            return nullptr;
+        }
+        auto begin = reinterpret_cast<uintptr_t>(ptr),
+             aligned = (begin + alignment - 1) / alignment * alignment,
+             end = begin + map_size;
+        if (aligned > begin) {
+            munmap(ptr, aligned - begin);
+        }
+        if (end > aligned + size) {
+            munmap(reinterpret_cast<void*>(aligned + size),
+                   end - aligned - size);
+        }
+        ptr = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+        if (huge_page) {
+            // failure is harmless: THP may be disabled in the kernel
+            madvise(ptr, size, MADV_HUGEPAGE);
+        }
+#else
+        MGB_MARK_USED_VAR(huge_page);
+#endif
+    }
+#if defined(__linux__) && defined(SYS_mbind)
+    if (numa_node >= 0) {
+        constexpr int MPOL_BIND_ = 2;
+        constexpr int BITS = sizeof(unsigned long) * 8, MAX_NODE = 256;
+        unsigned long mask[MAX_NODE / BITS] = {0};
+        if (numa_node < MAX_NODE) {
+            mask[numa_node / BITS] |= 1ul << (numa_node % BITS);
+            if (syscall(SYS_mbind, ptr, size, MPOL_BIND_, mask, MAX_NODE,
+                        0)) {
+                mgb_log_debug("mbind to NUMA node %d failed: %s (ignored)",
+                              numa_node, strerror(errno));
+            }
+        }
+    }
+#else
+    MGB_MARK_USED_VAR(numa_node);
+#endif
+    return ptr;
+}
+
+void sys::free_pages(void* ptr, size_t size) {
+    auto page = get_page_size();
+    munmap(ptr, (size + page - 1) / page * page);
+}
+
+size_t sys::get_page_size() {
+    static size_t size = sysconf(_SC_PAGESIZE);
+    return size;
+}
 #endif // WIN32
 
+/* ===================== CPU topology ===================== */
+#ifdef __linux__
+namespace {
+bool read_sys_file(const std::string& path, std::string& content) {
+    FILE* fin = fopen(path.c_str(), "r");
+    if (!fin) {
+        return false;
+    }
+    char buf[256];
+    auto size = fread(buf, 1, sizeof(buf) - 1, fin);
+    fclose(fin);
+    buf[size] = 0;
+    content = buf;
+    return true;
+}
+
+long read_sys_int(const std::string& path, long default_val) {
+    std::string content;
+    if (!read_sys_file(path, content) || content.empty()) {
+        return default_val;
+    }
+    return strtol(content.c_str(), nullptr, 10);
+}
+
+//! parse cpu list like "0-3,8,10-11"
+std::vector<int> parse_cpu_list(const std::string& str) {
+    std::vector<int> ret;
+    const char* p = str.c_str();
+    while (*p) {
+        char* end;
+        long begin = strtol(p, &end, 10);
+        if (end == p) {
+            break;
+        }
+        long last = begin;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            p = end;
+        }
+        for (long i = begin; i <= last; ++i) {
+            ret.push_back(i);
+        }
+        if (*p == ',') {
+            ++p;
+        }
+    }
+    return ret;
+}
+
+std::vector<CpuInfo> detect_cpu_topology() {
+    std::string content;
+    std::vector<int> cpus;
+    if (read_sys_file("/sys/devices/system/cpu/online", content)) {
+        cpus = parse_cpu_list(content);
+    }
+    if (cpus.empty()) {
+        for (int i = 0; i < get_cpu_count(); ++i) {
+            cpus.push_back(i);
+        }
+    }
+
+    // P-cores of intel hybrid CPUs
+    std::vector<int> big_cores;
+    if (read_sys_file("/sys/devices/cpu_core/cpus", content)) {
+        big_cores = parse_cpu_list(content);
+    }
+
+    std::vector<CpuInfo> ret;
+    std::map<std::pair<long, long>, int> core2idx;
+    for (int cpu : cpus) {
+        auto dir = ssprintf("/sys/devices/system/cpu/cpu%d/", cpu);
+        std::pair<long, long> core_key{
+                read_sys_int(dir + "topology/physical_package_id", 0),
+                read_sys_int(dir + "topology/core_id", cpu)};
+        int nr_smt = 1;
+        if (read_sys_file(dir + "topology/thread_siblings_list", content)) {
+            nr_smt = std::max<int>(parse_cpu_list(content).size(), 1);
+        }
+        // cpu_capacity is provided on ARM big.LITTLE; fall back to the max
+        // frequency
+        long capacity = read_sys_int(dir + "cpu_capacity", 0);
+        if (!capacity) {
+            capacity = read_sys_int(dir + "cpufreq/cpuinfo_max_freq", 1);
+        }
+        auto ins = core2idx.emplace(core_key, core2idx.size());
+        ret.push_back({cpu, ins.first->second, nr_smt,
+                       static_cast<size_t>(std::max(capacity, 1l))});
+    }
+    if (!big_cores.empty()) {
+        // P-cores may report similar or even lower max freq than E-cores;
+        // offset them by the max capacity so that any P-core ranks above
+        // all the E-cores, while the order within each kind is kept
+        size_t max_capacity = 0;
+        for (auto&& i : ret) {
+            max_capacity = std::max(max_capacity, i.capacity);
+        }
+        for (auto&& i : ret) {
+            if (std::find(big_cores.begin(), big_cores.end(), i.cpu) !=
+                big_cores.end()) {
+                i.capacity += max_capacity;
+            }
+        }
+    }
+    return ret;
+}
+}  // anonymous namespace
+#else
+namespace {
+std::vector<CpuInfo> detect_cpu_topology() {
+    std::vector<CpuInfo> ret;
+    for (int i = 0; i < get_cpu_count(); ++i) {
+        ret.push_back({i, i, 1, 1});
+    }
+    return ret;
+}
+}  // anonymous namespace
+#endif
+
+const std::vector<CpuInfo>& sys::get_cpu_topology() {
+    static std::vector<CpuInfo> topology = detect_cpu_topology();
+    return topology;
+}
+
+std::vector<int> sys::select_cpus(size_t nr, bool one_per_core,
+                                  bool prefer_fast) {
+    auto cpus = get_cpu_topology();
+    mgb_assert(!cpus.empty());
+    // rank of each CPU within its physical core
+    std::vector<int> smt_rank(cpus.size());
+    {
+        std::map<int, int> core_cnt;
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            smt_rank[i] = core_cnt[cpus[i].core]++;
+        }
+    }
+    std::vector<size_t> order(cpus.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (one_per_core && smt_rank[a] != smt_rank[b]) {
+            return smt_rank[a] < smt_rank[b];
+        }
+        if (prefer_fast && cpus[a].capacity != cpus[b].capacity) {
+            return cpus[a].capacity > cpus[b].capacity;
+        }
+        return false;
+    });
+    std::vector<int> ret;
+    for (size_t i = 0; i < nr; ++i) {
+        ret.push_back(cpus[order[i % order.size()]].cpu);
+    }
+    return ret;
+}
+
 #if !MGB_BUILD_SLIM_SERVING && defined(__linux)
 #include <unistd.h>
 bool sys::stderr_ansi_color() {
@@ -0,0 +1,64 @@
+/**
+ * \file src/core/impl/utils/cancel_token.cpp
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "megbrain/utils/cancel_token.h"
+#include "megbrain/common.h"
+#include "megbrain/utils/timer.h"
+
+using namespace mgb;
+
+namespace {
+thread_local CancelToken* tl_cur_cancel_token = nullptr;
+
+int64_t now_ns() {
+    auto t = RealTimer::get_time();
+    return t.sec * 1000000000 + t.nsec;
+}
+}  // anonymous namespace
+
+bool CancelToken::check_deadline() const {
+    if (now_ns() >= m_deadline_ns.load(std::memory_order_relaxed)) {
+        m_cancelled.store(true, std::memory_order_release);
+        return true;
+    }
+    return false;
+}
+
+void CancelToken::set_timeout(double timeout) {
+    mgb_assert(timeout >= 0, "bad timeout: %g", timeout);
+    m_deadline_ns.store(now_ns() + static_cast<int64_t>(timeout * 1e9),
+                        std::memory_order_relaxed);
+}
+
+void CancelToken::reset() {
+    m_deadline_ns.store(NO_DEADLINE, std::memory_order_relaxed);
+    m_nr_skipped_task.store(0, std::memory_order_relaxed);
+    m_cancelled.store(false, std::memory_order_release);
+}
+
+bool CancelToken::deadline_exceeded() const {
+    auto deadline = m_deadline_ns.load(std::memory_order_relaxed);
+    return deadline != NO_DEADLINE && now_ns() >= deadline;
+}
+
+CancelToken* CancelToken::current() {
+    return tl_cur_cancel_token;
+}
+
+CancelToken::Scope::Scope(CancelToken* token) : m_prev{tl_cur_cancel_token} {
+    tl_cur_cancel_token = token;
+}
+
+CancelToken::Scope::~Scope() {
+    tl_cur_cancel_token = m_prev;
+}
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -244,6 +244,36 @@ void SCQueueSynchronizer::consumer_commit(size_t nr) {
     }
 }
 
+/* =============== FutexWord ===============  */
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <climits>
+
+void FutexWord::wait(uint32_t expected) {
+    static_assert(sizeof(m_val) == sizeof(int), "bad futex word");
+    syscall(SYS_futex, reinterpret_cast<int*>(&m_val), FUTEX_WAIT_PRIVATE,
+            expected, nullptr, nullptr, 0);
+}
+
+void FutexWord::wake_all() {
+    syscall(SYS_futex, reinterpret_cast<int*>(&m_val), FUTEX_WAKE_PRIVATE,
+            INT_MAX, nullptr, nullptr, 0);
+}
+#else
+void FutexWord::wait(uint32_t expected) {
+    std::unique_lock<std::mutex> lock(m_mtx);
+    m_cv.wait(lock, [this, expected]() { return m_val.load() != expected; });
+}
+
+void FutexWord::wake_all() {
+    { MGB_LOCK_GUARD(m_mtx); }
+    m_cv.notify_all();
+}
+#endif
+
 /* =============== SyncableCounter ===============  */
 
 SyncableCounter::SyncableCounter() = default;
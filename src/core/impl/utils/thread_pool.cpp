@@ -10,17 +10,506 @@
  */
 
 #include "megbrain/utils/thread_pool.h"
+#include <algorithm>
 #include <chrono>
+#include <climits>
+#include <cstring>
+
+#if MGB_HAVE_THREAD && defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 using namespace mgb;
 
 #if MGB_HAVE_THREAD
+namespace {
+//! the pool and thread id of the sub task being executed by current thread
+struct CurTask {
+    const ThreadPool* pool;
+    size_t thread_id;
+};
+thread_local CurTask tl_cur_task{nullptr, 0};
+
+//! set tl_cur_task in the scope
+class CurTaskScope {
+    CurTask m_prev;
+
+public:
+    CurTaskScope(const ThreadPool* pool, size_t thread_id)
+            : m_prev{tl_cur_task} {
+        tl_cur_task = {pool, thread_id};
+    }
+    ~CurTaskScope() { tl_cur_task = m_prev; }
+};
+
+}  // anonymous namespace
+
+/* ======================== SharedThreadPool ======================== */
+struct SharedThreadPool::Job {
+    const TaskElem& task_elem;
+    const size_t quota;
+    //! the ThreadPool that dispatched the task, set as current task pool
+    const ThreadPool* const owner;
+
+    //! index of next sub task to be executed
+    std::atomic_size_t next_index{0};
+
+    //! number of workers that have joined; guarded by SharedThreadPool::m_mtx
+    size_t nr_joined = 0;
+
+    //! number of workers still running; guarded by done_mtx
+    size_t nr_running = 0;
+    std::mutex done_mtx;
+    std::condition_variable done_cv;
+
+    Job(const TaskElem& task_elem, size_t quota, const ThreadPool* owner)
+            : task_elem{task_elem}, quota{quota}, owner{owner} {}
+
+    bool joinable() const {
+        return nr_joined + 1 < quota &&
+               next_index.load(std::memory_order_relaxed) <
+                       task_elem.nr_parallelism;
+    }
+
+    void execute(size_t thread_id) {
+        CurTaskScope cur_task_scope{owner, thread_id};
+        size_t index;
+        while ((index = next_index.fetch_add(1, std::memory_order_relaxed)) <
+               task_elem.nr_parallelism) {
+            task_elem.task(index, thread_id);
+        }
+    }
+};
+
+SharedThreadPool::SharedThreadPool(size_t nr_workers,
+                                   AffinityCallBack affinity_cb) {
+    mgb_assert(nr_workers, "SharedThreadPool requires at least one worker");
+    for (size_t i = 0; i < nr_workers; ++i) {
+        m_workers.emplace_back([this, i, affinity_cb]() {
+            worker_loop(i, affinity_cb);
+        });
+    }
+}
+
+SharedThreadPool::~SharedThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        mgb_assert(m_jobs.empty());
+        m_stop = true;
+    }
+    m_cv.notify_all();
+    for (auto&& i : m_workers) {
+        i.join();
+    }
+}
+
+SharedThreadPool::Job* SharedThreadPool::pick_job() {
+    for (size_t i = 0; i < m_jobs.size(); ++i) {
+        size_t idx = (m_next_job + i) % m_jobs.size();
+        if (m_jobs[idx]->joinable()) {
+            m_next_job = idx + 1;
+            return m_jobs[idx];
+        }
+    }
+    return nullptr;
+}
+
+void SharedThreadPool::worker_loop(size_t id,
+                                   const AffinityCallBack& affinity_cb) {
+    sys::set_thread_name(ssprintf("shared_worker%zu", id));
+    if (affinity_cb) {
+        affinity_cb(id);
+    }
+    for (;;) {
+        Job* job = nullptr;
+        size_t thread_id;
+        {
+            std::unique_lock<std::mutex> lock(m_mtx);
+            m_cv.wait(lock, [this, &job]() {
+                return m_stop || (job = pick_job());
+            });
+            if (!job) {
+                return;
+            }
+            thread_id = job->nr_joined++;
+            std::lock_guard<std::mutex> lock_done(job->done_mtx);
+            ++job->nr_running;
+        }
+        job->execute(thread_id);
+        // job may be destructed as soon as done_mtx is released
+        std::lock_guard<std::mutex> lock_done(job->done_mtx);
+        if (!--job->nr_running) {
+            job->done_cv.notify_all();
+        }
+    }
+}
+
+void SharedThreadPool::run(const TaskElem& task_elem, size_t quota,
+                           const ThreadPool* owner) {
+    quota = std::min(quota, m_workers.size() + 1);
+    if (quota <= 1 || task_elem.nr_parallelism == 1) {
+        CurTaskScope cur_task_scope{owner, 0};
+        for (size_t i = 0; i < task_elem.nr_parallelism; i++) {
+            task_elem.task(i, 0);
+        }
+        return;
+    }
+    Job job{task_elem, quota, owner};
+    {
+        std::lock_guard<std::mutex> lock(m_mtx);
+        m_jobs.push_back(&job);
+    }
+    if (quota > m_workers.size()) {
+        m_cv.notify_all();
+    } else {
+        for (size_t i = 1; i < quota; ++i) {
+            m_cv.notify_one();
+        }
+    }
+    job.execute(quota - 1);
+    {
+        // all sub tasks have been taken, so no more workers should join
+        std::lock_guard<std::mutex> lock(m_mtx);
+        auto iter = std::find(m_jobs.begin(), m_jobs.end(), &job);
+        mgb_assert(iter != m_jobs.end());
+        m_jobs.erase(iter);
+    }
+    std::unique_lock<std::mutex> lock_done(job.done_mtx);
+    job.done_cv.wait(lock_done, [&job]() { return !job.nr_running; });
+}
+
+namespace {
+struct SharedThreadPoolGlobal {
+    std::mutex mtx;
+    bool env_checked = false;
+    std::shared_ptr<SharedThreadPool> inst;
+
+    static SharedThreadPoolGlobal& get() {
+        static SharedThreadPoolGlobal ins;
+        return ins;
+    }
+};
+}  // anonymous namespace
+
+std::shared_ptr<SharedThreadPool> SharedThreadPool::get_global() {
+    auto&& glob = SharedThreadPoolGlobal::get();
+    std::lock_guard<std::mutex> lock(glob.mtx);
+    if (!glob.env_checked) {
+        glob.env_checked = true;
+        if (auto setting = MGB_GETENV("MGB_CPU_SHARED_THREAD_POOL")) {
+            auto nr_workers = std::stoul(setting);
+            if (nr_workers) {
+                mgb_log_debug("use shared cpu thread pool with %zu workers",
+                              static_cast<size_t>(nr_workers));
+                glob.inst = std::make_shared<SharedThreadPool>(nr_workers);
+            }
+        }
+    }
+    return glob.inst;
+}
+
+void SharedThreadPool::set_global(size_t nr_workers,
+                                  AffinityCallBack affinity_cb) {
+    auto&& glob = SharedThreadPoolGlobal::get();
+    std::shared_ptr<SharedThreadPool> inst;
+    if (nr_workers) {
+        inst = std::make_shared<SharedThreadPool>(nr_workers, affinity_cb);
+    }
+    std::lock_guard<std::mutex> lock(glob.mtx);
+    glob.env_checked = true;
+    glob.inst.swap(inst);
+}
+
+/* ======================== ThreadPool::AdaptiveImpl ======================== */
+namespace {
+inline void cpu_relax() {
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+}  // anonymous namespace
+
+class ThreadPool::AdaptiveImpl {
+    //! bounds of the number of cpu_relax() calls before parking
+    static constexpr uint32_t MIN_SPIN = 1 << 6, MAX_SPIN = 1 << 16;
+
+    /*!
+     * State accessed by other workers only when stealing; it is padded so
+     * the owner's updates do not cause false sharing.
+     */
+    struct WorkerState {
+        //! remaining sub tasks [begin, end), packed as begin | end << 32
+        std::atomic<uint64_t> range{0};
+        std::atomic_bool affinity_flag{false};
+        uint8_t padding[128 - sizeof(std::atomic<uint64_t>) -
+                        sizeof(std::atomic_bool)];
+    };
+
+    ThreadPool* const m_owner;
+    const size_t m_nr_threads;
+    std::unique_ptr<WorkerState[]> m_states;
+    std::vector<std::thread> m_workers;
+
+    //! task of current round; published by the release store of ranges
+    const TaskElem* m_task = nullptr;
+    std::atomic_size_t m_nr_done{0}, m_parallelism{0};
+
+    //! increased for each round; workers park on it
+    std::atomic<uint32_t> m_epoch{0};
+    std::atomic<uint32_t> m_nr_parked{0};
+    std::atomic_bool m_stop{false}, m_active{false};
+    AffinityCallBack m_affinity_cb;
+    //! start of the initial range of each thread as a fraction of all sub
+    //! tasks, with a trailing 1; empty for even split
+    std::vector<double> m_split;
+#if !defined(__linux__)
+    std::mutex m_park_mtx;
+    std::condition_variable m_park_cv;
+#endif
+
+    static uint64_t pack(uint64_t begin, uint64_t end) {
+        return begin | end << 32;
+    }
+
+    //! take one sub task from the front of own range
+    bool pop_front(std::atomic<uint64_t>& range, size_t& index) {
+        auto cur = range.load(std::memory_order_relaxed);
+        for (;;) {
+            uint64_t begin = cur & 0xffffffffu, end = cur >> 32;
+            if (begin >= end) {
+                return false;
+            }
+            if (range.compare_exchange_weak(cur, pack(begin + 1, end),
+                                            std::memory_order_acquire,
+                                            std::memory_order_relaxed)) {
+                index = begin;
+                return true;
+            }
+        }
+    }
+
+    /*!
+     * \brief steal the back half of another worker's range; one of the
+     *      stolen sub tasks is returned and the others are put into own
+     *      range, so they can be stolen again
+     */
+    bool steal(size_t id, size_t& index) {
+        for (size_t i = 1; i < m_nr_threads; ++i) {
+            auto&& range = m_states[(id + i) % m_nr_threads].range;
+            auto cur = range.load(std::memory_order_relaxed);
+            for (;;) {
+                uint64_t begin = cur & 0xffffffffu, end = cur >> 32;
+                if (begin >= end) {
+                    break;
+                }
+                auto mid = begin + (end - begin) / 2;
+                if (range.compare_exchange_weak(cur, pack(begin, mid),
+                                                std::memory_order_acquire,
+                                                std::memory_order_relaxed)) {
+                    m_states[id].range.store(pack(mid + 1, end),
+                                             std::memory_order_release);
+                    index = mid;
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void run_round(size_t id) {
+        size_t nr_done = 0, index;
+        auto&& range = m_states[id].range;
+        for (;;) {
+            while (pop_front(range, index)) {
+                m_task->task(index, id);
+                ++nr_done;
+            }
+            if (!steal(id, index)) {
+                break;
+            }
+            m_task->task(index, id);
+            ++nr_done;
+        }
+        if (nr_done) {
+            m_nr_done.fetch_add(nr_done, std::memory_order_release);
+        }
+        // sub tasks still running may dispatch nested tasks
+        while (m_nr_done.load(std::memory_order_acquire) <
+               m_parallelism.load(std::memory_order_relaxed)) {
+            if (!m_owner->help_nested(id)) {
+                cpu_relax();
+            }
+        }
+    }
+
+    void futex_wait(uint32_t seen) {
+#if defined(__linux__)
+        static_assert(sizeof(m_epoch) == sizeof(int), "bad futex word");
+        syscall(SYS_futex, reinterpret_cast<int*>(&m_epoch),
+                FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+#else
+        std::unique_lock<std::mutex> lock(m_park_mtx);
+        m_park_cv.wait(lock, [this, seen]() { return m_epoch != seen; });
+#endif
+    }
+
+    void futex_wake_all() {
+#if defined(__linux__)
+        syscall(SYS_futex, reinterpret_cast<int*>(&m_epoch),
+                FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+        { std::lock_guard<std::mutex> lock(m_park_mtx); }
+        m_park_cv.notify_all();
+#endif
+    }
+
+    //! start a new round and wake up parked workers
+    void bump_epoch() {
+        m_epoch.fetch_add(1);
+        if (m_nr_parked.load()) {
+            futex_wake_all();
+        }
+    }
+
+    //! wait until epoch changes; return the new epoch
+    uint32_t park(uint32_t seen) {
+        m_nr_parked.fetch_add(1);
+        uint32_t epoch;
+        while ((epoch = m_epoch.load()) == seen) {
+            futex_wait(seen);
+        }
+        m_nr_parked.fetch_sub(1);
+        return epoch;
+    }
+
+    void worker_loop(size_t id) {
+        CurTaskScope cur_task_scope{m_owner, id};
+        uint32_t seen = 0, spin_limit = MIN_SPIN;
+        for (;;) {
+            uint32_t epoch = seen;
+            for (uint32_t i = 0;
+                 i < spin_limit && m_active.load(std::memory_order_relaxed);
+                 ++i) {
+                epoch = m_epoch.load(std::memory_order_acquire);
+                if (epoch != seen) {
+                    break;
+                }
+                cpu_relax();
+            }
+            if (epoch != seen) {
+                // new task arrived while spinning: spin longer next time
+                spin_limit = std::min(spin_limit * 2, MAX_SPIN);
+            } else {
+                epoch = park(seen);
+                spin_limit = std::max(spin_limit / 2, MIN_SPIN);
+            }
+            seen = epoch;
+            if (m_stop.load(std::memory_order_relaxed)) {
+                return;
+            }
+            if (m_states[id].affinity_flag.exchange(false)) {
+                m_affinity_cb(id);
+            }
+            run_round(id);
+        }
+    }
+
+public:
+    AdaptiveImpl(ThreadPool* owner, size_t nr_threads)
+            : m_owner{owner},
+              m_nr_threads{nr_threads},
+              m_states{new WorkerState[nr_threads]} {
+        for (size_t i = 0; i + 1 < m_nr_threads; ++i) {
+            m_workers.emplace_back([this, i]() { worker_loop(i); });
+        }
+    }
+
+    ~AdaptiveImpl() {
+        m_stop = true;
+        bump_epoch();
+        for (auto&& i : m_workers) {
+            i.join();
+        }
+    }
+
+    //! run the task; must not be called concurrently
+    void add_task(const TaskElem& task_elem) {
+        size_t parallelism = task_elem.nr_parallelism;
+        mgb_assert(parallelism < (1ull << 32), "too many sub tasks: %zu",
+                   parallelism);
+        m_active = true;
+        m_task = &task_elem;
+        m_nr_done.store(0, std::memory_order_relaxed);
+        m_parallelism.store(parallelism, std::memory_order_relaxed);
+        auto split = [&](size_t i) -> size_t {
+            if (m_split.empty()) {
+                return parallelism * i / m_nr_threads;
+            }
+            return std::min<size_t>(parallelism * m_split[i], parallelism);
+        };
+        for (size_t i = 0; i < m_nr_threads; ++i) {
+            m_states[i].range.store(pack(split(i), split(i + 1)),
+                                    std::memory_order_release);
+        }
+        bump_epoch();
+
+        CurTaskScope cur_task_scope{m_owner, m_nr_threads - 1};
+        run_round(m_nr_threads - 1);
+    }
+
+    void set_affinity(const AffinityCallBack& affinity_cb) {
+        m_affinity_cb = affinity_cb;
+        for (size_t i = 0; i + 1 < m_nr_threads; ++i) {
+            m_states[i].affinity_flag = true;
+        }
+    }
+
+    void set_weights(const std::vector<float>& weights) {
+        m_split.clear();
+        if (weights.empty()) {
+            return;
+        }
+        double sum = 0;
+        for (auto i : weights) {
+            sum += i;
+        }
+        m_split.resize(m_nr_threads + 1);
+        for (size_t i = 0; i < m_nr_threads; ++i) {
+            m_split[i + 1] = m_split[i] + weights[i] / sum;
+        }
+        m_split[m_nr_threads] = 1;
+    }
+
+    //! let workers park without spinning until next add_task()
+    void deactive() { m_active = false; }
+};
+
+/* ======================== ThreadPool ======================== */
 ThreadPool::ThreadPool(size_t threads_num)
+        : ThreadPool(threads_num, SharedThreadPool::get_global(),
+                     default_mode()) {}
+
+ThreadPool::ThreadPool(size_t threads_num,
+                       std::shared_ptr<SharedThreadPool> shared)
+        : ThreadPool(threads_num, std::move(shared), Mode::SPIN) {}
+
+ThreadPool::ThreadPool(size_t threads_num, Mode mode)
+        : ThreadPool(threads_num, nullptr, mode) {}
+
+ThreadPool::ThreadPool(size_t threads_num,
+                       std::shared_ptr<SharedThreadPool> shared, Mode mode)
         : m_nr_threads(threads_num),
+          m_shared{threads_num > 1 ? std::move(shared) : nullptr},
           m_main_affinity_flag{false},
           m_stop{false},
           m_active{false} {
-    if (m_nr_threads > 1) {
+    if (m_nr_threads > 1 && !m_shared && mode == Mode::ADAPTIVE) {
+        m_adaptive = std::make_unique<AdaptiveImpl>(this, m_nr_threads);
+    } else if (m_nr_threads > 1 && !m_shared) {
         if (m_nr_threads > static_cast<uint32_t>(sys::get_cpu_count())) {
             mgb_log_debug(
                     "The number of threads is bigger than number of "
@@ -29,6 +518,7 @@ ThreadPool::ThreadPool(size_t threads_num)
         }
         for (uint32_t i = 0; i < m_nr_threads - 1; i++) {
             m_workers.push_back(new Worker([this, i]() {
+                CurTaskScope cur_task_scope{this, i};
                 while (!m_stop) {
                     while (m_active) {
                         if (m_workers[i]->affinity_flag &&
@@ -51,6 +541,14 @@ ThreadPool::ThreadPool(size_t threads_num)
                                                            index),
                                        i);
                             }
+                            //! Help nested tasks dispatched by sub tasks
+                            //! still running
+                            m_nr_busy.fetch_sub(1, std::memory_order_release);
+                            while (m_nr_busy.load(std::memory_order_acquire)) {
+                                if (!help_nested(i)) {
+                                    std::this_thread::yield();
+                                }
+                            }
                             //! Flag worker is finished
                             m_workers[i]->work_flag.store(
                                     false, std::memory_order_release);
@@ -70,7 +568,106 @@ ThreadPool::ThreadPool(size_t threads_num)
         }
     }
 }
+/* ======================== ThreadPool nested tasks ======================== */
+struct ThreadPool::NestedJob {
+    const TaskElem& task_elem;
+    std::atomic_size_t next_index{0}, nr_done{0};
+
+    explicit NestedJob(const TaskElem& task_elem) : task_elem{task_elem} {}
+
+    //! execute sub tasks starting from a claimed index; the job may be
+    //! destructed when it returns
+    void execute(size_t index, size_t thread_id) {
+        size_t parallelism = task_elem.nr_parallelism;
+        for (;;) {
+            task_elem.task(index, thread_id);
+            // claim next index before finishing current one, so the job is
+            // kept alive
+            index = next_index.fetch_add(1, std::memory_order_relaxed);
+            bool more = index < parallelism;
+            nr_done.fetch_add(1, std::memory_order_acq_rel);
+            if (!more) {
+                return;
+            }
+        }
+    }
+};
+
+bool ThreadPool::in_task() const {
+    return tl_cur_task.pool == this;
+}
+
+void ThreadPool::run_nested(const TaskElem& task_elem, size_t thread_id) {
+    size_t parallelism = task_elem.nr_parallelism;
+    if (parallelism == 1) {
+        task_elem.task(0, thread_id);
+        return;
+    }
+    NestedJob job{task_elem};
+    {
+        std::lock_guard<std::mutex> lock(m_nested_mtx);
+        m_nested_jobs.push_back(&job);
+        m_nr_nested_jobs.fetch_add(1, std::memory_order_release);
+    }
+    size_t index = job.next_index.fetch_add(1, std::memory_order_relaxed);
+    if (index < parallelism) {
+        job.execute(index, thread_id);
+    }
+    {
+        // all sub tasks have been claimed, so no more threads should join
+        std::lock_guard<std::mutex> lock(m_nested_mtx);
+        auto iter = std::find(m_nested_jobs.begin(), m_nested_jobs.end(),
+                              &job);
+        mgb_assert(iter != m_nested_jobs.end());
+        m_nested_jobs.erase(iter);
+        m_nr_nested_jobs.fetch_sub(1, std::memory_order_relaxed);
+    }
+    while (job.nr_done.load(std::memory_order_acquire) < parallelism) {
+        if (!help_nested(thread_id)) {
+            std::this_thread::yield();
+        }
+    }
+}
+
+bool ThreadPool::help_nested(size_t thread_id) {
+    if (!m_nr_nested_jobs.load(std::memory_order_acquire)) {
+        return false;
+    }
+    NestedJob* job = nullptr;
+    size_t index;
+    {
+        std::lock_guard<std::mutex> lock(m_nested_mtx);
+        for (auto i : m_nested_jobs) {
+            index = i->next_index.fetch_add(1, std::memory_order_relaxed);
+            if (index < i->task_elem.nr_parallelism) {
+                job = i;
+                break;
+            }
+        }
+    }
+    if (!job) {
+        return false;
+    }
+    CurTaskScope cur_task_scope{this, thread_id};
+    job->execute(index, thread_id);
+    return true;
+}
+
 void ThreadPool::add_task(const TaskElem& task_elem) {
+    if (in_task()) {
+        size_t thread_id = tl_cur_task.thread_id;
+        if (m_shared) {
+            // thread ids of a shared job are only unique within the job,
+            // and the other threads working on it may serve other jobs
+            // meanwhile; so nested tasks are executed by the caller
+            for (size_t i = 0; i < task_elem.nr_parallelism; i++) {
+                task_elem.task(i, thread_id);
+            }
+        } else {
+            run_nested(task_elem, thread_id);
+        }
+        return;
+    }
     //! Make sure the main thread have bind
     if (m_main_affinity_flag &&
         m_core_binding_function != nullptr) {
@@ -85,6 +682,11 @@ void ThreadPool::add_task(const TaskElem& task_elem) {
             task_elem.task(i, 0);
         }
         return;
+    } else if (m_shared) {
+        m_shared->run(task_elem, m_nr_threads, this);
+    } else if (m_adaptive) {
+        std::lock_guard<std::mutex> lock(m_mutex_task);
+        m_adaptive->add_task(task_elem);
     } else {
         std::lock_guard<std::mutex> lock(m_mutex_task);
         mgb_assert(m_task_iter.load(std::memory_order_acquire) <= 0,
@@ -96,17 +698,25 @@ void ThreadPool::add_task(const TaskElem& task_elem) {
         m_task = [&task_elem](size_t index, size_t thread_id) {
             task_elem.task(index, thread_id);
         };
+        m_nr_busy.store(m_nr_threads, std::memory_order_relaxed);
         //! Set flag to start thread working
         for (uint32_t i = 0; i < m_nr_threads - 1; i++) {
             m_workers[i]->work_flag = true;
         }
         //! Main thread working
+        CurTaskScope cur_task_scope{this, m_nr_threads - 1};
         int index = -1;
         while ((index = m_task_iter.fetch_sub(1, std::memory_order_acq_rel)) &&
                (index > 0)) {
             m_task(static_cast<size_t>(m_nr_parallelism - index),
                    m_nr_threads - 1);
         }
+        m_nr_busy.fetch_sub(1, std::memory_order_release);
+        while (m_nr_busy.load(std::memory_order_acquire)) {
+            if (!help_nested(m_nr_threads - 1)) {
+                std::this_thread::yield();
+            }
+        }
         //! make sure all threads done
         sync();
     }
@@ -116,12 +726,29 @@ void ThreadPool::set_affinity(AffinityCallBack affinity_cb) {
     mgb_assert(affinity_cb, "The affinity callback must not be nullptr");
     std::lock_guard<std::mutex> lock(m_mutex_task);
     m_core_binding_function = affinity_cb;
-    for (size_t i = 0; i < m_nr_threads - 1; i++) {
-        m_workers[i]->affinity_flag = true;
+    //! workers of the shared pool are bound when the pool is created
+    for (auto worker : m_workers) {
+        worker->affinity_flag = true;
+    }
+    if (m_adaptive) {
+        m_adaptive->set_affinity(affinity_cb);
     }
     m_main_affinity_flag = true;
 }
 
+void ThreadPool::set_thread_weights(const std::vector<float>& weights) {
+    mgb_assert(weights.empty() || weights.size() == m_nr_threads,
+               "thread weights size mismatch: got %zu, expect %zu",
+               weights.size(), m_nr_threads);
+    for (auto i : weights) {
+        mgb_assert(i > 0, "thread weights must be positive: got %g", i);
+    }
+    std::lock_guard<std::mutex> lock(m_mutex_task);
+    if (m_adaptive) {
+        m_adaptive->set_weights(weights);
+    }
+}
+
 size_t ThreadPool::nr_threads() const {
     return m_nr_threads;
 }
@@ -130,7 +757,7 @@ void ThreadPool::sync() {
     bool no_finished = false;
     do {
         no_finished = false;
-        for (uint32_t i = 0; i < m_nr_threads - 1; ++i) {
+        for (size_t i = 0; i < m_workers.size(); ++i) {
             if (m_workers[i]->work_flag) {
                 no_finished = true;
                 break;
@@ -150,9 +777,23 @@ void ThreadPool::active() {
 }
 void ThreadPool::deactive() {
     std::lock_guard<std::mutex> lock_task(m_mutex_task);
+    if (m_adaptive) {
+        m_adaptive->deactive();
+    }
     std::unique_lock<std::mutex> lock(m_mutex);
     m_active = false;
 }
+ThreadPool::Mode ThreadPool::default_mode() {
+    static Mode mode = []() {
+        auto setting = MGB_GETENV("MGB_CPU_THREAD_POOL_MODE");
+        if (setting && !strcmp(setting, "adaptive")) {
+            return Mode::ADAPTIVE;
+        }
+        return Mode::SPIN;
+    }();
+    return mode;
+}
+
 ThreadPool::~ThreadPool() {
     std::lock_guard<std::mutex> lock_task(m_mutex_task);
     {
@@ -478,6 +478,147 @@ class CompNode {
          */
         static bool enable_affinity_for_cpu(bool flag);
 
+        /*!
+         * \brief let multithread CPU comp nodes created afterwards share a
+         *      process-wide worker pool, instead of each owning its threads
+         *
+         * The nr_threads of each comp node is used as its concurrency quota
+         * on the shared workers. If affinity is enabled (see
+         * enable_affinity_for_cpu()), the i'th worker is bound to the i'th
+         * CPU when the pool is created.
+         *
+         * This can also be enabled by setting MGB_CPU_SHARED_THREAD_POOL.
+         *
+         * (implemented in comp_node/cpu/comp_node.cpp)
+         *
+         * \param nr_workers number of shared workers; 0 to disable
+         */
+        static void enable_shared_cpu_thread_pool(size_t nr_workers);
+
+        /*!
+         * \brief page size and NUMA placement of large allocations on a CPU
+         *      comp node, such as static memory and weights
+         */
+        struct CpuMemPolicy {
+            enum class HugePage {
+                NONE,      //!< use default pages
+                MADVISE,   //!< transparent huge pages via madvise()
+                HUGETLB    //!< hugetlb pages, falling back to MADVISE
+            };
+            enum class Numa {
+                DEFAULT,      //!< no placement control
+                //! touch new memory on the threads of this comp node, so
+                //! the pages are placed on their nodes; the allocation
+                //! waits for the tasks already dispatched to the comp node
+                FIRST_TOUCH,
+                //! bind new memory to numa_node with mbind()
+                BIND
+            };
+
+            HugePage huge_page = HugePage::NONE;
+            Numa numa = Numa::DEFAULT;
+            //! node for Numa::BIND; -1 means the node that the threads of
+            //! this comp node are running on
+            int numa_node = -1;
+            //! allocations smaller than this are not affected
+            size_t min_size = 1 << 20;
+        };
+
+        /*!
+         * \brief set memory policy of a CPU comp node
+         *
+         * It only affects later allocations. Thread affinity of the comp
+         * node should be set before if numa_node is -1.
+         *
+         * (implemented in comp_node/cpu/comp_node.cpp)
+         */
+        void set_cpu_mem_policy(const CpuMemPolicy& policy) const;
+
+        /*!
+         * \brief how to bind the threads of a CPU comp node according to
+         *      the CPU topology (see sys::get_cpu_topology())
+         */
+        struct CpuBindPolicy {
+            //! use one logical CPU of each physical core before the SMT
+            //! siblings
+            bool one_per_physical_core = true;
+            //! prefer CPUs with higher capacity (big cores on ARM, P-cores
+            //! on hybrid x86)
+            bool prefer_fast_core = true;
+            //! measure throughput of the bound threads and split sub tasks
+            //! in proportion to it; see ThreadPool::set_thread_weights()
+            bool weight_by_throughput = true;
+        };
+
+        /*!
+         * \brief bind threads of a CPU comp node to the CPUs selected by
+         *      the policy, replacing the affinity set before
+         *
+         * The main thread (the last thread id) gets the first selected
+         * CPU, i.e. the fastest one if prefer_fast_core is set.
+         *
+         * (implemented in comp_node/cpu/comp_node.cpp)
+         *
+         * \return the CPU bound for each thread id
+         */
+        std::vector<int> bind_cpu_topology(const CpuBindPolicy& policy) const;
+
+        /*!
+         * \brief priority lane for tasks dispatched to CPU comp nodes that
+         *      have their own worker thread
+         *
+         * Pending HIGH tasks are executed before any pending NORMAL task,
+         * so a latency-critical graph can preempt a large one between its
+         * kernels. Tasks in the same lane keep their order, but tasks in
+         * different lanes are not ordered: data passed between lanes must
+         * be synchronized on the host (e.g. by CompNode::sync()).
+         *
+         * Other comp nodes ignore the priority.
+         */
+        enum class CpuDispatchPriority : int {
+            NORMAL = 0,
+            HIGH = 1
+        };
+        static constexpr int NR_CPU_DISPATCH_PRIORITY = 2;
+
+        /*!
+         * \brief set priority of tasks dispatched from the calling thread
+         *      within the scope
+         *
+         * (implemented in comp_node/cpu/comp_node.cpp)
+         */
+        class CpuDispatchPriorityScope : public NonCopyableObj {
+            CpuDispatchPriority m_prev;
+
+        public:
+            explicit CpuDispatchPriorityScope(CpuDispatchPriority priority);
+            ~CpuDispatchPriorityScope();
+        };
+
+        //! priority of tasks dispatched from the calling thread
+        static CpuDispatchPriority cur_cpu_dispatch_priority();
+
+        //! queueing delay of tasks in a lane, from dispatch to start
+        struct CpuLaneStat {
+            size_t nr_task = 0;
+            double total_delay = 0;  //!< in seconds
+            double max_delay = 0;    //!< in seconds
+
+            double avg_delay() const {
+                return nr_task ? total_delay / nr_task : 0;
+            }
+        };
+
+        /*!
+         * \brief get queueing delay statistics of a lane of a CPU comp
+         *      node; all zero for comp nodes without worker thread
+         * \param reset whether to clear the statistics after reading
+         *
+         * (implemented in comp_node/cpu/comp_node.cpp)
+         */
+        CpuLaneStat get_cpu_lane_stat(CpuDispatchPriority priority,
+                                      bool reset = false) const;
+
 
     protected:
         //! ImplBase with env(); defined in CompNodeEnv
@@ -382,6 +382,98 @@ public:
     };
 };
 
+/* ===================== SizeClassCachingAlloc  ===================== */
+/*!
+ * \brief statistics of a SizeClassCachingAlloc
+ *
+ * Counters are accumulated in per-thread caches and published in batches, so
+ * they may lag behind; call SizeClassCachingAlloc::flush_thread_cache() on
+ * the working threads before reading if exact numbers are needed.
+ */
+struct SizeClassAllocStat {
+    //! number of alloc() and free() calls
+    size_t nr_alloc = 0, nr_free = 0;
+    //! number of allocations served by the per-thread caches
+    size_t nr_thread_cache_hit = 0;
+    //! number of allocations served by the central free lists
+    size_t nr_central_hit = 0;
+    //! bytes requested by live allocations, and its peak value
+    size_t used = 0, peak_used = 0;
+    //! bytes currently obtained from the system
+    size_t reserved = 0;
+
+    //! ratio of allocations that do not need new memory from the system
+    double cache_hit_rate() const {
+        return nr_alloc ? double(nr_thread_cache_hit + nr_central_hit) /
+                                  nr_alloc
+                        : 0.;
+    }
+
+    //! ratio of reserved memory that is not used by live allocations
+    double fragmentation() const {
+        return reserved > used ? 1. - double(used) / reserved : 0.;
+    }
+};
+
+/*!
+ * \brief a host memory allocator optimized for frequent small allocations
+ *
+ * Requests are rounded up to size classes (four classes per power of two).
+ * Small blocks are carved from large arenas (backed by transparent huge pages
+ * where available) and recycled through per-thread caches and lock-free
+ * central free lists, so no block is ever split or merged. Larger blocks are
+ * obtained from the system individually and cached per size class up to a
+ * limit; the largest ones are returned to the system on free.
+ */
+class SizeClassCachingAlloc : virtual public MemAllocBase {
+public:
+    struct Config {
+        //! alignment of returned addresses; must be a power of two
+        size_t alignment = 64;
+        //! size of arenas that small blocks are carved from
+        size_t arena_size = 4 << 20;
+        //! max size of blocks that are served from the per-thread caches
+        size_t max_small_size = 256 << 10;
+        //! max bytes of each size class kept in a per-thread cache
+        size_t thread_cache_size = 1 << 20;
+        //! blocks larger than this are returned to the system on free
+        size_t max_cached_size = 64 << 20;
+        //! max total bytes of freed large blocks kept for reuse
+        size_t large_cache_limit = 256 << 20;
+        //! whether to request transparent huge pages for arenas
+        bool use_huge_page = true;
+    };
+
+    virtual ~SizeClassCachingAlloc() = default;
+
+    static std::unique_ptr<SizeClassCachingAlloc> make(const Config& config);
+
+    /*!
+     * \brief the allocator used by all CPU comp nodes, or nullptr if it is
+     *      not enabled
+     *
+     * It is enabled by setting MGB_CPU_SIZE_CLASS_ALLOC=1; the instance is
+     * never destroyed.
+     */
+    static SizeClassCachingAlloc* get_cpu_default();
+
+    virtual void* alloc(size_t size) = 0;
+    virtual void free(void* ptr) = 0;
+
+    virtual const Config& config() const = 0;
+
+    virtual SizeClassAllocStat get_stat() = 0;
+
+    /*!
+     * \brief return blocks cached by the calling thread to the central free
+     *      lists and publish its pending statistics
+     */
+    virtual void flush_thread_cache() = 0;
+
+    //! return cached large blocks to the system
+    virtual void release_cached_large_blocks() = 0;
+};
+
 } // mem_alloc
 } // mgb
 
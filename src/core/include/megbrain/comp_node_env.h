@@ -590,6 +590,7 @@ class MegDNNHandle final : public UserDataContainer::UserData,
     MGB_TYPEINFO_OBJ_DECL;
 
     static int sm_default_dbg_level;
+    static size_t sm_default_deterministic_nr_partition;
     megcoreDeviceHandle_t m_dev_hdl = nullptr;
     megcoreComputingHandle_t m_comp_hdl = nullptr;
     std::unique_ptr<megdnn::Handle> m_megdnn_handle;
@@ -616,6 +617,19 @@ public:
         return ret;
     }
 
+    /*!
+     * \brief set the default deterministic partition of CPU megdnn handles
+     *      created afterwards; return original setting
+     *
+     * 0 disables deterministic parallelism. See
+     * megdnn::Handle::set_deterministic_nr_partition() for details.
+     */
+    static size_t exchange_default_deterministic_nr_partition(size_t nr) {
+        auto ret = sm_default_deterministic_nr_partition;
+        sm_default_deterministic_nr_partition = nr;
+        return ret;
+    }
+
 #if MGB_NEED_MEGDNN_ASYNC_ERROR
     /*!
      * \brief get pointer to underlying AsyncErrorInfo
@@ -219,6 +219,12 @@ public:
     using MegBrainError::MegBrainError;
 };
 
+//! execution aborted because its cancel token is cancelled
+class ExecCancelledError final : public MegBrainError {
+public:
+    using MegBrainError::MegBrainError;
+};
+
 
 }  // namespace mgb
 
@@ -12,6 +12,7 @@
 #pragma once
 
 #include "megbrain/utils/json.h"
+#include "megbrain/utils/cancel_token.h"
 #include "megbrain/utils/metahelper.h"
 #include "megbrain/exception.h"
 #include "megbrain/comp_node.h"
@@ -64,6 +65,7 @@ namespace cg {
 
 namespace static_infer {
     struct DepElement;
+    struct CompSeqInferStat;
 };
 
 using GraphError = mgb::GraphError;
@@ -108,6 +110,22 @@ class GraphNodeBase: public json::Serializable, public NonCopyableObj {
 class AsyncExecutable : public json::Serializable,
                         public CompNodeDepedentObject {
     UserDataContainer m_user_data;
+    std::shared_ptr<CancelToken> m_cancel_token;
+    //! value of nr_skipped_task() of the token when execution starts
+    size_t m_cancel_token_nr_skipped = 0;
+
+    protected:
+        /*!
+         * \brief called by execute() impls when execution starts; return the
+         *      token that should be installed while dispatching kernels
+         */
+        CancelToken* start_cancellable_exec();
+
+        /*!
+         * \brief called by wait() impls after all comp nodes finish; throw
+         *      ExecCancelledError if any kernel has been skipped
+         */
+        void check_exec_cancelled();
 
     public:
         virtual ~AsyncExecutable() noexcept;
@@ -142,6 +160,13 @@ class AsyncExecutable : public json::Serializable,
          */
         virtual size_t get_run_id() const = 0;
 
+        /*!
+         * \brief get accumulated statistics of static shape inference since
+         *      this func is compiled
+         */
+        virtual static_infer::CompSeqInferStat get_static_infer_stat()
+                const = 0;
+
         /*!
          * \brief update static memory allocation plan and allocation size
          *
@@ -165,6 +190,27 @@ class AsyncExecutable : public json::Serializable,
         UserDataContainer& user_data() {
             return m_user_data;
         }
+
+        /*!
+         * \brief set the token to abort following executions
+         *
+         * When the token is cancelled (explicitly or by its deadline), the
+         * remaining kernels are skipped on CPU comp nodes, so the cores are
+         * released within the latency of one kernel. wait() would then throw
+         * ExecCancelledError; static memory is kept intact and the
+         * executable can be executed again after resetting the token.
+         *
+         * The token should not be changed while executing; pass nullptr to
+         * disable cancellation.
+         */
+        AsyncExecutable& set_cancel_token(std::shared_ptr<CancelToken> token) {
+            m_cancel_token = std::move(token);
+            return *this;
+        }
+
+        const std::shared_ptr<CancelToken>& cancel_token() const {
+            return m_cancel_token;
+        }
 };
 
 
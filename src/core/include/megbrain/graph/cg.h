@@ -99,6 +99,11 @@ struct GraphCommonOptimizeOptions {
     //! memory, default disable now, when weight preprocess is enabled, the
     //! input shape should no change
     bool weight_preprocess = false;
+    //! whether to look up preprocessed weights in PersistentCache before
+    //! preprocessing and save the results there, keyed by the algorithm and
+    //! the weight values; only effective for weights on CPU and when
+    //! comp_node_seq_record_level is 0. See serialization::CompiledModelCache
+    bool weight_preprocess_cache = false;
     //! fuse preprocess patten, like astype + pad_channel + dimshuffle
     bool fuse_preprocess = false;
     enum LayoutTransform : uint32_t {
@@ -132,6 +137,7 @@ struct GraphCommonOptimizeOptions {
     SET(fuse_conv_bias_with_z);
     SET(fuse_preprocess);
     SET(weight_preprocess);
+    SET(weight_preprocess_cache);
 #undef SET
 #define SET(_trans, _trans_capital)                                 \
     GraphCommonOptimizeOptions& enable_##_trans() {                 \
@@ -388,6 +394,11 @@ class ComputingGraph : public std::enable_shared_from_this<ComputingGraph>,
              */
             uint16_t async_exec_level = 1;
 
+            //! priority lane of the tasks dispatched to CPU comp nodes when
+            //! executing this graph; see CompNode::CpuDispatchPriority
+            CompNode::CpuDispatchPriority cpu_dispatch_priority =
+                    CompNode::CpuDispatchPriority::NORMAL;
+
             //! force dynamic memory alloc for all vars
             bool force_dynamic_alloc = false;
 
@@ -414,12 +425,32 @@ class ComputingGraph : public std::enable_shared_from_this<ComputingGraph>,
                 int genetic_pool_size = 20;
                 int lb_memory = 0;
                 int num_worker = sys::get_cpu_count() / 2;
+
+                /*!
+                 * memory budget in bytes for the cost-model driven
+                 * rematerialization planner; if it is nonzero, checkpoints
+                 * are selected according to per-opr computation (see
+                 * OprFootprint) so that peak memory fits the budget while
+                 * only cheap oprs are recomputed, instead of running the
+                 * block-level search above
+                 */
+                size_t remat_budget = 0;
             } sublinear_mem_config;
 
             //! do not re-profile to select best impl algo when input shape
             //! changes (use previous algo)
             bool no_profiling_on_shape_change = false;
 
+            /*!
+             * max number of distinct source shapes/values whose static
+             * inference results are cached for the compiled func; a cached
+             * result is reused when the sources repeat so infer funcs of the
+             * intermediate vars would not be re-run (except those of
+             * workspaces, which also choose algorithms); 0 to disable the
+             * cache
+             */
+            uint16_t static_infer_cache_size = 16;
+
             //! whether to perform defragmenting when memory allocation for a
             //! dynamic var fails
             bool enable_var_mem_defragment = true;
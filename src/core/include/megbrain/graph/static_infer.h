@@ -181,6 +181,34 @@ namespace static_infer {
         Flag shape, value;
     };
 
+    /*!
+     * \brief statistics of the static inference performed for a compiled
+     *      function before each execution
+     *
+     * Inference results of the intermediate shapes are memorized by the
+     * inferred shapes and values of the RT_STATIC sources, so a repeated
+     * input shape only needs to update the sources.
+     */
+    struct CompSeqInferStat {
+        //! number of checks for shape change (usually once per execution)
+        size_t nr_check = 0;
+
+        //! number of checks where some source has changed
+        size_t nr_src_changed = 0;
+
+        //! number of source changes served by the inference result cache
+        size_t nr_cache_hit = 0;
+
+        //! number of source changes that re-run all the infer funcs
+        size_t nr_full_infer = 0;
+
+        //! total time spent in static inference, in seconds
+        double time = 0;
+
+        //! time spent in re-running infer funcs for nr_full_infer
+        double full_infer_time = 0;
+    };
+
     /*!
      * \brief manager for statically inferring of var shapes and value on CPU
      *
@@ -45,6 +45,65 @@ namespace sys {
     //! get total ram and free ram in bytes
     std::pair<size_t, size_t> get_ram_status_bytes();
 
+    //! get NUMA node of the CPU running the caller thread, or -1 if unknown
+    int get_cur_numa_node();
+
+    /*!
+     * \brief allocate zero-filled pages directly from the system
+     *
+     * \param alignment alignment of returned address; it is raised to the
+     *      page size if smaller
+     * \param huge_page whether to request transparent huge pages
+     * \param hugetlb whether to try explicit hugetlb pages first; size
+     *      should be a multiple of the huge page size in such case
+     * \param numa_node if non-negative, bind the pages to given NUMA node
+     * \return allocated address, or nullptr if out of memory
+     */
+    void* alloc_pages(size_t size, size_t alignment, bool huge_page,
+                      bool hugetlb = false, int numa_node = -1);
+
+    //! release memory allocated by alloc_pages()
+    void free_pages(void* ptr, size_t size);
+
+    //! get page size of the system
+    size_t get_page_size();
+
+    //! topology and performance info of a logical CPU
+    struct CpuInfo {
+        //! logical CPU id, as used by set_cpu_affinity()
+        int cpu;
+        //! index of the physical core; SMT siblings share the same value
+        int core;
+        //! number of logical CPUs on the physical core
+        int nr_smt;
+        //! relative performance; larger is faster (e.g. big cores on ARM
+        //! or P-cores on hybrid x86). Only the order is meaningful: it is
+        //! not proportional to throughput on hybrid x86, where P-cores are
+        //! ranked above all the E-cores
+        size_t capacity;
+    };
+
+    /*!
+     * \brief get topology of online CPUs
+     *
+     * On linux it is read from /sys/devices/system/cpu; on other systems
+     * each CPU is considered as a distinct physical core with equal
+     * capacity.
+     */
+    const std::vector<CpuInfo>& get_cpu_topology();
+
+    /*!
+     * \brief select CPUs to bind worker threads
+     *
+     * \param nr number of CPUs to be returned; CPUs are repeated if there
+     *      are not enough ones
+     * \param one_per_core take one logical CPU from each physical core
+     *      before using the SMT siblings
+     * \param prefer_fast take the CPUs with larger capacity first
+     */
+    std::vector<int> select_cpus(size_t nr, bool one_per_core,
+                                 bool prefer_fast);
+
     /*!
      * \brief invoke a function with time limit
      *
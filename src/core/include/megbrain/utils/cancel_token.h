@@ -0,0 +1,114 @@
+/**
+ * \file src/core/include/megbrain/utils/cancel_token.h
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include "megbrain/utils/metahelper.h"
+
+#include <atomic>
+#include <limits>
+#include <memory>
+
+namespace mgb {
+
+/*!
+ * \brief a token to cancel running computation, either explicitly or when a
+ *      deadline is exceeded
+ *
+ * Kernels dispatched while a token is installed by CancelToken::Scope are
+ * bound to it; such kernels are skipped instead of being executed once the
+ * token is cancelled. Currently only CPU comp nodes (including the replay of
+ * their seq recorders) check the token.
+ *
+ * All the methods are thread safe. A token must be managed by std::shared_ptr,
+ * so pending tasks can keep it alive.
+ */
+class CancelToken final : public std::enable_shared_from_this<CancelToken>,
+                          public NonCopyableObj {
+    static constexpr int64_t NO_DEADLINE = std::numeric_limits<int64_t>::max();
+
+    mutable std::atomic_bool m_cancelled{false};
+    std::atomic<int64_t> m_deadline_ns{NO_DEADLINE};
+    std::atomic_size_t m_nr_skipped_task{0};
+
+    bool check_deadline() const;
+
+public:
+    class Scope;
+
+    //! cancel the computation bound to this token
+    void cancel() { m_cancelled.store(true, std::memory_order_release); }
+
+    /*!
+     * \brief set the deadline to be \p timeout seconds later than now; the
+     *      token would be considered as cancelled after the deadline
+     */
+    void set_timeout(double timeout);
+
+    //! clear the cancelled state, deadline and skipped task counter
+    void reset();
+
+    //! whether the token has been cancelled or the deadline has passed
+    bool cancelled() const {
+        if (m_cancelled.load(std::memory_order_acquire)) {
+            return true;
+        }
+        if (m_deadline_ns.load(std::memory_order_relaxed) == NO_DEADLINE) {
+            return false;
+        }
+        return check_deadline();
+    }
+
+    //! whether the token is cancelled by passing the deadline
+    bool deadline_exceeded() const;
+
+    /*!
+     * \brief check whether a task bound to this token should be skipped, and
+     *      count it as skipped if so
+     */
+    bool skip_task() {
+        if (!cancelled()) {
+            return false;
+        }
+        m_nr_skipped_task.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    //! number of tasks skipped due to cancellation since last reset()
+    size_t nr_skipped_task() const {
+        return m_nr_skipped_task.load(std::memory_order_relaxed);
+    }
+
+    /*!
+     * \brief token bound to kernels dispatched by current thread; nullptr if
+     *      no token is installed
+     */
+    static CancelToken* current();
+};
+
+/*!
+ * \brief install a cancel token for current thread in the lifespan of this
+ *      object
+ *
+ * A scope with nullptr token can be used to dispatch tasks that must not be
+ * skipped (such as event records) in a cancellable region.
+ */
+class CancelToken::Scope : public NonCopyableObj {
+    CancelToken* const m_prev;
+
+public:
+    explicit Scope(CancelToken* token);
+    ~Scope();
+};
+
+}  // namespace mgb
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
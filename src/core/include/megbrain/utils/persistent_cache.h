@@ -40,6 +40,23 @@ namespace mgb {
             virtual void put(const std::string &category,
                     const Blob &key, const Blob &value) = 0;
 
+            /*!
+             * \brief get a value whose memory is kept alive by the returned
+             *      pointer, so it can be used in place without copy
+             *
+             * \param[out] size size of the value
+             * \return null if the value is not found or the implementation
+             *      does not support pinning values
+             */
+            virtual std::shared_ptr<const void> get_pinned(
+                    const std::string &category, const Blob &key,
+                    size_t &size) {
+                MGB_MARK_USED_VAR(category);
+                MGB_MARK_USED_VAR(key);
+                MGB_MARK_USED_VAR(size);
+                return {};
+            }
+
             //! set an implementation; return the original implementation
             static std::shared_ptr<PersistentCache> set_impl(
                     std::shared_ptr<PersistentCache> impl);
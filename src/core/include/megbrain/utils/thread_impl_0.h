@@ -88,6 +88,13 @@ namespace mgb {
             virtual void on_sync_all_task_finish() {}
             virtual void on_async_queue_worker_thread_start() {}
     };
+
+    // tasks would be dispatched inplace
+    template<typename Param, class TaskImpl>
+    class AsyncQueueMPSC: public AsyncQueueSC<Param, TaskImpl> {
+        public:
+            explicit AsyncQueueMPSC(size_t = 0, size_t = 0) {}
+    };
 }
 
 // vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
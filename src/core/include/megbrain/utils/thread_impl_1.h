@@ -21,6 +21,7 @@
 #include <condition_variable>
 #include <thread>
 #include <limits>
+#include <memory>
 
 namespace mgb {
 
@@ -417,6 +418,320 @@ namespace mgb {
             }
     };
 
+    /*!
+     * \brief a 32-bit atomic word that threads can block on; it uses futex
+     *      on linux and condition variable on other systems
+     */
+    class FutexWord final : public NonCopyableObj {
+        std::atomic<uint32_t> m_val{0};
+#if !defined(__linux__)
+        std::mutex m_mtx;
+        std::condition_variable m_cv;
+#endif
+
+        public:
+            std::atomic<uint32_t>& val() { return m_val; }
+
+            //! block while the value equals to \p expected; it may return
+            //! spuriously
+            void wait(uint32_t expected);
+
+            //! wake up all threads blocked in wait(); the value should be
+            //! changed before calling this
+            void wake_all();
+    };
+
+    /*!
+     * \brief multi producer, single consumer asynchronous queue on a bounded
+     *      lock-free ring buffer
+     *
+     * It has the same interface as AsyncQueueSC, but producers do not
+     * serialize on a lock, the worker fetches tasks in batches, and the idle
+     * worker and waiting producers sleep on futex. add_task() blocks while
+     * the ring is full, so unlike AsyncQueueSC it must not be called from
+     * process_one_task().
+     *
+     * The worker would be started when first task is added.
+     *
+     * \tparam Param single param for a task
+     * \tparam TaskImpl a subclass that provides the following public method:
+     *
+     *      void process_one_task(Param &);
+     */
+    template<typename Param, class TaskImpl>
+    class AsyncQueueMPSC: public NonCopyableObj {
+        struct Slot {
+            //! equals to the ticket of the producer that may write it, and
+            //! is increased by one after the param is written
+            std::atomic_size_t seq;
+            typename
+                std::aligned_storage<sizeof(Param), alignof(Param)>::type
+                storage;
+
+            Param* get() {
+                return aliased_ptr<Param>(&storage);
+            }
+        };
+
+        static constexpr size_t MAX_BATCH = 64;
+
+        const size_t m_mask, m_max_spin;
+        std::unique_ptr<Slot[]> m_slots;
+        //! ticket of next task to be added
+        std::atomic_size_t m_tail{0};
+        //! keep producer and worker counters on different cache lines
+        uint8_t m_padding[64];
+        std::atomic_size_t m_finished{0};
+        //! ticket of next task to be processed; only used by the worker
+        size_t m_head = 0;
+        //! set to 1 by the worker before sleeping
+        FutexWord m_worker_sleep;
+        //! increased when tasks finish while there are waiting producers
+        FutexWord m_finish_epoch;
+        //! number of threads waiting for tasks to finish or for free slots
+        std::atomic_size_t m_nr_waiter{0};
+        std::atomic_bool m_stop{false}, m_worker_started{false};
+        Spinlock m_worker_start_mtx;
+        std::thread m_worker;
+#if MGB_ENABLE_EXCEPTION
+        std::exception_ptr m_worker_exc;    //!< exception caught in worker
+#endif
+
+        template<typename T>
+        void emplace_task(T&& param) {
+            if (!m_worker_started.load(std::memory_order_acquire)) {
+                start_worker();
+            }
+            size_t ticket = m_tail.fetch_add(1, std::memory_order_relaxed);
+            Slot& slot = m_slots[ticket & m_mask];
+            if (slot.seq.load(std::memory_order_acquire) != ticket) {
+                wait_slot_free(slot, ticket);
+            }
+            new (slot.get()) Param(std::forward<T>(param));
+            slot.seq.store(ticket + 1, std::memory_order_release);
+            // pair with the fence in wait_task()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_worker_sleep.val().load(std::memory_order_relaxed)) {
+                m_worker_sleep.val().store(0, std::memory_order_relaxed);
+                m_worker_sleep.wake_all();
+            }
+        }
+
+        MGB_NOINLINE
+        void start_worker() {
+            MGB_LOCK_GUARD(m_worker_start_mtx);
+            if (!m_worker_started.load(std::memory_order_relaxed)) {
+                m_worker = std::thread{&AsyncQueueMPSC::worker_thread_impl,
+                                       this};
+                m_worker_started.store(true, std::memory_order_release);
+            }
+        }
+
+        //! wait for the worker to free the slot when the ring is full
+        MGB_NOINLINE
+        void wait_slot_free(Slot& slot, size_t ticket) {
+            mgb_assert(std::this_thread::get_id() != m_worker.get_id(),
+                       "AsyncQueueMPSC is full when adding task from worker");
+            for (size_t i = 0; i < m_max_spin; ++ i) {
+                if (slot.seq.load(std::memory_order_acquire) == ticket) {
+                    return;
+                }
+            }
+            // sleep as wait_finished() does; the slot is freed before the
+            // worker increases m_finish_epoch
+            m_nr_waiter.fetch_add(1);
+            // pair with the fence in worker_thread_impl()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (;;) {
+                auto epoch = m_finish_epoch.val().load();
+                if (slot.seq.load(std::memory_order_acquire) == ticket) {
+                    break;
+                }
+                m_finish_epoch.wait(epoch);
+            }
+            m_nr_waiter.fetch_sub(1);
+        }
+
+        //! wait until m_finished reaches \p target
+        void wait_finished(size_t target) {
+            if (m_finished.load(std::memory_order_acquire) >= target) {
+                return;
+            }
+            m_nr_waiter.fetch_add(1);
+            // pair with the fence in worker_thread_impl()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (;;) {
+                auto epoch = m_finish_epoch.val().load();
+                if (m_finished.load(std::memory_order_acquire) >= target) {
+                    break;
+                }
+                m_finish_epoch.wait(epoch);
+            }
+            m_nr_waiter.fetch_sub(1);
+        }
+
+        bool task_ready() {
+            return m_slots[m_head & m_mask].seq.load(
+                           std::memory_order_acquire) == m_head + 1;
+        }
+
+        //! wait for next task; return false if the worker should exit
+        bool wait_task() {
+            for (size_t i = 0; i < m_max_spin; ++ i) {
+                if (task_ready()) {
+                    return true;
+                }
+            }
+            for (; ; ) {
+                m_worker_sleep.val().store(1, std::memory_order_relaxed);
+                // pair with the fence in emplace_task()
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (task_ready()) {
+                    m_worker_sleep.val().store(0, std::memory_order_relaxed);
+                    return true;
+                }
+                if (m_stop.load()) {
+                    return false;
+                }
+                m_worker_sleep.wait(1);
+            }
+        }
+
+        void worker_thread_impl() {
+            on_async_queue_worker_thread_start();
+            for (; ; ) {
+                size_t nr = 0;
+                while (nr < MAX_BATCH &&
+                       m_slots[(m_head + nr) & m_mask].seq.load(
+                               std::memory_order_acquire) == m_head + nr + 1) {
+                    ++ nr;
+                }
+                if (!nr) {
+                    if (!wait_task()) {
+                        return;
+                    }
+                    continue;
+                }
+                for (size_t i = 0; i < nr; ++ i) {
+                    Slot& slot = m_slots[(m_head + i) & m_mask];
+                    MGB_TRY {
+                        static_cast<TaskImpl*>(this)->process_one_task(
+                                *slot.get());
+                    } MGB_CATCH_ALL_EXCEPTION("AsyncQueueMPSC", m_worker_exc);
+                    slot.get()->~Param();
+                    slot.seq.store(m_head + i + m_mask + 1,
+                                   std::memory_order_release);
+                }
+                m_head += nr;
+                m_finished.fetch_add(nr, std::memory_order_release);
+                // pair with the fence in wait_finished()
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (m_nr_waiter.load(std::memory_order_relaxed)) {
+                    m_finish_epoch.val().fetch_add(1);
+                    m_finish_epoch.wake_all();
+                }
+            }
+        }
+
+        public:
+            /*!
+             * \param capacity number of tasks that can be pending; it is
+             *      rounded up to a power of 2, and at least 2
+             * \param max_spin number of polls before the idle worker
+             *      sleeps
+             */
+            explicit AsyncQueueMPSC(
+                    size_t capacity = 1024,
+                    size_t max_spin =
+                            SCQueueSynchronizer::get_default_max_spin())
+                    : m_mask{get_capacity(capacity) - 1},
+                      m_max_spin{max_spin},
+                      m_slots{new Slot[m_mask + 1]} {
+                for (size_t i = 0; i <= m_mask; ++ i) {
+                    m_slots[i].seq.store(i, std::memory_order_relaxed);
+                }
+            }
+
+            void add_task(const Param& param) {
+                emplace_task(param);
+            }
+
+            void add_task(Param&& param) {
+                emplace_task(std::move(param));
+            }
+
+            /*!
+             * \brief wait for the worker to process all already issued tasks
+             *
+             * Note: new tasks issued during this call would not be waited
+             */
+            void wait_all_task_finish() {
+                wait_finished(m_tail.load(std::memory_order_acquire));
+                check_exception();
+                on_sync_all_task_finish();
+            }
+
+            //! wait until the task queue becomes empty
+            void wait_task_queue_empty() {
+                size_t tgt;
+                while (m_finished.load(std::memory_order_acquire) !=
+                       (tgt = m_tail.load(std::memory_order_acquire))) {
+                    wait_finished(tgt);
+                }
+            }
+
+            /*!
+             * \brief check for exception in worker thread and rethrow it to the
+             *      caller thread
+             */
+            void check_exception() {
+#if MGB_ENABLE_EXCEPTION
+                if (m_worker_exc) {
+                    std::exception_ptr exc;
+                    std::swap(m_worker_exc, exc);
+                    std::rethrow_exception(exc);
+                }
+#endif
+            }
+
+            MGB_WARN_UNUSED_RESULT bool all_task_finished() const {
+                return m_finished.load(std::memory_order_acquire) ==
+                       m_tail.load(std::memory_order_acquire);
+            }
+
+        protected:
+            ~AsyncQueueMPSC() noexcept {
+                if (!m_worker_started.load()) {
+                    return;
+                }
+                if (!all_task_finished()) {
+                    mgb_log_error("async queue not finished in destructor");
+                    mgb_trap();
+                }
+                m_stop.store(true);
+                m_worker_sleep.val().store(0);
+                m_worker_sleep.wake_all();
+                m_worker.join();
+            }
+
+            //! see AsyncQueueSC::on_async_queue_worker_thread_start()
+            virtual void on_async_queue_worker_thread_start() {}
+
+            //! see AsyncQueueSC::on_sync_all_task_finish()
+            virtual void on_sync_all_task_finish() {}
+
+        private:
+            static size_t get_capacity(size_t capacity) {
+                // slot states of ticket t are t (free) and t + 1 (written),
+                // which would collide with ticket t + 1 if capacity is 1
+                size_t ret = 2;
+                while (ret < capacity) {
+                    ret <<= 1;
+                }
+                return ret;
+            }
+    };
+
     //! a thread would block until all threads reach this barrier
     class Barrier {
         bool m_need_clear = false;
@@ -17,6 +17,7 @@
 #include <atomic>
 #include <condition_variable>
 #include <functional>
+#include <memory>
 #include <mutex>
 #include <queue>
 #include <thread>
@@ -54,23 +55,144 @@ public:
 };
 
 #if MGB_HAVE_THREAD
+class ThreadPool;
+
+/**
+ * \brief a process-wide pool of workers shared by multiple ThreadPool
+ * objects, so that comp nodes in different graphs or models do not
+ * oversubscribe the cores
+ *
+ * Each run() is limited by a concurrency quota; idle workers join the
+ * running tasks in a round-robin manner, so concurrent callers are served
+ * fairly.
+ */
+class SharedThreadPool : public NonCopyableObj {
+public:
+    struct Job;
+
+    /*!
+     * \param nr_workers number of worker threads; the caller of run() also
+     *      participates in the computing
+     * \param affinity_cb called in each worker thread with its worker id
+     *      when it starts, so core binding is only configured once
+     */
+    SharedThreadPool(size_t nr_workers, AffinityCallBack affinity_cb = {});
+    ~SharedThreadPool();
+
+    /*!
+     * \brief execute all the sub tasks and wait for them to finish
+     *
+     * The thread ids passed to the task are in [0, quota) and are unique
+     * among the threads concurrently working on this task; the caller
+     * thread always uses quota - 1.
+     *
+     * \param quota max number of threads working on this task, including
+     *      the caller
+     * \param owner the ThreadPool dispatching the task; its in_task()
+     *      returns true in the threads while they execute the sub tasks
+     */
+    void run(const TaskElem& task_elem, size_t quota,
+             const ThreadPool* owner = nullptr);
+
+    size_t nr_workers() const { return m_workers.size(); }
+
+    /*!
+     * \brief get the pool to be used by newly created ThreadPool objects
+     *
+     * It can be enabled by set_global(), or by setting the environment var
+     * MGB_CPU_SHARED_THREAD_POOL to the number of workers.
+     *
+     * \return the global pool, or nullptr if not enabled
+     */
+    static std::shared_ptr<SharedThreadPool> get_global();
+
+    /*!
+     * \brief set the global pool; ThreadPool objects created before keep
+     *      using the previous one
+     * \param nr_workers number of workers; 0 to disable the global pool
+     */
+    static void set_global(size_t nr_workers,
+                           AffinityCallBack affinity_cb = {});
+
+private:
+    std::vector<std::thread> m_workers;
+    //! jobs that can still be joined by workers, guarded by m_mtx
+    std::vector<Job*> m_jobs;
+    size_t m_next_job = 0;
+    bool m_stop = false;
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+
+    //! find a job to join in a round-robin manner; m_mtx must be held
+    Job* pick_job();
+
+    void worker_loop(size_t id, const AffinityCallBack& affinity_cb);
+};
+
 /**
  * \brief ThreadPool execute the task in multi-threads(nr_threads>1) mode , it
  * will fallback to single-thread mode if nr_thread is 1.
+ *
+ * If a SharedThreadPool is given, no thread would be created and the tasks
+ * are executed on the shared workers with nr_threads as the quota.
  */
 class ThreadPool : public NonCopyableObj {
 public:
-    //! Create thread-pool nr_threads thread_pool
+    //! how the own workers wait for and distribute the sub tasks
+    enum class Mode {
+        //! workers keep yielding while the pool is active, and fetch sub
+        //! tasks one by one from a shared counter
+        SPIN,
+        //! workers spin for an adaptively tuned period and then park on a
+        //! futex; sub tasks are split into contiguous per-worker ranges,
+        //! and idle workers steal from others to balance the tail
+        ADAPTIVE
+    };
+
+    //! Create thread-pool nr_threads thread_pool, using the global
+    //! SharedThreadPool if it is enabled, or default_mode() otherwise
     ThreadPool(size_t nr_threads);
+
+    ThreadPool(size_t nr_threads, std::shared_ptr<SharedThreadPool> shared);
+
+    ThreadPool(size_t nr_threads, Mode mode);
+
+    /*!
+     * \brief mode of ThreadPool objects created without explicit mode
+     *
+     * It is SPIN unless MGB_CPU_THREAD_POOL_MODE is set to "adaptive".
+     */
+    static Mode default_mode();
+
     //! The main thread set the task, parallelism and worker flag to
     //! notify other thread.
+    //!
+    //! If it is called from a sub task running on this pool, the task is
+    //! executed as nested parallel work: the caller works on it together
+    //! with the threads of this pool that have finished their own sub
+    //! tasks, and it returns after all the nested sub tasks finish.
+    //! If a SharedThreadPool is used, the nested sub tasks are executed
+    //! by the caller alone with its own thread id.
     void add_task(const TaskElem& task_elem);
 
+    //! whether the calling thread is executing a sub task of this pool
+    bool in_task() const;
+
     size_t nr_threads() const;
 
     //! Set the affinity of all the threads
     void set_affinity(AffinityCallBack affinity_cb);
 
+    /*!
+     * \brief set relative throughput of each thread, indexed by thread id
+     *
+     * In Mode::ADAPTIVE the sub tasks are initially split among the
+     * threads in proportion to the weights, so less stealing is needed on
+     * heterogeneous cores. Other modes fetch sub tasks dynamically and
+     * ignore the weights. An empty vector restores even split.
+     */
+    void set_thread_weights(const std::vector<float>& weights);
+
     void sync();
     //! wake up all the threads from cv.wait(), when the thread pool is not
     //! active, all the threads will go to sleep.
@@ -80,7 +202,17 @@ public:
     ~ThreadPool();
 
 private:
+    class AdaptiveImpl;
+    struct NestedJob;
+
+    ThreadPool(size_t nr_threads, std::shared_ptr<SharedThreadPool> shared,
+               Mode mode);
+
     const size_t m_nr_threads = 0;
+    //! the pool to execute tasks on, or nullptr to use own workers
+    const std::shared_ptr<SharedThreadPool> m_shared;
+    //! own workers in ADAPTIVE mode
+    std::unique_ptr<AdaptiveImpl> m_adaptive;
     //! Indicate whether the main thread have binding
     bool m_main_affinity_flag;
     //! The callback binding the threads to cores
@@ -99,6 +231,20 @@ private:
     std::condition_variable m_cv;
     std::mutex m_mutex;
     std::mutex m_mutex_task;
+
+    //! number of threads still executing sub tasks of current task
+    std::atomic_size_t m_nr_busy{0};
+    //! nested jobs that can be joined; guarded by m_nested_mtx
+    std::vector<NestedJob*> m_nested_jobs;
+    std::atomic_size_t m_nr_nested_jobs{0};
+    std::mutex m_nested_mtx;
+
+    //! run a nested task from a sub task on given thread
+    void run_nested(const TaskElem& task_elem, size_t thread_id);
+
+    //! execute sub tasks of a nested job if there is any
+    //! \return whether any sub task is executed
+    bool help_nested(size_t thread_id);
 };
 #else
 /**
@@ -109,11 +255,13 @@ public:
     ThreadPool(size_t) {}
     void add_task(const TaskElem& task_elem);
     void set_affinity(AffinityCallBack affinity_cb);
+    void set_thread_weights(const std::vector<float>&) {}
     void active() {}
     void deactive() {}
     void sync() {}
     ~ThreadPool() {}
     size_t nr_threads() const { return 1_z; }
+    bool in_task() const { return false; }
 };
 
 #endif
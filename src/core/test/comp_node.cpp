@@ -12,16 +12,26 @@
 #include "./comp_node_helper.h"
 
 #include "megbrain/comp_node_env.h"
+#include "megbrain/utils/cancel_token.h"
 #include "megbrain/utils/comp_node_sync_manager.h"
 #include "megbrain/utils/timer.h"
 #include "megbrain/system.h"
 #include "megbrain/test/helper.h"
+#include "megbrain/opr/io.h"
 #include "megbrain/opr/utility.h"
+#include "megbrain/opr/basic_arith_wrapper.h"
 
 #include <chrono>
+#include <random>
 #if MGB_HAVE_THREAD
 #include <thread>
 #endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 using namespace mgb;
 
@@ -233,6 +243,166 @@ TEST(TestCompNodeCPU, CoreAffinity) {
     ASSERT_EQ(data_v[1], static_cast<size_t>(30));
 }
 
+TEST(TestCompNodeCPU, MemPolicy) {
+    using Policy = CompNode::CpuMemPolicy;
+    constexpr size_t SIZE = 3 << 20, HUGE_PAGE = 2 << 20;
+    for (auto&& name : {"cpu:default", "cpu3", "multithread2:3"}) {
+        auto cn = CompNode::load(name);
+        for (auto numa : {Policy::Numa::FIRST_TOUCH, Policy::Numa::BIND}) {
+            Policy policy;
+            policy.huge_page = Policy::HugePage::MADVISE;
+            policy.numa = numa;
+            cn.set_cpu_mem_policy(policy);
+
+            HostTensorND src{cn, {SIZE}, dtype::Uint8()};
+            for (size_t i = 0; i < SIZE; ++i) {
+                src.ptr<dt_uint8>()[i] = i * 3;
+            }
+            DeviceTensorND dev;
+            dev.copy_from(src);
+            ASSERT_EQ(0u, reinterpret_cast<size_t>(dev.raw_ptr()) % HUGE_PAGE);
+
+            // small allocations are not affected
+            DeviceTensorND small{cn, {16}, dtype::Uint8()};
+
+            // pages are touched before the allocation returns, so they can
+            // be freed at once
+            for (int i = 0; i < 4; ++i) {
+                DeviceTensorND tmp{cn, {SIZE}, dtype::Uint8()};
+                memset(tmp.raw_ptr(), 0, SIZE);
+            }
+
+            HostTensorND dst;
+            dst.copy_from(dev).sync();
+            ASSERT_EQ(0, memcmp(src.raw_ptr(), dst.raw_ptr(), SIZE)) << name;
+        }
+        cn.set_cpu_mem_policy({});
+        cn.sync();
+    }
+}
+
+namespace {
+//! count data TLB misses of the caller thread if perf events are available
+class DTLBMissCounter {
+    int m_fd = -1;
+
+public:
+    DTLBMissCounter() {
+#ifdef __linux__
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_DTLB |
+                      (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        m_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+    }
+
+    ~DTLBMissCounter() {
+#ifdef __linux__
+        if (m_fd >= 0) {
+            close(m_fd);
+        }
+#endif
+    }
+
+    void start() {
+#ifdef __linux__
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_RESET, 0);
+            ioctl(m_fd, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+    }
+
+    //! number of misses since start(), or -1 if not available
+    int64_t stop() {
+        int64_t cnt = -1;
+#ifdef __linux__
+        if (m_fd >= 0) {
+            ioctl(m_fd, PERF_EVENT_IOC_DISABLE, 0);
+            if (read(m_fd, &cnt, sizeof(cnt)) != sizeof(cnt)) {
+                cnt = -1;
+            }
+        }
+#endif
+        return cnt;
+    }
+};
+}  // anonymous namespace
+
+TEST(TestCompNodeCPU, MemPolicyBenchmark) {
+    using Policy = CompNode::CpuMemPolicy;
+    // still far beyond the TLB reach of small pages, while cheap enough to
+    // run with other tests
+    constexpr size_t SIZE = 64 << 20, NR_ACCESS = 1 << 20;
+    auto cn = CompNode::load("cpu:default");
+    auto nr_threads = std::min(sys::get_cpu_count(), 4);
+    auto cn_mt = CompNode::load(ssprintf("multithread%d:4", nr_threads));
+
+    for (auto huge_page : {Policy::HugePage::NONE, Policy::HugePage::MADVISE}) {
+        for (auto numa : {Policy::Numa::DEFAULT, Policy::Numa::FIRST_TOUCH}) {
+            Policy policy;
+            policy.huge_page = huge_page;
+            policy.numa = numa;
+            cn.set_cpu_mem_policy(policy);
+            cn_mt.set_cpu_mem_policy(policy);
+
+            // random accesses across pages to stress the TLB
+            DeviceTensorND buf{cn, {SIZE}, dtype::Uint8()};
+            auto ptr = buf.ptr<dt_uint8>();
+            memset(ptr, 1, SIZE);
+            std::mt19937 rng(0);
+            std::vector<uint32_t> idx(NR_ACCESS);
+            for (auto&& i : idx) {
+                i = rng() % SIZE;
+            }
+            DTLBMissCounter counter;
+            RealTimer timer;
+            counter.start();
+            size_t sum = 0;
+            for (auto i : idx) {
+                sum += ptr[i];
+            }
+            auto tlb_miss = counter.stop();
+            auto random_time = timer.get_secs();
+            ASSERT_EQ(NR_ACCESS, sum);
+
+            // parallel streaming on threads of the comp node
+            DeviceTensorND buf_mt{cn_mt, {SIZE}, dtype::Uint8()};
+            auto ptr_mt = buf_mt.ptr<dt_uint8>();
+            auto stream = [ptr_mt, nr_threads](size_t index, size_t) {
+                auto begin = SIZE * index / nr_threads,
+                     end = SIZE * (index + 1) / nr_threads;
+                memset(ptr_mt + begin, 2, end - begin);
+            };
+            auto&& env = CompNodeEnv::from_comp_node(cn_mt).cpu_env();
+            env.dispatch(stream, nr_threads);  // warm up and fault in
+            cn_mt.sync();
+            constexpr int NR_RUN = 5;
+            timer.reset();
+            for (int i = 0; i < NR_RUN; ++i) {
+                env.dispatch(stream, nr_threads);
+            }
+            cn_mt.sync();
+            auto stream_time = timer.get_secs();
+
+            mgb_log("mem policy huge_page=%d numa=%d: random access %.2fns "
+                    "(dTLB read misses: %lld); stream bandwidth %.2fGiB/s",
+                    static_cast<int>(huge_page), static_cast<int>(numa),
+                    random_time * 1e9 / NR_ACCESS,
+                    static_cast<long long>(tlb_miss),
+                    SIZE * NR_RUN / stream_time / (1 << 30));
+        }
+    }
+    cn.set_cpu_mem_policy({});
+    cn_mt.set_cpu_mem_policy({});
+}
+
 TEST(TestCompNode, CPU_MULTI_THREAD) {
     REQUIRE_THREAD();
     std::vector<int> source(100), dst0(100), dst1(100);
@@ -402,6 +572,148 @@ TEST(TestCompNodeCPU, EventWait) {
     ASSERT_TRUE(succ);
 }
 
+TEST(TestCompNodeCPU, PriorityLane) {
+    REQUIRE_THREAD();
+    using Priority = CompNode::CpuDispatchPriority;
+    constexpr size_t NR_TASK = 5;
+    auto cn = CompNode::load("cpu0");
+    auto&& env = CompNodeEnv::from_comp_node(cn).cpu_env();
+    cn.sync();
+    cn.get_cpu_lane_stat(Priority::NORMAL, true);
+    cn.get_cpu_lane_stat(Priority::HIGH, true);
+
+    std::atomic_bool start{false};
+    std::vector<int> order;
+    env.dispatch([&]() {
+        while (!start)
+            std::this_thread::yield();
+    });
+    for (size_t i = 0; i < NR_TASK; ++i) {
+        env.dispatch([&order, i]() { order.push_back(i); });
+    }
+    {
+        CompNode::CpuDispatchPriorityScope scope{Priority::HIGH};
+        ASSERT_EQ(Priority::HIGH, CompNode::cur_cpu_dispatch_priority());
+        for (size_t i = 0; i < NR_TASK; ++i) {
+            env.dispatch([&order, i]() { order.push_back(-1 - int(i)); });
+        }
+    }
+    ASSERT_EQ(Priority::NORMAL, CompNode::cur_cpu_dispatch_priority());
+    start = true;
+    cn.sync();
+
+    // HIGH tasks overtake the pending NORMAL tasks in their own order
+    ASSERT_EQ(NR_TASK * 2, order.size());
+    for (size_t i = 0; i < NR_TASK; ++i) {
+        ASSERT_EQ(-1 - int(i), order[i]);
+        ASSERT_EQ(int(i), order[i + NR_TASK]);
+    }
+    auto stat_normal = cn.get_cpu_lane_stat(Priority::NORMAL, true),
+         stat_high = cn.get_cpu_lane_stat(Priority::HIGH, true);
+    ASSERT_EQ(NR_TASK + 1, stat_normal.nr_task);
+    ASSERT_EQ(NR_TASK, stat_high.nr_task);
+    ASSERT_LE(stat_high.avg_delay(), stat_high.max_delay);
+    ASSERT_LE(stat_high.max_delay, stat_normal.max_delay);
+    ASSERT_EQ(0u, cn.get_cpu_lane_stat(Priority::HIGH).nr_task);
+
+    // graph tagged with high priority
+    HostTensorGenerator<> gen;
+    auto host_x = gen({23}, cn);
+    auto graph = ComputingGraph::make();
+    graph->options().cpu_dispatch_priority = Priority::HIGH;
+    auto x = opr::Host2DeviceCopy::make(*graph, host_x), y = x + 1;
+    HostTensorND host_y;
+    auto func = graph->compile({make_callback_copy(y, host_y)});
+    func->execute().wait();
+    ASSERT_GT(cn.get_cpu_lane_stat(Priority::HIGH).nr_task, 0u);
+    for (size_t i = 0; i < 23; ++i) {
+        ASSERT_EQ(host_x->ptr<float>()[i] + 1, host_y.ptr<float>()[i]);
+    }
+}
+
+TEST(TestCompNodeCPU, CancelToken) {
+    REQUIRE_THREAD();
+    constexpr size_t NR_TASK = 5;
+    auto cn = CompNode::load("cpu0");
+    auto&& env = CompNodeEnv::from_comp_node(cn).cpu_env();
+    cn.sync();
+
+    auto token = std::make_shared<CancelToken>();
+    std::atomic_bool start{false};
+    std::atomic_size_t nr_run{0};
+    env.dispatch([&]() {
+        while (!start)
+            std::this_thread::yield();
+    });
+    auto event = cn.create_event();
+    {
+        CancelToken::Scope scope{token.get()};
+        ASSERT_EQ(token.get(), CancelToken::current());
+        for (size_t i = 0; i < NR_TASK; ++i) {
+            env.dispatch([&]() { ++nr_run; });
+        }
+        // event records are never skipped
+        event->record();
+    }
+    ASSERT_EQ(nullptr, CancelToken::current());
+    token->cancel();
+    start = true;
+    event->host_wait();
+    cn.sync();
+    ASSERT_EQ(0u, nr_run.load());
+    ASSERT_EQ(NR_TASK, token->nr_skipped_task());
+
+    token->reset();
+    ASSERT_FALSE(token->cancelled());
+    token->set_timeout(0);
+    ASSERT_TRUE(token->cancelled());
+    ASSERT_TRUE(token->deadline_exceeded());
+    token->reset();
+
+    // graph execution aborted by deadline
+    constexpr size_t NR_SLEEP = 20;
+    constexpr double SLEEP_TIME = 0.05;
+    HostTensorGenerator<> gen;
+    auto host_x = gen({23}, cn);
+    for (int record : {0, 1}) {
+        auto graph = ComputingGraph::make();
+        graph->options().comp_node_seq_record_level = record;
+        graph->options().graph_opt_level = 0;
+        auto x = opr::Host2DeviceCopy::make(*graph, host_x), y = x;
+        for (size_t i = 0; i < NR_SLEEP; ++i) {
+            y = opr::Sleep::make(y, SLEEP_TIME) + 1;
+        }
+        HostTensorND host_y;
+        auto func = graph->compile({make_callback_copy(y, host_y)});
+        auto check = [&]() {
+            for (size_t i = 0; i < 23; ++i) {
+                ASSERT_EQ(host_x->ptr<float>()[i] + NR_SLEEP,
+                          host_y.ptr<float>()[i]);
+            }
+        };
+        func->execute().wait();
+        check();
+
+        func->set_cancel_token(token);
+        token->set_timeout(SLEEP_TIME * 2);
+        RealTimer timer;
+        func->execute();
+        ASSERT_THROW(func->wait(), ExecCancelledError);
+        // cores are released soon after the deadline
+        ASSERT_LT(timer.get_secs(), SLEEP_TIME * NR_SLEEP / 2);
+        ASSERT_GT(token->nr_skipped_task(), 0u);
+
+        // the executable is reusable after resetting the token
+        token->reset();
+        for (size_t i = 0; i < 23; ++i) {
+            host_x->ptr<float>()[i] += 1;
+        }
+        func->execute().wait();
+        check();
+        func->set_cancel_token(nullptr);
+    }
+}
+
 TEST(TestCompNodeCPU, EventRecOverwrite) {
     REQUIRE_THREAD();
     auto cn = CompNode::load("cpu0");
@@ -16,6 +16,7 @@
 #include "megbrain/opr/io.h"
 #include "megbrain/opr/utility.h"
 #include "megbrain/test/helper.h"
+#include "megbrain/utils/timer.h"
 
 #include <thread>
 #include <map>
@@ -543,6 +544,201 @@ TEST(TestSimpleCachingAlloc, Basic) {
     EXPECT_EQ(0u, raw_alloc->nr_free());
 };
 
+TEST(TestSizeClassCachingAlloc, Basic) {
+    SizeClassCachingAlloc::Config config;
+    config.max_small_size = 1024;
+    config.max_cached_size = 8192;
+    auto alloc = SizeClassCachingAlloc::make(config);
+
+    auto ptr = alloc->alloc(100);
+    ASSERT_EQ(0u, reinterpret_cast<size_t>(ptr) % config.alignment);
+    alloc->free(ptr);
+    // recycled from the thread cache
+    ASSERT_EQ(ptr, alloc->alloc(90));
+
+    auto small = alloc->alloc(0), large = alloc->alloc(4000),
+         huge = alloc->alloc(100000);
+    for (auto i : {small, large, huge}) {
+        ASSERT_EQ(0u, reinterpret_cast<size_t>(i) % config.alignment);
+    }
+    memset(huge, -1, 100000);
+    alloc->flush_thread_cache();
+    auto stat = alloc->get_stat();
+    EXPECT_EQ(5u, stat.nr_alloc);
+    EXPECT_EQ(1u, stat.nr_free);
+    EXPECT_EQ(1u, stat.nr_thread_cache_hit);
+    EXPECT_EQ(90u + 4000 + 100000, stat.used);
+    EXPECT_EQ(stat.used, stat.peak_used);
+    EXPECT_GE(stat.reserved, stat.used);
+
+    alloc->free(ptr);
+    alloc->free(small);
+    alloc->free(large);
+    alloc->free(huge);
+    ASSERT_THROW(alloc->free(small), MegBrainError);
+
+    // large blocks are cached and reused
+    ASSERT_EQ(large, alloc->alloc(3900));
+    alloc->free(large);
+    alloc->flush_thread_cache();
+    stat = alloc->get_stat();
+    EXPECT_EQ(0u, stat.used);
+    EXPECT_EQ(90u + 4000 + 100000, stat.peak_used);
+    EXPECT_EQ(1u, stat.nr_central_hit);
+    auto reserved = stat.reserved;
+    alloc->release_cached_large_blocks();
+    EXPECT_LT(alloc->get_stat().reserved, reserved);
+}
+
+TEST(TestSizeClassCachingAlloc, MultiThread) {
+    constexpr size_t NR_THREAD = 4, NR_ITER = 20000, NR_LIVE = 64;
+    SizeClassCachingAlloc::Config config;
+    config.thread_cache_size = 16 << 10;
+    auto alloc = SizeClassCachingAlloc::make(config);
+
+    // blocks allocated by one thread are freed by the next one, so blocks
+    // flow through the central free lists
+    std::vector<std::vector<std::pair<uint8_t*, size_t>>> handover(NR_THREAD);
+    std::vector<std::mutex> handover_mtx(NR_THREAD);
+    std::atomic_size_t nr_error{0};
+    auto worker = [&](size_t tid) {
+        std::mt19937 rng(tid);
+        std::vector<std::pair<uint8_t*, size_t>> live;
+        auto check_free = [&](std::pair<uint8_t*, size_t> blk) {
+            for (size_t i = 0; i < blk.second; i += 61) {
+                if (blk.first[i] != static_cast<uint8_t>(blk.second)) {
+                    ++nr_error;
+                }
+            }
+            alloc->free(blk.first);
+        };
+        for (size_t iter = 0; iter < NR_ITER; ++iter) {
+            if (live.size() < NR_LIVE && rng() % 2) {
+                size_t size = rng() % 64 ? rng() % 2048 : rng() % (1 << 20);
+                auto ptr = static_cast<uint8_t*>(alloc->alloc(size));
+                if (reinterpret_cast<size_t>(ptr) % config.alignment) {
+                    ++nr_error;
+                }
+                memset(ptr, static_cast<uint8_t>(size), size);
+                live.emplace_back(ptr, size);
+            } else if (!live.empty()) {
+                auto blk = live.back();
+                live.pop_back();
+                if (rng() % 4) {
+                    check_free(blk);
+                } else {
+                    auto next = (tid + 1) % NR_THREAD;
+                    MGB_LOCK_GUARD(handover_mtx[next]);
+                    handover[next].push_back(blk);
+                }
+            }
+            if (iter % 128 == 0) {
+                decltype(live) recv;
+                {
+                    MGB_LOCK_GUARD(handover_mtx[tid]);
+                    recv.swap(handover[tid]);
+                }
+                for (auto i : recv) {
+                    check_free(i);
+                }
+            }
+        }
+        for (auto i : live) {
+            check_free(i);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < NR_THREAD; ++i) {
+        threads.emplace_back(worker, i);
+    }
+    for (auto&& i : threads) {
+        i.join();
+    }
+    for (auto&& i : handover) {
+        for (auto blk : i) {
+            alloc->free(blk.first);
+        }
+    }
+    alloc->flush_thread_cache();
+
+    ASSERT_EQ(0u, nr_error.load());
+    // caches of exited threads have been flushed
+    auto stat = alloc->get_stat();
+    EXPECT_EQ(stat.nr_alloc, stat.nr_free);
+    EXPECT_EQ(0u, stat.used);
+    EXPECT_GT(stat.cache_hit_rate(), 0.5);
+    alloc->print_memory_state();
+}
+
+TEST(TestSizeClassCachingAlloc, Benchmark) {
+    // kept small so the benchmark can run with other tests
+    constexpr size_t NR_ITER = 20000, NR_LIVE = 256, ALIGN = 64;
+    class MallocRawAlloc final : public RawAllocator {
+    public:
+        void* alloc(size_t size) override { return ::malloc(size); }
+        void free(void* ptr) override { ::free(ptr); }
+        void get_mem_info(size_t& free, size_t& tot) override {
+            free = tot = 0;
+        }
+    };
+
+    using AllocFunc = thin_function<void*(size_t)>;
+    using FreeFunc = thin_function<void(void*)>;
+    auto run = [&](const char* name, size_t nr_thread, const AllocFunc& af,
+                   const FreeFunc& ff) {
+        auto worker = [&](size_t tid) {
+            std::mt19937 rng(tid);
+            std::vector<void*> live(NR_LIVE, nullptr);
+            for (size_t i = 0; i < NR_ITER; ++i) {
+                auto&& slot = live[rng() % NR_LIVE];
+                if (slot) {
+                    ff(slot);
+                }
+                // mostly small tensors as in dynamic shape workloads
+                size_t size = rng() % 16 ? rng() % 4096 : rng() % (256 << 10);
+                slot = af(size + 1);
+            }
+            for (auto i : live) {
+                ff(i);
+            }
+        };
+        RealTimer timer;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < nr_thread; ++i) {
+            threads.emplace_back(worker, i);
+        }
+        for (auto&& i : threads) {
+            i.join();
+        }
+        auto time = timer.get_secs();
+        mgb_log("%s: threads=%zu time=%.3fms per_op=%.2fns", name, nr_thread,
+                time * 1e3, time * 1e9 / (NR_ITER * nr_thread));
+    };
+
+    for (size_t nr_thread : {1, 4}) {
+        auto size_class = SizeClassCachingAlloc::make({});
+        run("size_class", nr_thread,
+            [&](size_t size) { return size_class->alloc(size); },
+            [&](void* ptr) { size_class->free(ptr); });
+        size_class->print_memory_state();
+
+        auto simple = SimpleCachingAlloc::make(
+                std::make_unique<MallocRawAlloc>());
+        simple->alignment(ALIGN);
+        run("simple_caching", nr_thread,
+            [&](size_t size) { return simple->alloc(size); },
+            [&](void* ptr) { simple->free(ptr); });
+
+        run("posix_memalign", nr_thread,
+            [](size_t size) {
+                void* ptr = nullptr;
+                mgb_assert(!posix_memalign(&ptr, ALIGN, size));
+                return ptr;
+            },
+            [](void* ptr) { ::free(ptr); });
+    }
+}
+
 namespace {
 class DevicePolicy {
 public:
@@ -131,6 +131,60 @@ MGB_DEFINE_OPR_CLASS(StaticInferMidValueInjector,
 };
 MGB_DYN_TYPE_OBJ_FINAL_IMPL(StaticInferMidValueInjector);
 
+//! copy the input, with a workspace whose infer func chooses an
+//! "algorithm" for the input shape as a side effect, like AlgoChooser does
+MGB_DEFINE_OPR_CLASS(WorkspaceAlgoChooser,
+        cg::SingleCNOperatorNodeBase) // {
+
+    TensorShape m_algo_shape;
+    size_t m_nr_mismatch = 0;
+
+    void scn_do_execute() override {
+        auto&& ishp = input(0)->shape();
+        if (!m_algo_shape.eq_shape(ishp) ||
+            output(1)->shape().total_nr_elems() != ishp.total_nr_elems()) {
+            ++m_nr_mismatch;
+        }
+        output(0)->dev_tensor().copy_from_fixlayout(input(0)->dev_tensor());
+    }
+
+    void init_output_static_infer_desc() override {
+        using namespace cg::static_infer;
+        auto infer_wk = [this](TensorShape &dest, const InpVal &inp) {
+            m_algo_shape = inp.val.at(0).shape();
+            dest = {m_algo_shape.total_nr_elems()};
+            return true;
+        };
+        auto &&mgr = owner_graph()->static_infer_manager();
+        mgr.register_shape_infer(output(0),
+                                 ShapeInferDesc::make_identity(input(0)));
+        mgr.register_shape_infer(
+                output(1),
+                {SourceType::DEP, {{input(0), DepType::SHAPE}}, infer_wk});
+    }
+
+    public:
+        WorkspaceAlgoChooser(VarNode *inp, const OperatorNodeConfig &config):
+            Super{inp->owner_graph(), config, "wk_algo", {inp}}
+        {
+            add_input({inp});
+            add_output(None)->dtype(inp->dtype());
+            cg::add_workspace_output(this);
+        }
+
+        static SymbolVar make(SymbolVar inp) {
+            return inp.insert_single_output_opr<WorkspaceAlgoChooser>(
+                    inp.node(), OperatorNodeConfig{});
+        }
+
+        //! number of executions whose algorithm or workspace does not
+        //! match the input shape
+        size_t nr_mismatch() const {
+            return m_nr_mismatch;
+        }
+};
+MGB_DYN_TYPE_OBJ_FINAL_IMPL(WorkspaceAlgoChooser);
+
 class TrackableStaticMemAlloc final : public cg::DeviceMemoryAllocator {
     size_t m_nr_call = 0;
 
@@ -333,6 +387,74 @@ TEST(TestStaticInfer, EagerConstShape) {
     }
 }
 
+TEST(TestStaticInfer, InferResultCache) {
+    auto run = [](uint16_t cache_size) {
+        HostTensorGenerator<> gen;
+        HostTensorGenerator<dtype::Int32> gen_int;
+        auto host_x = gen({2, 3}), host_tshp = gen_int({2});
+        auto graph = ComputingGraph::make();
+        graph->options().static_infer_cache_size = cache_size;
+        auto x = opr::Host2DeviceCopy::make(*graph, host_x),
+             tshp = opr::Host2DeviceCopy::make(*graph, host_tshp),
+             y = opr::Concat::make({x.flatten(), x.flatten()}, 0),
+             z = y.reshape(tshp);
+        HostTensorND host_z;
+        auto func = graph->compile({make_callback_copy(z, host_z)});
+        auto check = [&](size_t n0, size_t n1) {
+            *host_x = *gen({n0, n1});
+            host_tshp->ptr<int>()[0] = n1;
+            host_tshp->ptr<int>()[1] = n0 * 2;
+            func->execute();
+            ASSERT_EQ(TensorShape({n1, n0 * 2}), host_z.shape());
+            auto px = host_x->ptr<float>(), pz = host_z.ptr<float>();
+            for (size_t i = 0; i < n0 * n1; ++ i) {
+                ASSERT_EQ(px[i], pz[i]);
+                ASSERT_EQ(px[i], pz[i + n0 * n1]);
+            }
+        };
+        for (int i = 0; i < 3; ++ i) {
+            check(2, 3);
+            check(4, 5);
+        }
+        check(3, 3);
+        return func->get_static_infer_stat();
+    };
+
+    auto stat = run(16);
+    ASSERT_EQ(7u, stat.nr_src_changed);
+    ASSERT_EQ(3u, stat.nr_full_infer);
+    ASSERT_EQ(4u, stat.nr_cache_hit);
+    ASSERT_GE(stat.time, stat.full_infer_time);
+
+    stat = run(0);
+    ASSERT_EQ(7u, stat.nr_src_changed);
+    ASSERT_EQ(7u, stat.nr_full_infer);
+    ASSERT_EQ(0u, stat.nr_cache_hit);
+}
+
+TEST(TestStaticInfer, InferResultCacheWorkspace) {
+    HostTensorGenerator<> gen;
+    auto host_x = gen({2, 3});
+    auto graph = ComputingGraph::make();
+    auto x = opr::Host2DeviceCopy::make(*graph, host_x),
+         y = WorkspaceAlgoChooser::make(x);
+    auto&& chooser =
+            y.node()->owner_opr()->cast_final_safe<WorkspaceAlgoChooser>();
+    HostTensorND host_y;
+    auto func = graph->compile({make_callback_copy(y, host_y)});
+    for (int i = 0; i < 3; ++ i) {
+        for (auto&& shp : {TensorShape{2, 3}, TensorShape{4, 5}}) {
+            *host_x = *gen(shp);
+            func->execute();
+            MGB_ASSERT_TENSOR_EQ(*host_x, host_y);
+        }
+    }
+    // workspace infer funcs are re-run on cache hits, so the algorithm of
+    // the opr is chosen for the current shape
+    ASSERT_EQ(4u, func->get_static_infer_stat().nr_cache_hit);
+    ASSERT_EQ(0u, chooser.nr_mismatch());
+}
+
 TEST(TestStaticInfer, Updater) {
     using namespace cg::static_infer;
     auto graph = ComputingGraph::make();
@@ -547,6 +547,93 @@ TEST(TestSublinearMemory, BadOpr) {
    }
 }
 
+TEST(TestSublinearMemory, RematBudget) {
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu0");
+    constexpr size_t N = 2, H = 16, W = 16, NR_LAYER = 5;
+    auto host_data = gen({N, 1, H, W}, cn);
+
+    auto graph = ComputingGraph::make();
+    SymbolVarArray params;
+    auto out = opr::Host2DeviceCopy::make(*graph, host_data).rename("data");
+    opr::Convolution::Param conv_param;
+    conv_param.pad_h = conv_param.pad_w = 1;
+    size_t out_chl = 1;
+    for (size_t i = 0; i < NR_LAYER; ++i) {
+        params.emplace_back(opr::SharedDeviceTensor::make(
+                *graph, *gen({4, out_chl, 3, 3}, cn)));
+        out = opr::relu(opr::Convolution::make(out, params.back(), conv_param));
+        out_chl = 4;
+    }
+
+    auto loss = opr::Dot::make(out.flatten(), out.flatten());
+    std::vector<HostTensorND> grad_params_get(params.size());
+    ComputingGraph::OutputSpec out_spec;
+    for (size_t i = 0; i < params.size(); ++i) {
+        out_spec.emplace_back(make_callback_copy(cg::grad(loss, params[i]),
+                                                 grad_params_get[i]));
+    }
+
+    auto nr_conv_fwd = [](cg::AsyncExecutable* func) {
+        size_t nr = 0;
+        func->iter_opr_seq([&nr](cg::OperatorNodeBase* opr) {
+            nr += opr->same_type<opr::Convolution>();
+            return true;
+        });
+        return nr;
+    };
+
+    graph->options().graph_opt_level = 0;
+    std::vector<HostTensorND> grad_params_expect(grad_params_get.size());
+    {
+        auto func = graph->compile(out_spec);
+        func->execute();
+        for (size_t i = 0; i < grad_params_get.size(); ++i)
+            grad_params_expect[i].copy_from(grad_params_get[i]);
+    }
+
+    graph->options().enable_sublinear_memory_opt = true;
+    struct RunResult {
+        size_t nr_conv_fwd, static_alloc, bottleneck;
+    };
+    auto check_grads = [&]() {
+        for (size_t i = 0; i < grad_params_get.size(); ++i)
+            MGB_ASSERT_TENSOR_NEAR(grad_params_get[i], grad_params_expect[i],
+                                   1e-4);
+    };
+    auto run = [&](size_t budget) {
+        graph->options().sublinear_mem_config.remat_budget = budget;
+        auto func = graph->compile(out_spec);
+        func->execute();
+        RunResult ret;
+        ret.nr_conv_fwd = nr_conv_fwd(func.get());
+        ret.static_alloc = func->update_static_alloc_plan_and_get_size().at(cn);
+        ret.bottleneck =
+                static_cast<cg::ComputingGraphImpl*>(graph.get())
+                        ->seq_modifier_for_sublinear_memory()
+                        .prev_min_bottleneck()
+                        .at(cn);
+        return ret;
+    };
+
+    // a budget large enough: nothing should be recomputed
+    auto full = run(std::numeric_limits<size_t>::max());
+    check_grads();
+    ASSERT_EQ(NR_LAYER, full.nr_conv_fwd);
+
+    // a budget that can not be reached: use the plan with min bottleneck
+    auto least = run(1);
+    check_grads();
+    ASSERT_LT(least.bottleneck, full.bottleneck);
+
+    // a tight budget that can be reached: recompute to lower the peak memory
+    auto tight = run(least.bottleneck);
+    check_grads();
+    ASSERT_LE(tight.bottleneck, least.bottleneck);
+    ASSERT_GT(tight.nr_conv_fwd, NR_LAYER);
+    ASSERT_LT(tight.static_alloc, full.static_alloc);
+}
+
 #else
 #pragma message "tests are disabled as Sublinear is not enabled."
 #endif  // MGB_ENABLE_SUBLINEAR
@@ -18,6 +18,7 @@
 
 #else
 
+#include <set>
 #include <unistd.h>
 
 using namespace mgb;
@@ -80,6 +81,47 @@ namespace sys {
 }
 }
 
+TEST(TestSystem, CpuTopology) {
+    auto&& topo = get_cpu_topology();
+    ASSERT_FALSE(topo.empty());
+    std::set<int> all_cpus, all_cores;
+    for (auto&& i : topo) {
+        ASSERT_GE(i.cpu, 0);
+        ASSERT_GE(i.nr_smt, 1);
+        ASSERT_GT(i.capacity, 0u);
+        all_cpus.insert(i.cpu);
+        all_cores.insert(i.core);
+    }
+    ASSERT_EQ(topo.size(), all_cpus.size());
+
+    // one CPU per core is taken before the SMT siblings
+    auto cpus = select_cpus(all_cores.size(), true, false);
+    ASSERT_EQ(all_cores.size(), cpus.size());
+    std::set<int> cores;
+    for (int cpu : cpus) {
+        ASSERT_TRUE(all_cpus.count(cpu));
+        for (auto&& i : topo) {
+            if (i.cpu == cpu) {
+                cores.insert(i.core);
+            }
+        }
+    }
+    ASSERT_EQ(all_cores.size(), cores.size());
+
+    // the fastest CPU comes first, and CPUs are reused if not enough
+    cpus = select_cpus(topo.size() * 2 + 1, false, true);
+    ASSERT_EQ(topo.size() * 2 + 1, cpus.size());
+    size_t max_cap = 0;
+    for (auto&& i : topo) {
+        max_cap = std::max(max_cap, i.capacity);
+    }
+    for (auto&& i : topo) {
+        if (i.cpu == cpus[0]) {
+            ASSERT_EQ(max_cap, i.capacity);
+        }
+    }
+}
+
 TEST(TestSystem, TimedFuncInvokerBasic) {
     auto ins = TimedFuncInvokerTest::make_ins();
     double time = 0.1;
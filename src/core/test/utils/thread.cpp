@@ -40,6 +40,17 @@ namespace {
             }
     };
 
+    class FuncExecutorMPSC final: public AsyncQueueMPSC<
+                                  thin_function<void()>,
+                                  FuncExecutorMPSC> {
+        public:
+            using AsyncQueueMPSC::AsyncQueueMPSC;
+
+            void process_one_task(const thin_function<void()> &task) {
+                task();
+            }
+    };
+
     template<int producer_sleep, int consumer_sleep>
     void test_scq_sync_multi_producer() {
         size_t nr_worker_call = 0;
@@ -426,6 +437,112 @@ TEST(TestAsyncQueue, Benchmark) {
     ASSERT_EQ(N * 5, nr_call);
 }
 
+TEST(TestAsyncQueue, MPSCCorrectness) {
+    constexpr size_t N = 20000, M = 4;
+    for (size_t capacity : {1, 8, 1024}) {
+        for (size_t max_spin : {0, 1000}) {
+            FuncExecutorMPSC queue{capacity, max_spin};
+            // only accessed in the worker
+            std::vector<size_t> last(M, 0), sum(M, 0);
+            size_t nr_err = 0;
+            std::atomic_size_t nr_started{0};
+            auto producer = [&](size_t id) {
+                ++ nr_started;
+                while (nr_started != M);
+                for (size_t i = 1; i <= N; ++ i) {
+                    queue.add_task([&, id, i]() {
+                        nr_err += last[id] + 1 != i;
+                        last[id] = i;
+                        sum[id] += i;
+                    });
+                    if (i % 1000 == id) {
+                        queue.wait_all_task_finish();
+                        ASSERT_GE(last[id], i);
+                    }
+                }
+            };
+            std::vector<std::thread> threads;
+            for (size_t i = 0; i < M; ++ i) {
+                threads.emplace_back(producer, i);
+            }
+            for (auto&& i : threads) {
+                i.join();
+            }
+            queue.wait_all_task_finish();
+            ASSERT_TRUE(queue.all_task_finished());
+            ASSERT_EQ(0u, nr_err);
+            for (size_t i = 0; i < M; ++ i) {
+                ASSERT_EQ(N * (N + 1) / 2, sum[i]);
+            }
+        }
+    }
+}
+
+#if MGB_ENABLE_EXCEPTION
+TEST(TestAsyncQueue, MPSCException) {
+    FuncExecutorMPSC queue;
+    int cnt = 0;
+    queue.add_task([&]() { ++ cnt; });
+    queue.add_task([]() { throw std::runtime_error("test"); });
+    queue.add_task([&]() { ++ cnt; });
+    ASSERT_THROW(queue.wait_all_task_finish(), std::runtime_error);
+    queue.wait_all_task_finish();
+    ASSERT_EQ(2, cnt);
+}
+#endif
+
+TEST(TestAsyncQueue, MPSCBenchmark) {
+    constexpr size_t N = 100000, NR_PING = 2000, M = 4;
+    std::atomic_size_t nr_done{0};
+
+    // enqueue->execute latency: each task is added after previous one
+    // finished, so the worker is idle and may be sleeping
+    auto bench_latency = [&](auto& queue) {
+        RealTimer timer;
+        for (size_t i = 0; i < NR_PING; ++ i) {
+            queue.add_task([&]() { ++ nr_done; });
+            while (nr_done.load(std::memory_order_acquire) != i + 1);
+        }
+        auto ret = timer.get_secs() * 1e9 / NR_PING;
+        queue.wait_all_task_finish();
+        nr_done = 0;
+        return ret;
+    };
+    // throughput with multiple producers
+    auto bench_throughput = [&](auto& queue) {
+        RealTimer timer;
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < M; ++ i) {
+            threads.emplace_back([&]() {
+                for (size_t j = 0; j < N / M; ++ j) {
+                    queue.add_task([&]() {
+                        nr_done.fetch_add(1, std::memory_order_relaxed);
+                    });
+                }
+            });
+        }
+        for (auto&& i : threads) {
+            i.join();
+        }
+        queue.wait_all_task_finish();
+        auto ret = timer.get_secs() * 1e9 / N;
+        EXPECT_EQ(N / M * M, nr_done.load());
+        nr_done = 0;
+        return ret;
+    };
+
+    FuncExecutor sc;
+    FuncExecutorMPSC mpsc_spin, mpsc_sleep{1024, 0};
+    auto sc_lat = bench_latency(sc), sc_thr = bench_throughput(sc);
+    auto spin_lat = bench_latency(mpsc_spin),
+         spin_thr = bench_throughput(mpsc_spin);
+    auto sleep_lat = bench_latency(mpsc_sleep),
+         sleep_thr = bench_throughput(mpsc_sleep);
+    mgb_log("enqueue->execute latency / per task time with %zu producers: "
+            "sc=%.1f/%.1f mpsc=%.1f/%.1f mpsc_no_spin=%.1f/%.1f [ns]",
+            M, sc_lat, sc_thr, spin_lat, spin_thr, sleep_lat, sleep_thr);
+}
+
 TEST(TestThread, Spinlock) {
     Spinlock lock;
     int cnt = 0;
@@ -10,11 +10,14 @@
  */
 #include "megbrain/utils/thread_pool.h"
 #include "megbrain/comp_node.h"
+#include "megbrain/comp_node_env.h"
 #include "megbrain/system.h"
 #include "megbrain/test/helper.h"
+#include "megbrain/utils/timer.h"
 #include "megbrain/opr/io.h"
 #include "megbrain/opr/utility.h"
 #include <atomic>
+#include <chrono>
 #include <random>
 
 #if MGB_HAVE_THREAD
@@ -62,6 +65,334 @@ TEST(TestThreadPool, BASIC) {
     }
 }
 
+TEST(TestThreadPool, Adaptive) {
+    constexpr size_t NR_THREADS = 4;
+    ThreadPool pool{NR_THREADS, ThreadPool::Mode::ADAPTIVE};
+    ASSERT_EQ(NR_THREADS, pool.nr_threads());
+    std::atomic_size_t nr_err{0};
+    std::unique_ptr<std::atomic_int[]> data_v{
+            new std::atomic_int[NR_THREADS]};
+    for (size_t i = 0; i < NR_THREADS; ++i) {
+        data_v[i] = 0;
+    }
+    pool.set_affinity([&](size_t thread_id) { data_v[thread_id] = 1; });
+    for (size_t parallelism : {2, 3, 4, 7, 64, 1000, 10007}) {
+        std::unique_ptr<std::atomic_int[]> cnt{
+                new std::atomic_int[parallelism]};
+        for (size_t run = 0; run < 3; ++run) {
+            for (size_t i = 0; i < parallelism; ++i) {
+                cnt[i] = 0;
+            }
+            auto task = [&](size_t index, size_t thread_id) {
+                if (thread_id >= NR_THREADS) {
+                    ++nr_err;
+                }
+                ++cnt[index];
+            };
+            pool.add_task({task, parallelism});
+            for (size_t i = 0; i < parallelism; ++i) {
+                ASSERT_EQ(1, cnt[i].load()) << parallelism << " " << i;
+            }
+            if (run == 1) {
+                // workers should be woken up after parking
+                pool.deactive();
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+    }
+    ASSERT_EQ(0u, nr_err.load());
+    for (size_t i = 0; i < NR_THREADS - 1; ++i) {
+        ASSERT_EQ(1, data_v[i].load());
+    }
+}
+
+TEST(TestThreadPool, Nested) {
+    constexpr size_t NR_THREADS = 4, OUTER = 7, INNER = 33;
+    for (auto mode : {ThreadPool::Mode::SPIN, ThreadPool::Mode::ADAPTIVE}) {
+        ThreadPool pool{NR_THREADS, mode};
+        std::unique_ptr<std::atomic_int[]> cnt{
+                new std::atomic_int[OUTER * INNER]};
+        std::atomic_size_t nr_err{0};
+        for (size_t run = 0; run < 10; ++run) {
+            for (size_t i = 0; i < OUTER * INNER; ++i) {
+                cnt[i] = 0;
+            }
+            auto outer = [&](size_t oidx, size_t thread_id) {
+                if (thread_id >= NR_THREADS || !pool.in_task()) {
+                    ++nr_err;
+                }
+                auto inner = [&, oidx](size_t iidx, size_t thread_id) {
+                    if (thread_id >= NR_THREADS) {
+                        ++nr_err;
+                    }
+                    ++cnt[oidx * INNER + iidx];
+                };
+                pool.add_task({inner, INNER});
+            };
+            pool.add_task({outer, OUTER});
+            ASSERT_FALSE(pool.in_task());
+            for (size_t i = 0; i < OUTER * INNER; ++i) {
+                ASSERT_EQ(1, cnt[i].load());
+            }
+        }
+        pool.deactive();
+        ASSERT_EQ(0u, nr_err.load());
+    }
+}
+
+TEST(TestThreadPool, NestedCompNode) {
+    constexpr size_t OUTER = 5, INNER = 17;
+    for (auto name : {"cpu:default", "cpu31", "multithread:default:4",
+                      "multithread4:31"}) {
+        auto cn = CompNode::load(name);
+        auto&& env = CompNodeEnv::from_comp_node(cn).cpu_env();
+        std::vector<size_t> dst(OUTER * INNER);
+        auto outer = [&](size_t oidx, size_t) {
+            auto inner = [&, oidx](size_t iidx, size_t) {
+                dst[oidx * INNER + iidx] = oidx * INNER + iidx + 1;
+            };
+            env.dispatch(inner, INNER);
+            // the nested dispatch should have finished
+            for (size_t i = 0; i < INNER; ++i) {
+                mgb_assert(dst[oidx * INNER + i] == oidx * INNER + i + 1);
+            }
+        };
+        env.dispatch(outer, OUTER);
+        cn.sync();
+        for (size_t i = 0; i < OUTER * INNER; ++i) {
+            ASSERT_EQ(i + 1, dst[i]) << name;
+        }
+    }
+}
+
+TEST(TestThreadPool, Weighted) {
+    constexpr size_t NR_THREADS = 4;
+    ThreadPool pool{NR_THREADS, ThreadPool::Mode::ADAPTIVE};
+    ASSERT_THROW(pool.set_thread_weights({1.f, 2.f}), MegBrainError);
+    for (auto&& weights : std::vector<std::vector<float>>{
+                 {1.f, 1.f, 1.f, 1.f}, {4.f, 1.f, 1.f, 2.f},
+                 {1.f, 1e-3f, 1e-3f, 1e-3f}, {}}) {
+        pool.set_thread_weights(weights);
+        for (size_t parallelism : {2, 5, 64, 1001}) {
+            std::unique_ptr<std::atomic_int[]> cnt{
+                    new std::atomic_int[parallelism]};
+            for (size_t i = 0; i < parallelism; ++i) {
+                cnt[i] = 0;
+            }
+            auto task = [&](size_t index, size_t) { ++cnt[index]; };
+            pool.add_task({task, parallelism});
+            for (size_t i = 0; i < parallelism; ++i) {
+                ASSERT_EQ(1, cnt[i].load()) << parallelism << " " << i;
+            }
+        }
+    }
+    pool.deactive();
+
+    for (auto name : {"cpu31", "multithread:default:3", "multithread3:31"}) {
+        auto cn = CompNode::load(name);
+        auto&& env = CompNodeEnv::from_comp_node(cn).cpu_env();
+        auto cpus = cn.bind_cpu_topology({});
+        ASSERT_EQ(env.dispatcher->nr_threads(), cpus.size());
+        for (int i : cpus) {
+            ASSERT_GE(i, 0);
+        }
+        std::vector<size_t> dst(100);
+        auto task = [&](size_t index, size_t) { dst[index] = index + 1; };
+        env.dispatch(task, dst.size());
+        cn.sync();
+        for (size_t i = 0; i < dst.size(); ++i) {
+            ASSERT_EQ(i + 1, dst[i]) << name;
+        }
+    }
+}
+
+TEST(TestThreadPool, Benchmark) {
+    size_t nr_threads = std::min<size_t>(4, sys::get_cpu_count());
+    if (nr_threads < 2) {
+        return;
+    }
+    auto run_case = [nr_threads](const char* name,
+                                 const std::function<ThreadPool*()>& maker) {
+        std::unique_ptr<ThreadPool> pool{maker()};
+        std::vector<size_t> sink(64 * 1024);
+        auto make_task = [&sink](size_t work) {
+            return [&sink, work](size_t index, size_t) {
+                // volatile so the loop is not folded by the compiler
+                volatile size_t acc = index;
+                for (size_t i = 0; i < work; ++i) {
+                    acc = acc * 3 + i;
+                }
+                sink[index % sink.size()] = acc;
+            };
+        };
+        RealTimer timer;
+
+        // dispatch latency: one empty sub task per thread
+        constexpr size_t NR_DISPATCH = 5000;
+        auto empty = make_task(0);
+        pool->active();
+        timer.reset();
+        for (size_t i = 0; i < NR_DISPATCH; ++i) {
+            pool->add_task({empty, nr_threads});
+        }
+        auto t_dispatch = timer.get_secs() * 1e6 / NR_DISPATCH;
+
+        // wake-up latency after the workers have gone idle
+        constexpr size_t NR_WAKE = 20;
+        double t_wake = 0;
+        for (size_t i = 0; i < NR_WAKE; ++i) {
+            pool->deactive();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            timer.reset();
+            pool->add_task({empty, nr_threads});
+            t_wake += timer.get_secs();
+        }
+        t_wake = t_wake * 1e6 / NR_WAKE;
+
+        // throughput for different task granularities, with the same
+        // total amount of work
+        std::string thp;
+        for (size_t work : {10, 100, 1000, 10000}) {
+            size_t parallelism = (1 << 18) / work;
+            auto task = make_task(work);
+            pool->active();
+            timer.reset();
+            for (int i = 0; i < 5; ++i) {
+                pool->add_task({task, parallelism});
+            }
+            thp += ssprintf(" work%zu:%.2fns", work,
+                            timer.get_secs() * 1e9 / (5 * parallelism));
+        }
+        pool->deactive();
+        mgb_log("%s(%zu threads): dispatch=%.2fus wake=%.2fus per-subtask:%s",
+                name, nr_threads, t_dispatch, t_wake, thp.c_str());
+    };
+    run_case("spin", [nr_threads]() {
+        return new ThreadPool{nr_threads, ThreadPool::Mode::SPIN};
+    });
+    run_case("adaptive", [nr_threads]() {
+        return new ThreadPool{nr_threads, ThreadPool::Mode::ADAPTIVE};
+    });
+    auto shared = std::make_shared<SharedThreadPool>(nr_threads - 1);
+    run_case("shared", [nr_threads, shared]() {
+        return new ThreadPool{nr_threads, shared};
+    });
+}
+
+TEST(TestThreadPool, Shared) {
+    constexpr size_t NR_CALLER = 4, NR_RUN = 200, PARALLELISM = 37;
+    auto shared = std::make_shared<SharedThreadPool>(3u);
+    std::vector<std::thread> callers;
+    std::atomic_size_t nr_err{0};
+    for (size_t caller = 0; caller < NR_CALLER; ++caller) {
+        callers.emplace_back([&, caller]() {
+            size_t quota = caller % 2 ? 2 : 4;
+            ThreadPool pool{quota, shared};
+            ASSERT_EQ(quota, pool.nr_threads());
+            std::vector<int> dst(PARALLELISM);
+            std::unique_ptr<std::atomic_int[]> in_use{
+                    new std::atomic_int[quota]};
+            for (size_t run = 0; run < NR_RUN; ++run) {
+                for (size_t i = 0; i < quota; ++i) {
+                    in_use[i] = 0;
+                }
+                auto task = [&](size_t index, size_t thread_id) {
+                    if (thread_id >= quota || !pool.in_task() ||
+                        in_use[thread_id]++) {
+                        ++nr_err;
+                    }
+                    dst[index] = index * run;
+                    --in_use[thread_id];
+                };
+                pool.add_task({task, PARALLELISM});
+                ASSERT_FALSE(pool.in_task());
+                for (size_t i = 0; i < PARALLELISM; ++i) {
+                    ASSERT_EQ(static_cast<int>(i * run), dst[i]);
+                }
+            }
+        });
+    }
+    for (auto&& i : callers) {
+        i.join();
+    }
+    ASSERT_EQ(0u, nr_err.load());
+}
+
+TEST(TestThreadPool, SharedNested) {
+    constexpr size_t NR_CALLER = 2, NR_RUN = 50, OUTER = 9, INNER = 13;
+    auto shared = std::make_shared<SharedThreadPool>(3u);
+    std::vector<std::thread> callers;
+    std::atomic_size_t nr_err{0};
+    for (size_t caller = 0; caller < NR_CALLER; ++caller) {
+        callers.emplace_back([&]() {
+            constexpr size_t QUOTA = 3;
+            ThreadPool pool{QUOTA, shared};
+            std::unique_ptr<std::atomic_int[]> cnt{
+                    new std::atomic_int[OUTER * INNER]};
+            std::unique_ptr<std::atomic_int[]> in_use{
+                    new std::atomic_int[QUOTA]};
+            for (size_t i = 0; i < QUOTA; ++i) {
+                in_use[i] = 0;
+            }
+            for (size_t run = 0; run < NR_RUN; ++run) {
+                for (size_t i = 0; i < OUTER * INNER; ++i) {
+                    cnt[i] = 0;
+                }
+                auto outer = [&](size_t oidx, size_t thread_id) {
+                    if (thread_id >= QUOTA || !pool.in_task() ||
+                        in_use[thread_id]++) {
+                        ++nr_err;
+                        return;
+                    }
+                    auto tid = std::this_thread::get_id();
+                    auto inner = [&, oidx, thread_id, tid](size_t iidx,
+                                                           size_t inner_tid) {
+                        // nested sub tasks must not be run by other threads
+                        // under the ids held by outer sub tasks
+                        if (inner_tid != thread_id ||
+                            std::this_thread::get_id() != tid) {
+                            ++nr_err;
+                        }
+                        ++cnt[oidx * INNER + iidx];
+                    };
+                    pool.add_task({inner, INNER});
+                    --in_use[thread_id];
+                };
+                pool.add_task({outer, OUTER});
+                ASSERT_FALSE(pool.in_task());
+                for (size_t i = 0; i < OUTER * INNER; ++i) {
+                    ASSERT_EQ(1, cnt[i].load());
+                }
+            }
+        });
+    }
+    for (auto&& i : callers) {
+        i.join();
+    }
+    ASSERT_EQ(0u, nr_err.load());
+}
+
+TEST(TestThreadPool, SharedCompNode) {
+    CompNode::enable_shared_cpu_thread_pool(2);
+    auto cn0 = CompNode::load("multithread4:29"),
+         cn1 = CompNode::load("multithread2:30");
+    CompNode::enable_shared_cpu_thread_pool(0);
+    for (auto cn : {cn0, cn1}) {
+        auto&& env = CompNodeEnv::from_comp_node(cn).cpu_env();
+        size_t nr_threads = env.dispatcher->nr_threads();
+        std::vector<size_t> dst(100);
+        auto task = [&](size_t index, size_t thread_id) {
+            mgb_assert(thread_id < nr_threads);
+            dst[index] = index * 2;
+        };
+        env.dispatch(task, 100u);
+        cn.sync();
+        for (size_t i = 0; i < 100; ++i) {
+            ASSERT_EQ(i * 2, dst[i]);
+        }
+    }
+}
+
 TEST(TestGraph, ParallelRunMultithreadMode) {
     // check race conditions when graphs are executed on multple threads
     std::atomic_size_t sync_counter{0};
@@ -15,8 +15,10 @@
 #include "megbrain/opr/search_policy/algo_chooser.h"
 #include "megbrain/opr/search_policy/algo_chooser_helper.h"
 
+#include "megbrain/comp_node_env.h"
 #include "megbrain/graph/grad_impl.h"
 #include "megbrain/system.h"
+#include "megbrain/utils/hash.h"
 #include "megbrain/utils/hash_ct.h"
 #include "megbrain/utils/timer.h"
 
@@ -29,6 +31,7 @@
 #include <array>
 #include <chrono>
 #include <cstring>
+#include <future>
 #include <thread>
 
 using namespace mgb;
@@ -142,12 +145,164 @@ void mixin::WeightPreprocessExecutor::mixin_update_preprocessed_filter(
     m_preprocessed_filter->tensors.resize(new_size);
     m_filter_storage.resize(new_size);
     m_preprocessed_filter->algorithm_id = nullptr;
-    for (size_t i = 0; i < new_size; i++) {
-        m_filter_storage[i] = {opr.output(0)->comp_node(), new_layout[i],
-                               new_layout[i].dtype, new_layout[i].format};
-        m_preprocessed_filter->tensors[i] = m_filter_storage[i].as_megdnn();
+    auto cn = opr.output(0)->comp_node();
+    size_t tot_size = 0;
+    for (auto&& i : new_layout) {
+        tot_size += i.span().dist_byte();
     }
+    auto alloc_storage = [&]() {
+        for (size_t i = 0; i < new_size; i++) {
+            m_filter_storage[i] = {cn, new_layout[i], new_layout[i].dtype,
+                                   new_layout[i].format};
+            m_preprocessed_filter->tensors[i] =
+                    m_filter_storage[i].as_megdnn();
+        }
+    };
+
+    auto cache_key = preprocessed_filter_cache_key(opr);
+    if (cache_key.empty()) {
+        alloc_storage();
+        scn_do_execute_preprocess();
+        return;
+    }
+    auto category = "weight_preprocess:" +
+                    PersistentCache::make_category_from_comp_node(cn);
+    PersistentCache::Blob key{cache_key.data(), cache_key.size()};
+
+    // use values kept alive by the cache (e.g. mapped from shared memory) in
+    // place if possible; they are only read by the kernels
+    bool hit = false;
+    size_t pinned_size = 0;
+    auto pinned = PersistentCache::inst().get_pinned(category, key,
+                                                     pinned_size);
+    if (pinned && pinned_size == tot_size) {
+        auto base = const_cast<dt_byte*>(
+                static_cast<const dt_byte*>(pinned.get()));
+        auto align = cn.get_mem_addr_alignment();
+        size_t offset = 0;
+        hit = true;
+        for (auto&& i : new_layout) {
+            if (reinterpret_cast<uintptr_t>(base + offset) % align) {
+                hit = false;
+            }
+            offset += i.span().dist_byte();
+        }
+        offset = 0;
+        for (size_t i = 0; hit && i < new_size; i++) {
+            auto size = new_layout[i].span().dist_byte();
+            DeviceTensorStorage storage;
+            storage.reset(cn, size, {pinned, base + offset});
+            m_filter_storage[i].reset(storage, new_layout[i]);
+            m_preprocessed_filter->tensors[i] =
+                    m_filter_storage[i].as_megdnn();
+            offset += size;
+        }
+    }
+    if (!hit) {
+        alloc_storage();
+        auto cached = PersistentCache::inst().get(category, key);
+        if (cached.valid() && cached->size == tot_size) {
+            auto ptr = static_cast<const dt_byte*>(cached->ptr);
+            for (auto&& i : m_filter_storage) {
+                auto size = i.layout().span().dist_byte();
+                memcpy(i.raw_ptr(), ptr, size);
+                ptr += size;
+            }
+            hit = true;
+        }
+    }
+    if (hit) {
+        // as in scn_do_execute_preprocess(): release the original values
+        // that are not used elsewhere
+        auto mark_no_need = [&opr](size_t idx) {
+            auto var = opr.input(idx);
+            auto info = var->owner_graph()->var_receiver_in_current_comp_seq(
+                    var);
+            if (info.dev_value == 1 && info.host_value == 0 &&
+                info.shape == 0) {
+                var->add_flag(VarNode::Flag::MEMORY_NO_NEED);
+            }
+        };
+        mark_no_need(1);
+        if (opr.input().size() > 2 && new_size > 1 &&
+            !new_layout[1].is_empty()) {
+            mark_no_need(2);
+        }
+        return;
+    }
+
     scn_do_execute_preprocess();
+    // exec_preprocess() is only queued on the worker, so the preprocessed
+    // weights are read back by a kernel dispatched after it
+    auto kern = [storage = m_filter_storage, category, cache_key,
+                 tot_size]() {
+        std::vector<dt_byte> value(tot_size);
+        auto ptr = value.data();
+        for (auto&& i : storage) {
+            auto size = i.layout().span().dist_byte();
+            memcpy(ptr, i.raw_ptr(), size);
+            ptr += size;
+        }
+        PersistentCache::inst().put(category,
+                                    {cache_key.data(), cache_key.size()},
+                                    {value.data(), value.size()});
+    };
+    CompNodeEnv::from_comp_node(cn).cpu_env().dispatch(kern);
+}
+
+std::string mixin::WeightPreprocessExecutor::preprocessed_filter_cache_key(
+        const cg::OperatorNodeBase& opr) {
+    auto&& options = opr.owner_graph()->options();
+    if (!options.graph_opt.weight_preprocess_cache ||
+        opr.output(0)->comp_node().device_type() !=
+                CompNode::DeviceType::CPU) {
+        // values are hashed and copied on the host
+        return {};
+    }
+    if (options.comp_node_seq_record_level) {
+        // the kernels below would be recorded and replayed on each run, and
+        // host code can not wait for them while recording
+        return {};
+    }
+    std::string ret = opr.dyn_typeinfo()->name;
+    ret.append(";");
+    ret.append(preprocessed_filter_algo_name());
+    auto add_layout = [&ret](const TensorLayout& layout) {
+        ret.append(";");
+        ret.append(layout.to_string());
+        ret.append(layout.dtype.name());
+    };
+    for (auto i : opr.input()) {
+        add_layout(i->layout());
+    }
+    add_layout(opr.output(0)->layout());
+
+    // filter and bias are the values that may be preprocessed
+    SmallVector<DeviceTensorND> values;
+    for (size_t i = 1; i < std::min<size_t>(opr.input().size(), 3); ++i) {
+        auto var = opr.input(i);
+        if (!var->contain_flag(VarNode::Flag::PERSISTENT_DEVICE_VALUE) ||
+            !var->layout().is_contiguous() ||
+            var->comp_node() != opr.output(0)->comp_node()) {
+            return {};
+        }
+        values.push_back(var->dev_tensor());
+    }
+    // the values may still be written by kernels queued on the worker, so
+    // they are hashed by a callback running after them; only the callback
+    // is waited for, rather than syncing the comp node
+    std::promise<uint64_t> digest;
+    auto future = digest.get_future();
+    opr.output(0)->comp_node().add_callback([&values, &digest]() {
+        XXHash hash;
+        for (auto&& i : values) {
+            hash.update(i.raw_ptr(), i.layout().span().dist_byte());
+        }
+        digest.set_value(hash.digest());
+    });
+    ret.append(ssprintf(";%016llx",
+                        static_cast<unsigned long long>(future.get())));
+    return ret;
 }
 
 void mixin::WeightPreprocessExecutor::record_preprocessed_weight(
@@ -156,6 +311,11 @@ void mixin::WeightPreprocessExecutor::record_preprocessed_weight(
             std::move(m_preprocessed_filter), std::move(m_filter_storage)});
 }
 
+void mixin::WeightPreprocessExecutor::reset_preprocessed_filter() {
+    m_preprocessed_filter.reset();
+    m_filter_storage.clear();
+}
+
 bool mixin::WeightPreprocessExecutor::mixin_allow_weight_preprocess(
         const cg::OperatorNodeBase& opr) const {
     if (!opr.owner_graph()->options().graph_opt.weight_preprocess) {
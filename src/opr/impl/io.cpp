@@ -15,6 +15,7 @@
 #include "megbrain/graph/grad_impl.h"
 #include "megbrain/graph/exc_extra_info.h"
 #include "megbrain/opr/internal/megdnn_opr_wrapper.h"
+#include "megbrain/serialization/lazy_param_pool.h"
 #include "megbrain/serialization/opr_load_dump.h"
 
 using namespace mgb;
@@ -52,6 +53,8 @@ void dv_helper::init_output_mem_plan(const DeviceTensorND& val,
                "dtype mismatch: get=%s expect=%s opr=%s{%s}",
                val.dtype().name(), ovar->dtype().name(), opr.cname(),
                opr.dyn_typeinfo()->name);
+    // params loaded with GraphLoadConfig::lazy_param get their memory here
+    serialization::LazyParamPool::on_init_mem_plan(ovar, val);
     ovar->init_mem_plan(&val);
 }
 
@@ -385,6 +388,10 @@ class ImmutableTensor::Value {
     public:
         void setup(CompNode cn, const HostTensorND &val);
 
+        //! share the device storage of another value on \p cn, which must
+        //! be on the same mem node
+        void setup_view(CompNode cn, const Value& src);
+
         bool initialized() const {
             return m_dev.shape_valid();
         }
@@ -428,6 +435,13 @@ void ImmutableTensor::Value::setup(CompNode cn, const HostTensorND &val) {
     }
 }
 
+void ImmutableTensor::Value::setup_view(CompNode cn, const Value& src) {
+    mgb_assert(m_dev.empty() && !m_dev.shape_valid() && src.initialized());
+    m_dev = src.m_dev;
+    m_dev.comp_node(cn);
+    m_summary = src.m_summary;
+}
+
 DeviceTensorND& ImmutableTensor::Value::static_infer() {
     MGB_LOCK_GUARD(m_mtx);
     if (m_static_infer.empty()) {
@@ -638,6 +652,23 @@ SymbolVar ImmutableTensor::make(ComputingGraph &graph, const DTypeScalar &val,
     return make_from_value(graph, cache.get(val), {}, config);
 }
 
+SymbolVar ImmutableTensor::shallow_copy(
+        ComputingGraph &graph, const OperatorNodeConfig &config) const {
+    auto cn = m_value.dev().comp_node();
+    if (config.has_comp_node_set() && config.get_single_comp_node() != cn) {
+        auto new_cn = config.get_single_comp_node();
+        if (new_cn.mem_node() != cn.mem_node()) {
+            HostTensorND hv;
+            hv.copy_from(m_value.dev()).sync();
+            return make(graph, hv, config);
+        }
+        auto value = std::make_shared<Value>();
+        value->setup_view(new_cn, m_value);
+        return make_from_value(graph, *value, value, config);
+    }
+    return make_from_value(graph, m_value, m_value_refkeep, config);
+}
+
 const DeviceTensorND& ImmutableTensor::value() const {
     return m_value.dev();
 }
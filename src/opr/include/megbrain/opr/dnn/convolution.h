@@ -36,6 +36,10 @@ class WeightPreprocessExecutor : public cg::OperatorNodeMixinBase {
     using PreprocessedFilter = megdnn::detail::PreprocessedFilter;
     std::unique_ptr<PreprocessedFilter> m_preprocessed_filter;
     SmallVector<DeviceTensorND> m_filter_storage;
+
+    //! key of the preprocessed filter in PersistentCache; empty if it should
+    //! not be cached
+    std::string preprocessed_filter_cache_key(const OperatorNodeBase& opr);
 protected:
     //! this should only be called in scn_do_execute or similar functions (i.e.
     //! post dispatch-to-ExecEnv)
@@ -49,7 +53,15 @@ protected:
     bool mixin_allow_weight_preprocess(const OperatorNodeBase& opr) const;
     virtual SmallVector<TensorLayout> deduce_preprocessed_filter_layout() = 0;
     virtual void scn_do_execute_preprocess() = 0;
+    //! identifier of the algorithm that the filter is preprocessed for
+    virtual std::string preprocessed_filter_algo_name() = 0;
     virtual ~WeightPreprocessExecutor() = default;
+
+public:
+    //! drop the preprocessed filter, so it would be computed again from the
+    //! current filter value in the next execution; this should be called
+    //! after the filter is modified in place, when the opr is not running
+    void reset_preprocessed_filter();
 };
 
 } // namespace mixin
@@ -70,6 +82,12 @@ namespace intl {
         bool allow_weight_preprocess() const {
             return this->mixin_allow_weight_preprocess(*this);
         }
+
+        std::string preprocessed_filter_algo_name() override {
+            auto mo = this->megdnn_opr();
+            return ssprintf("%s:%s", mo->get_algorithm_set_name(),
+                            mo->execution_policy().algo.name.c_str());
+        }
     };
 
     using ConvBiasBase = cg::SingleCNOperatorNode<
@@ -389,10 +389,14 @@ MGB_DEFINE_OPR_CLASS(ImmutableTensor, intl::DeviceTensorHolder) // {
 
         const DeviceTensorND& host_value();
 
+        /*!
+         * \brief copy this opr into another graph
+         *
+         * If a different comp node on the same mem node is given in \p
+         * config, the device storage would still be shared.
+         */
         SymbolVar shallow_copy(
-                ComputingGraph &graph, const OperatorNodeConfig &config) const {
-            return make_from_value(graph, m_value, m_value_refkeep, config);
-        }
+                ComputingGraph &graph, const OperatorNodeConfig &config) const;
     private:
         const Value &m_value;
         //! refkeep is used if value is not stored in DevValueCache
@@ -13,54 +13,124 @@
 
 #include "megbrain/utils/arith_helper.h"
 
+#include <cstring>
+
 namespace mgb {
 namespace serialization {
 
+constexpr size_t BatchedDeviceValueLoader::DEFAULT_CHUNK_SIZE;
+constexpr size_t BatchedDeviceValueLoader::MIN_CHUNK_SIZE;
+
+BatchedDeviceValueLoader::BatchedDeviceValueLoader(size_t chunk_size)
+        : m_chunk_size{chunk_size} {}
+
+BatchedDeviceValueLoader::~BatchedDeviceValueLoader() {
+    // staging buffers must be alive until the copies finish, e.g. when
+    // loading is aborted by an exception
+    for (auto&& item : m_cn2state) {
+        for (auto&& buf : item.second.buffers) {
+            if (buf.copied) {
+                buf.copied->host_wait();
+            }
+        }
+    }
+}
+
 std::shared_ptr<DeviceTensorND> BatchedDeviceValueLoader::make(
-        CompNode comp_node, HostTensorND value) {
-    auto&& tensor_list = m_cn2tensor_list[comp_node];
+        CompNode comp_node, const TensorLayout& layout,
+        thin_function<void(HostTensorND&)> loader) {
+    auto&& state = m_cn2state[comp_node];
+    auto alignment = std::max(comp_node.get_mem_addr_alignment(),
+                              CompNode::default_cpu().get_mem_addr_alignment());
+    auto size = layout.span().dist_byte();
+    auto offset = get_aligned_power2(state.used, alignment);
+    auto&& cur = state.buffers[state.cur_buffer];
+    if (!state.pending.empty() && offset + size > cur.storage.size()) {
+        flush(comp_node, state);
+        offset = 0;
+    }
+
+    auto&& buf = state.buffers[state.cur_buffer];
+    if (state.pending.empty()) {
+        // wait for the previous copy from this buffer
+        if (buf.copied) {
+            buf.copied->host_wait();
+        }
+        if (!state.next_capacity) {
+            state.next_capacity = std::min(MIN_CHUNK_SIZE, m_chunk_size);
+        }
+        if (!buf.storage.comp_node_valid()) {
+            buf.storage = HostTensorStorage{comp_node};
+        }
+        buf.storage.ensure_size(std::max(state.next_capacity, size));
+        state.next_capacity = std::min(state.next_capacity * 2, m_chunk_size);
+    }
+
+    auto dest = buf.storage.sub(offset);
+    HostTensorND host;
+    host.reset(dest, layout);
+    loader(host);
+    if (host.raw_ptr() != dest.ptr()) {
+        HostTensorND copy;
+        copy.reset(dest, layout);
+        copy.copy_from_fixlayout(host);
+    }
+
+    // the storage is set in flush()
     auto dev_tensor = std::make_shared<DeviceTensorND>();
     DeviceTensorStorage storage;
-
-    auto size = value.layout().span().dist_byte();
     storage.reset(comp_node, size, nullptr);
-    dev_tensor->reset(storage, value.layout());
-    tensor_list.tensors.emplace_back(std::move(value), dev_tensor);
+    dev_tensor->reset(storage, layout);
+    state.pending.push_back({offset, dev_tensor});
+    state.used = offset + size;
     return dev_tensor;
 }
 
-void BatchedDeviceValueLoader::apply() {
-    for (auto&& item : m_cn2tensor_list) {
-        auto alignment = item.first.get_mem_addr_alignment();
-        size_t tot_size = 0;
-        for (auto&& i : item.second.tensors) {
-            tot_size = get_aligned_power2(tot_size, alignment) +
-                       i.second->layout().span().dist_byte();
+std::shared_ptr<DeviceTensorND> BatchedDeviceValueLoader::make(
+        CompNode comp_node, HostTensorND value) {
+    auto layout = value.layout();
+    return make(comp_node, layout, [&value](HostTensorND& dest) {
+        if (dest.layout().format.is_default()) {
+            auto size = dest.layout().span().dist_byte();
+            mgb_assert(size == value.layout().span().dist_byte());
+            memcpy(dest.raw_ptr(), value.raw_ptr(), size);
+        } else {
+            dest.copy_from_fixlayout(value);
         }
+    });
+}
 
-        HostTensorStorage host_storage{item.first};
-        DeviceTensorStorage dev_storage{item.first};
-        host_storage.ensure_size(tot_size);
-        dev_storage.ensure_size(tot_size);
-        auto ptr_host = host_storage.ptr();
-        size_t offset = 0;
-        for (auto&& i : item.second.tensors) {
-            offset = get_aligned_power2(offset, alignment);
-            auto size = i.second->layout().span().dist_byte();
-            if (i.second->layout().format.is_default()) {
-                mgb_assert(size == i.first.layout().span().dist_byte());
-                memcpy(ptr_host + offset, i.first.raw_ptr(), size);
-            } else {
-                HostTensorND host;
-                host.reset(host_storage.sub(offset), i.second->layout());
-                host.copy_from_fixlayout(i.first);
-            }
-            i.second->reset(dev_storage.sub(offset), i.second->layout());
-            offset += size;
-        }
-        dev_storage.copy_from(host_storage, tot_size);
+void BatchedDeviceValueLoader::flush(CompNode comp_node,
+                                     CompNodeState& state) {
+    if (state.pending.empty()) {
+        return;
+    }
+    DeviceTensorStorage dev_storage{comp_node};
+    dev_storage.ensure_size(state.used);
+    for (auto&& i : state.pending) {
+        i.dest->reset(dev_storage.sub(i.offset), i.dest->layout());
+    }
+    auto&& buf = state.buffers[state.cur_buffer];
+    // the copy is asynchronous, and the next values are staged in the other
+    // buffer meanwhile
+    dev_storage.copy_from(buf.storage, state.used);
+    if (!buf.copied) {
+        buf.copied = comp_node.create_event();
+    }
+    buf.copied->record();
+    state.pending.clear();
+    state.used = 0;
+    state.cur_buffer ^= 1;
+}
+
+void BatchedDeviceValueLoader::apply() {
+    for (auto&& item : m_cn2state) {
+        flush(item.first, item.second);
+    }
+    for (auto&& item : m_cn2state) {
         item.first.sync();
     }
+    m_cn2state.clear();
 }
 
 }  // namespace serialization
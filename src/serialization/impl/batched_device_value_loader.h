@@ -13,36 +13,79 @@
 #include <vector>
 #include "megbrain/comp_node.h"
 #include "megbrain/tensor.h"
+#include "megbrain/utils/thin/function.h"
 
 namespace mgb {
 namespace serialization {
 
 /*!
- * \brief load a batch of DeviceTensorND with a single device allocation and
- *      memory transaction
+ * \brief load a batch of DeviceTensorND with few device allocations and
+ *      memory transactions
  *
- * This class caches the host values and merge them and copy them to device in a
- * single transaction. Some devices (like hexagon) have long latency so batching
- * has great benifits.
+ * Host values are staged in a pinned buffer of the target comp node, and each
+ * full buffer is copied to a single device allocation asynchronously, so the
+ * transfer overlaps with deserializing the following values. Two staging
+ * buffers are used in turn for each comp node, so the host memory used is
+ * bounded by twice the chunk size. Some devices (like hexagon) have long
+ * latency so batching has great benifits.
  */
-class BatchedDeviceValueLoader {
-    struct TensorList {
-        std::vector<std::pair<HostTensorND, std::shared_ptr<DeviceTensorND>>>
-                tensors;
+class BatchedDeviceValueLoader : public NonCopyableObj {
+    struct PendingValue {
+        size_t offset;
+        std::shared_ptr<DeviceTensorND> dest;
     };
-    CompNode::UnorderedMap<TensorList> m_cn2tensor_list;
+    struct StagingBuffer {
+        HostTensorStorage storage;
+        //! recorded after the copy from this buffer is issued
+        std::unique_ptr<CompNode::Event> copied;
+    };
+    struct CompNodeState {
+        StagingBuffer buffers[2];
+        size_t cur_buffer = 0, used = 0, next_capacity = 0;
+        std::vector<PendingValue> pending;
+    };
+    size_t m_chunk_size;
+    CompNode::UnorderedMap<CompNodeState> m_cn2state;
+
+    //! copy the values staged in current buffer to device
+    void flush(CompNode comp_node, CompNodeState& state);
 
 public:
+    //! default max size of a staging buffer
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 32 * 1024 * 1024;
+    //! min size of the first staging buffer of a comp node; buffer sizes grow
+    //! exponentially to the chunk size, so small models use little memory
+    static constexpr size_t MIN_CHUNK_SIZE = 64 * 1024;
+
+    explicit BatchedDeviceValueLoader(size_t chunk_size = DEFAULT_CHUNK_SIZE);
+    ~BatchedDeviceValueLoader();
+
+    /*!
+     * \brief make a device tensor whose value is loaded into the staging
+     *      buffer by a callback
+     *
+     * The returned tensor has correct dtype and comp node; its storage is
+     * valid after the buffer is flushed, and its value is valid after
+     * apply().
+     *
+     * \param loader callback to fill the host tensor, which has the given
+     *      layout and is placed in the staging buffer; it is also allowed to
+     *      reset the host tensor to other memory, and the value would be
+     *      copied to the buffer
+     */
+    std::shared_ptr<DeviceTensorND> make(
+            CompNode comp_node, const TensorLayout& layout,
+            thin_function<void(HostTensorND&)> loader);
+
     /*!
-     * \brief make a place holder device tensor that has correct dtype and comp
-     *      node, but an empty pointer
+     * \brief make a device tensor from a loaded value
      * \param comp_node target comp node
      * \param value tensor value; it should be placed on the CPU comp node
      */
     std::shared_ptr<DeviceTensorND> make(CompNode comp_node,
                                          HostTensorND value);
 
-    //! apply all the lazy loads
+    //! copy remaining values and wait for all the copies to finish
     void apply();
 };
 
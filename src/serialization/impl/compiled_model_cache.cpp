@@ -0,0 +1,251 @@
+/**
+ * \file src/serialization/impl/compiled_model_cache.cpp
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "megbrain/serialization/compiled_model_cache.h"
+#include "megbrain/serialization/serializer.h"
+#include "megbrain/version.h"
+
+#include "megdnn/version.h"
+
+#include <cstring>
+
+using namespace mgb;
+using namespace serialization;
+
+/*
+ * serialized format, with integers in local endian:
+ *
+ * <nr_category|uint32_t>[<category_size|uint32_t><category><nr_entry|uint32_t>
+ *  [<key_size|uint32_t><key><value_size|uint64_t><value>]*]*
+ */
+
+namespace {
+
+//! category prefix of preprocessed weights, used in convolution.cpp
+constexpr char WEIGHT_PREPROCESS_CATEGORY[] = "weight_preprocess:";
+
+std::string cpu_features() {
+    std::string ret;
+#if defined(__x86_64__) || defined(_M_X64)
+    ret = "x86_64";
+#elif defined(__i386__) || defined(_M_IX86)
+    ret = "x86";
+#elif defined(__aarch64__)
+    ret = "aarch64";
+#elif defined(__arm__)
+    ret = "armv7";
+#else
+    ret = "unknown";
+#endif
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+    // megdnn chooses x86 kernels by runtime features
+    __builtin_cpu_init();
+#define cb(_name)                         \
+    if (__builtin_cpu_supports(_name)) { \
+        ret.append("," _name);            \
+    }
+    cb("sse4.2");
+    cb("avx");
+    cb("fma");
+    cb("avx2");
+    cb("avx512f");
+#undef cb
+#endif
+#if defined(__ARM_FEATURE_DOTPROD)
+    ret.append(",dotprod");
+#endif
+#if defined(__ARM_FEATURE_FP16_VECTOR_ARITHMETIC)
+    ret.append(",fp16");
+#endif
+    return ret;
+}
+
+class Reader {
+    const uint8_t *m_ptr, *m_end;
+
+public:
+    Reader(const void* ptr, size_t size)
+            : m_ptr{static_cast<const uint8_t*>(ptr)}, m_end{m_ptr + size} {}
+
+    bool finished() const { return m_ptr == m_end; }
+
+    const uint8_t* take(size_t size) {
+        mgb_throw_if(size > static_cast<size_t>(m_end - m_ptr),
+                     SerializationError,
+                     "compiled model cache truncated: want %zu bytes, %zu "
+                     "remaining",
+                     size, static_cast<size_t>(m_end - m_ptr));
+        auto ret = m_ptr;
+        m_ptr += size;
+        return ret;
+    }
+
+    template <typename T>
+    T read() {
+        T ret;
+        memcpy(&ret, take(sizeof(T)), sizeof(T));
+        return ret;
+    }
+
+    std::string read_str() {
+        auto size = read<uint32_t>();
+        return {reinterpret_cast<const char*>(take(size)), size};
+    }
+};
+
+template <typename T>
+void write(std::vector<uint8_t>& dest, T val) {
+    auto ptr = reinterpret_cast<const uint8_t*>(&val);
+    dest.insert(dest.end(), ptr, ptr + sizeof(T));
+}
+
+void write(std::vector<uint8_t>& dest, const void* data, size_t size) {
+    auto ptr = static_cast<const uint8_t*>(data);
+    dest.insert(dest.end(), ptr, ptr + size);
+}
+
+}  // anonymous namespace
+
+CompiledModelCache::CompiledModelCache(
+        std::shared_ptr<PersistentCache> fallback)
+        : m_fallback{std::move(fallback)} {}
+
+std::string CompiledModelCache::env_tag() {
+    static std::string tag = ssprintf(
+            "mgb=%d.%d.%d;dnn=%d.%d.%d;cpu=%s", MGB_MAJOR, MGB_MINOR,
+            MGB_PATCH, MEGDNN_MAJOR, MEGDNN_MINOR, MEGDNN_PATCH,
+            cpu_features().c_str());
+    return tag;
+}
+
+std::vector<uint8_t> CompiledModelCache::serialize() const {
+    MGB_LOCK_GUARD(m_mtx);
+    std::vector<uint8_t> ret;
+    write<uint32_t>(ret, m_cache.size());
+    for (auto&& category : m_cache) {
+        write<uint32_t>(ret, category.first.size());
+        write(ret, category.first.data(), category.first.size());
+        write<uint32_t>(ret, category.second.size());
+        for (auto&& entry : category.second) {
+            write<uint32_t>(ret, entry.first.size());
+            write(ret, entry.first.data(), entry.first.size());
+            write<uint64_t>(ret, entry.second.size);
+            write(ret, entry.second.data.get(), entry.second.size);
+        }
+    }
+    return ret;
+}
+
+std::shared_ptr<CompiledModelCache> CompiledModelCache::deserialize(
+        const SharedBuffer& buf) {
+    auto ret = std::make_shared<CompiledModelCache>();
+    Reader reader{buf.data(), buf.size()};
+    for (auto nr_category = reader.read<uint32_t>(); nr_category;
+         --nr_category) {
+        auto&& entries = ret->m_cache[reader.read_str()];
+        for (auto nr_entry = reader.read<uint32_t>(); nr_entry; --nr_entry) {
+            auto key = reader.read_str();
+            auto size = reader.read<uint64_t>();
+            // alias the buffer to avoid copying preprocessed weights
+            std::shared_ptr<const void> data{buf.shared_data(),
+                                             reader.take(size)};
+            entries[std::move(key)] = {std::move(data), size};
+        }
+    }
+    mgb_throw_if(!reader.finished(), SerializationError,
+                 "extra bytes after compiled model cache");
+    return ret;
+}
+
+void CompiledModelCache::install() {
+    if (&PersistentCache::inst() == this) {
+        return;
+    }
+    auto prev = PersistentCache::set_impl(shared_from_this());
+    MGB_LOCK_GUARD(m_mtx);
+    if (!m_fallback) {
+        m_fallback = std::move(prev);
+    }
+}
+
+size_t CompiledModelCache::nr_entry(const std::string& category_prefix) const {
+    MGB_LOCK_GUARD(m_mtx);
+    size_t ret = 0;
+    for (auto&& i : m_cache) {
+        if (!i.first.compare(0, category_prefix.size(), category_prefix)) {
+            ret += i.second.size();
+        }
+    }
+    return ret;
+}
+
+Maybe<PersistentCache::Blob> CompiledModelCache::get(
+        const std::string& category, const Blob& key) {
+    std::shared_ptr<PersistentCache> fallback;
+    {
+        MGB_LOCK_GUARD(m_mtx);
+        auto iter0 = m_cache.find(category);
+        if (iter0 != m_cache.end()) {
+            auto iter1 = iter0->second.find(
+                    {static_cast<const char*>(key.ptr), key.size});
+            if (iter1 != iter0->second.end()) {
+                return Blob{iter1->second.data.get(), iter1->second.size};
+            }
+        }
+        fallback = m_fallback;
+    }
+    if (fallback) {
+        return fallback->get(category, key);
+    }
+    return None;
+}
+
+std::shared_ptr<const void> CompiledModelCache::get_pinned(
+        const std::string& category, const Blob& key, size_t& size) {
+    std::shared_ptr<PersistentCache> fallback;
+    {
+        MGB_LOCK_GUARD(m_mtx);
+        auto iter0 = m_cache.find(category);
+        if (iter0 != m_cache.end()) {
+            auto iter1 = iter0->second.find(
+                    {static_cast<const char*>(key.ptr), key.size});
+            if (iter1 != iter0->second.end()) {
+                size = iter1->second.size;
+                return iter1->second.data;
+            }
+        }
+        fallback = m_fallback;
+    }
+    if (fallback) {
+        return fallback->get_pinned(category, key, size);
+    }
+    return {};
+}
+
+void CompiledModelCache::put(const std::string& category, const Blob& key,
+                             const Blob& value) {
+    std::shared_ptr<uint8_t> data{new uint8_t[value.size],
+                                  std::default_delete<uint8_t[]>()};
+    memcpy(data.get(), value.ptr, value.size);
+    std::shared_ptr<PersistentCache> fallback;
+    {
+        MGB_LOCK_GUARD(m_mtx);
+        m_cache[category][{static_cast<const char*>(key.ptr), key.size}] = {
+                std::move(data), value.size};
+        fallback = m_fallback;
+    }
+    if (fallback && category.compare(0, sizeof(WEIGHT_PREPROCESS_CATEGORY) - 1,
+                                     WEIGHT_PREPROCESS_CATEGORY)) {
+        fallback->put(category, key, value);
+    }
+}
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
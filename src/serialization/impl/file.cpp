@@ -11,6 +11,16 @@
 
 #include "megbrain/serialization/file.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MGB_HAVE_MMAP 1
+#else
+#define MGB_HAVE_MMAP 0
+#endif
+
 namespace mgb {
 namespace serialization {
 
@@ -245,6 +255,42 @@ std::unique_ptr<InputFile> InputFile::make_mem_proxy(std::shared_ptr<void> ptr,
     return std::make_unique<SharedMemProxyImpl>(std::move(ptr), size, writable);
 }
 
+std::unique_ptr<InputFile> InputFile::make_mmap(const char* path) {
+#if MGB_HAVE_MMAP
+    int fd = open(path, O_RDONLY);
+    mgb_assert(fd >= 0, "failed to open %s: %s", path, strerror(errno));
+    struct stat st;
+    if (fstat(fd, &st)) {
+        close(fd);
+        mgb_throw(SystemError, "failed to stat %s: %s", path, strerror(errno));
+    }
+    size_t size = st.st_size;
+    mgb_assert(size, "empty file: %s", path);
+    // private writable mapping: pages are shared with page cache until
+    // written (e.g. by in-place param modification), which only affects
+    // this process
+    auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+                    0);
+    close(fd);
+    mgb_throw_if(ptr == MAP_FAILED, SystemError, "failed to mmap %s: %s", path,
+                 strerror(errno));
+    std::shared_ptr<void> buf{ptr, [size](void* p) { munmap(p, size); }};
+    // non-writable so tensor values are never moved for alignment
+    return make_mem_proxy(std::move(buf), size, false);
+#else
+    FILE* fin = fopen(path, "rb");
+    mgb_assert(fin, "failed to open %s: %s", path, strerror(errno));
+    fseek(fin, 0, SEEK_END);
+    size_t size = ftell(fin);
+    fseek(fin, 0, SEEK_SET);
+    std::shared_ptr<void> buf{malloc(size), free};
+    auto nr = fread(buf.get(), 1, size, fin);
+    fclose(fin);
+    mgb_assert(nr == size, "failed to read %s", path);
+    return make_mem_proxy(std::move(buf), size, true);
+#endif
+}
+
 class OutputFile::VectorProxyImpl final : public OutputFile {
     std::vector<uint8_t>* const m_buf;
     size_t m_offset;
@@ -276,5 +322,34 @@ std::unique_ptr<OutputFile> OutputFile::make_vector_proxy(
     return std::make_unique<VectorProxyImpl>(buf);
 }
 
+class OutputFile::StreamImpl final : public OutputFile {
+    thin_function<void(const void*, size_t)> m_writer;
+    size_t m_offset = 0;
+
+public:
+    StreamImpl(thin_function<void(const void*, size_t)> writer)
+            : m_writer{std::move(writer)} {
+        mgb_assert(m_writer);
+    }
+
+    void write(const void* src, size_t size) override {
+        m_writer(src, size);
+        m_offset += size;
+    }
+
+    void seek(size_t) override {
+        mgb_throw(SerializationError, "can not seek in a stream OutputFile");
+    }
+
+    size_t tell() override { return m_offset; }
+
+    bool seekable() const override { return false; }
+};
+
+std::unique_ptr<OutputFile> OutputFile::make_stream(
+        thin_function<void(const void*, size_t)> writer) {
+    return std::make_unique<StreamImpl>(std::move(writer));
+}
+
 }  // namespace serialization
 }  // namespace mgb
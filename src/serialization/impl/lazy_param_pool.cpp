@@ -0,0 +1,272 @@
+/**
+ * \file src/serialization/impl/lazy_param_pool.cpp
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "megbrain/serialization/lazy_param_pool.h"
+#include "megbrain/graph/event.h"
+#include "megbrain/serialization/serializer.h"
+
+#include <cerrno>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#define MGB_HAVE_MMAP 1
+#else
+#define MGB_HAVE_MMAP 0
+#endif
+
+using namespace mgb;
+using namespace serialization;
+
+struct LazyParamPool::Param {
+    size_t offset;
+    TensorLayout layout;
+    CompNode comp_node;
+    //! empty before a graph using this param is compiled
+    DeviceTensorStorage storage;
+    //! whether pages of the storage can be released in evict()
+    bool evictable = false;
+    std::atomic_bool filled{false};
+    //! value of m_nr_exec when this param is used last time
+    std::atomic_size_t last_use{0};
+
+    Param(size_t offset_, const TensorLayout& layout_, CompNode comp_node_)
+            : offset{offset_}, layout{layout_}, comp_node{comp_node_} {}
+
+    size_t size() const { return layout.span().dist_byte(); }
+};
+
+/*!
+ * \brief state of a pool bound to a graph, stored as user data of the graph
+ *
+ * Event handlers are kept here rather than in the pool, so they are destroyed
+ * with the graph.
+ */
+class LazyParamPool::GraphBinding final : public UserDataContainer::UserData {
+    MGB_TYPEINFO_OBJ_DECL;
+
+public:
+    std::shared_ptr<LazyParamPool> pool;
+    //! output vars of param holders whose mem plans have been initialized
+    ThinHashMap<VarNode*, Param*> var2param;
+    std::vector<SyncEventConnecter::ReceiverHandler> handlers;
+
+    GraphBinding(std::shared_ptr<LazyParamPool> pool_, ComputingGraph& graph);
+};
+MGB_TYPEINFO_OBJ_IMPL(LazyParamPool::GraphBinding);
+
+LazyParamPool::GraphBinding::GraphBinding(std::shared_ptr<LazyParamPool> pool_,
+                                          ComputingGraph& graph)
+        : pool{std::move(pool_)} {
+    using namespace cg::event;
+    auto on_exec_start = [this](const CompSeqExecBeforeStart&) {
+        pool->m_nr_exec.fetch_add(1, std::memory_order_relaxed);
+    };
+    auto on_kern_start = [this](const OprExecKernelStart& event) {
+        auto opr = event.opr;
+        for (auto i : opr->input()) {
+            auto iter = var2param.find(i);
+            if (iter == var2param.end()) {
+                continue;
+            }
+            auto param = iter->second;
+            if (!param->evictable &&
+                param->filled.load(std::memory_order_acquire)) {
+                // usage is only tracked for evictable params
+                continue;
+            }
+            // dispatched under the mask of the reader, so the value is not
+            // filled if the reader is not executed
+            event.env->dispatch_on_comp_node(
+                    opr->output(0)->comp_node(),
+                    [pool = pool, param]() { pool->fill(*param); });
+        }
+    };
+    auto&& mgr = graph.event();
+    handlers.emplace_back(
+            mgr.register_receiver<CompSeqExecBeforeStart>(on_exec_start));
+    handlers.emplace_back(
+            mgr.register_receiver<OprExecKernelStart>(on_kern_start));
+}
+
+/* ======================= LazyParamPool ======================= */
+
+LazyParamPool::LazyParamPool(SharedBuffer blob) : m_blob{std::move(blob)} {}
+
+LazyParamPool::~LazyParamPool() = default;
+
+std::shared_ptr<DeviceTensorND> LazyParamPool::add(size_t offset,
+                                                   const TensorLayout& layout,
+                                                   CompNode comp_node) {
+    mgb_assert(layout.format.is_default() && layout.is_contiguous());
+    auto param = std::make_unique<Param>(offset, layout, comp_node);
+    mgb_throw_if(offset + param->size() > m_blob.size(), SerializationError,
+                 "tensor value out of range: offset=%zu size=%zu blob=%zu",
+                 offset, param->size(), m_blob.size());
+
+    auto ret = std::make_shared<DeviceTensorND>();
+    DeviceTensorStorage storage;
+    storage.reset(comp_node, param->size(), nullptr);
+    ret->reset(storage, layout);
+
+    MGB_LOCK_GUARD(m_mtx);
+    m_tensors[ret.get()] = {ret, param.get()};
+    m_params.emplace_back(std::move(param));
+    return ret;
+}
+
+std::shared_ptr<DeviceTensorND> LazyParamPool::alias(
+        const std::shared_ptr<DeviceTensorND>& src, CompNode comp_node) {
+    mgb_assert(src->comp_node().mem_node() == comp_node.mem_node());
+    auto ret = std::make_shared<DeviceTensorND>(*src);
+    ret->comp_node(comp_node);
+
+    MGB_LOCK_GUARD(m_mtx);
+    auto iter = m_tensors.find(src.get());
+    mgb_assert(iter != m_tensors.end(), "tensor is not a lazy param");
+    m_tensors[ret.get()] = {ret, iter->second.second};
+    return ret;
+}
+
+bool LazyParamPool::is_lazy(const DeviceTensorND& value) const {
+    MGB_LOCK_GUARD(m_mtx);
+    return m_tensors.count(&value);
+}
+
+void LazyParamPool::bind(ComputingGraph& graph) {
+    auto&& user_data = graph.options().user_data;
+    auto bound = user_data.get_user_data<GraphBinding>();
+    if (bound.second) {
+        mgb_assert(bound.second == 1 && bound.first[0]->pool.get() == this,
+                   "a graph can only be bound to one LazyParamPool");
+        return;
+    }
+    user_data.add_user_data(
+            std::make_shared<GraphBinding>(shared_from_this(), graph));
+}
+
+void LazyParamPool::on_init_mem_plan(VarNode* var,
+                                     const DeviceTensorND& value) {
+    auto bound = var->owner_graph()
+                         ->options()
+                         .user_data.get_user_data<GraphBinding>();
+    if (!bound.second) {
+        return;
+    }
+    auto binding = bound.first[0];
+    auto&& pool = *binding->pool;
+    MGB_LOCK_GUARD(pool.m_mtx);
+    auto iter = pool.m_tensors.find(&value);
+    if (iter == pool.m_tensors.end()) {
+        return;
+    }
+    auto&& tensor = *iter->second.first;
+    auto param = iter->second.second;
+    if (param->storage.empty()) {
+        pool.alloc(*param);
+    }
+    if (tensor.raw_ptr() != param->storage.ptr()) {
+        auto cn = tensor.comp_node();
+        tensor.reset(param->storage, param->layout);
+        tensor.comp_node(cn);
+    }
+    binding->var2param[var] = param;
+}
+
+void LazyParamPool::alloc(Param& param) {
+    auto size = param.size();
+#if MGB_HAVE_MMAP
+    static const size_t page_size = sysconf(_SC_PAGESIZE);
+    if (param.comp_node.mem_node() == CompNode::default_cpu().mem_node() &&
+        size >= page_size) {
+        // use a dedicated anonymous mapping, whose pages can be released by
+        // madvise() in evict() while the address is still valid
+        auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        mgb_throw_if(ptr == MAP_FAILED, SystemError,
+                     "failed to map %zu bytes: %s", size, strerror(errno));
+        param.storage.reset(param.comp_node, size,
+                            {static_cast<dt_byte*>(ptr),
+                             [size](dt_byte* p) { munmap(p, size); }});
+        param.evictable = true;
+        return;
+    }
+#endif
+    param.storage = DeviceTensorStorage{param.comp_node};
+    param.storage.ensure_size(size);
+}
+
+void LazyParamPool::fill(Param& param) {
+    param.last_use.store(m_nr_exec.load(std::memory_order_relaxed),
+                         std::memory_order_relaxed);
+    if (param.filled.load(std::memory_order_acquire)) {
+        return;
+    }
+    MGB_LOCK_GUARD(m_mtx);
+    if (param.filled.load(std::memory_order_relaxed)) {
+        return;
+    }
+    auto size = param.size();
+    auto src = static_cast<const dt_byte*>(m_blob.data()) + param.offset;
+    if (param.comp_node.mem_node() == CompNode::default_cpu().mem_node()) {
+        memcpy(param.storage.ptr(), src, size);
+    } else {
+        HostTensorStorage host_storage;
+        host_storage.reset(CompNode::default_cpu(), size,
+                           {m_blob.shared_data(), const_cast<dt_byte*>(src)});
+        param.storage.copy_from(host_storage, size);
+        param.comp_node.sync();
+    }
+    param.filled.store(true, std::memory_order_release);
+    ++m_nr_fill;
+}
+
+size_t LazyParamPool::evict(size_t max_idle_exec) {
+    MGB_LOCK_GUARD(m_mtx);
+    auto nr_exec = m_nr_exec.load(std::memory_order_relaxed);
+    size_t released = 0;
+    for (auto&& param : m_params) {
+        if (!param->evictable ||
+            !param->filled.load(std::memory_order_relaxed) ||
+            nr_exec - param->last_use.load(std::memory_order_relaxed) <
+                    max_idle_exec) {
+            continue;
+        }
+#if MGB_HAVE_MMAP
+        // pages of private anonymous mappings are zero-filled on next access
+        auto err = madvise(param->storage.ptr(), param->size(), MADV_DONTNEED);
+        mgb_throw_if(err, SystemError, "madvise failed: %s", strerror(errno));
+#endif
+        param->filled.store(false, std::memory_order_relaxed);
+        released += param->size();
+        ++m_nr_evict;
+    }
+    return released;
+}
+
+LazyParamPool::Stats LazyParamPool::stats() const {
+    MGB_LOCK_GUARD(m_mtx);
+    Stats ret;
+    ret.nr_param = m_params.size();
+    for (auto&& param : m_params) {
+        ret.total_bytes += param->size();
+        if (param->filled.load(std::memory_order_relaxed)) {
+            ++ret.nr_resident;
+            ret.resident_bytes += param->size();
+        }
+    }
+    ret.nr_fill = m_nr_fill;
+    ret.nr_evict = m_nr_evict;
+    return ret;
+}
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
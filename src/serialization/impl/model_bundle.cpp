@@ -0,0 +1,477 @@
+/**
+ * \file src/serialization/impl/model_bundle.cpp
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "megbrain/serialization/model_bundle.h"
+#include "megbrain/graph/helper.h"
+#include "megbrain/opr/io.h"
+#include "megbrain/utils/arith_helper.h"
+#include "megbrain/utils/hash.h"
+
+#include <cstring>
+
+using namespace mgb;
+using namespace serialization;
+
+/*
+ * file format, with integers in local endian:
+ *
+ * <magic|uint32_t><version|uint32_t><index_size|uint64_t><index>
+ * <padding to POOL_ALIGN><pool><graphs>
+ *
+ * index:
+ * <pool_size|uint64_t><nr_value|uint64_t>[<offset|uint64_t><size|uint64_t>]*
+ * <nr_graph|uint32_t>[<generic|uint32_t><nr_input|uint32_t>
+ *  [<name_size|uint32_t><name><ndim|uint32_t><shape|uint64_t*ndim>]*
+ *  <size|uint64_t>]*
+ *
+ * Graphs are stored one after another in the order of the index. Each tensor
+ * value in a graph is the index of the value in the pool as a uint64_t.
+ */
+
+namespace {
+
+constexpr uint32_t BUNDLE_MAGIC = 0x4242474D;  // "MGBB" in little endian
+constexpr uint32_t BUNDLE_VERSION = 1;
+constexpr size_t POOL_ALIGN = 64;
+
+class Reader {
+    const uint8_t *m_ptr, *m_end;
+
+public:
+    Reader(const void* ptr, size_t size)
+            : m_ptr{static_cast<const uint8_t*>(ptr)}, m_end{m_ptr + size} {}
+
+    bool finished() const { return m_ptr == m_end; }
+
+    const uint8_t* take(size_t size) {
+        mgb_throw_if(size > static_cast<size_t>(m_end - m_ptr),
+                     SerializationError,
+                     "model bundle index truncated: want %zu bytes, %zu "
+                     "remaining",
+                     size, static_cast<size_t>(m_end - m_ptr));
+        auto ret = m_ptr;
+        m_ptr += size;
+        return ret;
+    }
+
+    template <typename T>
+    T read() {
+        T ret;
+        memcpy(&ret, take(sizeof(T)), sizeof(T));
+        return ret;
+    }
+};
+
+template <typename T>
+void write(std::vector<uint8_t>& dest, T val) {
+    auto ptr = reinterpret_cast<const uint8_t*>(&val);
+    dest.insert(dest.end(), ptr, ptr + sizeof(T));
+}
+
+void write(std::vector<uint8_t>& dest, const void* data, size_t size) {
+    auto ptr = static_cast<const uint8_t*>(data);
+    dest.insert(dest.end(), ptr, ptr + size);
+}
+
+InputShapeMap get_input_shapes(const SymbolVarArray& output_vars) {
+    InputShapeMap ret;
+    cg::DepOprIter iter{[&ret](cg::OperatorNodeBase* opr) {
+        if (auto h2d = opr->try_cast_final<opr::Host2DeviceCopy>()) {
+            ret[h2d->name()] = h2d->host_data()->shape();
+        }
+    }};
+    for (auto&& i : output_vars) {
+        iter.add(i);
+    }
+    return ret;
+}
+
+bool same_shapes(const InputShapeMap& lhs, const InputShapeMap& rhs) {
+    if (lhs.size() != rhs.size()) {
+        return false;
+    }
+    for (auto i = lhs.begin(), j = rhs.begin(); i != lhs.end(); ++i, ++j) {
+        if (i->first != j->first || !i->second.eq_shape(j->second)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::string shapes_to_string(const InputShapeMap& shapes) {
+    std::string ret;
+    for (auto&& i : shapes) {
+        if (!ret.empty()) {
+            ret.append(",");
+        }
+        ret.append(ssprintf("%s=%s", i.first.c_str(),
+                            i.second.to_string().c_str()));
+    }
+    return "{" + ret + "}";
+}
+
+}  // anonymous namespace
+
+/* ====================== ModelBundleWriter ====================== */
+
+ModelBundleWriter::ModelBundleWriter(std::unique_ptr<OutputFile> file)
+        : m_file{std::move(file)} {}
+
+ModelBundleWriter::~ModelBundleWriter() = default;
+
+size_t ModelBundleWriter::add_value(const void* ptr, size_t size) {
+    auto hash = XXHash{}.update(ptr, size).digest();
+    auto&& candidates = m_hash2values[hash];
+    for (auto i : candidates) {
+        auto&& value = m_values[i];
+        if (value.size == size &&
+            !memcmp(m_pool.data() + value.offset, ptr, size)) {
+            return i;
+        }
+    }
+    auto offset = get_aligned_power2(m_pool.size(), POOL_ALIGN);
+    m_pool.resize(offset);
+    write(m_pool, ptr, size);
+    candidates.push_back(m_values.size());
+    m_values.push_back({offset, size});
+    return m_values.size() - 1;
+}
+
+GraphDumper::DumpResult ModelBundleWriter::add_graph(
+        Graph graph, const SymbolVarArray& output_vars,
+        const GraphDumpConfig& config) {
+    mgb_assert(!m_finished, "graphs can not be added after finish()");
+    mgb_throw_if(config.tensor_value_dumper || config.tensor_encoding,
+                 SerializationError,
+                 "tensor_value_dumper and tensor_encoding can not be used "
+                 "for graphs in a model bundle");
+    auto dump_config = config;
+    dump_config.tensor_value_dumper = [this](OutputFile& fout,
+                                             const cg::OperatorNodeBase&,
+                                             const HostTensorND& tensor) {
+        uint64_t idx = add_value(tensor.raw_ptr(),
+                                 tensor.layout().span().high_byte);
+        fout.write(&idx, sizeof(idx));
+    };
+    auto dumper = GraphDumper::make(
+            OutputFile::make_vector_proxy(&graph.data),
+            GraphDumpFormat::FLATBUFFERS);
+    auto ret = dumper->dump(output_vars, dump_config);
+    dumper.reset();
+    m_graphs.emplace_back(std::move(graph));
+    return ret;
+}
+
+GraphDumper::DumpResult ModelBundleWriter::add_generic(
+        const SymbolVarArray& output_vars, const GraphDumpConfig& config) {
+    for (auto&& i : m_graphs) {
+        mgb_throw_if(i.generic, SerializationError,
+                     "generic graph already added to the model bundle");
+    }
+    return add_graph({true, {}, {}}, output_vars, config);
+}
+
+GraphDumper::DumpResult ModelBundleWriter::add_variant(
+        const SymbolVarArray& output_vars, const GraphDumpConfig& config) {
+    auto shapes = get_input_shapes(output_vars);
+    for (auto&& i : m_graphs) {
+        mgb_throw_if(!i.generic && same_shapes(i.shapes, shapes),
+                     SerializationError,
+                     "duplicated graph variant for input shapes %s",
+                     shapes_to_string(shapes).c_str());
+    }
+    return add_graph({false, std::move(shapes), {}}, output_vars, config);
+}
+
+void ModelBundleWriter::finish() {
+    mgb_assert(!m_finished, "finish() called twice");
+    mgb_throw_if(m_graphs.empty(), SerializationError,
+                 "can not write empty model bundle");
+    m_finished = true;
+
+    std::vector<uint8_t> index;
+    write<uint64_t>(index, m_pool.size());
+    write<uint64_t>(index, m_values.size());
+    for (auto&& i : m_values) {
+        write<uint64_t>(index, i.offset);
+        write<uint64_t>(index, i.size);
+    }
+    write<uint32_t>(index, m_graphs.size());
+    for (auto&& i : m_graphs) {
+        write<uint32_t>(index, i.generic);
+        write<uint32_t>(index, i.shapes.size());
+        for (auto&& j : i.shapes) {
+            write<uint32_t>(index, j.first.size());
+            write(index, j.first.data(), j.first.size());
+            write<uint32_t>(index, j.second.ndim);
+            for (size_t k = 0; k < j.second.ndim; ++k) {
+                write<uint64_t>(index, j.second[k]);
+            }
+        }
+        write<uint64_t>(index, i.data.size());
+    }
+
+    uint32_t header[2] = {BUNDLE_MAGIC, BUNDLE_VERSION};
+    uint64_t index_size = index.size();
+    m_file->write(header, sizeof(header));
+    m_file->write(&index_size, sizeof(index_size));
+    m_file->write(index.data(), index.size());
+    auto index_end = sizeof(header) + sizeof(index_size) + index.size();
+    static const uint8_t zeros[POOL_ALIGN] = {0};
+    m_file->write(zeros,
+                  get_aligned_power2(index_end, POOL_ALIGN) - index_end);
+    m_file->write(m_pool.data(), m_pool.size());
+    for (auto&& i : m_graphs) {
+        m_file->write(i.data.data(), i.data.size());
+    }
+
+    m_pool.clear();
+    m_graphs.clear();
+}
+
+/* ====================== ModelBundle ====================== */
+
+/*!
+ * \brief graph blob of a bundle, whose tensor values are read as proxies into
+ *      the value pool
+ */
+class ModelBundle::GraphFile final : public InputFile {
+    const ModelBundle* const m_bundle;
+    std::unique_ptr<InputFile> m_file;
+
+public:
+    GraphFile(const ModelBundle* bundle, const SharedBuffer& data)
+            : m_bundle{bundle},
+              m_file{make_mem_proxy(data.data(), data.size())} {}
+
+    void rewind() override { m_file->rewind(); }
+
+    void skip(size_t bytes) override { m_file->skip(bytes); }
+
+    void read(void* dst, size_t size) override { m_file->read(dst, size); }
+
+    size_t tell() override { return m_file->tell(); }
+
+    void read_into_tensor(HostTensorND& dest,
+                          const TensorLayout& layout) override;
+
+    SharedBuffer read_shared(size_t size) override {
+        return m_file->read_shared(size);
+    }
+};
+
+void ModelBundle::GraphFile::read_into_tensor(HostTensorND& dest,
+                                              const TensorLayout& layout) {
+    uint64_t idx;
+    m_file->read(&idx, sizeof(idx));
+    auto&& values = m_bundle->m_values;
+    mgb_throw_if(idx >= values.size(), SerializationError,
+                 "bad value index in model bundle: %zu >= %zu",
+                 static_cast<size_t>(idx), values.size());
+    auto&& value = values[idx];
+    auto size = layout.span().high_byte;
+    mgb_throw_if(value.size != size, SerializationError,
+                 "value size mismatch in model bundle: layout=%s "
+                 "value_size=%zu",
+                 layout.to_string().c_str(), value.size);
+    auto&& pool = m_bundle->m_pool;
+    auto ptr = const_cast<dt_byte*>(static_cast<const dt_byte*>(pool.data()) +
+                                    value.offset);
+    auto align = dest.comp_node().get_mem_addr_alignment();
+    if (!(reinterpret_cast<uintptr_t>(ptr) & (align - 1))) {
+        // share the pool with all the graphs loaded from the bundle
+        HostTensorStorage storage;
+        storage.reset(dest.comp_node(), size,
+                      {std::const_pointer_cast<void>(pool.shared_data()),
+                       ptr});
+        dest.reset(storage, layout);
+    } else {
+        dest.dtype(layout.dtype).resize(layout);
+        memcpy(dest.raw_ptr(), ptr, size);
+    }
+}
+
+ModelBundle::~ModelBundle() = default;
+
+bool ModelBundle::is_bundle(InputFile& file) {
+    uint32_t magic = 0;
+    auto pos = file.tell();
+    bool ok = false;
+    MGB_TRY {
+        file.read(&magic, sizeof(magic));
+        ok = true;
+    }
+    MGB_CATCH(MegBrainError&, {
+        // shorter than the magic; the read position may have been moved
+        file.rewind();
+        file.skip(pos);
+    });
+    if (!ok) {
+        return false;
+    }
+    file.skip(-static_cast<int64_t>(sizeof(magic)));
+    return magic == BUNDLE_MAGIC;
+}
+
+std::unique_ptr<ModelBundle> ModelBundle::open(
+        std::unique_ptr<InputFile> file) {
+    uint32_t header[2];
+    uint64_t index_size;
+    file->read(header, sizeof(header));
+    mgb_throw_if(header[0] != BUNDLE_MAGIC, SerializationError,
+                 "wrong magic: wanted %#08x, actual %#08x (not a model "
+                 "bundle?)",
+                 BUNDLE_MAGIC, header[0]);
+    mgb_throw_if(header[1] > BUNDLE_VERSION, SerializationError,
+                 "model bundle version %u is not supported (max %u)",
+                 header[1], BUNDLE_VERSION);
+    file->read(&index_size, sizeof(index_size));
+    auto index_buf = file->read_shared(index_size);
+    auto index_end = sizeof(header) + sizeof(index_size) + index_size;
+    file->skip(get_aligned_power2<size_t>(index_end, POOL_ALIGN) -
+               index_end);
+
+    std::unique_ptr<ModelBundle> ret{new ModelBundle};
+    Reader reader{index_buf.data(), index_buf.size()};
+    auto pool_size = reader.read<uint64_t>();
+    ret->m_values.resize(reader.read<uint64_t>());
+    for (auto&& i : ret->m_values) {
+        i.offset = reader.read<uint64_t>();
+        i.size = reader.read<uint64_t>();
+        mgb_throw_if(i.offset > pool_size || i.size > pool_size - i.offset,
+                     SerializationError,
+                     "bad value location in model bundle: offset=%zu "
+                     "size=%zu pool_size=%zu",
+                     i.offset, i.size, static_cast<size_t>(pool_size));
+    }
+    std::vector<size_t> graph_sizes;
+    ret->m_graphs.resize(reader.read<uint32_t>());
+    for (size_t i = 0; i < ret->m_graphs.size(); ++i) {
+        auto&& graph = ret->m_graphs[i];
+        graph.generic = reader.read<uint32_t>();
+        for (auto nr_input = reader.read<uint32_t>(); nr_input; --nr_input) {
+            auto name_size = reader.read<uint32_t>();
+            std::string name{reinterpret_cast<const char*>(
+                                     reader.take(name_size)),
+                             name_size};
+            TensorShape shape;
+            shape.ndim = reader.read<uint32_t>();
+            mgb_throw_if(shape.ndim > TensorShape::MAX_NDIM,
+                         SerializationError, "bad input ndim: %zu",
+                         shape.ndim);
+            for (size_t k = 0; k < shape.ndim; ++k) {
+                shape[k] = reader.read<uint64_t>();
+            }
+            graph.shapes[std::move(name)] = shape;
+        }
+        graph_sizes.push_back(reader.read<uint64_t>());
+        if (graph.generic) {
+            mgb_throw_if(ret->m_generic.valid(), SerializationError,
+                         "multiple generic graphs in model bundle");
+            ret->m_generic = i;
+        } else {
+            ret->m_variants.push_back(i);
+        }
+    }
+    mgb_throw_if(!reader.finished(), SerializationError,
+                 "extra bytes after model bundle index");
+
+    ret->m_pool = file->read_shared(pool_size);
+    if (reinterpret_cast<uintptr_t>(ret->m_pool.data()) & (POOL_ALIGN - 1)) {
+        // values are proxied into the pool, so keep them aligned as written;
+        // files read into heap buffers usually get here
+        std::shared_ptr<uint8_t> buf{new uint8_t[pool_size + POOL_ALIGN],
+                                     [](uint8_t* p) { delete[] p; }};
+        auto ptr = reinterpret_cast<uint8_t*>(get_aligned_power2(
+                reinterpret_cast<uintptr_t>(buf.get()), POOL_ALIGN));
+        memcpy(ptr, ret->m_pool.data(), pool_size);
+        ret->m_pool = {std::shared_ptr<const void>{buf, ptr}, pool_size};
+    }
+    for (size_t i = 0; i < ret->m_graphs.size(); ++i) {
+        ret->m_graphs[i].data = file->read_shared(graph_sizes[i]);
+    }
+    return ret;
+}
+
+Maybe<size_t> ModelBundle::find_variant(const InputShapeMap& shapes) const {
+    Maybe<size_t> ret;
+    size_t ret_nr_input = 0;
+    for (size_t i = 0; i < m_variants.size(); ++i) {
+        auto&& key = variant_shapes(i);
+        bool match = true;
+        for (auto&& j : key) {
+            auto iter = shapes.find(j.first);
+            if (iter == shapes.end() || !iter->second.eq_shape(j.second)) {
+                match = false;
+                break;
+            }
+        }
+        // prefer the most specialized variant
+        if (match && (!ret.valid() || key.size() > ret_nr_input)) {
+            ret = i;
+            ret_nr_input = key.size();
+        }
+    }
+    return ret;
+}
+
+GraphLoader::LoadResult ModelBundle::load_graph(
+        Graph& graph, const GraphLoadConfig& config) {
+    mgb_throw_if(config.tensor_value_loader, SerializationError,
+                 "tensor_value_loader can not be used for graphs in a model "
+                 "bundle");
+    auto load_config = config;
+    // values are already in memory and stored as pool indices in the graph
+    // blobs, which can only be read by GraphFile
+    load_config.lazy_param = false;
+    load_config.nr_load_thread = 0;
+    load_config.shm_cache.name.clear();
+    if (!graph.loader) {
+        graph.loader = GraphLoader::make(
+                std::make_unique<GraphFile>(this, graph.data),
+                GraphDumpFormat::FLATBUFFERS);
+    }
+    return graph.loader->load(load_config);
+}
+
+GraphLoader::LoadResult ModelBundle::load_variant(
+        size_t idx, const GraphLoadConfig& config) {
+    mgb_throw_if(idx >= m_variants.size(), SerializationError,
+                 "variant index out of range: %zu >= %zu", idx,
+                 m_variants.size());
+    return load_graph(m_graphs[m_variants[idx]], config);
+}
+
+GraphLoader::LoadResult ModelBundle::load_generic(
+        const GraphLoadConfig& config) {
+    mgb_throw_if(!m_generic.valid(), SerializationError,
+                 "no generic graph in model bundle");
+    return load_graph(m_graphs[m_generic.val()], config);
+}
+
+GraphLoader::LoadResult ModelBundle::load(const InputShapeMap& shapes,
+                                          const GraphLoadConfig& config,
+                                          Maybe<size_t>* variant) {
+    auto idx = find_variant(shapes);
+    if (variant) {
+        *variant = idx;
+    }
+    if (idx.valid()) {
+        return load_variant(idx.val(), config);
+    }
+    mgb_throw_if(!m_generic.valid(), SerializationError,
+                 "no graph variant for input shapes %s, and no generic "
+                 "graph in model bundle",
+                 shapes_to_string(shapes).c_str());
+    return load_generic(config);
+}
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -0,0 +1,110 @@
+/**
+ * \file src/serialization/impl/parallel_tensor_loader.cpp
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "parallel_tensor_loader.h"
+#include "tensor_codec.h"
+
+#if MGB_HAVE_THREAD
+
+#include <cstring>
+
+namespace mgb {
+namespace serialization {
+
+ParallelTensorLoader::ParallelTensorLoader(SharedBuffer blob,
+                                           std::vector<Slot> slots,
+                                           size_t nr_thread)
+        : m_blob{std::move(blob)},
+          m_slots{std::move(slots)},
+          m_results(m_slots.size()) {
+    nr_thread = std::min(nr_thread, m_slots.size());
+    for (size_t i = 0; i < nr_thread; ++i) {
+        m_workers.emplace_back(&ParallelTensorLoader::worker, this);
+    }
+}
+
+ParallelTensorLoader::~ParallelTensorLoader() {
+    m_stop.store(true);
+    for (auto&& i : m_workers) {
+        i.join();
+    }
+}
+
+HostTensorND ParallelTensorLoader::load_slot(const Slot& slot) {
+    mgb_assert(slot.offset + slot.size <= m_blob.size(),
+               "tensor value out of range: offset=%zu size=%zu blob=%zu",
+               slot.offset, slot.size, m_blob.size());
+    auto ptr = static_cast<const dt_byte*>(m_blob.data()) + slot.offset;
+    HostTensorND ret;
+    if (!slot.encoding.is_raw()) {
+        ret.comp_node(slot.comp_node).dtype(slot.layout.dtype).resize(
+                slot.layout);
+        tensor_codec::decode(ptr, slot.size, slot.encoding, slot.layout,
+                             ret.raw_ptr());
+        return ret;
+    }
+    auto align = slot.comp_node.get_mem_addr_alignment();
+    if (!slot.copy && !(reinterpret_cast<uintptr_t>(ptr) & (align - 1))) {
+        // aligned; share the blob without copy
+        HostTensorStorage storage;
+        storage.reset(slot.comp_node, slot.size,
+                      {m_blob.shared_data(), const_cast<dt_byte*>(ptr)});
+        ret.reset(storage, slot.layout);
+    } else {
+        ret.comp_node(slot.comp_node).dtype(slot.layout.dtype).resize(
+                slot.layout);
+        memcpy(ret.raw_ptr(), ptr, slot.size);
+    }
+    return ret;
+}
+
+void ParallelTensorLoader::worker() {
+    for (;;) {
+        if (m_stop.load(std::memory_order_relaxed)) {
+            return;
+        }
+        auto idx = m_next_slot.fetch_add(1);
+        if (idx >= m_slots.size()) {
+            return;
+        }
+        Result result;
+        MGB_TRY { result.value = load_slot(m_slots[idx]); }
+        MGB_CATCH(..., { result.exc = std::current_exception(); });
+        {
+            MGB_LOCK_GUARD(m_mtx);
+            m_results[idx].value = std::move(result.value);
+            m_results[idx].exc = result.exc;
+            m_results[idx].ready = true;
+        }
+        m_cv.notify_all();
+    }
+}
+
+HostTensorND ParallelTensorLoader::get(size_t idx) {
+    mgb_assert(idx < m_slots.size());
+    std::unique_lock<std::mutex> lock{m_mtx};
+    auto&& result = m_results[idx];
+    m_cv.wait(lock, [&result]() { return result.ready; });
+#if MGB_ENABLE_EXCEPTION
+    if (result.exc) {
+        std::rethrow_exception(result.exc);
+    }
+#endif
+    // move out so the storage is only referenced by the graph
+    return std::move(result.value);
+}
+
+}  // namespace serialization
+}  // namespace mgb
+
+#endif  // MGB_HAVE_THREAD
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
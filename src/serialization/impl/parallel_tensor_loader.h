@@ -0,0 +1,97 @@
+/**
+ * \file src/serialization/impl/parallel_tensor_loader.h
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+#pragma once
+
+#include "megbrain/serialization/file.h"
+#include "megbrain/serialization/load_dump_config.h"
+#include "megbrain/tensor.h"
+
+#if MGB_HAVE_THREAD
+
+#include <atomic>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+namespace mgb {
+namespace serialization {
+
+/*!
+ * \brief materialize tensor values from an in-memory blob on worker threads
+ *
+ * The tensor table is scanned beforehand and each tensor is described by a
+ * Slot. Workers take slots in order and produce host tensors, either as
+ * proxies into the blob (for params, when aligned and not encoded) or as
+ * copies, so graph construction on the caller thread can proceed
+ * concurrently and only blocks in get() on the tensor that is actually
+ * needed.
+ */
+class ParallelTensorLoader : public NonCopyableObj {
+public:
+    struct Slot {
+        //! offset of the value in the blob
+        size_t offset;
+        //! size of the (possibly encoded) value in the blob
+        size_t size;
+        TensorLayout layout;
+        //! comp node of the resulting host tensor
+        CompNode comp_node;
+        //! encoded values are decoded on the worker threads
+        TensorValueEncoding encoding;
+        //! whether the value must be copied out of the blob, e.g. for
+        //! inputs that are written by the user
+        bool copy;
+    };
+
+    /*!
+     * \param blob memory holding all the tensor values
+     * \param slots tensors to be loaded; index in this array is used in get()
+     * \param nr_thread number of worker threads
+     */
+    ParallelTensorLoader(SharedBuffer blob, std::vector<Slot> slots,
+                         size_t nr_thread);
+
+    //! wait for workers to exit; values not taken yet are discarded
+    ~ParallelTensorLoader();
+
+    //! get value of a tensor, blocking until it is ready; rethrow the
+    //! exception if loading failed
+    HostTensorND get(size_t idx);
+
+    size_t nr_slot() const { return m_slots.size(); }
+
+private:
+    struct Result {
+        bool ready = false;
+        HostTensorND value;
+        std::exception_ptr exc;
+    };
+
+    const SharedBuffer m_blob;
+    const std::vector<Slot> m_slots;
+    std::vector<Result> m_results;
+    std::atomic_size_t m_next_slot{0};
+    std::atomic_bool m_stop{false};
+
+    std::mutex m_mtx;
+    std::condition_variable m_cv;
+    std::vector<std::thread> m_workers;
+
+    void worker();
+    HostTensorND load_slot(const Slot& slot);
+};
+
+}  // namespace serialization
+}  // namespace mgb
+
+#endif  // MGB_HAVE_THREAD
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -0,0 +1,194 @@
+/**
+ * \file src/serialization/impl/param_swapper.cpp
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "megbrain/serialization/param_swapper.h"
+#include "megbrain/graph/helper.h"
+#include "megbrain/opr/dnn/convolution.h"
+#include "megbrain/opr/io.h"
+#include "megbrain/serialization/serializer.h"
+#include "megbrain/serialization/shm_model_cache.h"
+
+#include <cstring>
+
+using namespace mgb;
+using namespace serialization;
+
+namespace {
+
+//! host view of a device value; \p sync is needed for CPU values that may
+//! still be written by pending tasks
+HostTensorND to_host(const DeviceTensorND& value, bool sync) {
+    if (value.comp_node().mem_node() == CompNode::default_cpu().mem_node()) {
+        if (sync) {
+            value.comp_node().sync();
+        }
+        return HostTensorND::make_proxy(value);
+    }
+    HostTensorND ret;
+    ret.copy_from(value).sync();
+    return ret;
+}
+
+}  // anonymous namespace
+
+ParamSwapper::ParamSwapper(const SymbolVarArray& outputs)
+        : m_params{collect_params(outputs)} {
+    for (auto&& i : m_params) {
+        mgb_throw_if(i.value && !i.cur->layout().is_empty() &&
+                             i.cur->storage().empty(),
+                     GraphError,
+                     "value of param %s is not resident (released by weight "
+                     "preprocessing or loaded lazily); ParamSwapper should "
+                     "be created before the first execution",
+                     i.var->cname());
+        mgb_throw_if(i.value && !i.cur->layout().is_empty() &&
+                             ShmModelCache::is_shm_memory(i.cur->raw_ptr()),
+                     GraphError,
+                     "value of param %s is used in place from a read-only "
+                     "shm segment (loaded with GraphLoadConfig::shm_cache) "
+                     "and can not be swapped",
+                     i.var->cname());
+    }
+    cg::DepOprIter iter{[this](cg::OperatorNodeBase* opr) {
+        auto reader = dynamic_cast<opr::mixin::WeightPreprocessExecutor*>(opr);
+        if (!reader) {
+            return;
+        }
+        // replayed kernels keep using the storage of the preprocessed
+        // weights, which is released and reallocated by the next execution
+        auto&& options = opr->owner_graph()->options();
+        mgb_throw_if(options.comp_node_seq_record_level &&
+                             options.graph_opt.weight_preprocess,
+                     GraphError,
+                     "params of opr %s with preprocessed weights can not be "
+                     "swapped when comp_node_seq_record_level is %d",
+                     opr->cname(), options.comp_node_seq_record_level);
+        // params may reach the preprocessed inputs through other oprs, such
+        // as TypeCvt, Reshape or RelayoutFormat, so all the vars the inputs
+        // depend on are recorded
+        ThinHashSet<VarNode*> visited;
+        VarNodeArray stack(opr->input().begin() + 1, opr->input().end());
+        while (!stack.empty()) {
+            auto var = stack.back();
+            stack.pop_back();
+            if (!visited.insert(var).second) {
+                continue;
+            }
+            m_preprocess_readers[var].push_back(reader);
+            for (auto i : var->owner_opr()->input()) {
+                stack.push_back(i);
+            }
+        }
+    }};
+    for (auto&& i : outputs) {
+        iter.add(i);
+    }
+}
+
+ParamSwapper::~ParamSwapper() = default;
+
+std::vector<ParamSwapper::Param> ParamSwapper::collect_params(
+        const SymbolVarArray& outputs) {
+    std::vector<Param> ret;
+    cg::DepOprIter iter{[&ret](cg::OperatorNodeBase* opr) {
+        if (opr->same_type<opr::SharedDeviceTensor>() ||
+            opr->same_type<opr::SharedDeviceTensorWithFormat>()) {
+            auto&& value =
+                    static_cast<opr::intl::SharedDeviceTensorBase*>(opr)
+                            ->dev_data();
+            ret.push_back({opr, opr->output(0), value.get(), value});
+        } else if (opr->same_type<opr::MultipleDeviceTensorHolder>() ||
+                   opr->same_type<
+                           opr::MultipleDeviceTensorWithFormatHolder>()) {
+            auto&& values =
+                    static_cast<opr::intl::MultipleDeviceTensorHolderBase*>(
+                            opr)
+                            ->values();
+            for (size_t i = 0; i < values.size(); ++i) {
+                ret.push_back({opr, opr->output(i), values[i].get(),
+                               values[i]});
+            }
+        } else if (auto imm = opr->try_cast_final<opr::ImmutableTensor>()) {
+            ret.push_back({opr, opr->output(0), &imm->value(), {}});
+        }
+    }};
+    for (auto&& i : outputs) {
+        iter.add(i);
+    }
+    return ret;
+}
+
+ParamSwapper::Stats ParamSwapper::prepare(const SymbolVarArray& new_outputs) {
+    auto new_params = collect_params(new_outputs);
+    mgb_throw_if(new_params.size() != m_params.size(), GraphError,
+                 "number of params mismatch: current %zu, new %zu",
+                 m_params.size(), new_params.size());
+    m_staged.clear();
+    Stats stats;
+    stats.nr_param = m_params.size();
+    for (size_t i = 0; i < m_params.size(); ++i) {
+        auto &&cur = m_params[i], &&new_ = new_params[i];
+        auto&& layout = cur.cur->layout();
+        mgb_throw_if(
+                cur.opr->dyn_typeinfo() != new_.opr->dyn_typeinfo() ||
+                        !layout.eq_layout(new_.cur->layout()),
+                GraphError,
+                "param %zu mismatch: current %s{%s}, new %s{%s}", i,
+                cur.opr->dyn_typeinfo()->name, layout.to_string().c_str(),
+                new_.opr->dyn_typeinfo()->name,
+                new_.cur->layout().to_string().c_str());
+        auto size = layout.span().dist_byte();
+        auto cur_host = to_host(*cur.cur, false),
+             new_host = to_host(*new_.cur, true);
+        if (!memcmp(cur_host.raw_ptr(), new_host.raw_ptr(), size)) {
+            continue;
+        }
+        mgb_throw_if(!cur.value, GraphError,
+                     "value of ImmutableTensor %s changed; it is a constant "
+                     "of the compiled graph and can not be swapped",
+                     cur.var->cname());
+        m_staged.emplace_back(i, new_.value);
+        ++stats.nr_changed;
+        stats.changed_bytes += size;
+    }
+    return stats;
+}
+
+ParamSwapper::Stats ParamSwapper::prepare(std::unique_ptr<InputFile> file,
+                                          const GraphLoadConfig& config) {
+    auto loader = GraphLoader::make(std::move(file));
+    auto rst = loader->load(config);
+    // staged values are kept alive without the new graph
+    return prepare(rst.output_var_list);
+}
+
+void ParamSwapper::commit() {
+    CompNode::UnorderedSet comp_nodes;
+    for (auto&& i : m_staged) {
+        auto&& param = m_params[i.first];
+        // copy in place, since the storage is referenced by the compiled
+        // sequence
+        param.value->copy_from_fixlayout(*i.second);
+        comp_nodes.insert(param.value->comp_node());
+        auto iter = m_preprocess_readers.find(param.var);
+        if (iter != m_preprocess_readers.end()) {
+            for (auto reader : iter->second) {
+                reader->reset_preprocessed_filter();
+            }
+        }
+    }
+    for (auto cn : comp_nodes) {
+        cn.sync();
+    }
+    m_staged.clear();
+}
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
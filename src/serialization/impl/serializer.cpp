@@ -10,7 +10,10 @@
  */
 
 #include "megbrain/serialization/serializer.h"
+#include "megbrain/graph/helper.h"
+#include "megbrain/opr/io.h"
 #include "megbrain/opr/utility.h"
+#include "megbrain/serialization/opr_shallow_copy.h"
 
 namespace mgb {
 namespace serialization {
@@ -27,6 +30,203 @@ std::unique_ptr<cg::AsyncExecutable> GraphLoader::LoadResult::graph_compile(
     return ret;
 }
 
+GraphLoader::LoadResult GraphLoader::LoadResult::make_instance(
+        const GraphLoadConfig::CompNodeMapper& comp_node_mapper) const {
+    mgb_assert(graph, "graph has been destroyed; make instances before "
+                      "compiling with comp_node_seq_record_level == 2");
+    LoadResult ret;
+    ret.graph = ComputingGraph::make();
+    {
+        // opr attributes, extra deps and user data are bound to the old
+        // graph and not copied
+        auto &&src = graph->options(), &&dst = ret.graph->options();
+#define cb(_name) dst._name = src._name
+        cb(seq_opt);
+        cb(graph_opt);
+        cb(graph_opt_level);
+        cb(log_level);
+        cb(async_exec_level);
+        cb(cpu_dispatch_priority);
+        cb(force_dynamic_alloc);
+        cb(var_sanity_check_first_run);
+        cb(allocate_static_mem_after_graph_compile);
+        cb(enable_sublinear_memory_opt);
+        cb(sublinear_mem_config);
+        cb(no_profiling_on_shape_change);
+        cb(static_infer_cache_size);
+        cb(enable_var_mem_defragment);
+        cb(enable_grad_var_static_reshape);
+        cb(enable_memory_swap);
+        cb(comp_node_seq_record_level);
+        cb(imperative_proxy_graph);
+        cb(no_force_inplace);
+#if !MGB_BUILD_SLIM_SERVING
+        cb(eager_evaluation);
+#endif
+#undef cb
+    }
+
+    CompNode::UnorderedMap<CompNode> cn_map;
+    auto map_cn = [&](CompNode cn) {
+        if (!comp_node_mapper) {
+            return cn;
+        }
+        auto iter = cn_map.find(cn);
+        if (iter == cn_map.end()) {
+            auto loc = cn.locator_logical();
+            comp_node_mapper(loc);
+            iter = cn_map.emplace(cn, CompNode::load(loc)).first;
+        }
+        return iter->second;
+    };
+
+    // device params are shared; a new DeviceTensorND object is created for
+    // each param so its comp node can be changed without copying storage
+    ThinHashMap<DeviceTensorND*, std::shared_ptr<DeviceTensorND>> dev_map;
+    auto share_dev = [&](const std::shared_ptr<DeviceTensorND>& src) {
+        auto&& dst = dev_map[src.get()];
+        if (!dst) {
+            auto cn = map_cn(src->comp_node());
+            bool is_lazy = lazy_params && lazy_params->is_lazy(*src);
+            if (cn == src->comp_node()) {
+                dst = src;
+            } else if (cn.mem_node() == src->comp_node().mem_node()) {
+                if (is_lazy) {
+                    dst = lazy_params->alias(src, cn);
+                } else {
+                    dst = std::make_shared<DeviceTensorND>(*src);
+                    dst->comp_node(cn);
+                }
+            } else {
+                mgb_throw_if(is_lazy, GraphError,
+                             "can not map lazy param from %s to %s on "
+                             "another mem node",
+                             src->comp_node().to_string().c_str(),
+                             cn.to_string().c_str());
+                dst = std::make_shared<DeviceTensorND>();
+                dst->comp_node(cn).copy_from(*src).sync();
+            }
+        }
+        return dst;
+    };
+
+    ThinHashMap<HostTensorND*, std::shared_ptr<HostTensorND>> host_map;
+    auto copy_host = [&](const std::shared_ptr<HostTensorND>& src) {
+        auto&& dst = host_map[src.get()];
+        if (!dst) {
+            dst = std::make_shared<HostTensorND>(map_cn(src->comp_node()),
+                                                 src->dtype());
+            dst->copy_from(*src);
+        }
+        return dst;
+    };
+
+    ThinHashMap<VarNode*, VarNode*> var_map;
+    auto on_opr = [&](cg::OperatorNodeBase* opr) {
+        VarNodeArray inputs;
+        for (auto i : opr->input()) {
+            inputs.push_back(var_map.at(i));
+        }
+        auto config = opr->config();
+        if (config.has_comp_node_set()) {
+            auto cns = config.comp_node();
+            for (auto&& i : cns) {
+                i = map_cn(i);
+            }
+            config.comp_node_arr(cns);
+        }
+
+        auto&& g = *ret.graph;
+        cg::OperatorNodeBase* new_opr;
+        if (auto h2d = opr->try_cast_final<opr::Host2DeviceCopy>()) {
+            new_opr = opr::Host2DeviceCopy::make(g, copy_host(h2d->host_data()),
+                                                 h2d->param(), config)
+                              .node()
+                              ->owner_opr();
+        } else if (auto p = opr->try_cast_final<opr::SharedDeviceTensor>()) {
+            new_opr = opr::SharedDeviceTensor::make(g, share_dev(p->dev_data()),
+                                                    p->const_value(), config)
+                              .node()
+                              ->owner_opr();
+        } else if (auto p = opr->try_cast_final<
+                            opr::SharedDeviceTensorWithFormat>()) {
+            new_opr = opr::SharedDeviceTensorWithFormat::make(
+                              g, share_dev(p->dev_data()), p->const_value(),
+                              config)
+                              .node()
+                              ->owner_opr();
+        } else if (auto p = opr->try_cast_final<
+                            opr::VolatileSharedDeviceTensor>()) {
+            // volatile tensors are replaced by users and can not be shared
+            auto dev = std::make_shared<DeviceTensorND>(*p->dev_data());
+            dev->comp_node(map_cn(dev->comp_node()), true);
+            new_opr = opr::VolatileSharedDeviceTensor::make(g, dev, config)
+                              .node()
+                              ->owner_opr();
+        } else if (opr->same_type<opr::MultipleDeviceTensorHolder>() ||
+                   opr->same_type<opr::MultipleDeviceTensorWithFormatHolder>()) {
+            auto&& holder =
+                    opr->cast_final<opr::intl::MultipleDeviceTensorHolderBase>();
+            opr::intl::MultipleDeviceTensorHolderBase::ValueArray values;
+            for (auto&& i : holder.values()) {
+                values.push_back(share_dev(i));
+            }
+            if (opr->same_type<opr::MultipleDeviceTensorHolder>()) {
+                new_opr = opr::MultipleDeviceTensorHolder::make(
+                                  g, std::move(values), config)[0]
+                                  .node()
+                                  ->owner_opr();
+            } else {
+                new_opr = opr::MultipleDeviceTensorWithFormatHolder::make(
+                                  g, std::move(values), config)[0]
+                                  .node()
+                                  ->owner_opr();
+            }
+        } else {
+            new_opr = copy_opr_shallow(*opr, inputs, config, {&g});
+        }
+
+        auto &&out0 = opr->output(), &&out1 = new_opr->output();
+        mgb_assert(out0.size() == out1.size(),
+                   "output number mismatch when copying %s{%s}", opr->cname(),
+                   opr->dyn_typeinfo()->name);
+        for (size_t i = 0; i < out0.size(); ++i) {
+            var_map[out0[i]] = out1[i];
+        }
+    };
+    cg::DepOprIter iter{on_opr};
+    for (auto&& i : output_var_list) {
+        iter.add(i);
+    }
+    for (auto&& i : output_var_map) {
+        iter.add(i.second);
+    }
+
+    auto map_var = [&](SymbolVar var) -> SymbolVar {
+        return var_map.at(var.node());
+    };
+    for (auto&& i : output_var_list) {
+        ret.output_var_list.push_back(map_var(i));
+    }
+    for (auto&& i : output_var_map) {
+        ret.output_var_map[i.first] = map_var(i.second);
+    }
+    for (auto&& i : output_var_map_id) {
+        ret.output_var_map_id[i.first] = map_var(i.second);
+    }
+    for (auto&& i : tensor_map) {
+        ret.tensor_map[i.first] = copy_host(i.second);
+    }
+    if (lazy_params) {
+        lazy_params->bind(*ret.graph);
+        ret.lazy_params = lazy_params;
+    }
+    // strategies of oprs are copied, and the caches are shared
+    ret.compiled_cache = compiled_cache;
+    ret.shm_cache = shm_cache;
+    return ret;
+}
+
 GraphLoader::SharedTensorNameMap
 GraphLoader::shared_tensor_name_map() {
     SharedTensorNameMap ret;
@@ -23,7 +23,10 @@
 #if MGB_ENABLE_FBS_SERIALIZATION
 
 #include "batched_device_value_loader.h"
+#include "parallel_tensor_loader.h"
+#include "tensor_codec.h"
 
+#include "megbrain/gopt/inference.h"
 #include "megbrain/graph/exc_extra_info.h"
 #include "megbrain/opr/io.h"
 #include "megbrain/serialization/helper.h"
@@ -49,6 +52,37 @@ constexpr uint32_t MGB_VERSION =
 
 constexpr uint32_t MGB_MAGIC = 0x5342474D;
 
+/*!
+ * flag in the reserved header field for the stream layout, which is used
+ * when the output file is not seekable: offset_to_fbs in the header is 0,
+ * each value in the tensor region is prefixed by the size of the rest of
+ * its record, and the records end with STREAM_END followed by the graph
+ */
+constexpr uint32_t HEADER_FLAG_STREAM = 1;
+constexpr uint64_t STREAM_END = ~static_cast<uint64_t>(0);
+
+/*!
+ * flag in the reserved header field for models containing encoded tensor
+ * values (see GraphDumpConfig::tensor_encoding), so loaders that can not
+ * decode them reject the model instead of reading the payload as raw values
+ */
+constexpr uint32_t HEADER_FLAG_ENCODED = 2;
+constexpr uint32_t HEADER_FLAGS_ALL = HEADER_FLAG_STREAM | HEADER_FLAG_ENCODED;
+
+//! ShmModelCache category of param values, keyed by shared tensor index
+constexpr char SHM_PARAM_CATEGORY[] = "param";
+
+//! whether values loaded for oprs of this type are params, which are not
+//! written after loading and can share memory with the model file; values
+//! of other oprs (e.g. Host2DeviceCopy inputs) are written by the user
+bool is_param_opr_type(Typeinfo* type) {
+    return type == opr::SharedDeviceTensor::typeinfo() ||
+           type == opr::SharedDeviceTensorWithFormat::typeinfo() ||
+           type == opr::MultipleDeviceTensorHolder::typeinfo() ||
+           type == opr::MultipleDeviceTensorWithFormatHolder::typeinfo() ||
+           type == opr::ImmutableTensor::typeinfo();
+}
+
 template <typename T>
 bool contains_any_in_set(const SmallVector<T>& list,
                          const ThinHashSet<T>& set) {
@@ -91,6 +125,16 @@ class GraphDumperOSS final : public GraphDumper, OprDumpContextFlatBuffers {
 
     size_t m_nr_shared_tensor;
 
+    //! whether to write the stream layout; see HEADER_FLAG_STREAM
+    bool m_stream = false;
+
+    //! whether any tensor value is encoded; see HEADER_FLAG_ENCODED
+    bool m_has_encoded = false;
+
+    //! hash of tensor values written by this dumper, so the content hash
+    //! identifies param values (e.g. for ShmModelCache)
+    XXHash m_value_hash;
+
     std::vector<std::pair<cg::OperatorNodeBase*, const OprRegistry*>>
             m_oprs_to_dump;
     ThinHashMap<VarNode*, size_t> m_var2id;
@@ -115,6 +159,10 @@ class GraphDumperOSS final : public GraphDumper, OprDumpContextFlatBuffers {
 
     flatbuffers::Offset<fbs::DType> build_dtype(DType dtype);
 
+    //! write the record header in the stream layout and \p pad zeros, before
+    //! a value of \p size bytes
+    void write_value_header(size_t pad, size_t size);
+
 public:
     GraphDumperOSS(std::unique_ptr<OutputFile> file) : m_file{std::move(file)} {}
     DumpResult dump(const SymbolVarArray& output_vars,
@@ -284,6 +332,9 @@ GraphDumper::DumpResult GraphDumperOSS::dump(
     m_used_input_names.clear();
     m_used_param_names.clear();
     m_nr_shared_tensor = 0;
+    m_value_hash.reset();
+    m_stream = !m_file->seekable();
+    m_has_encoded = false;
 
     // process output vars
     bool keep_output_var_name = m_config.keep_var_name >= 1;
@@ -303,9 +354,17 @@ GraphDumper::DumpResult GraphDumperOSS::dump(
     uint32_t magic = MGB_MAGIC;
     m_file->write(&magic, sizeof(magic));
 
-    // Padding
-    uint32_t reserved = 0;
-    m_file->write(&reserved, sizeof(reserved));
+    // Header flags; HEADER_FLAG_ENCODED is only known after the values are
+    // written, so the stream layout sets it whenever encoding is enabled
+    auto flags_pos = m_file->tell();
+    uint32_t flags = 0;
+    if (m_stream) {
+        flags |= HEADER_FLAG_STREAM;
+        if (m_config.tensor_encoding) {
+            flags |= HEADER_FLAG_ENCODED;
+        }
+    }
+    m_file->write(&flags, sizeof(flags));
 
     // Write placeholder for offset_to_fbs
     auto offset_pos = m_file->tell();
@@ -331,23 +390,51 @@ GraphDumper::DumpResult GraphDumperOSS::dump(
     XXHash content_hash;
     content_hash.update(m_builder.GetCurrentBufferPointer(),
                         m_builder.GetSize());
+    auto value_hash = m_value_hash.digest();
+    content_hash.update(&value_hash, sizeof(value_hash));
     auto graph_hash = content_hash.digest();
 
+    // Dump compiled cache after tensor values; it does not contribute to
+    // the graph hash
+    flatbuffers::Offset<fbs::CompiledCache> fb_compiled_cache;
+    if (m_config.compiled_cache) {
+        auto data = m_config.compiled_cache->serialize();
+        write_value_header(0, data.size());
+        uint64_t offset = m_file->tell() - offset_pos - sizeof(offset_to_fbs);
+        m_file->write(data.data(), data.size());
+        fb_compiled_cache = fbs::CreateCompiledCache(
+                m_builder,
+                m_builder.CreateString(CompiledModelCache::env_tag()), offset,
+                data.size());
+    }
+
     fbs::GraphBuilder graph(m_builder);
     graph.add_mgb_version(MGB_VERSION);
     graph.add_hash(graph_hash);
     graph.add_oprs(fb_oprs);
     graph.add_output_vars_idx(fb_output_vars);
     graph.add_nr_shared_tensor(m_nr_shared_tensor);
+    graph.add_compiled_cache(fb_compiled_cache);
     m_builder.FinishSizePrefixed(graph.Finish(), fbs::GraphIdentifier());
 
-    // Write actual offset_to_fbs
-    auto cur = m_file->tell();
-    mgb_assert(cur >= offset_pos && cur - offset_pos >= sizeof(offset_to_fbs));
-    offset_to_fbs = cur - offset_pos - sizeof(offset_to_fbs);
-    m_file->seek(offset_pos);
-    m_file->write(&offset_to_fbs, sizeof(offset_to_fbs));
-    m_file->seek(cur);
+    if (m_stream) {
+        // the loader finds the graph by walking the value records
+        m_file->write(&STREAM_END, sizeof(STREAM_END));
+    } else {
+        // Write actual offset_to_fbs
+        auto cur = m_file->tell();
+        mgb_assert(cur >= offset_pos &&
+                   cur - offset_pos >= sizeof(offset_to_fbs));
+        offset_to_fbs = cur - offset_pos - sizeof(offset_to_fbs);
+        m_file->seek(offset_pos);
+        m_file->write(&offset_to_fbs, sizeof(offset_to_fbs));
+        if (m_has_encoded) {
+            flags |= HEADER_FLAG_ENCODED;
+            m_file->seek(flags_pos);
+            m_file->write(&flags, sizeof(flags));
+        }
+        m_file->seek(cur);
+    }
 
     // Write serialized fbs::Graph
     m_file->write(m_builder.GetBufferPointer(), m_builder.GetSize());
@@ -399,18 +486,51 @@ void GraphDumperOSS::dump_tensor(const std::string& name,
             break;
     }
 
-    size_t value_size = 0;
+    size_t value_size = 0, value_offset = 0;
+    TensorValueEncoding encoding;
     if (has_value) {
         check_tensor_value_valid(name, tensor);
         auto begin = m_file->tell();
+        // padding (and record header) before the value is skipped by the
+        // loader with Tensor::offset
+        size_t pad = 0, header = m_stream ? sizeof(uint64_t) : 0;
+        if (auto align = m_config.tensor_value_align) {
+            pad = (align - (begin + header) % align) % align;
+        }
+        value_offset = header + pad;
         auto&& dumper = m_config.tensor_value_dumper;
+        if (m_config.tensor_encoding) {
+            mgb_assert(!dumper, "tensor_encoding and tensor_value_dumper can "
+                                "not be used together");
+            encoding = m_config.tensor_encoding(name, tensor);
+        }
         if (dumper) {
-            dumper(*m_file, *m_cur_opr, tensor);
+            // values written by a custom dumper are not hashed
+            if (m_stream) {
+                // record size must be known before the value
+                std::vector<uint8_t> buf;
+                dumper(*OutputFile::make_vector_proxy(&buf), *m_cur_opr,
+                       tensor);
+                write_value_header(pad, buf.size());
+                m_file->write(buf.data(), buf.size());
+            } else {
+                write_value_header(pad, 0);
+                dumper(*m_file, *m_cur_opr, tensor);
+            }
+        } else if (!encoding.is_raw()) {
+            m_has_encoded = true;
+            auto payload = tensor_codec::encode(tensor, encoding);
+            m_value_hash.update(payload.data(), payload.size());
+            write_value_header(pad, payload.size());
+            m_file->write(payload.data(), payload.size());
         } else {
-            m_file->write(tensor.raw_ptr(), tensor.layout().span().high_byte);
+            auto size = tensor.layout().span().high_byte;
+            m_value_hash.update(tensor.raw_ptr(), size);
+            write_value_header(pad, size);
+            m_file->write(tensor.raw_ptr(), size);
         }
         value_size = m_file->tell() - begin;
-        m_cur_rst.tensor_value_bytes += value_size;
+        m_cur_rst.tensor_value_bytes += value_size - value_offset;
     }
 
     auto fbname = should_keep_name ? m_builder.CreateSharedString(name) : 0;
@@ -420,11 +540,28 @@ void GraphDumperOSS::dump_tensor(const std::string& name,
             m_builder, m_builder.CreateSharedString(
                                tensor.comp_node().to_string_logical()));
     auto dtype = build_dtype(tensor.dtype());
-    auto serialized_tensor = fbs::CreateTensor(m_builder, fbname, shape,
-                                               comp_node, dtype, value_size);
+    auto serialized_tensor = fbs::CreateTensor(
+            m_builder, fbname, shape, comp_node, dtype, value_size,
+            value_offset, static_cast<fbs::TensorEncoding>(encoding.format),
+            encoding.compress ? fbs::TensorCompression_LZ4_BLOCK
+                              : fbs::TensorCompression_NONE);
     m_cur_opr_tensor.emplace_back(serialized_tensor);
 }
 
+void GraphDumperOSS::write_value_header(size_t pad, size_t size) {
+    if (m_stream) {
+        uint64_t record_size = pad + size;
+        mgb_assert(record_size != STREAM_END);
+        m_file->write(&record_size, sizeof(record_size));
+    }
+    static const uint8_t zeros[256] = {0};
+    while (pad) {
+        auto cur = std::min(pad, sizeof(zeros));
+        m_file->write(zeros, cur);
+        pad -= cur;
+    }
+}
+
 void GraphDumperOSS::dump_buf_with_len(const void* data, uint32_t size) {
     auto blob = fbs::CreateBlob(
             m_builder,
@@ -440,6 +577,12 @@ class GraphLoaderOSS final : public GraphLoader {
     SharedBuffer m_graph_buf{{}, 0};
     const fbs::Graph* m_graph;
     SharedTensorIDMap m_shared_tensor_map;
+    //! values of shared tensors if they are loaded with lazy_param
+    std::shared_ptr<LazyParamPool> m_lazy_param_pool;
+    //! cache embedded in the model; loaded once and shared by later loads
+    std::shared_ptr<CompiledModelCache> m_compiled_cache;
+    //! segment to share values with other processes if shm_cache is set
+    std::shared_ptr<ShmModelCache> m_shm_cache;
     uint32_t m_mgb_version = 0;
     uint64_t m_graph_hash = 0;
 
@@ -479,6 +622,8 @@ class GraphLoaderOSS::OprLoadContextImpl final
     VarNodeArray m_id2varnode;
     BatchedDeviceValueLoader m_device_value_loader;
     const fbs::Operator* m_current_opr;
+    Typeinfo* m_current_opr_type = nullptr;
+    size_t m_cur_opr_idx = 0;
     size_t m_cur_opr_tensor_cnt;
     size_t m_cur_opr_blob_cnt;
     size_t m_cur_opr_param_cnt;
@@ -496,8 +641,34 @@ class GraphLoaderOSS::OprLoadContextImpl final
 
     std::shared_ptr<DeviceTensorND> load_tensor_shared() override;
 
+    //! load value of a param through GraphLoaderOSS::m_shm_cache
+    std::shared_ptr<DeviceTensorND> load_tensor_shm(
+            ShmModelCache& shm, CompNode comp_node, const TensorLayout& layout,
+            const fbs::Tensor* tensor);
+
     void load_single_opr(const fbs::Operator* opr);
 
+#if MGB_HAVE_THREAD
+    //! index of first tensor of each opr in the global tensor table
+    std::vector<size_t> m_opr_tensor_begin;
+    //! comp node and slot in m_parallel_loader (or -1 if no value) of each
+    //! tensor in the global tensor table
+    std::vector<std::pair<CompNode, ptrdiff_t>> m_tensor_info;
+    std::unique_ptr<ParallelTensorLoader> m_parallel_loader;
+
+    //! index of the tensor being loaded in the global tensor table
+    size_t cur_tensor_idx() const {
+        return m_opr_tensor_begin.at(m_cur_opr_idx) + m_cur_opr_tensor_cnt - 1;
+    }
+#endif
+
+    //! comp node of a tensor of current opr
+    CompNode load_tensor_comp_node(const fbs::Tensor* tensor);
+
+    //! in-memory view of tensor values if lazy_param is enabled; tensors
+    //! that are not loaded lazily are read from it
+    std::unique_ptr<InputFile> m_lazy_value_file;
+
 public:
     OprLoadContextImpl(GraphLoaderOSS* loader, uint32_t version)
             : OprLoadContextFlatBuffers(version), m_loader{loader} {
@@ -523,6 +694,18 @@ public:
     LoadResult load_oprs();
     CompNode load_comp_node(const fbs::CompNode* comp_node);
 
+    /*!
+     * \brief scan the tensor table and start loading tensor values of the
+     *      \p size bytes at current file position on worker threads
+     */
+    void start_parallel_load(size_t size, size_t nr_thread);
+
+    /*!
+     * \brief read the \p size bytes of tensor values at current file position
+     *      into a LazyParamPool, so params can be loaded on first use
+     */
+    void start_lazy_load(size_t size);
+
     const void* get_next_param(uint32_t enumv) override {
         auto type = static_cast<fbs::OperatorParam>(enumv);
         if (m_cur_opr_param_cnt == 0) {
@@ -573,6 +756,17 @@ CompNode GraphLoaderOSS::OprLoadContextImpl::load_comp_node(
     return CompNode::load(loc);
 }
 
+CompNode GraphLoaderOSS::OprLoadContextImpl::load_tensor_comp_node(
+        const fbs::Tensor* tensor) {
+#if MGB_HAVE_THREAD
+    if (m_parallel_loader) {
+        // comp nodes have been mapped in start_parallel_load()
+        return m_tensor_info.at(cur_tensor_idx()).first;
+    }
+#endif
+    return load_comp_node(tensor->comp_node());
+}
+
 TensorLayout load_tensor_layout(const fbs::Tensor* tensor) {
     TensorLayout layout;
     if (tensor->shape()) {
@@ -587,14 +781,63 @@ TensorLayout load_tensor_layout(const fbs::Tensor* tensor) {
     return layout;
 }
 
+TensorValueEncoding load_tensor_encoding(const fbs::Tensor* tensor) {
+    mgb_throw_if(tensor->encoding() > fbs::TensorEncoding_MAX ||
+                         tensor->compression() > fbs::TensorCompression_MAX,
+                 SerializationError,
+                 "unsupported tensor value encoding: encoding=%d "
+                 "compression=%d (model from future MegBrain?)",
+                 static_cast<int>(tensor->encoding()),
+                 static_cast<int>(tensor->compression()));
+    TensorValueEncoding ret;
+    ret.format =
+            static_cast<TensorValueEncoding::Format>(tensor->encoding());
+    ret.compress = tensor->compression() == fbs::TensorCompression_LZ4_BLOCK;
+    return ret;
+}
+
 void GraphLoaderOSS::OprLoadContextImpl::load_tensor_value(
         HostTensorND* dest, const TensorLayout& layout,
         const fbs::Tensor* tensor) {
+#if MGB_HAVE_THREAD
+    if (m_parallel_loader) {
+        auto slot = m_tensor_info.at(cur_tensor_idx()).second;
+        mgb_assert(slot >= 0);
+        if (dest) {
+            auto value = m_parallel_loader->get(slot);
+            if (value.comp_node() == dest->comp_node()) {
+                *dest = std::move(value);
+            } else {
+                dest->dtype(layout.dtype).resize(layout).copy_from_fixlayout(
+                        value);
+            }
+        }
+        return;
+    }
+#endif
     auto&& loader = m_loader->m_cur_load_config->tensor_value_loader;
-    auto&& file = m_loader->m_file;
+    auto&& file = m_lazy_value_file ? m_lazy_value_file : m_loader->m_file;
     auto begin_pos = file->tell();
     file->skip(tensor->offset());
-    if (loader) {
+    auto encoding = load_tensor_encoding(tensor);
+    if (!encoding.is_raw()) {
+        mgb_throw_if(loader, SerializationError,
+                     "custom tensor value loader can not be used for encoded "
+                     "tensor values");
+        mgb_throw_if(tensor->offset() > tensor->data_size(),
+                     SerializationError, "bad tensor value offset: %u > %u",
+                     tensor->offset(), tensor->data_size());
+        auto size = tensor->data_size() - tensor->offset();
+        if (dest) {
+            auto payload = file->read_shared(size);
+            dest->dtype(layout.dtype).resize(layout);
+            tensor_codec::decode(payload.data(), payload.size(), encoding,
+                                 layout, dest->raw_ptr(),
+                                 m_loader->m_cur_load_config->nr_load_thread);
+        } else {
+            file->skip(size);
+        }
+    } else if (loader) {
         // call custom loader
         void* dest_ptr = nullptr;
         if (dest) {
@@ -606,7 +849,13 @@ void GraphLoaderOSS::OprLoadContextImpl::load_tensor_value(
         if (dest) {
             file->read_into_tensor(*dest, layout);
         } else {
-            file->skip(layout.span().high_byte);
+            // skip the whole blob, whose size may differ from the layout if
+            // read_into_tensor() is overridden (e.g. by model bundles)
+            mgb_throw_if(tensor->offset() > tensor->data_size(),
+                         SerializationError,
+                         "bad tensor value offset: %u > %u", tensor->offset(),
+                         tensor->data_size());
+            file->skip(tensor->data_size() - tensor->offset());
         }
     }
     mgb_throw_if(file->tell() < begin_pos, SerializationError,
@@ -632,7 +881,7 @@ GraphLoaderOSS::OprLoadContextImpl::load_tensor() {
     mgb_assert(m_current_opr->tensors() &&
                m_cur_opr_tensor_cnt < m_current_opr->tensors()->size());
     auto tensor = m_current_opr->tensors()->Get(m_cur_opr_tensor_cnt++);
-    auto comp_node = load_comp_node(tensor->comp_node());
+    auto comp_node = load_tensor_comp_node(tensor);
     auto layout = load_tensor_layout(tensor);
     auto ret = std::make_shared<HostTensorND>(comp_node, layout);
     if (tensor->data_size()) {
@@ -653,7 +902,7 @@ GraphLoaderOSS::OprLoadContextImpl::load_tensor_shared() {
     mgb_assert(m_current_opr->tensors() &&
                m_cur_opr_tensor_cnt < m_current_opr->tensors()->size());
     auto tensor = m_current_opr->tensors()->Get(m_cur_opr_tensor_cnt++);
-    auto comp_node = load_comp_node(tensor->comp_node());
+    auto comp_node = load_tensor_comp_node(tensor);
     auto layout = load_tensor_layout(tensor);
     mgb_assert(tensor->data_size());
     auto&& sh_reg = m_loader->m_shared_tensor_map.at(m_cur_shared_tensor_idx++);
@@ -665,6 +914,10 @@ GraphLoaderOSS::OprLoadContextImpl::load_tensor_shared() {
             return sh_ptr_ref;
         // same mem node but different comp node, change comp node and share
         // value
+        auto&& pool = m_loader->m_lazy_param_pool;
+        if (pool && pool->is_lazy(*sh_ptr_ref)) {
+            return pool->alias(sh_ptr_ref, comp_node);
+        }
         auto ret = std::make_shared<DeviceTensorND>(*sh_ptr_ref);
         ret->comp_node(comp_node);
         return ret;
@@ -673,6 +926,32 @@ GraphLoaderOSS::OprLoadContextImpl::load_tensor_shared() {
         sh_reg.first = tensor->name()->str();
     }
 
+    if (m_lazy_value_file && load_tensor_encoding(tensor).is_raw() &&
+        (m_current_opr_type == opr::SharedDeviceTensor::typeinfo() ||
+         m_current_opr_type == opr::MultipleDeviceTensorHolder::typeinfo())) {
+        // only record the offset; other holders (e.g. those with tensor
+        // formats) may access the value during loading
+        mgb_throw_if(tensor->offset() + layout.span().dist_byte() >
+                             tensor->data_size(),
+                     SerializationError,
+                     "tensor value size mismatch: layout=%s data_size=%u",
+                     layout.to_string().c_str(), tensor->data_size());
+        auto offset = m_lazy_value_file->tell() + tensor->offset();
+        m_lazy_value_file->skip(tensor->data_size());
+        sh_ptr_ref = m_loader->m_lazy_param_pool->add(offset, layout,
+                                                      comp_node);
+        return sh_ptr_ref;
+    }
+
+    if (auto&& shm = m_loader->m_shm_cache) {
+        if (m_current_opr_type == opr::SharedDeviceTensor::typeinfo() ||
+            m_current_opr_type ==
+                    opr::MultipleDeviceTensorHolder::typeinfo()) {
+            sh_ptr_ref = load_tensor_shm(*shm, comp_node, layout, tensor);
+            return sh_ptr_ref;
+        }
+    }
+
     if (comp_node.mem_node() == CompNode::default_cpu().mem_node()) {
         // directly forward CPU memory
         HostTensorND hv{comp_node};
@@ -680,14 +959,70 @@ GraphLoaderOSS::OprLoadContextImpl::load_tensor_shared() {
         sh_ptr_ref = std::make_shared<DeviceTensorND>();
         *sh_ptr_ref = DeviceTensorND::make_proxy(hv);
     } else {
-        // use lazy load for non-CPU devices
-        HostTensorND hv{CompNode::default_cpu()};
-        load_tensor_value(&hv, layout, tensor);
-        sh_ptr_ref = m_device_value_loader.make(comp_node, std::move(hv));
+        // read into the staging buffer of the batched loader for non-CPU
+        // devices, which copies the values asynchronously
+        sh_ptr_ref = m_device_value_loader.make(
+                comp_node, layout, [&](HostTensorND& hv) {
+                    load_tensor_value(&hv, layout, tensor);
+                });
     }
     return sh_ptr_ref;
 }
 
+std::shared_ptr<DeviceTensorND>
+GraphLoaderOSS::OprLoadContextImpl::load_tensor_shm(
+        ShmModelCache& shm, CompNode comp_node, const TensorLayout& layout,
+        const fbs::Tensor* tensor) {
+    // values in the segment are on the host; they are copied to non-CPU
+    // devices as usual
+    auto host_cn = comp_node;
+    if (comp_node.mem_node() != CompNode::default_cpu().mem_node()) {
+        host_cn = CompNode::default_cpu();
+    }
+    auto size = layout.span().dist_byte();
+    auto key = ssprintf("%zu", m_cur_shared_tensor_idx - 1);
+    PersistentCache::Blob blob{key.data(), key.size()};
+    auto get_value = [&]() -> Maybe<SharedBuffer> {
+        auto ret = shm.get_shared(SHM_PARAM_CATEGORY, blob);
+        if (ret.valid() && ret->size() == size &&
+            !(reinterpret_cast<uintptr_t>(ret->data()) %
+              host_cn.get_mem_addr_alignment())) {
+            return ret;
+        }
+        return None;
+    };
+
+    HostTensorND hv;
+    auto value = get_value();
+    if (value.valid()) {
+        load_tensor_value(nullptr, layout, tensor);
+    } else {
+        hv.comp_node(host_cn);
+        load_tensor_value(&hv, layout, tensor);
+        if (shm.is_writer() && hv.layout().is_contiguous()) {
+            shm.put(SHM_PARAM_CATEGORY, blob, {hv.raw_ptr(), size});
+            value = get_value();
+        }
+    }
+    if (value.valid()) {
+        // the segment is mapped read-only (see ShmModelCache::is_shm_memory);
+        // HostTensorStorage takes a mutable pointer, but the value must
+        // never be written
+        HostTensorStorage storage;
+        storage.reset(host_cn, size,
+                      {value->shared_data(),
+                       const_cast<dt_byte*>(
+                               static_cast<const dt_byte*>(value->data()))});
+        hv.reset(storage, layout);
+    }
+    if (host_cn == comp_node) {
+        auto ret = std::make_shared<DeviceTensorND>();
+        *ret = DeviceTensorND::make_proxy(hv);
+        return ret;
+    }
+    return m_device_value_loader.make(comp_node, std::move(hv));
+}
+
 void GraphLoaderOSS::OprLoadContextImpl::load_single_opr(
         const fbs::Operator* fbopr) {
     m_cur_opr_tensor_cnt = 0;
@@ -729,6 +1064,7 @@ void GraphLoaderOSS::OprLoadContextImpl::load_single_opr(
     }
 
     // call loader
+    m_current_opr_type = registry->type;
     auto opr = registry->loader(*this, inputs, config);
 
     // check opr type; note that:
@@ -757,9 +1093,13 @@ GraphLoader::LoadResult GraphLoaderOSS::OprLoadContextImpl::load_oprs() {
     // load oprs
     const auto* oprs = m_loader->m_graph->oprs();
     for (flatbuffers::uoffset_t i = 0; i < oprs->size(); ++i) {
+        m_cur_opr_idx = i;
         m_current_opr = oprs->Get(i);
         load_single_opr(m_current_opr);
     }
+#if MGB_HAVE_THREAD
+    m_parallel_loader.reset();
+#endif
 
     // batched loading device values
     m_device_value_loader.apply();
@@ -781,6 +1121,75 @@ GraphLoader::LoadResult GraphLoaderOSS::OprLoadContextImpl::load_oprs() {
     return ret;
 }
 
+void GraphLoaderOSS::OprLoadContextImpl::start_parallel_load(
+        size_t size, size_t nr_thread) {
+#if MGB_HAVE_THREAD
+    std::vector<ParallelTensorLoader::Slot> slots;
+    const auto* oprs = m_loader->m_graph->oprs();
+    size_t offset = 0;
+    for (flatbuffers::uoffset_t i = 0; i < oprs->size(); ++i) {
+        m_opr_tensor_begin.push_back(m_tensor_info.size());
+        auto tensors = oprs->Get(i)->tensors();
+        if (!tensors) {
+            continue;
+        }
+        auto registry =
+                OprRegistry::find_by_unversioned_id(oprs->Get(i)->type_id());
+        bool is_param = registry && is_param_opr_type(registry->type);
+        for (flatbuffers::uoffset_t j = 0; j < tensors->size(); ++j) {
+            auto tensor = tensors->Get(j);
+            auto cn = load_comp_node(tensor->comp_node());
+            ptrdiff_t slot = -1;
+            if (tensor->data_size()) {
+                slot = slots.size();
+                auto layout = load_tensor_layout(tensor);
+                auto encoding = load_tensor_encoding(tensor);
+                // values on devices are staged on CPU, as in
+                // load_tensor_shared()
+                auto host_cn =
+                        cn.mem_node() == CompNode::default_cpu().mem_node()
+                                ? cn
+                                : CompNode::default_cpu();
+                mgb_throw_if(tensor->offset() > tensor->data_size(),
+                             SerializationError,
+                             "bad tensor value offset: %u > %u",
+                             tensor->offset(), tensor->data_size());
+                // encoded values take the whole blob after offset
+                size_t value_size =
+                        encoding.is_raw()
+                                ? layout.span().dist_byte()
+                                : tensor->data_size() - tensor->offset();
+                mgb_throw_if(tensor->offset() + value_size >
+                                     tensor->data_size(),
+                             SerializationError,
+                             "tensor value size mismatch: layout=%s "
+                             "data_size=%u",
+                             layout.to_string().c_str(), tensor->data_size());
+                slots.push_back({offset + tensor->offset(), value_size, layout,
+                                 host_cn, encoding, !is_param});
+                offset += tensor->data_size();
+            }
+            m_tensor_info.emplace_back(cn, slot);
+        }
+    }
+    mgb_throw_if(offset > size, SerializationError,
+                 "tensor values exceed data region: %zu > %zu", offset, size);
+    auto blob = m_loader->m_file->read_shared(size);
+    m_parallel_loader = std::make_unique<ParallelTensorLoader>(
+            std::move(blob), std::move(slots), nr_thread);
+#else
+    MGB_MARK_USED_VAR(size);
+    MGB_MARK_USED_VAR(nr_thread);
+#endif
+}
+
+void GraphLoaderOSS::OprLoadContextImpl::start_lazy_load(size_t size) {
+    auto blob = m_loader->m_file->read_shared(size);
+    m_lazy_value_file = InputFile::make_mem_proxy(blob.data(), blob.size());
+    m_loader->m_lazy_param_pool =
+            std::make_shared<LazyParamPool>(std::move(blob));
+}
+
 GraphLoader::LoadResult GraphLoaderOSS::load(const LoadConfig& config,
                                                    bool rewind) {
     mgb_assert(m_file);
@@ -794,13 +1203,31 @@ GraphLoader::LoadResult GraphLoaderOSS::load(const LoadConfig& config,
                  "wrong magic: wanted %#08x, actual %#08x (not a MegBrain fbs "
                  "model?)",
                  MGB_MAGIC, magic);
-    m_file->skip(4);
+    uint32_t flags;
+    m_file->read(&flags, sizeof(flags));
+    mgb_throw_if(flags & ~HEADER_FLAGS_ALL, SerializationError,
+                 "unsupported model header flags: %#x (model dumped by a "
+                 "newer version?)",
+                 flags);
 
     uint64_t offset_to_fbs;
     m_file->read(&offset_to_fbs, sizeof(offset_to_fbs));
     auto tensor_begin = m_file->tell();
-    // Skip tensor data
-    m_file->skip(offset_to_fbs);
+    if (flags & HEADER_FLAG_STREAM) {
+        // walk the value records to find the graph
+        for (;;) {
+            uint64_t record_size;
+            m_file->read(&record_size, sizeof(record_size));
+            if (record_size == STREAM_END) {
+                break;
+            }
+            m_file->skip(record_size);
+        }
+        offset_to_fbs = m_file->tell() - tensor_begin;
+    } else {
+        // Skip tensor data
+        m_file->skip(offset_to_fbs);
+    }
 
     // Read fbs::Graph
     uint32_t size;
@@ -844,14 +1271,74 @@ GraphLoader::LoadResult GraphLoaderOSS::load(const LoadConfig& config,
                    static_cast<unsigned long long>(m_graph->hash()));
     }
 
-    if (m_shared_tensor_map.empty()) {
+    bool first_load = m_shared_tensor_map.empty();
+    if (first_load) {
         m_shared_tensor_map.resize(m_graph->nr_shared_tensor());
     } else {
         mgb_assert(m_shared_tensor_map.size() == m_graph->nr_shared_tensor());
     }
 
+    bool open_shm = !config.shm_cache.name.empty() &&
+                    !config.tensor_value_loader && first_load;
+    if (open_shm) {
+        auto capacity = config.shm_cache.capacity;
+        if (!capacity) {
+            // also leave room for preprocessed weights
+            capacity = offset_to_fbs * 4 + (64 << 20);
+        }
+        m_shm_cache = ShmModelCache::open(config.shm_cache.name,
+                                          m_graph_hash, capacity,
+                                          config.shm_cache.timeout);
+    }
+    // readers do not need to read values that are found in the segment
+    bool shm_reader = m_shm_cache && !m_shm_cache->is_writer();
+
     OprLoadContextImpl ctx{this, m_graph->mgb_version()};
+    if (config.lazy_param && !config.tensor_value_loader && first_load &&
+        !m_shm_cache) {
+        ctx.start_lazy_load(offset_to_fbs);
+    } else if (config.nr_load_thread > 1 && !config.tensor_value_loader &&
+               (first_load || !m_graph->nr_shared_tensor()) && !shm_reader) {
+        ctx.start_parallel_load(offset_to_fbs, config.nr_load_thread);
+    }
     auto result = ctx.load_oprs();
+    if (m_lazy_param_pool) {
+        // also needed for later loads that share the lazy params
+        m_lazy_param_pool->bind(*result.graph);
+        result.lazy_params = m_lazy_param_pool;
+    }
+
+    auto fb_cache = m_graph->compiled_cache();
+    if (fb_cache && !config.ignore_compiled_cache) {
+        auto tag = fb_cache->env_tag() ? fb_cache->env_tag()->str()
+                                       : std::string{};
+        if (tag != CompiledModelCache::env_tag()) {
+            mgb_log_warn(
+                    "compiled cache in the model is ignored: recorded on "
+                    "[%s], running on [%s]",
+                    tag.c_str(), CompiledModelCache::env_tag().c_str());
+        } else {
+            if (!m_compiled_cache) {
+                size_t cache_offset = fb_cache->offset(),
+                       cache_size = fb_cache->size();
+                mgb_throw_if(cache_offset > offset_to_fbs ||
+                                     cache_size > offset_to_fbs - cache_offset,
+                             SerializationError,
+                             "bad compiled cache location: offset=%zu "
+                             "size=%zu",
+                             cache_offset, cache_size);
+                m_file->rewind();
+                m_file->skip(tensor_begin + cache_offset);
+                m_compiled_cache = CompiledModelCache::deserialize(
+                        m_file->read_shared(cache_size));
+            }
+            gopt::enable_opr_use_profiling_cache_inplace(
+                    result.output_var_list);
+            result.compiled_cache = m_compiled_cache;
+        }
+    }
+
+    result.shm_cache = m_shm_cache;
 
     auto fbs_end = tensor_begin + offset_to_fbs + sizeof(size) + size;
     auto cur = m_file->tell();
@@ -870,10 +1357,11 @@ std::unique_ptr<GraphLoader> make_fbs_loader(std::unique_ptr<InputFile> file) {
 }
 
 bool is_fbs_file(InputFile& file) {
-    uint64_t magic_with_reserved = 0;
-    file.read(&magic_with_reserved, sizeof(magic_with_reserved));
-    file.skip(-sizeof(magic_with_reserved));
-    return magic_with_reserved == MGB_MAGIC;
+    uint32_t magic_with_flags[2] = {0, 0};
+    file.read(magic_with_flags, sizeof(magic_with_flags));
+    file.skip(-sizeof(magic_with_flags));
+    return magic_with_flags[0] == MGB_MAGIC &&
+           !(magic_with_flags[1] & ~HEADER_FLAGS_ALL);
 }
 
 }  // namespace serialization
@@ -0,0 +1,461 @@
+/**
+ * \file src/serialization/impl/shm_model_cache.cpp
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "megbrain/serialization/shm_model_cache.h"
+#include "megbrain/serialization/serializer.h"
+#include "megbrain/utils/timer.h"
+#include "megbrain/version.h"
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <map>
+#include <thread>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MGB_HAVE_SHM 1
+#else
+#define MGB_HAVE_SHM 0
+#endif
+
+using namespace mgb;
+using namespace serialization;
+
+/*
+ * segment layout:
+ *
+ * <Header>[<EntryHeader><category><key><padding><value><padding>]*
+ *
+ * where values are aligned to ENTRY_ALIGN bytes
+ */
+
+namespace {
+
+constexpr uint32_t MGB_VERSION =
+        (MGB_MAJOR * 1000 + MGB_MINOR) * 100 + MGB_PATCH;
+
+//! "mgbshm01" in little endian
+constexpr uint64_t SHM_MAGIC = 0x31306d6873626d67ull;
+constexpr size_t ENTRY_ALIGN = 64;
+
+enum State : uint32_t { INIT = 0, WRITING = 1, SEALED = 2 };
+
+struct EntryHeader {
+    uint32_t category_size, key_size;
+    uint64_t value_size;
+};
+
+size_t align_up(size_t v) {
+    return (v + ENTRY_ALIGN - 1) & ~(ENTRY_ALIGN - 1);
+}
+
+std::string index_key(const std::string& category,
+                      const PersistentCache::Blob& key) {
+    std::string ret = category;
+    ret.push_back(0);
+    ret.append(static_cast<const char*>(key.ptr), key.size);
+    return ret;
+}
+
+//! address ranges of segments mapped in this process, for is_shm_memory()
+struct MappedRanges {
+    std::mutex mtx;
+    //! begin address => size
+    std::map<uintptr_t, size_t> ranges;
+
+    static MappedRanges& inst() {
+        static MappedRanges ret;
+        return ret;
+    }
+};
+
+}  // anonymous namespace
+
+struct ShmModelCache::Header {
+    //! zero-filled when the segment is created; set last by the writer
+    std::atomic<uint32_t> state;
+    uint32_t mgb_version;
+    uint64_t magic;
+    int64_t writer_pid;
+    uint64_t capacity;
+    //! end of the last entry, from the beginning of the segment
+    std::atomic<uint64_t> used;
+};
+
+struct ShmModelCache::Mapping {
+    dt_byte* ptr;
+    size_t size;
+    int fd;
+
+    Mapping(dt_byte* ptr_, size_t size_, int fd_)
+            : ptr{ptr_}, size{size_}, fd{fd_} {
+        auto&& inst = MappedRanges::inst();
+        MGB_LOCK_GUARD(inst.mtx);
+        inst.ranges[reinterpret_cast<uintptr_t>(ptr)] = size;
+    }
+
+    ~Mapping() {
+        {
+            auto&& inst = MappedRanges::inst();
+            MGB_LOCK_GUARD(inst.mtx);
+            inst.ranges.erase(reinterpret_cast<uintptr_t>(ptr));
+        }
+#if MGB_HAVE_SHM
+        munmap(ptr, size);
+        close(fd);
+#endif
+    }
+};
+
+ShmModelCache::ShmModelCache(std::shared_ptr<Mapping> mapping, bool is_writer)
+        : m_mapping{std::move(mapping)}, m_is_writer{is_writer} {}
+
+ShmModelCache::~ShmModelCache() = default;
+
+std::string ShmModelCache::segment_name(const std::string& prefix,
+                                        uint64_t model_hash) {
+    mgb_assert(prefix.find('/') == std::string::npos,
+               "bad shm cache name: %s", prefix.c_str());
+    return ssprintf("/%s-%016llx", prefix.c_str(),
+                    static_cast<unsigned long long>(model_hash));
+}
+
+bool ShmModelCache::is_shm_memory(const void* ptr) {
+    auto addr = reinterpret_cast<uintptr_t>(ptr);
+    auto&& inst = MappedRanges::inst();
+    MGB_LOCK_GUARD(inst.mtx);
+    auto iter = inst.ranges.upper_bound(addr);
+    if (iter == inst.ranges.begin()) {
+        return false;
+    }
+    --iter;
+    return addr - iter->first < iter->second;
+}
+
+void ShmModelCache::remove(const std::string& prefix, uint64_t model_hash) {
+#if MGB_HAVE_SHM
+    shm_unlink(segment_name(prefix, model_hash).c_str());
+#endif
+}
+
+std::shared_ptr<ShmModelCache> ShmModelCache::open(const std::string& prefix,
+                                                   uint64_t model_hash,
+                                                   size_t capacity,
+                                                   double timeout) {
+#if MGB_HAVE_SHM
+    /*
+     * The writer holds an exclusive flock() on the segment until it is
+     * sealed. The lock is released by the kernel if the writer dies, so a
+     * process that gets the lock on an unsealed segment recreates it in
+     * place while still holding the lock.
+     */
+    auto name = segment_name(prefix, model_hash);
+    size_t data_begin = align_up(sizeof(Header));
+    capacity = align_up(std::max(capacity, data_begin));
+
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        mgb_log_warn("failed to open shm segment %s: %s", name.c_str(),
+                     strerror(errno));
+        return nullptr;
+    }
+
+    // state of the segment; must be called with the lock held
+    auto read_state = [&]() -> uint32_t {
+        struct stat st;
+        uint32_t state;
+        if (fstat(fd, &st) || static_cast<size_t>(st.st_size) < data_begin ||
+            pread(fd, &state, sizeof(state), 0) != sizeof(state)) {
+            return INIT;
+        }
+        return state;
+    };
+
+    // initialize the segment as the writer; must be called with the
+    // exclusive lock held, which is kept until seal()
+    auto create = [&]() -> std::shared_ptr<ShmModelCache> {
+        void* ptr = MAP_FAILED;
+        // truncate to discard content of a dead writer
+        if (!ftruncate(fd, 0) && !ftruncate(fd, capacity)) {
+            ptr = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       fd, 0);
+        }
+        if (ptr == MAP_FAILED) {
+            mgb_log_warn("failed to create shm segment %s: %s", name.c_str(),
+                         strerror(errno));
+            close(fd);
+            return nullptr;
+        }
+        auto mapping = std::make_shared<Mapping>(static_cast<dt_byte*>(ptr),
+                                                 capacity, fd);
+        auto hdr = static_cast<Header*>(ptr);
+        hdr->mgb_version = MGB_VERSION;
+        hdr->magic = SHM_MAGIC;
+        hdr->writer_pid = getpid();
+        hdr->capacity = capacity;
+        hdr->used.store(data_begin);
+        hdr->state.store(WRITING, std::memory_order_release);
+        return std::shared_ptr<ShmModelCache>(
+                new ShmModelCache{std::move(mapping), true});
+    };
+
+    // map a sealed segment read-only; must be called with the lock held,
+    // which is released after mapping
+    auto attach = [&]() -> std::shared_ptr<ShmModelCache> {
+        struct stat st;
+        void* ptr = MAP_FAILED;
+        if (!fstat(fd, &st)) {
+            ptr = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        flock(fd, LOCK_UN);
+        if (ptr == MAP_FAILED) {
+            mgb_log_warn("failed to map shm segment %s: %s", name.c_str(),
+                         strerror(errno));
+            close(fd);
+            return nullptr;
+        }
+        auto mapping = std::make_shared<Mapping>(static_cast<dt_byte*>(ptr),
+                                                 st.st_size, fd);
+        auto hdr = static_cast<Header*>(ptr);
+        if (hdr->magic != SHM_MAGIC || hdr->mgb_version != MGB_VERSION ||
+            hdr->capacity != mapping->size) {
+            mgb_log_warn("shm segment %s is created by an incompatible "
+                         "MegBrain (version %u); load values in this process",
+                         name.c_str(), hdr->mgb_version);
+            return nullptr;
+        }
+        std::shared_ptr<ShmModelCache> ret{
+                new ShmModelCache{std::move(mapping), false}};
+        ret->build_index();
+        return ret;
+    };
+
+    RealTimer timer;
+    for (;;) {
+        if (!flock(fd, LOCK_EX | LOCK_NB)) {
+            auto state = read_state();
+            if (state == SEALED) {
+                return attach();
+            }
+            if (state == WRITING) {
+                mgb_log_warn("writer of shm segment %s died before sealing "
+                             "it; recreate the segment",
+                             name.c_str());
+            }
+            return create();
+        }
+        if (errno != EWOULDBLOCK) {
+            mgb_log_warn("failed to lock shm segment %s: %s", name.c_str(),
+                         strerror(errno));
+            close(fd);
+            return nullptr;
+        }
+        // the lock is held by the writer or by another process checking the
+        // state; a shared lock is granted after the writer seals or dies
+        if (!flock(fd, LOCK_SH | LOCK_NB)) {
+            if (read_state() == SEALED) {
+                return attach();
+            }
+            flock(fd, LOCK_UN);
+        }
+        if (timer.get_secs() > timeout) {
+            mgb_log_warn("shm segment %s is not sealed in %.1f seconds; "
+                         "load values in this process",
+                         name.c_str(), timeout);
+            close(fd);
+            return nullptr;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+#else
+    MGB_MARK_USED_VAR(prefix);
+    MGB_MARK_USED_VAR(model_hash);
+    MGB_MARK_USED_VAR(capacity);
+    MGB_MARK_USED_VAR(timeout);
+    mgb_log_warn("shm model cache is not supported on this platform");
+    return nullptr;
+#endif
+}
+
+ShmModelCache::Header* ShmModelCache::header() const {
+    return reinterpret_cast<Header*>(m_mapping->ptr);
+}
+
+void ShmModelCache::build_index() {
+    auto base = m_mapping->ptr;
+    size_t pos = align_up(sizeof(Header)),
+           end = header()->used.load(std::memory_order_acquire);
+    mgb_throw_if(end > m_mapping->size, SerializationError,
+                 "corrupted shm segment: used=%zu size=%zu", end,
+                 m_mapping->size);
+    while (pos < end) {
+        EntryHeader eh;
+        mgb_throw_if(pos + sizeof(eh) > end, SerializationError,
+                     "corrupted shm segment: truncated entry at %zu", pos);
+        memcpy(&eh, base + pos, sizeof(eh));
+        auto name_begin = pos + sizeof(eh);
+        auto data_begin = align_up(name_begin + eh.category_size +
+                                   eh.key_size);
+        auto next = align_up(data_begin + eh.value_size);
+        mgb_throw_if(next > end || next <= pos, SerializationError,
+                     "corrupted shm segment: entry at %zu exceeds %zu", pos,
+                     end);
+        auto name = reinterpret_cast<const char*>(base + name_begin);
+        std::string category{name, eh.category_size};
+        m_index[index_key(category,
+                          {name + eh.category_size, eh.key_size})] = {
+                data_begin, eh.value_size};
+        pos = next;
+    }
+}
+
+bool ShmModelCache::sealed() const {
+    return header()->state.load(std::memory_order_acquire) == SEALED;
+}
+
+void ShmModelCache::seal() {
+    mgb_assert(m_is_writer, "only the writer can seal a shm segment");
+    MGB_LOCK_GUARD(m_mtx);
+    header()->state.store(SEALED, std::memory_order_release);
+#if MGB_HAVE_SHM
+    // values are used in place by all the processes from now on
+    if (mprotect(m_mapping->ptr, m_mapping->size, PROT_READ)) {
+        mgb_log_warn("failed to make shm segment read-only: %s",
+                     strerror(errno));
+    }
+    // let waiting processes attach
+    flock(m_mapping->fd, LOCK_UN);
+#endif
+}
+
+size_t ShmModelCache::used_bytes() const {
+    return header()->used.load(std::memory_order_acquire);
+}
+
+Maybe<ShmModelCache::Entry> ShmModelCache::find(const std::string& category,
+                                                const Blob& key) {
+    MGB_LOCK_GUARD(m_mtx);
+    auto iter = m_index.find(index_key(category, key));
+    if (iter == m_index.end()) {
+        return None;
+    }
+    return iter->second;
+}
+
+std::shared_ptr<PersistentCache> ShmModelCache::get_fallback() {
+    MGB_LOCK_GUARD(m_mtx);
+    return m_fallback;
+}
+
+Maybe<SharedBuffer> ShmModelCache::get_shared(const std::string& category,
+                                              const Blob& key) {
+    auto entry = find(category, key);
+    if (!entry.valid()) {
+        return None;
+    }
+    return SharedBuffer{{m_mapping, m_mapping->ptr + entry->offset},
+                        entry->size};
+}
+
+Maybe<PersistentCache::Blob> ShmModelCache::get(const std::string& category,
+                                                const Blob& key) {
+    auto entry = find(category, key);
+    if (entry.valid()) {
+        return Blob{m_mapping->ptr + entry->offset, entry->size};
+    }
+    if (auto fallback = get_fallback()) {
+        return fallback->get(category, key);
+    }
+    return None;
+}
+
+std::shared_ptr<const void> ShmModelCache::get_pinned(
+        const std::string& category, const Blob& key, size_t& size) {
+    auto entry = find(category, key);
+    if (entry.valid()) {
+        size = entry->size;
+        return {m_mapping, m_mapping->ptr + entry->offset};
+    }
+    if (auto fallback = get_fallback()) {
+        return fallback->get_pinned(category, key, size);
+    }
+    return {};
+}
+
+void ShmModelCache::put(const std::string& category, const Blob& key,
+                        const Blob& value) {
+    if (!m_is_writer || !put_local(category, key, value)) {
+        if (auto fallback = get_fallback()) {
+            fallback->put(category, key, value);
+        }
+    }
+}
+
+bool ShmModelCache::put_local(const std::string& category, const Blob& key,
+                              const Blob& value) {
+    MGB_LOCK_GUARD(m_mtx);
+    auto hdr = header();
+    auto ikey = index_key(category, key);
+    if (hdr->state.load(std::memory_order_relaxed) == SEALED) {
+        return false;
+    }
+    if (m_index.count(ikey)) {
+        return true;
+    }
+    size_t begin = hdr->used.load(std::memory_order_relaxed),
+           data_begin = align_up(begin + sizeof(EntryHeader) +
+                                 category.size() + key.size),
+           end = align_up(data_begin + value.size);
+    if (end > m_mapping->size) {
+        mgb_log_warn("shm segment is full (capacity=%zu); value of %zu "
+                     "bytes is not shared",
+                     m_mapping->size, value.size);
+        return false;
+    }
+#if defined(__linux__)
+    // reserve the pages, so running out of shm reports an error instead of
+    // raising SIGBUS on access
+    if (auto err = posix_fallocate(m_mapping->fd, begin, end - begin)) {
+        mgb_log_warn("failed to allocate %zu bytes in shm segment: %s",
+                     end - begin, strerror(err));
+        return false;
+    }
+#endif
+    auto base = m_mapping->ptr;
+    EntryHeader eh{static_cast<uint32_t>(category.size()),
+                   static_cast<uint32_t>(key.size), value.size};
+    memcpy(base + begin, &eh, sizeof(eh));
+    memcpy(base + begin + sizeof(eh), category.data(), category.size());
+    memcpy(base + begin + sizeof(eh) + category.size(), key.ptr, key.size);
+    memcpy(base + data_begin, value.ptr, value.size);
+    m_index[std::move(ikey)] = {data_begin, value.size};
+    hdr->used.store(end, std::memory_order_release);
+    return true;
+}
+
+void ShmModelCache::install() {
+    if (&PersistentCache::inst() == this) {
+        return;
+    }
+    auto prev = PersistentCache::set_impl(shared_from_this());
+    MGB_LOCK_GUARD(m_mtx);
+    if (!m_fallback) {
+        m_fallback = std::move(prev);
+    }
+}
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
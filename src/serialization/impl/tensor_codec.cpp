@@ -0,0 +1,561 @@
+/**
+ * \file src/serialization/impl/tensor_codec.cpp
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#include "tensor_codec.h"
+#include "megbrain/serialization/serializer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if MGB_HAVE_THREAD
+#include <thread>
+#endif
+
+#if defined(__SSE2__) || defined(__F16C__)
+#include <immintrin.h>
+#endif
+
+using namespace mgb;
+using namespace serialization;
+using namespace tensor_codec;
+
+namespace {
+
+using Format = TensorValueEncoding::Format;
+
+//! uncompressed size of each block in compressed payloads; LZ4 offsets are
+//! limited to 64KiB
+constexpr size_t BLOCK_SIZE = 65536;
+//! flag in block size table for blocks stored without compression
+constexpr uint32_t BLOCK_STORED = 1u << 31;
+
+/*!
+ * compressed payload:
+ * CompressedHeader, uint32_t block_size_table[nr_block], block data
+ */
+struct CompressedHeader {
+    uint64_t raw_size;
+    uint32_t block_size;
+    uint32_t nr_block;
+};
+
+//! minimal number of bytes or elements to be processed by a thread
+constexpr size_t MIN_WORK_PER_THREAD = 1 << 18;
+
+/*!
+ * \brief call func(begin, end) on disjoint sub-ranges of [0, size) on at most
+ *      nr_thread threads, including the caller thread
+ */
+template <typename Func>
+void parallel_for(size_t size, size_t nr_thread, size_t min_work,
+                  Func&& func) {
+#if MGB_HAVE_THREAD
+    nr_thread = std::min(nr_thread, size / std::max<size_t>(min_work, 1));
+    if (nr_thread > 1) {
+        size_t chunk = (size + nr_thread - 1) / nr_thread;
+        std::vector<std::exception_ptr> excs(nr_thread);
+        auto run = [&](size_t idx) {
+            auto begin = std::min(size, idx * chunk),
+                 end = std::min(size, begin + chunk);
+            MGB_TRY { func(begin, end); }
+            MGB_CATCH(..., { excs[idx] = std::current_exception(); });
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < nr_thread; ++i) {
+            workers.emplace_back(run, i);
+        }
+        run(0);
+        for (auto&& i : workers) {
+            i.join();
+        }
+#if MGB_ENABLE_EXCEPTION
+        for (auto&& i : excs) {
+            if (i) {
+                std::rethrow_exception(i);
+            }
+        }
+#endif
+        return;
+    }
+#else
+    MGB_MARK_USED_VAR(nr_thread);
+    MGB_MARK_USED_VAR(min_work);
+#endif
+    func(size_t(0), size);
+}
+
+uint16_t load_u16(const uint8_t* ptr) {
+    uint16_t ret;
+    memcpy(&ret, ptr, sizeof(ret));
+    return ret;
+}
+
+uint32_t load_u32(const uint8_t* ptr) {
+    uint32_t ret;
+    memcpy(&ret, ptr, sizeof(ret));
+    return ret;
+}
+
+/* ======================= float conversions ======================= */
+
+uint16_t float_to_half(float val) {
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    uint16_t sign = (bits >> 16) & 0x8000;
+    uint32_t abs = bits & 0x7fffffff;
+    if (abs >= 0x7f800000) {
+        // inf or nan
+        return sign | (abs > 0x7f800000 ? 0x7e00 : 0x7c00);
+    }
+    if (abs >= 0x477ff000) {
+        // rounds to inf
+        return sign | 0x7c00;
+    }
+    if (abs < 0x38800000) {
+        // subnormal in half precision
+        float fabs;
+        memcpy(&fabs, &abs, sizeof(fabs));
+        return sign | static_cast<uint16_t>(std::nearbyint(fabs * 16777216.f));
+    }
+    // rebias exponent and round to nearest even
+    abs += 0xc8000fff + ((abs >> 13) & 1);
+    return sign | static_cast<uint16_t>(abs >> 13);
+}
+
+float half_to_float(uint16_t val) {
+    uint32_t sign = static_cast<uint32_t>(val & 0x8000) << 16,
+             exp = (val >> 10) & 0x1f, mant = val & 0x3ff, bits;
+    if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (mant << 13);
+    } else if (!exp) {
+        float ret = mant * (1.f / 16777216.f);
+        return sign ? -ret : ret;
+    } else {
+        bits = sign | ((exp + 112) << 23) | (mant << 13);
+    }
+    float ret;
+    memcpy(&ret, &bits, sizeof(ret));
+    return ret;
+}
+
+uint16_t float_to_bfloat16(float val) {
+    uint32_t bits;
+    memcpy(&bits, &val, sizeof(bits));
+    if ((bits & 0x7fffffff) > 0x7f800000) {
+        // keep nan quiet
+        return (bits >> 16) | 0x40;
+    }
+    bits += 0x7fff + ((bits >> 16) & 1);
+    return bits >> 16;
+}
+
+void decode_float16(const uint8_t* src, float* dst, size_t size) {
+    size_t i = 0;
+#if defined(__F16C__)
+    for (; i + 8 <= size; i += 8) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        _mm256_storeu_ps(dst + i, _mm256_cvtph_ps(v));
+    }
+#endif
+    for (; i < size; ++i) {
+        dst[i] = half_to_float(load_u16(src + i * 2));
+    }
+}
+
+void decode_bfloat16(const uint8_t* src, float* dst, size_t size) {
+    size_t i = 0;
+#if defined(__SSE2__)
+    auto zero = _mm_setzero_si128();
+    for (; i + 8 <= size; i += 8) {
+        auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * 2));
+        // interleave zeros as the lower halves of float32
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+                         _mm_unpacklo_epi16(zero, v));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i + 4),
+                         _mm_unpackhi_epi16(zero, v));
+    }
+#endif
+    for (; i < size; ++i) {
+        uint32_t bits = static_cast<uint32_t>(load_u16(src + i * 2)) << 16;
+        memcpy(dst + i, &bits, sizeof(bits));
+    }
+}
+
+void dequant_int8(const int8_t* __restrict src, float scale,
+                  float* __restrict dst, size_t size) {
+    // simple enough to be auto-vectorized
+    for (size_t i = 0; i < size; ++i) {
+        dst[i] = src[i] * scale;
+    }
+}
+
+/* ======================= format stage ======================= */
+
+size_t formatted_size(Format format, const TensorLayout& layout) {
+    switch (format) {
+        case Format::RAW:
+            return layout.span().dist_byte();
+        case Format::FLOAT16:
+        case Format::BFLOAT16:
+            return layout.total_nr_elems() * 2;
+        case Format::INT8_PER_CHANNEL:
+            mgb_throw_if(!layout.ndim || !layout[0], SerializationError,
+                         "empty tensor can not be encoded as int8");
+            return layout[0] * sizeof(float) + layout.total_nr_elems();
+    }
+    mgb_throw(SerializationError, "invalid tensor value encoding: %d",
+              static_cast<int>(format));
+}
+
+std::vector<uint8_t> encode_format(const HostTensorND& value, Format format) {
+    auto&& layout = value.layout();
+    std::vector<uint8_t> ret(formatted_size(format, layout));
+    if (format == Format::RAW) {
+        memcpy(ret.data(), value.raw_ptr(), ret.size());
+        return ret;
+    }
+    auto src = value.ptr<float>();
+    size_t size = layout.total_nr_elems();
+    if (format == Format::FLOAT16 || format == Format::BFLOAT16) {
+        auto conv = format == Format::FLOAT16 ? float_to_half
+                                              : float_to_bfloat16;
+        for (size_t i = 0; i < size; ++i) {
+            auto v = conv(src[i]);
+            memcpy(ret.data() + i * 2, &v, sizeof(v));
+        }
+        return ret;
+    }
+    mgb_assert(format == Format::INT8_PER_CHANNEL);
+    size_t nr_channel = layout[0], channel_size = size / nr_channel;
+    auto dst = reinterpret_cast<int8_t*>(ret.data() +
+                                         nr_channel * sizeof(float));
+    for (size_t c = 0; c < nr_channel; ++c) {
+        auto csrc = src + c * channel_size;
+        float amax = 0;
+        for (size_t i = 0; i < channel_size; ++i) {
+            amax = std::max(amax, std::abs(csrc[i]));
+        }
+        float scale = amax / 127.f;
+        memcpy(ret.data() + c * sizeof(float), &scale, sizeof(scale));
+        auto cdst = dst + c * channel_size;
+        for (size_t i = 0; i < channel_size; ++i) {
+            float q = scale ? std::round(csrc[i] / scale) : 0.f;
+            cdst[i] = static_cast<int8_t>(std::min(127.f, std::max(-127.f, q)));
+        }
+    }
+    return ret;
+}
+
+void decode_format(const uint8_t* src, Format format,
+                   const TensorLayout& layout, void* dest, size_t nr_thread) {
+    size_t size = layout.total_nr_elems();
+    auto dst = static_cast<float*>(dest);
+    switch (format) {
+        case Format::RAW: {
+            parallel_for(layout.span().dist_byte(), nr_thread,
+                         MIN_WORK_PER_THREAD, [&](size_t begin, size_t end) {
+                             memcpy(static_cast<uint8_t*>(dest) + begin,
+                                    src + begin, end - begin);
+                         });
+            return;
+        }
+        case Format::FLOAT16:
+        case Format::BFLOAT16: {
+            auto conv = format == Format::FLOAT16 ? decode_float16
+                                                  : decode_bfloat16;
+            parallel_for(size, nr_thread, MIN_WORK_PER_THREAD,
+                         [&](size_t begin, size_t end) {
+                             conv(src + begin * 2, dst + begin, end - begin);
+                         });
+            return;
+        }
+        case Format::INT8_PER_CHANNEL: {
+            size_t nr_channel = layout[0], channel_size = size / nr_channel;
+            auto qval = reinterpret_cast<const int8_t*>(
+                    src + nr_channel * sizeof(float));
+            parallel_for(
+                    nr_channel, nr_thread,
+                    MIN_WORK_PER_THREAD / std::max<size_t>(channel_size, 1),
+                    [&](size_t begin, size_t end) {
+                        for (size_t c = begin; c < end; ++c) {
+                            float scale;
+                            memcpy(&scale, src + c * sizeof(float),
+                                   sizeof(scale));
+                            dequant_int8(qval + c * channel_size, scale,
+                                         dst + c * channel_size,
+                                         channel_size);
+                        }
+                    });
+            return;
+        }
+    }
+    mgb_throw(SerializationError, "invalid tensor value encoding: %d",
+              static_cast<int>(format));
+}
+
+/* ======================= compression stage ======================= */
+
+std::vector<uint8_t> compress(const std::vector<uint8_t>& src) {
+    CompressedHeader header;
+    header.raw_size = src.size();
+    header.block_size = BLOCK_SIZE;
+    header.nr_block = (src.size() + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    auto table_size = header.nr_block * sizeof(uint32_t);
+
+    std::vector<uint8_t> ret(sizeof(header) + table_size + src.size());
+    memcpy(ret.data(), &header, sizeof(header));
+    auto table = ret.data() + sizeof(header);
+    size_t offset = sizeof(header) + table_size;
+    for (size_t i = 0; i < header.nr_block; ++i) {
+        auto begin = i * BLOCK_SIZE,
+             size = std::min(BLOCK_SIZE, src.size() - begin);
+        auto csize = lz4_compress_block(src.data() + begin, size,
+                                        ret.data() + offset, size - 1);
+        uint32_t info = csize;
+        if (!csize) {
+            memcpy(ret.data() + offset, src.data() + begin, size);
+            csize = size;
+            info = size | BLOCK_STORED;
+        }
+        memcpy(table + i * sizeof(uint32_t), &info, sizeof(info));
+        offset += csize;
+    }
+    ret.resize(offset);
+    return ret;
+}
+
+void decompress(const uint8_t* src, size_t size, uint8_t* dest,
+                size_t dest_size, size_t nr_thread) {
+    CompressedHeader header;
+    mgb_throw_if(size < sizeof(header), SerializationError,
+                 "compressed tensor value too short");
+    memcpy(&header, src, sizeof(header));
+    mgb_throw_if(header.raw_size != dest_size ||
+                         header.block_size != BLOCK_SIZE ||
+                         header.nr_block != (dest_size + BLOCK_SIZE - 1) /
+                                                    BLOCK_SIZE ||
+                         size < sizeof(header) +
+                                        header.nr_block * sizeof(uint32_t),
+                 SerializationError,
+                 "bad compressed tensor value header: raw_size=%zu "
+                 "expected=%zu nr_block=%u",
+                 static_cast<size_t>(header.raw_size), dest_size,
+                 header.nr_block);
+
+    // compute offsets of blocks so they can be decoded concurrently
+    auto table = src + sizeof(header);
+    std::vector<size_t> offsets(header.nr_block + 1);
+    offsets[0] = sizeof(header) + header.nr_block * sizeof(uint32_t);
+    for (size_t i = 0; i < header.nr_block; ++i) {
+        auto info = load_u32(table + i * sizeof(uint32_t));
+        offsets[i + 1] = offsets[i] + (info & ~BLOCK_STORED);
+    }
+    mgb_throw_if(offsets.back() != size, SerializationError,
+                 "compressed tensor value size mismatch: %zu vs %zu",
+                 offsets.back(), size);
+
+    auto work = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            auto info = load_u32(table + i * sizeof(uint32_t));
+            auto dbegin = i * BLOCK_SIZE,
+                 dsize = std::min(BLOCK_SIZE, dest_size - dbegin),
+                 csize = offsets[i + 1] - offsets[i];
+            if (info & BLOCK_STORED) {
+                mgb_throw_if(csize != dsize, SerializationError,
+                             "bad stored block size");
+                memcpy(dest + dbegin, src + offsets[i], dsize);
+            } else {
+                lz4_decompress_block(src + offsets[i], csize, dest + dbegin,
+                                     dsize);
+            }
+        }
+    };
+    parallel_for(header.nr_block, nr_thread,
+                 MIN_WORK_PER_THREAD / BLOCK_SIZE, work);
+}
+
+}  // anonymous namespace
+
+/* ======================= LZ4 block codec ======================= */
+
+size_t tensor_codec::lz4_compress_block(const uint8_t* src, size_t size,
+                                        uint8_t* dest, size_t max_size) {
+    // constants defined by the LZ4 block format
+    constexpr size_t MIN_MATCH = 4, MF_LIMIT = 12, LAST_LITERALS = 5,
+                     MAX_OFFSET = 65535, HASH_LOG = 12;
+    mgb_assert(size <= BLOCK_SIZE);
+
+    uint8_t *op = dest, *const oend = dest + max_size;
+    auto put_len = [&op](size_t len) {
+        for (; len >= 255; len -= 255) {
+            *op++ = 255;
+        }
+        *op++ = len;
+    };
+    // emit a sequence; match_len is zero for the last sequence
+    auto emit = [&](size_t lit_begin, size_t lit_len, size_t offset,
+                    size_t match_len) {
+        size_t bound =
+                1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1;
+        if (bound > static_cast<size_t>(oend - op)) {
+            return false;
+        }
+        auto token = op++;
+        *token = std::min<size_t>(lit_len, 15) << 4;
+        if (lit_len >= 15) {
+            put_len(lit_len - 15);
+        }
+        memcpy(op, src + lit_begin, lit_len);
+        op += lit_len;
+        if (match_len) {
+            *op++ = offset & 0xff;
+            *op++ = offset >> 8;
+            auto mlen = match_len - MIN_MATCH;
+            *token |= std::min<size_t>(mlen, 15);
+            if (mlen >= 15) {
+                put_len(mlen - 15);
+            }
+        }
+        return true;
+    };
+
+    size_t anchor = 0;
+    if (size > MF_LIMIT) {
+        uint32_t table[1 << HASH_LOG];
+        std::fill(std::begin(table), std::end(table), 0);
+        auto hash = [](uint32_t v) {
+            return (v * 2654435761u) >> (32 - HASH_LOG);
+        };
+        size_t limit = size - MF_LIMIT, match_limit = size - LAST_LITERALS;
+        for (size_t ip = 0; ip < limit;) {
+            auto seq = load_u32(src + ip);
+            auto&& slot = table[hash(seq)];
+            size_t ref = slot;
+            slot = ip;
+            if (ref >= ip || ip - ref > MAX_OFFSET ||
+                load_u32(src + ref) != seq) {
+                ++ip;
+                continue;
+            }
+            size_t len = MIN_MATCH;
+            while (ip + len < match_limit && src[ref + len] == src[ip + len]) {
+                ++len;
+            }
+            if (!emit(anchor, ip - anchor, ip - ref, len)) {
+                return 0;
+            }
+            ip += len;
+            anchor = ip;
+        }
+    }
+    if (!emit(anchor, size - anchor, 0, 0)) {
+        return 0;
+    }
+    return op - dest;
+}
+
+void tensor_codec::lz4_decompress_block(const uint8_t* src, size_t size,
+                                        uint8_t* dest, size_t dest_size) {
+    auto ip = src, iend = src + size;
+    auto op = dest, oend = dest + dest_size;
+    auto check = [](bool cond) {
+        mgb_throw_if(!cond, SerializationError,
+                     "corrupted compressed tensor value");
+    };
+    auto get_len = [&](size_t len) {
+        if (len == 15) {
+            uint8_t b;
+            do {
+                check(ip < iend);
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        return len;
+    };
+    for (;;) {
+        check(ip < iend);
+        auto token = *ip++;
+        auto lit_len = get_len(token >> 4);
+        check(lit_len <= static_cast<size_t>(iend - ip) &&
+              lit_len <= static_cast<size_t>(oend - op));
+        memcpy(op, ip, lit_len);
+        ip += lit_len;
+        op += lit_len;
+        if (ip == iend) {
+            break;
+        }
+        check(iend - ip >= 2);
+        size_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        check(offset && offset <= static_cast<size_t>(op - dest));
+        auto match_len = get_len(token & 15) + 4;
+        check(match_len <= static_cast<size_t>(oend - op));
+        auto match = op - offset;
+        if (offset >= match_len) {
+            memcpy(op, match, match_len);
+        } else {
+            // overlapping match repeats the last offset bytes
+            for (size_t i = 0; i < match_len; ++i) {
+                op[i] = match[i];
+            }
+        }
+        op += match_len;
+    }
+    check(op == oend);
+}
+
+/* ======================= encode / decode ======================= */
+
+std::vector<uint8_t> tensor_codec::encode(const HostTensorND& value,
+                                          TensorValueEncoding& encoding) {
+    mgb_assert(value.layout().is_contiguous());
+    if (encoding.format != Format::RAW &&
+        (value.dtype() != dtype::Float32() || !value.shape().ndim ||
+         !value.shape().total_nr_elems())) {
+        encoding.format = Format::RAW;
+    }
+    auto ret = encode_format(value, encoding.format);
+    if (encoding.compress) {
+        ret = compress(ret);
+    }
+    return ret;
+}
+
+void tensor_codec::decode(const void* payload, size_t size,
+                          const TensorValueEncoding& encoding,
+                          const TensorLayout& layout, void* dest,
+                          size_t nr_thread) {
+    mgb_assert(layout.is_contiguous());
+    mgb_throw_if(encoding.format != Format::RAW &&
+                         layout.dtype != dtype::Float32(),
+                 SerializationError, "encoded tensor value must be float32");
+    auto src = static_cast<const uint8_t*>(payload);
+    auto fsize = formatted_size(encoding.format, layout);
+    if (encoding.compress) {
+        if (encoding.format == Format::RAW) {
+            decompress(src, size, static_cast<uint8_t*>(dest), fsize,
+                       nr_thread);
+            return;
+        }
+        std::unique_ptr<uint8_t[]> buf{new uint8_t[fsize]};
+        decompress(src, size, buf.get(), fsize, nr_thread);
+        decode_format(buf.get(), encoding.format, layout, dest, nr_thread);
+        return;
+    }
+    mgb_throw_if(size != fsize, SerializationError,
+                 "encoded tensor value size mismatch: got=%zu expected=%zu",
+                 size, fsize);
+    decode_format(src, encoding.format, layout, dest, nr_thread);
+}
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
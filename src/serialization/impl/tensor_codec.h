@@ -0,0 +1,59 @@
+/**
+ * \file src/serialization/impl/tensor_codec.h
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+#pragma once
+
+#include "megbrain/serialization/load_dump_config.h"
+#include "megbrain/tensor.h"
+
+#include <vector>
+
+namespace mgb {
+namespace serialization {
+namespace tensor_codec {
+
+/*!
+ * \brief encode a tensor value as stored in the model file
+ *
+ * The format of \p encoding falls back to RAW if it can not be applied to
+ * the value (i.e. the value is not float32); \p encoding would be updated to
+ * the format actually used.
+ *
+ * \param value contiguous tensor value
+ * \return encoded payload
+ */
+std::vector<uint8_t> encode(const HostTensorND& value,
+                            TensorValueEncoding& encoding);
+
+/*!
+ * \brief decode a payload produced by encode()
+ *
+ * \param layout layout of the decoded value, which must be contiguous
+ * \param dest buffer to hold the decoded value
+ * \param nr_thread number of threads to decode large values
+ */
+void decode(const void* payload, size_t size,
+            const TensorValueEncoding& encoding, const TensorLayout& layout,
+            void* dest, size_t nr_thread = 1);
+
+//! LZ4 block compression of a buffer whose size is at most 64KiB
+//! \return compressed size, or 0 if it can not be compressed into \p max_size
+size_t lz4_compress_block(const uint8_t* src, size_t size, uint8_t* dest,
+                          size_t max_size);
+
+//! decompress an LZ4 block; throw SerializationError on corrupted data
+void lz4_decompress_block(const uint8_t* src, size_t size, uint8_t* dest,
+                          size_t dest_size);
+
+}  // namespace tensor_codec
+}  // namespace serialization
+}  // namespace mgb
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
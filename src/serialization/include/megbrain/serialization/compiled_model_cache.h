@@ -0,0 +1,100 @@
+/**
+ * \file src/serialization/include/megbrain/serialization/compiled_model_cache.h
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include "megbrain/serialization/file.h"
+#include "megbrain/utils/persistent_cache.h"
+
+#include <mutex>
+
+namespace mgb {
+namespace serialization {
+
+/*!
+ * \brief PersistentCache entries to be embedded in a dumped model
+ *
+ * It records algorithms chosen by profiling and preprocessed weights (see
+ * GraphCommonOptimizeOptions::weight_preprocess_cache) of a model on the
+ * target device, so loading the model on a matching environment skips
+ * profiling and weight preprocessing:
+ *
+ * 1. create a cache and install() it before compiling the model with
+ *    fast-run and/or weight preprocessing enabled, and execute the model
+ *    once;
+ * 2. dump the (unoptimized) model with GraphDumpConfig::compiled_cache set
+ *    to this cache;
+ * 3. GraphLoader checks env_tag() of the embedded cache, and returns it in
+ *    LoadResult::compiled_cache if the tag matches the loading environment;
+ *    the caller installs it before compiling the graph. Otherwise the cache
+ *    is ignored and algorithms are chosen and weights preprocessed as usual.
+ *
+ * The same graph optimization options must be used when recording and
+ * loading; entries are keyed by operator layouts, so entries of oprs
+ * transformed differently are just not found.
+ */
+class CompiledModelCache final
+        : public PersistentCache,
+          public std::enable_shared_from_this<CompiledModelCache> {
+public:
+    //! \param fallback cache to look up entries not in this cache
+    explicit CompiledModelCache(
+            std::shared_ptr<PersistentCache> fallback = {});
+
+    //! tag of the running environment, including versions and CPU features
+    static std::string env_tag();
+
+    //! serialize the entries (excluding the fallback)
+    std::vector<uint8_t> serialize() const;
+
+    //! load entries from the output of serialize(); the entries would refer
+    //! to \p buf without copy
+    static std::shared_ptr<CompiledModelCache> deserialize(
+            const SharedBuffer& buf);
+
+    /*!
+     * \brief use this cache as the global PersistentCache
+     *
+     * The current global cache would be used as fallback if no fallback
+     * has been set; nothing is done if this cache is already the global one.
+     */
+    void install();
+
+    //! number of entries whose category starts with \p category_prefix
+    size_t nr_entry(const std::string& category_prefix = {}) const;
+
+    Maybe<Blob> get(const std::string& category, const Blob& key) override;
+
+    std::shared_ptr<const void> get_pinned(const std::string& category,
+                                           const Blob& key,
+                                           size_t& size) override;
+
+    //! entries are recorded in this cache and also forwarded to the
+    //! fallback, except preprocessed weights which can be large
+    void put(const std::string& category, const Blob& key,
+             const Blob& value) override;
+
+private:
+    struct Value {
+        std::shared_ptr<const void> data;
+        size_t size;
+    };
+    using Entries = std::unordered_map<std::string, Value>;
+
+    std::shared_ptr<PersistentCache> m_fallback;
+    mutable std::mutex m_mtx;
+    std::unordered_map<std::string, Entries> m_cache;
+};
+
+}  // namespace serialization
+}  // namespace mgb
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
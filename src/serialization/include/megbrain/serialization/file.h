@@ -28,6 +28,9 @@ public:
 
     const void* data() const { return m_buf.get(); }
 
+    //! the underlying buffer, which can be used to share its ownership
+    const std::shared_ptr<const void>& shared_data() const { return m_buf; }
+
     size_t size() const { return m_size; }
 };
 
@@ -91,12 +94,28 @@ public:
     static std::unique_ptr<InputFile> make_mem_proxy(std::shared_ptr<void> ptr,
                                                      size_t size,
                                                      bool writable = true);
+
+    /*!
+     * \brief create an InputFile that maps a file on local file system into
+     *      memory
+     *
+     * Tensor values are loaded as proxies into the mapping whenever their
+     * address satisfies the alignment requirement of the comp node (see
+     * GraphDumpConfig::tensor_value_align), so multiple processes loading
+     * the same model share the pages in page cache. The mapping is private
+     * copy-on-write, so the file is never modified.
+     *
+     * On platforms without mmap, the whole file is read into memory and
+     * tensor values share that buffer.
+     */
+    static std::unique_ptr<InputFile> make_mmap(const char* path);
 };
 
 //! abstract output file interface
 class OutputFile {
     class FsImpl;
     class VectorProxyImpl;
+    class StreamImpl;
 
 public:
     virtual ~OutputFile() = default;
@@ -110,6 +129,10 @@ public:
     //! return current write offset
     virtual size_t tell() = 0;
 
+    //! whether seek() is supported; GraphDumper writes a layout that does
+    //! not need to seek back if it returns false
+    virtual bool seekable() const { return true; }
+
     //! create an OutputFile correspoding to a file on local file system
     static std::unique_ptr<OutputFile> make_fs(const char* path,
                                                char mode = 'w');
@@ -122,6 +145,15 @@ public:
      */
     static std::unique_ptr<OutputFile> make_vector_proxy(
             std::vector<uint8_t>* buf);
+
+    /*!
+     * \brief create a non-seekable OutputFile that passes written data to
+     *      a callback, e.g. to write to a pipe or a python file object
+     *
+     * Data is not buffered, and tell() returns number of bytes written.
+     */
+    static std::unique_ptr<OutputFile> make_stream(
+            thin_function<void(const void*, size_t)> writer);
 };
 
 }  // namespace serialization
@@ -0,0 +1,139 @@
+/**
+ * \file src/serialization/include/megbrain/serialization/lazy_param_pool.h
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include "megbrain/serialization/file.h"
+
+#include <atomic>
+#include <mutex>
+
+namespace mgb {
+namespace serialization {
+
+/*!
+ * \brief device values of params that are materialized on first use
+ *
+ * This is created by GraphLoader when GraphLoadConfig::lazy_param is set.
+ * Each param is backed by its offset in the tensor value region of the model
+ * file, and:
+ *
+ * 1. its device memory is allocated when a computing sequence that contains
+ *    it is compiled, so params not needed by the compiled outputs (e.g.
+ *    unused heads of a multi-task model) are never allocated;
+ * 2. its value is copied from the file right before the first opr reading it
+ *    is executed; the copy is dispatched under the execution mask of the
+ *    reader, so params on CondExec branches that are never taken are never
+ *    read;
+ * 3. params that have not been used for a number of executions can be
+ *    released by evict() and would be loaded again on next use.
+ *
+ * Memory of the file is only touched for params that are actually used if it
+ * is opened by InputFile::make_mmap(); other input files are read into memory
+ * as a whole.
+ *
+ * Note that param values are not available before execution, so graph
+ * optimizations that read param values at compile time (e.g. param fusion)
+ * should have been applied before dumping.
+ */
+class LazyParamPool final : public std::enable_shared_from_this<LazyParamPool>,
+                            public NonCopyableObj {
+    struct Param;
+    class GraphBinding;
+
+public:
+    struct Stats {
+        //! number of params managed by this pool
+        size_t nr_param = 0;
+        //! number of params whose values are currently resident
+        size_t nr_resident = 0;
+        size_t total_bytes = 0;
+        size_t resident_bytes = 0;
+        //! number of times values have been loaded from the file
+        size_t nr_fill = 0;
+        //! number of times values have been evicted
+        size_t nr_evict = 0;
+    };
+
+    //! \param blob the tensor value region of the model file
+    explicit LazyParamPool(SharedBuffer blob);
+    ~LazyParamPool();
+
+    /*!
+     * \brief add a param whose value is at \p offset of the blob
+     *
+     * \return a place holder device tensor that has correct layout and comp
+     *      node, but an empty pointer until a graph using it is compiled
+     */
+    std::shared_ptr<DeviceTensorND> add(size_t offset,
+                                        const TensorLayout& layout,
+                                        CompNode comp_node);
+
+    //! share the value of a param returned by add() on another comp node on
+    //! the same mem node
+    std::shared_ptr<DeviceTensorND> alias(
+            const std::shared_ptr<DeviceTensorND>& src, CompNode comp_node);
+
+    //! whether a tensor is returned by add() or alias()
+    bool is_lazy(const DeviceTensorND& value) const;
+
+    /*!
+     * \brief enable lazy materialization of params in a computing graph
+     *
+     * This must be called before compiling a graph that uses params in this
+     * pool. The pool is kept alive by the graph.
+     */
+    void bind(ComputingGraph& graph);
+
+    /*!
+     * \brief release params that have not been used in the last \p
+     *      max_idle_exec executions of the bound graphs
+     *
+     * Device memory of evicted params is still reserved for the compiled
+     * sequences, but its pages are returned to the system; this is only
+     * supported for params on CPU memory that span at least a page, and other
+     * params are kept resident once used. This must not be called while a
+     * computing sequence using the params is running.
+     *
+     * \return number of bytes released
+     */
+    size_t evict(size_t max_idle_exec);
+
+    Stats stats() const;
+
+    /*!
+     * \brief called by oprs holding device values before initializing the
+     *      mem plan of \p var, whose value is \p value
+     *
+     * If \p value is managed by a pool bound to the owner graph of \p var,
+     * its device memory would be allocated.
+     */
+    static void on_init_mem_plan(VarNode* var, const DeviceTensorND& value);
+
+private:
+    const SharedBuffer m_blob;
+    mutable std::mutex m_mtx;
+    std::vector<std::unique_ptr<Param>> m_params;
+    ThinHashMap<const DeviceTensorND*,
+                std::pair<std::shared_ptr<DeviceTensorND>, Param*>>
+            m_tensors;
+    //! number of executions of bound graphs
+    std::atomic_size_t m_nr_exec{0};
+    size_t m_nr_fill = 0, m_nr_evict = 0;
+
+    void alloc(Param& param);
+    void fill(Param& param);
+};
+
+}  // namespace serialization
+}  // namespace mgb
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -10,11 +10,36 @@
  */
 #pragma once
 
+#include "megbrain/serialization/compiled_model_cache.h"
 #include "megbrain/serialization/file.h"
 #include "megbrain/serialization/opr_registry.h"
+#include "megbrain/serialization/shm_model_cache.h"
 
 namespace mgb {
 namespace serialization {
+
+//! how a tensor value is stored in the dumped model
+struct TensorValueEncoding {
+    enum class Format : uint8_t {
+        //! stored as is
+        RAW = 0,
+        //! float32 values stored as IEEE half precision
+        FLOAT16 = 1,
+        //! float32 values stored as bfloat16 (upper half of float32)
+        BFLOAT16 = 2,
+        //! float32 values stored as symmetric int8 with a float32 scale for
+        //! each slice on the first axis; dequantized when loading
+        INT8_PER_CHANNEL = 3,
+    };
+
+    Format format = Format::RAW;
+
+    //! whether to apply LZ4 block compression on the (encoded) value
+    bool compress = false;
+
+    bool is_raw() const { return format == Format::RAW && !compress; }
+};
+
 //! config for dumping a whole graph; setup in GraphDumper
 struct GraphDumpConfig {
     /*!
@@ -48,13 +73,41 @@ struct GraphDumpConfig {
     std::shared_ptr<UserDataContainer> user_data;
 
     //! intercept how a single tensor is dumped; it should only dump the
-    //! tensor value without layout; useful for compression or encryption
+    //! tensor value without layout; useful for compression or encryption.
+    //! If the output file is not seekable, each value is buffered in memory
+    //! before written since its size must be written first
     TensorValueDumper tensor_value_dumper;
 
     //! a list of output nodes and names. one output node may have multiple
     //! names. this list record the mapping between output node and it's name
     std::vector<std::pair<std::string, SymbolVar>> alias_name_map;
 
+    //! if non-zero, tensor values are padded to start at file offsets that
+    //! are multiples of this value (e.g. 64 for cache line or 4096 for
+    //! page), so they can be used in-place when the file is loaded by
+    //! InputFile::make_mmap(); the dump must start at an offset aligned to
+    //! this value in the final file
+    size_t tensor_value_align = 0;
+
+    /*!
+     * \brief choose the encoding of each tensor value to reduce model size
+     * \param name tensor name; empty for anonymous tensors
+     * \param value tensor value to be dumped
+     *
+     * Values are stored as is if it is empty. Lossy formats only apply to
+     * float32 values, and other values fall back to RAW format (with
+     * compression still applied if requested). This can not be used together
+     * with tensor_value_dumper. Models containing encoded values are marked
+     * in the header, so older loaders reject them.
+     */
+    using TensorEncodingSelector = thin_function<TensorValueEncoding(
+            const std::string& name, const HostTensorND& value)>;
+    TensorEncodingSelector tensor_encoding;
+
+    //! algorithms and preprocessed weights to be embedded in the model; see
+    //! CompiledModelCache
+    std::shared_ptr<CompiledModelCache> compiled_cache;
+
     GraphDumpConfig(int keep_var_name_ = 1, bool keep_param_name_ = false,
                     bool keep_opr_priority_ = false,
                     const std::shared_ptr<UserDataContainer>& user_data_ =
@@ -128,6 +181,42 @@ struct GraphLoadConfig {
     //! GraphDumpConfig
     TensorValueLoader tensor_value_loader;
 
+    //! number of threads to copy tensor values concurrently with graph
+    //! construction; values are loaded sequentially if it is less than 2.
+    //! It is also the number of threads to decode large encoded values (see
+    //! GraphDumpConfig::tensor_encoding) when they are loaded sequentially.
+    //! It is ignored when tensor_value_loader is set or when shared tensors
+    //! of the loader have been loaded by a previous load()
+    size_t nr_load_thread = 0;
+
+    //! whether to defer loading values of params (SharedDeviceTensor and
+    //! MultipleDeviceTensorHolder) until they are used in graph execution;
+    //! see LazyParamPool for details. It is ignored when tensor_value_loader
+    //! is set or when shared tensors of the loader have been loaded by a
+    //! previous load()
+    bool lazy_param = false;
+
+    //! whether to ignore the CompiledModelCache embedded in the model
+    bool ignore_compiled_cache = false;
+
+    //! share param values and preprocessed weights with other processes
+    //! loading the same model; see ShmModelCache
+    struct ShmCacheConfig {
+        //! prefix of the segment name; shm cache is disabled if it is empty
+        std::string name;
+        //! max size of the segment; 0 to derive from the model size
+        size_t capacity = 0;
+        //! seconds to wait for the writer; values are loaded in this
+        //! process on timeout
+        double timeout = 30;
+    };
+    //! params that are kept on the host (i.e. on CPU comp nodes) are used in
+    //! place from the segment and must not be modified. It takes precedence
+    //! over lazy_param, and is ignored when tensor_value_loader is set or
+    //! when shared tensors of the loader have been loaded by a previous
+    //! load()
+    ShmCacheConfig shm_cache;
+
     GraphLoadConfig(const CompNodeMapper& comp_node_mapper_ = {},
                     const OprLoaderMaker& opr_loader_maker_ = {},
                     const std::shared_ptr<UserDataContainer>& user_data_ = {},
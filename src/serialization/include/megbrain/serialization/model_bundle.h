@@ -0,0 +1,179 @@
+/**
+ * \file src/serialization/include/megbrain/serialization/model_bundle.h
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include "megbrain/serialization/serializer.h"
+
+#include <map>
+
+namespace mgb {
+namespace serialization {
+
+//! input name => input shape, as the keys of graph variants in a bundle
+using InputShapeMap = std::map<std::string, TensorShape>;
+
+/*!
+ * \brief write a generic graph and graph variants specialized for fixed
+ *      input shapes into a single file
+ *
+ * Each graph is dumped as usual, except that tensor values are stored in a
+ * value pool shared by all the graphs: identical values (e.g. params not
+ * changed by shape-specific optimization) are written only once. Variants
+ * are usually optimized for their shapes before being dumped, and may embed
+ * a CompiledModelCache recorded with the same shapes (see
+ * GraphDumpConfig::compiled_cache), so loading a variant needs no graph
+ * optimization or algorithm profiling.
+ *
+ * Bundles are loaded by ModelBundle. GraphDumpConfig::tensor_value_dumper
+ * and tensor_encoding can not be used for graphs in a bundle.
+ */
+class ModelBundleWriter final : public NonCopyableObj {
+    struct Graph {
+        bool generic;
+        InputShapeMap shapes;
+        std::vector<uint8_t> data;
+    };
+    struct Value {
+        size_t offset, size;
+    };
+
+    std::unique_ptr<OutputFile> m_file;
+    std::vector<Graph> m_graphs;
+    std::vector<uint8_t> m_pool;
+    std::vector<Value> m_values;
+    //! hash of value content => indices in m_values
+    std::unordered_map<uint64_t, std::vector<size_t>> m_hash2values;
+    bool m_finished = false;
+
+    GraphDumper::DumpResult add_graph(Graph graph,
+                                      const SymbolVarArray& output_vars,
+                                      const GraphDumpConfig& config);
+    size_t add_value(const void* ptr, size_t size);
+
+public:
+    explicit ModelBundleWriter(std::unique_ptr<OutputFile> file);
+    ~ModelBundleWriter();
+
+    /*!
+     * \brief add the graph to be used when no variant matches the input
+     *      shapes; at most one generic graph can be added
+     */
+    GraphDumper::DumpResult add_generic(const SymbolVarArray& output_vars,
+                                        const GraphDumpConfig& config = {});
+
+    /*!
+     * \brief add a graph specialized for the shapes of its inputs
+     *
+     * The variant is keyed by names and shapes of all the Host2DeviceCopy
+     * inputs of the graph; it is an error to add two variants with the same
+     * key.
+     */
+    GraphDumper::DumpResult add_variant(const SymbolVarArray& output_vars,
+                                        const GraphDumpConfig& config = {});
+
+    //! write the bundle; no graph can be added after this call
+    void finish();
+};
+
+/*!
+ * \brief a bundle of graph variants written by ModelBundleWriter
+ *
+ * The value pool and graphs are read when the bundle is opened, and a
+ * graph is loaded from memory by its own GraphLoader each time it is
+ * requested, so loading the same graph multiple times shares the params as
+ * described in GraphLoader.
+ *
+ * Params on CPU are proxies into the pool, so the resident memory is the
+ * pool plus the graph blobs no matter how many graphs are loaded, and
+ * params of different graphs share the same memory if they have the same
+ * value. The pool is kept alive by the loaded params, which must not be
+ * modified in place (e.g. by ParamSwapper) since that would also change the
+ * other graphs. Params on other devices are copied from the pool.
+ * GraphLoadConfig::lazy_param, nr_load_thread and shm_cache are ignored,
+ * since the values are already in memory.
+ */
+class ModelBundle final : public NonCopyableObj {
+    struct Graph {
+        bool generic;
+        InputShapeMap shapes;
+        SharedBuffer data{nullptr, 0};
+        std::unique_ptr<GraphLoader> loader;
+    };
+    struct Value {
+        size_t offset, size;
+    };
+
+    class GraphFile;
+
+    SharedBuffer m_pool{nullptr, 0};
+    std::vector<Value> m_values;
+    std::vector<Graph> m_graphs;
+    //! indices of variants in m_graphs
+    std::vector<size_t> m_variants;
+    Maybe<size_t> m_generic;
+
+    ModelBundle() = default;
+    GraphLoader::LoadResult load_graph(Graph& graph,
+                                       const GraphLoadConfig& config);
+
+public:
+    ~ModelBundle();
+
+    //! whether the file is a model bundle; the read position is not
+    //! changed, and false is returned if the file is too short
+    static bool is_bundle(InputFile& file);
+
+    //! read a bundle from the current position of the file
+    static std::unique_ptr<ModelBundle> open(std::unique_ptr<InputFile> file);
+
+    //! number of shape-specialized variants
+    size_t nr_variant() const { return m_variants.size(); }
+
+    //! input shapes of a variant
+    const InputShapeMap& variant_shapes(size_t idx) const {
+        return m_graphs.at(m_variants.at(idx)).shapes;
+    }
+
+    bool has_generic() const { return m_generic.valid(); }
+
+    /*!
+     * \brief find the variant for given input shapes
+     *
+     * A variant matches if each of its inputs is given in \p shapes with
+     * the same shape; inputs not in the key of a variant are ignored.
+     *
+     * \return index of the variant; None if no variant matches
+     */
+    Maybe<size_t> find_variant(const InputShapeMap& shapes) const;
+
+    //! load a variant by index
+    GraphLoader::LoadResult load_variant(size_t idx,
+                                         const GraphLoadConfig& config = {});
+
+    //! load the generic graph
+    GraphLoader::LoadResult load_generic(const GraphLoadConfig& config = {});
+
+    /*!
+     * \brief load the variant matching the input shapes, or the generic
+     *      graph if no variant matches
+     * \param[out] variant index of the loaded variant, or None if the
+     *      generic graph is loaded
+     */
+    GraphLoader::LoadResult load(const InputShapeMap& shapes,
+                                 const GraphLoadConfig& config = {},
+                                 Maybe<size_t>* variant = nullptr);
+};
+
+}  // namespace serialization
+}  // namespace mgb
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -0,0 +1,119 @@
+/**
+ * \file src/serialization/include/megbrain/serialization/param_swapper.h
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include "megbrain/serialization/file.h"
+#include "megbrain/serialization/load_dump_config.h"
+
+namespace mgb {
+namespace opr {
+namespace mixin {
+class WeightPreprocessExecutor;
+}  // namespace mixin
+}  // namespace opr
+
+namespace serialization {
+
+/*!
+ * \brief replace param values of a running graph by those of a model with
+ *      the same topology, without recompiling the graph
+ *
+ * Params (SharedDeviceTensor, SharedDeviceTensorWithFormat and
+ * MultipleDeviceTensorHolder) are matched with the new graph by their order
+ * in the opr sequence, and must have the same layouts. New values are staged
+ * by prepare(), which can run while the graph is being executed, and are
+ * copied into the existing device storage by commit() between executions,
+ * so compiled functions and algorithms chosen by fast-run are kept. Weight
+ * preprocessing of oprs using changed params is done again in their next
+ * execution, including those reading the params through other oprs (e.g.
+ * TypeCvt or Reshape).
+ *
+ * Values of ImmutableTensor are constants of the compiled graph (used in
+ * static inference and shared between oprs), so they must be the same in the
+ * new graph.
+ *
+ * The swapper keeps references to the params, so they are not released by
+ * weight preprocessing; it should be created before the first execution if
+ * weight preprocessing is enabled. Params loaded with
+ * GraphLoadConfig::lazy_param or shm_cache can not be swapped (the
+ * constructor throws GraphError), and params shared by other graphs loaded
+ * by the same GraphLoader would also be changed.
+ *
+ * Graphs with weight preprocessing enabled can not be swapped when
+ * comp_node_seq_record_level is non-zero, since the recorded kernels would
+ * keep reading the released preprocessed weights; the constructor throws
+ * GraphError in this case, so the graph options should be set before it.
+ */
+class ParamSwapper final : public NonCopyableObj {
+    struct Param {
+        cg::OperatorNodeBase* opr;
+        VarNode* var;
+        const DeviceTensorND* cur;
+        //! modifiable value; null for ImmutableTensor
+        std::shared_ptr<DeviceTensorND> value;
+    };
+
+public:
+    struct Stats {
+        //! number of param values
+        size_t nr_param = 0;
+        //! number of values that differ from the current ones
+        size_t nr_changed = 0;
+        size_t changed_bytes = 0;
+    };
+
+    //! \param outputs endpoints of the graph whose params are to be swapped
+    explicit ParamSwapper(const SymbolVarArray& outputs);
+    ~ParamSwapper();
+
+    /*!
+     * \brief stage param values of another graph with the same topology
+     *
+     * The new graph should be transformed in the same way as the current
+     * one, e.g. loaded by GraphLoader without optimization in both cases.
+     * Previously staged values are discarded.
+     */
+    Stats prepare(const SymbolVarArray& new_outputs);
+
+    //! load a model and stage its param values
+    Stats prepare(std::unique_ptr<InputFile> file,
+                  const GraphLoadConfig& config = {});
+
+    /*!
+     * \brief copy staged values into the params
+     *
+     * This must not be called while a computing sequence of the graph is
+     * running, e.g. call it after waiting for the last execution. The copies
+     * are finished when this function returns.
+     */
+    void commit();
+
+    //! whether there are staged values not committed
+    bool has_staged() const { return !m_staged.empty(); }
+
+private:
+    std::vector<Param> m_params;
+    //! index in m_params and new value
+    std::vector<std::pair<size_t, std::shared_ptr<DeviceTensorND>>> m_staged;
+    //! oprs with preprocessed weights that depend on each var, directly or
+    //! through other oprs
+    ThinHashMap<VarNode*,
+                std::vector<opr::mixin::WeightPreprocessExecutor*>>
+            m_preprocess_readers;
+
+    static std::vector<Param> collect_params(const SymbolVarArray& outputs);
+};
+
+}  // namespace serialization
+}  // namespace mgb
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -14,6 +14,7 @@
 #include "megbrain/graph.h"
 #include "megbrain/serialization/dump_format.h"
 #include "megbrain/serialization/file.h"
+#include "megbrain/serialization/lazy_param_pool.h"
 #include "megbrain/serialization/load_dump_config.h"
 
 namespace mgb {
@@ -51,6 +52,41 @@ namespace serialization {
                 //! GraphDumper::dump
                 SymbolVarArray output_var_list;
 
+                //! params to be materialized on first use if
+                //! GraphLoadConfig::lazy_param is set; null otherwise
+                std::shared_ptr<LazyParamPool> lazy_params;
+
+                /*!
+                 * \brief cache embedded in the model; null if the model has
+                 *      no cache or the cache does not match the environment
+                 *
+                 * If it is not null, oprs are set to choose algorithms from
+                 * the cache (see gopt::enable_opr_use_profiling_cache_inplace).
+                 * The cache is not installed by the loader, since the global
+                 * PersistentCache is shared by all the graphs in the process;
+                 * the caller should call CompiledModelCache::install() before
+                 * compiling the graph to use the recorded entries, and enable
+                 * weight_preprocess and weight_preprocess_cache in the graph
+                 * options to use the recorded preprocessed weights.
+                 */
+                std::shared_ptr<CompiledModelCache> compiled_cache;
+
+                /*!
+                 * \brief shared memory cache of the model; null if
+                 *      GraphLoadConfig::shm_cache is not set or the cache can
+                 *      not be used
+                 *
+                 * Param values are taken from the cache by the loader. The
+                 * cache is not installed, since the global PersistentCache
+                 * is shared by all the graphs in the process; call
+                 * ShmModelCache::install() and enable
+                 * weight_preprocess_cache in the graph options before
+                 * compiling the graph to also share preprocessed weights.
+                 * The writer should call seal() after the model is
+                 * executed once.
+                 */
+                std::shared_ptr<ShmModelCache> shm_cache;
+
                 /*!
                  * \brief call graph->compile() but also checks for comp seq rec
                  *
@@ -59,6 +95,27 @@ namespace serialization {
                  */
                 std::unique_ptr<cg::AsyncExecutable> graph_compile(
                         const ComputingGraph::OutputSpec &outspec);
+
+                /*!
+                 * \brief create another instance of this graph for concurrent
+                 *      execution
+                 *
+                 * The new instance has its own ComputingGraph (and thus its
+                 * own activation memory), input tensors and dispatch
+                 * queues, so it can be executed simultaneously with this
+                 * one. Device storage of params (SharedDeviceTensor,
+                 * MultipleDeviceTensorHolder and ImmutableTensor) is shared
+                 * as long as the mapped comp node is on the same mem node,
+                 * which is always true for CPU comp nodes.
+                 *
+                 * \param comp_node_mapper maps logical locators of comp
+                 *      nodes used by this graph to those of the new
+                 *      instance, e.g. to bind each instance to its own
+                 *      cpu thread or thread pool
+                 */
+                LoadResult make_instance(
+                        const GraphLoadConfig::CompNodeMapper&
+                                comp_node_mapper = {}) const;
             };
 
             //! mem_node => tensor_value
@@ -129,6 +186,12 @@ namespace serialization {
 
     /*!
      * \brief dump graph into given output file
+     *
+     * Tensor values are written to the file as the oprs are dumped, and only
+     * the graph structure is kept in memory, so memory usage does not
+     * depend on param sizes. If the file is not seekable (see
+     * OutputFile::make_stream), a layout that does not need to seek back is
+     * written, which can only be loaded by this version or later.
      */
     class GraphDumper {
         public:
@@ -137,7 +200,8 @@ namespace serialization {
                 //! number of oprs written
                 size_t nr_opr = 0;
 
-                //! hash of the graph
+                //! hash of the graph, including values of tensors that are not
+                //! written by GraphDumpConfig::tensor_value_dumper
                 uint64_t content_hash;
 
                 //! full dump size and param value size
@@ -0,0 +1,143 @@
+/**
+ * \file src/serialization/include/megbrain/serialization/shm_model_cache.h
+ * MegEngine is Licensed under the Apache License, Version 2.0 (the "License")
+ *
+ * Copyright (c) 2014-2020 Megvii Inc. All rights reserved.
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT ARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+#pragma once
+
+#include "megbrain/serialization/file.h"
+#include "megbrain/utils/persistent_cache.h"
+
+#include <mutex>
+
+namespace mgb {
+namespace serialization {
+
+/*!
+ * \brief param values and preprocessed weights of a model stored in a named
+ *      POSIX shared memory segment, shared by processes serving the model
+ *
+ * The segment is named by a user-given prefix and the content hash of the
+ * model. The first process opening the segment becomes the writer: values
+ * it loads or computes are appended to the segment, and other processes
+ * wait until seal() is called by the writer and then map the segment
+ * read-only, using the values in place instead of loading and preprocessing
+ * them again. The writer holds a flock() on the segment until sealing it;
+ * if the writer dies before that, the segment is recreated by the next
+ * process that opens it.
+ *
+ * This is used by GraphLoader when GraphLoadConfig::shm_cache is set:
+ * values of shared tensors are taken from the segment. The caller can
+ * install() the cache as the global PersistentCache so preprocessed weights
+ * (see GraphCommonOptimizeOptions::weight_preprocess_cache) are also shared.
+ *
+ * Values in the segment are used in place and must not be written: the
+ * segment is mapped read-only by readers, and by the writer after seal().
+ * Use is_shm_memory() to check whether a value is in a segment.
+ *
+ * Pages are placed on the NUMA node of the writer; use different prefixes
+ * for processes on different NUMA nodes if remote access is not desired.
+ * The segment outlives the processes using it, and remove() should be
+ * called to free its memory when the model is no longer served.
+ */
+class ShmModelCache final
+        : public PersistentCache,
+          public std::enable_shared_from_this<ShmModelCache> {
+    struct Header;
+    struct Mapping;
+
+public:
+    ~ShmModelCache();
+
+    /*!
+     * \brief create or attach the segment for the model with given hash
+     *
+     * \param capacity max size of the segment if it is created by this
+     *      process
+     * \param timeout seconds to wait for the writer in another process to
+     *      seal the segment
+     * \return null if the segment can not be used, e.g. the writer does not
+     *      seal the segment within the timeout, or shared memory is not
+     *      supported
+     */
+    static std::shared_ptr<ShmModelCache> open(const std::string& prefix,
+                                               uint64_t model_hash,
+                                               size_t capacity,
+                                               double timeout);
+
+    //! name of the segment, as passed to shm_open()
+    static std::string segment_name(const std::string& prefix,
+                                    uint64_t model_hash);
+
+    //! remove the segment of a model; processes that have attached to it
+    //! are not affected
+    static void remove(const std::string& prefix, uint64_t model_hash);
+
+    //! whether \p ptr is in a segment mapped by this process; such memory
+    //! is read-only
+    static bool is_shm_memory(const void* ptr);
+
+    //! whether this process is the writer of the segment
+    bool is_writer() const { return m_is_writer; }
+
+    //! whether the segment is complete and read-only
+    bool sealed() const;
+
+    //! finish writing and make the segment read-only, so other processes
+    //! can attach to it; this must only be called by the writer
+    void seal();
+
+    //! number of bytes used in the segment
+    size_t used_bytes() const;
+
+    //! get an entry that shares memory of the segment
+    Maybe<SharedBuffer> get_shared(const std::string& category,
+                                   const Blob& key);
+
+    Maybe<Blob> get(const std::string& category, const Blob& key) override;
+
+    std::shared_ptr<const void> get_pinned(const std::string& category,
+                                           const Blob& key,
+                                           size_t& size) override;
+
+    //! append an entry if this process is the writer and the segment is not
+    //! sealed; otherwise the entry is forwarded to the fallback
+    void put(const std::string& category, const Blob& key,
+             const Blob& value) override;
+
+    //! use this cache as the global PersistentCache, with the current one
+    //! as fallback
+    void install();
+
+private:
+    struct Entry {
+        size_t offset, size;
+    };
+
+    std::shared_ptr<Mapping> m_mapping;
+    bool m_is_writer;
+    std::shared_ptr<PersistentCache> m_fallback;
+    mutable std::mutex m_mtx;
+    //! (category + '\0' + key) to entry
+    std::unordered_map<std::string, Entry> m_index;
+
+    ShmModelCache(std::shared_ptr<Mapping> mapping, bool is_writer);
+    Header* header() const;
+    void build_index();
+    Maybe<Entry> find(const std::string& category, const Blob& key);
+    std::shared_ptr<PersistentCache> get_fallback();
+    //! append an entry to the segment; return whether it is stored
+    bool put_local(const std::string& category, const Blob& key,
+                   const Blob& value);
+};
+
+}  // namespace serialization
+}  // namespace mgb
+
+// vim: syntax=cpp.doxygen foldmethod=marker foldmarker=f{{{,f}}}
@@ -11,18 +11,64 @@
 #if MGB_ENABLE_FBS_SERIALIZATION
 
 #include "megbrain/serialization/serializer.h"
+#include "megbrain/serialization/model_bundle.h"
+#include "megbrain/serialization/param_swapper.h"
 #include "megbrain/opr/io.h"
 #include "megbrain/opr/tensor_manip.h"
 #include "megbrain/opr/utility.h"
 #include "megbrain/opr/basic_arith_wrapper.h"
+#include "megbrain/opr/cond.h"
 #include "megbrain/opr/dnn/convolution.h"
 #include "megbrain/test/helper.h"
 
+#include "../impl/batched_device_value_loader.h"
+
+#if defined(__unix__)
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
 using namespace mgb;
 using namespace serialization;
 
 #define GET_OUTPUT_FILE() output_file(ssprintf("TestSerializer2.%d", __LINE__))
 
+namespace {
+//! forward algorithm lookups to another cache, but record preprocessed
+//! weights so they are computed again
+class FreshPreprocessCache final : public PersistentCache {
+    std::shared_ptr<PersistentCache> m_algo_cache;
+
+    static bool is_preprocess(const std::string& category) {
+        return !category.compare(0, 18, "weight_preprocess:");
+    }
+
+public:
+    std::map<std::pair<std::string, std::string>, std::vector<uint8_t>>
+            preprocessed;
+
+    explicit FreshPreprocessCache(std::shared_ptr<PersistentCache> algo_cache)
+            : m_algo_cache{std::move(algo_cache)} {}
+
+    Maybe<Blob> get(const std::string& category, const Blob& key) override {
+        if (is_preprocess(category)) {
+            return None;
+        }
+        return m_algo_cache->get(category, key);
+    }
+
+    void put(const std::string& category, const Blob& key,
+             const Blob& value) override {
+        if (is_preprocess(category)) {
+            auto ptr = static_cast<const uint8_t*>(value.ptr);
+            preprocessed[{category,
+                          {static_cast<const char*>(key.ptr), key.size}}] = {
+                    ptr, ptr + value.size};
+        }
+    }
+};
+}  // anonymous namespace
+
 TEST(TestSerializer2, GraphDumpLoad) {
     auto fname = GET_OUTPUT_FILE();
 
@@ -190,6 +236,972 @@ TEST(TestSerializer2, APlusBParam) {
             shmap.at("y")->size());
 }
 
+TEST(TestSerializer2, MakeInstance) {
+    auto fname = GET_OUTPUT_FILE();
+    TensorShape shape{2, 3};
+
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu0");
+    auto bias = std::make_shared<DeviceTensorND>();
+    auto bias_hv = gen(shape, cn);
+    bias->copy_from(*bias_hv);
+
+    {
+        // dump
+        auto host_x = std::make_shared<HostTensorND>(cn, shape);
+        auto graph = ComputingGraph::make();
+        auto x = opr::Host2DeviceCopy::make(*graph, host_x, {"x"}),
+             y = opr::SharedDeviceTensor::make(*graph, bias, {"y"});
+        auto z = (x + y) * 2.f;
+        auto dumper = GraphDumper::make(OutputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        dumper->dump({z.rename("z")});
+    }
+    auto loader = GraphLoader::make(InputFile::make_fs(fname.c_str()),
+                                    GraphDumpFormat::FLATBUFFERS);
+    auto rst = loader->load();
+
+    auto get_param_ptr = [](const GraphLoader::LoadResult& r) {
+        const void* ptr = nullptr;
+        cg::DepOprIter{[&](cg::OperatorNodeBase* opr) {
+            if (auto p = opr->try_cast_final<opr::SharedDeviceTensor>()) {
+                ptr = p->get_dev_tensor().raw_ptr();
+            }
+        }}.add(r.output_var_list.at(0).node());
+        return ptr;
+    };
+
+    constexpr size_t NR_INST = 2;
+    GraphLoader::LoadResult inst[NR_INST];
+    for (size_t i = 0; i < NR_INST; ++i) {
+        inst[i] = rst.make_instance([i](CompNode::Locator& loc) {
+            loc.device = i + 1;
+        });
+        ASSERT_NE(rst.graph.get(), inst[i].graph.get());
+        ASSERT_NE(rst.tensor_map.at("x").get(),
+                  inst[i].tensor_map.at("x").get());
+        ASSERT_EQ(get_param_ptr(rst), get_param_ptr(inst[i]));
+        ASSERT_EQ(CompNode::load(ssprintf("cpu%zu", i + 1)),
+                  inst[i].output_var_map.at("z").node()->comp_node());
+    }
+
+    HostTensorND host_z[NR_INST], host_z_expect[NR_INST];
+    std::unique_ptr<cg::AsyncExecutable> func[NR_INST];
+    for (size_t i = 0; i < NR_INST; ++i) {
+        auto xv = inst[i].tensor_map.at("x");
+        *xv = *gen(shape, cn);
+        host_z_expect[i].copy_from(*xv);
+        auto ptr = host_z_expect[i].ptr<float>();
+        for (size_t j = 0, it = shape.total_nr_elems(); j < it; ++j)
+            ptr[j] = (ptr[j] + bias_hv->ptr<float>()[j]) * 2.f;
+        func[i] = inst[i].graph_compile(
+                {make_callback_copy(inst[i].output_var_map.at("z"),
+                                    host_z[i])});
+    }
+    // instances run concurrently on their own comp nodes
+    for (size_t i = 0; i < NR_INST; ++i)
+        func[i]->execute();
+    for (size_t i = 0; i < NR_INST; ++i) {
+        func[i]->wait();
+        MGB_ASSERT_TENSOR_EQ(host_z_expect[i], host_z[i]);
+    }
+}
+
+TEST(TestSerializer2, MmapAlignedTensorValue) {
+    auto fname = GET_OUTPUT_FILE();
+    constexpr size_t ALIGN = 4096;
+    TensorShape shape{3, 7};
+
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu0");
+    auto bias_hv = gen(shape, cn);
+    {
+        auto host_x = std::make_shared<HostTensorND>(cn, shape);
+        auto graph = ComputingGraph::make();
+        auto x = opr::Host2DeviceCopy::make(*graph, host_x, {"x"}),
+             y = opr::SharedDeviceTensor::make(*graph, *bias_hv, {"y"}),
+             // odd-sized value to break the natural alignment
+             z = opr::SharedDeviceTensor::make(*graph, *gen({5}, cn));
+        auto dumper = GraphDumper::make(OutputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        GraphDumper::DumpConfig config;
+        config.tensor_value_align = ALIGN;
+        auto rst = dumper->dump(
+                {(x + y).rename("out0"), (z * 2.f).rename("out1")},
+                config);
+        ASSERT_EQ(rst.tensor_value_bytes,
+                  (shape.total_nr_elems() + 5) * sizeof(float));
+    }
+
+    auto check = [&](std::unique_ptr<InputFile> file, bool aligned) {
+        auto loader = GraphLoader::make(std::move(file),
+                                        GraphDumpFormat::FLATBUFFERS);
+        auto rst = loader->load();
+        auto out = rst.output_var_map.at("out0");
+        size_t nr_param = 0;
+        cg::DepOprIter{[&](cg::OperatorNodeBase* opr) {
+            if (auto p = opr->try_cast_final<opr::SharedDeviceTensor>()) {
+                auto ptr = reinterpret_cast<uintptr_t>(
+                        p->dev_data()->raw_ptr());
+                ++nr_param;
+                if (aligned) {
+                    ASSERT_EQ(0u, ptr % ALIGN);
+                }
+            }
+        }}.add(out.node());
+        ASSERT_EQ(1u, nr_param);
+
+        auto xv = rst.tensor_map.at("x");
+        *xv = *gen(shape, cn);
+        HostTensorND host_z, host_z_expect;
+        host_z_expect.copy_from(*xv);
+        for (size_t i = 0, it = shape.total_nr_elems(); i < it; ++i)
+            host_z_expect.ptr<float>()[i] += bias_hv->ptr<float>()[i];
+        auto func = rst.graph_compile({make_callback_copy(out, host_z)});
+        func->execute();
+        MGB_ASSERT_TENSOR_EQ(host_z_expect, host_z);
+    };
+
+    check(InputFile::make_fs(fname.c_str()), false);
+    check(InputFile::make_mmap(fname.c_str()), true);
+}
+
+TEST(TestSerializer2, ParallelLoad) {
+    auto fname = GET_OUTPUT_FILE();
+    TensorShape shape{4, 9};
+    constexpr size_t NR_PARAM = 16;
+
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu0");
+    {
+        auto host_x = gen(shape, cn);
+        auto graph = ComputingGraph::make();
+        // the input value is also dumped
+        auto y = opr::Host2DeviceCopy::make(*graph, host_x, {true, true},
+                                            {"x"});
+        for (size_t i = 0; i < NR_PARAM; ++i) {
+            // mix shared and immutable values of different sizes
+            auto p = i % 2 ? opr::SharedDeviceTensor::make(
+                                     *graph, *gen({1, shape[1]}, cn))
+                           : opr::ImmutableTensor::make(
+                                     *graph, *gen({shape[0], 1}, cn));
+            y = y * 0.5f + p;
+        }
+        auto dumper = GraphDumper::make(OutputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        dumper->dump({y.rename("y")});
+    }
+
+    auto host_x = gen(shape, cn);
+    auto run = [&](std::unique_ptr<InputFile> file, size_t nr_thread) {
+        GraphLoadConfig config;
+        config.nr_load_thread = nr_thread;
+        auto loader = GraphLoader::make(std::move(file),
+                                        GraphDumpFormat::FLATBUFFERS);
+        auto rst = loader->load(config);
+        rst.tensor_map.at("x")->copy_from(*host_x);
+        HostTensorND host_y;
+        auto func = rst.graph_compile(
+                {make_callback_copy(rst.output_var_map.at("y"), host_y)});
+        func->execute();
+        return host_y;
+    };
+
+    auto expect = run(InputFile::make_fs(fname.c_str()), 0);
+    for (size_t nr_thread : {2, 3, 8}) {
+        MGB_ASSERT_TENSOR_EQ(expect,
+                             run(InputFile::make_fs(fname.c_str()), nr_thread));
+        MGB_ASSERT_TENSOR_EQ(
+                expect, run(InputFile::make_mmap(fname.c_str()), nr_thread));
+    }
+
+    // input values are copied out of the model buffer, since they are
+    // written by the user
+    std::vector<uint8_t> buf;
+    {
+        FILE* fp = fopen(fname.c_str(), "rb");
+        ASSERT_NE(nullptr, fp);
+        fseek(fp, 0, SEEK_END);
+        buf.resize(ftell(fp));
+        fseek(fp, 0, SEEK_SET);
+        ASSERT_EQ(buf.size(), fread(buf.data(), 1, buf.size(), fp));
+        fclose(fp);
+    }
+    auto buf_copy = buf;
+    MGB_ASSERT_TENSOR_EQ(
+            expect,
+            run(InputFile::make_mem_proxy(buf.data(), buf.size()), 2));
+    ASSERT_EQ(buf_copy, buf);
+}
+
+TEST(TestSerializer2, BatchedDeviceValueLoader) {
+    // cpu1 stands for a device: copies to it are dispatched to its worker
+    // thread and overlap with staging the following values
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu1");
+    constexpr size_t CHUNK_SIZE = 4096;
+    BatchedDeviceValueLoader loader{CHUNK_SIZE};
+
+    std::vector<std::shared_ptr<HostTensorND>> expect;
+    std::vector<std::shared_ptr<DeviceTensorND>> dev;
+    std::vector<size_t> sizes{3, 100, 500, 1, 2000, 7, 300, 1024, 33};
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        auto host = gen({sizes[i]});
+        expect.push_back(host);
+        if (i % 3 == 0) {
+            // the value is staged in make(), and can be modified later
+            HostTensorND value;
+            value.copy_from(*host);
+            dev.push_back(loader.make(cn, value));
+            memset(value.raw_ptr(), 0, value.layout().span().dist_byte());
+        } else {
+            dev.push_back(loader.make(
+                    cn, host->layout(), [&](HostTensorND& dest) {
+                        if (i % 3 == 1) {
+                            dest.copy_from_fixlayout(*host);
+                        } else {
+                            // loaders may forward other memory
+                            dest = *host;
+                        }
+                    }));
+        }
+        ASSERT_EQ(cn, dev.back()->comp_node());
+        ASSERT_TRUE(dev.back()->layout().eq_layout(host->layout()));
+    }
+    loader.apply();
+
+    ThinHashSet<dt_byte*> chunks;
+    for (size_t i = 0; i < expect.size(); ++i) {
+        chunks.insert(dev[i]->storage().raw_storage().get());
+        HostTensorND got;
+        got.copy_from(*dev[i]).sync();
+        MGB_ASSERT_TENSOR_EQ(*expect[i], got);
+    }
+    // values are batched, and the buffer size is bounded by the chunk size
+    ASSERT_GT(chunks.size(), 1u);
+    ASSERT_LT(chunks.size(), expect.size());
+}
+
+TEST(TestSerializer2, StreamDump) {
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu0");
+    auto host_x = gen({4, 9}, cn), host_w = gen({1, 9}, cn),
+         host_b = gen({4, 1}, cn);
+
+    auto dump = [&](GraphDumper& dumper, size_t align) {
+        auto graph = ComputingGraph::make();
+        auto x = opr::Host2DeviceCopy::make(*graph, host_x, {"x"}),
+             y = x * opr::SharedDeviceTensor::make(*graph, *host_w) +
+                 opr::ImmutableTensor::make(*graph, *host_b);
+        GraphDumpConfig config;
+        config.tensor_value_align = align;
+        config.tensor_encoding = [](const std::string&, const HostTensorND&) {
+            TensorValueEncoding ret;
+            ret.compress = true;
+            return ret;
+        };
+        return dumper.dump({y.rename("y")}, config);
+    };
+    auto run = [&](GraphLoader& loader, size_t nr_thread) {
+        GraphLoadConfig config;
+        config.nr_load_thread = nr_thread;
+        auto rst = loader.load(config, false);
+        rst.tensor_map.at("x")->copy_from(*host_x);
+        HostTensorND host_y;
+        rst.graph_compile(
+                   {make_callback_copy(rst.output_var_map.at("y"), host_y)})
+                ->execute();
+        return host_y;
+    };
+
+    std::vector<uint8_t> seekable_buf;
+    dump(*GraphDumper::make(OutputFile::make_vector_proxy(&seekable_buf),
+                            GraphDumpFormat::FLATBUFFERS),
+         0);
+    auto expect = run(*GraphLoader::make(InputFile::make_mem_proxy(
+                                                 seekable_buf.data(),
+                                                 seekable_buf.size()),
+                                         GraphDumpFormat::FLATBUFFERS),
+                      0);
+
+    // two graphs written to a stream that can not seek back
+    std::vector<uint8_t> buf;
+    auto stream = OutputFile::make_stream([&buf](const void* ptr, size_t size) {
+        auto p = static_cast<const uint8_t*>(ptr);
+        buf.insert(buf.end(), p, p + size);
+    });
+    ASSERT_FALSE(stream->seekable());
+    auto dumper = GraphDumper::make(std::move(stream),
+                                    GraphDumpFormat::FLATBUFFERS);
+    ASSERT_EQ(dump(*dumper, 64).tot_bytes, buf.size());
+    dump(*dumper, 0);
+
+    for (size_t nr_thread : {0, 2}) {
+        auto file = InputFile::make_mem_proxy(buf.data(), buf.size());
+        auto format = GraphLoader::identify_graph_dump_format(*file);
+        ASSERT_TRUE(format.valid());
+        auto loader = GraphLoader::make(std::move(file), format.val());
+        MGB_ASSERT_TENSOR_EQ(expect, run(*loader, nr_thread));
+        loader = GraphLoader::make(loader->reset_file(), format.val());
+        MGB_ASSERT_TENSOR_EQ(expect, run(*loader, nr_thread));
+    }
+}
+
+#if MGB_ENABLE_COND_EXEC
+TEST(TestSerializer2, LazyParam) {
+    using MergeMode = opr::CondExecMerge::Param::Mode;
+    auto fname = GET_OUTPUT_FILE();
+    // params span several pages so they can be evicted
+    TensorShape shape{4096};
+    constexpr size_t NR_BRANCH = 2;
+
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu0");
+    std::shared_ptr<HostTensorND> host_w[NR_BRANCH];
+    {
+        auto host_x = std::make_shared<HostTensorND>(cn, shape),
+             host_pred = std::make_shared<HostTensorND>(cn, TensorShape{1});
+        auto graph = ComputingGraph::make();
+        auto x = opr::Host2DeviceCopy::make(*graph, host_x, {"x"}),
+             pred = opr::Host2DeviceCopy::make(*graph, host_pred, {"pred"});
+        auto masks = opr::CondExecPred::make(
+                pred, {pred.make_scalar(0.f), pred.make_scalar(1.f)});
+        SymbolVarArray branch_out;
+        for (size_t i = 0; i < NR_BRANCH; ++i) {
+            host_w[i] = gen(shape, cn);
+            SymbolVar xi;
+            unpack_vector(opr::CondExecMark::make(masks.at(i), {x}), xi);
+            branch_out.push_back(
+                    xi + opr::SharedDeviceTensor::make(*graph, *host_w[i]));
+        }
+        auto y = opr::CondExecMerge::make(branch_out,
+                                          {1, MergeMode::EXACT_ONE})[0];
+        auto dumper = GraphDumper::make(OutputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        dumper->dump({y.rename("y")});
+    }
+
+    GraphLoadConfig config;
+    config.lazy_param = true;
+    auto loader = GraphLoader::make(InputFile::make_mmap(fname.c_str()),
+                                    GraphDumpFormat::FLATBUFFERS);
+    auto rst = loader->load(config);
+    auto pool = rst.lazy_params;
+    ASSERT_NE(nullptr, pool);
+    ASSERT_EQ(NR_BRANCH, pool->stats().nr_param);
+    ASSERT_EQ(0u, pool->stats().nr_resident);
+
+    auto host_x = gen(shape, cn);
+    rst.tensor_map.at("x")->copy_from(*host_x);
+    HostTensorND host_y;
+    auto func = rst.graph_compile(
+            {make_callback_copy(rst.output_var_map.at("y"), host_y)});
+    ASSERT_EQ(0u, pool->stats().nr_resident);
+
+    auto run = [&](int branch) {
+        rst.tensor_map.at("pred")->ptr<float>()[0] = branch;
+        func->execute().wait();
+        HostTensorND expect;
+        expect.copy_from(*host_x);
+        for (size_t i = 0; i < shape[0]; ++i) {
+            expect.ptr<float>()[i] += host_w[branch]->ptr<float>()[i];
+        }
+        MGB_ASSERT_TENSOR_EQ(expect, host_y);
+    };
+
+    // only params on the executed branch are loaded
+    run(0);
+    auto stats = pool->stats();
+    ASSERT_EQ(1u, stats.nr_resident);
+    ASSERT_EQ(shape[0] * sizeof(float), stats.resident_bytes);
+    run(0);
+    ASSERT_EQ(1u, pool->stats().nr_fill);
+    run(1);
+    ASSERT_EQ(2u, pool->stats().nr_resident);
+
+    // branch 0 has been idle for one execution
+    ASSERT_EQ(0u, pool->evict(2));
+    ASSERT_EQ(shape[0] * sizeof(float), pool->evict(1));
+    stats = pool->stats();
+    ASSERT_EQ(1u, stats.nr_resident);
+    ASSERT_EQ(1u, stats.nr_evict);
+
+    // evicted param is loaded again on next use
+    run(0);
+    run(1);
+    stats = pool->stats();
+    ASSERT_EQ(2u, stats.nr_resident);
+    ASSERT_EQ(3u, stats.nr_fill);
+}
+#endif  // MGB_ENABLE_COND_EXEC
+
+TEST(TestSerializer2, TensorEncoding) {
+    using Format = TensorValueEncoding::Format;
+    auto fname = GET_OUTPUT_FILE();
+    TensorShape shape{16, 64};
+    // lossy formats, compression on lossy and raw values, and compressed
+    // constant (which is actually compressible)
+    std::vector<TensorValueEncoding> encodings = {
+            {Format::FLOAT16, false},          {Format::BFLOAT16, false},
+            {Format::INT8_PER_CHANNEL, false}, {Format::FLOAT16, true},
+            {Format::RAW, true},               {Format::RAW, true}};
+
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu0");
+    auto host_x = std::make_shared<HostTensorND>(cn, shape);
+    std::vector<std::shared_ptr<HostTensorND>> host_params;
+    for (size_t i = 0; i + 1 < encodings.size(); ++i) {
+        host_params.push_back(gen(shape, cn));
+    }
+    auto host_const = std::make_shared<HostTensorND>(cn, shape);
+    for (size_t i = 0; i < shape.total_nr_elems(); ++i) {
+        host_const->ptr<float>()[i] = i % 7;
+    }
+    host_params.push_back(host_const);
+
+    auto dump = [&](bool encode) {
+        auto graph = ComputingGraph::make();
+        auto y = opr::Host2DeviceCopy::make(*graph, host_x, {"x"});
+        for (size_t i = 0; i < host_params.size(); ++i) {
+            y = y + (i % 2 ? opr::SharedDeviceTensor::make(*graph,
+                                                           *host_params[i])
+                           : opr::ImmutableTensor::make(*graph,
+                                                        *host_params[i]));
+        }
+        GraphDumpConfig config;
+        size_t nr_value = 0;
+        if (encode) {
+            // values are dumped in topological order
+            config.tensor_encoding = [&](const std::string&,
+                                         const HostTensorND& value) {
+                mgb_assert(value.shape().eq_shape(shape));
+                return encodings.at(nr_value++);
+            };
+        }
+        auto dumper = GraphDumper::make(OutputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        auto rst = dumper->dump({y.rename("y")}, config);
+        if (encode) {
+            EXPECT_EQ(host_params.size(), nr_value);
+        }
+        return rst.tensor_value_bytes;
+    };
+
+    auto run = [&](size_t nr_thread) {
+        GraphLoadConfig config;
+        config.nr_load_thread = nr_thread;
+        auto loader = GraphLoader::make(InputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        auto rst = loader->load(config);
+        rst.tensor_map.at("x")->copy_from(*host_x);
+        HostTensorND host_y;
+        auto func = rst.graph_compile(
+                {make_callback_copy(rst.output_var_map.at("y"), host_y)});
+        func->execute();
+        return host_y;
+    };
+
+    // flags in the header, so loaders without decoding support reject
+    // encoded models
+    auto header_flags = [&]() {
+        uint32_t header[2];
+        InputFile::make_fs(fname.c_str())->read(header, sizeof(header));
+        return header[1];
+    };
+
+    *host_x = *gen(shape, cn);
+    auto raw_bytes = dump(false);
+    ASSERT_EQ(0u, header_flags());
+    auto expect = run(0);
+    auto encoded_bytes = dump(true);
+    ASSERT_NE(0u, header_flags());
+    ASSERT_LT(encoded_bytes, raw_bytes * 3 / 4);
+    for (size_t nr_thread : {0, 2, 4}) {
+        MGB_ASSERT_TENSOR_NEAR(expect, run(nr_thread), 5e-2);
+    }
+}
+
+TEST(TestSerializer2, CompiledCache) {
+    using S = opr::Convolution::ExecutionPolicy::Strategy;
+    auto fname = GET_OUTPUT_FILE();
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu0");
+    auto host_x = gen({2, 3, 12, 12}, cn), host_w = gen({8, 3, 3, 3}, cn);
+
+    auto make_y = [&](ComputingGraph& graph, S strategy) {
+        auto x = opr::Host2DeviceCopy::make(graph, host_x, {"x"}),
+             w = opr::SharedDeviceTensor::make(graph, *host_w);
+        opr::Convolution::ExecutionPolicy policy;
+        policy.strategy = strategy;
+        return opr::Convolution::make(x, w, {}, policy).rename("y");
+    };
+
+    // the global cache is restored by the hook on exit
+    PersistentCacheHook cache_hook{[](const std::string&, const void*,
+                                      size_t, const void*, size_t) {}};
+
+    auto run_preprocess = [&](HostTensorND& host_y, int record_level = 0) {
+        auto graph = ComputingGraph::make();
+        graph->options().comp_node_seq_record_level = record_level;
+        graph->options()
+                .graph_opt.enable_weight_preprocess()
+                .enable_weight_preprocess_cache();
+#if MGB_ENABLE_FASTRUN
+        auto y = make_y(*graph, record_level ? S::HEURISTIC : S::PROFILE);
+#else
+        auto y = make_y(*graph, S::HEURISTIC);
+#endif
+        auto func = graph->compile({make_callback_copy(y, host_y)});
+        // the second run replays the recorded kernels
+        for (int i = 0; i < (record_level ? 2 : 1); ++i) {
+            func->execute().wait();
+        }
+    };
+
+    // record algorithms and preprocessed weights on the first run
+    auto recorder = std::make_shared<CompiledModelCache>();
+    recorder->install();
+    HostTensorND expect;
+    run_preprocess(expect);
+#if MGB_ENABLE_FASTRUN
+    ASSERT_GT(recorder->nr_entry("profile:"), 0u);
+#endif
+    ASSERT_GT(recorder->nr_entry("weight_preprocess:"), 0u);
+
+    // the recorded weights are those computed again with the same algorithms
+    {
+        auto fresh = std::make_shared<FreshPreprocessCache>(recorder);
+        auto prev = PersistentCache::set_impl(fresh);
+        HostTensorND host_y;
+        run_preprocess(host_y);
+        PersistentCache::set_impl(prev);
+        MGB_ASSERT_TENSOR_NEAR(expect, host_y, 1e-4);
+        ASSERT_FALSE(fresh->preprocessed.empty());
+        for (auto&& i : fresh->preprocessed) {
+            auto&& key = i.first.second;
+            auto recorded =
+                    recorder->get(i.first.first, {key.data(), key.size()});
+            ASSERT_TRUE(recorded.valid());
+            ASSERT_EQ(i.second.size(), recorded->size);
+            ASSERT_EQ(0, memcmp(i.second.data(), recorded->ptr,
+                                recorded->size));
+        }
+    }
+    // the cache is bypassed when kernels are recorded, since they can not
+    // be waited for by the host and would be replayed on each run
+    {
+        auto bypassed = std::make_shared<CompiledModelCache>();
+        auto prev = PersistentCache::set_impl(bypassed);
+        HostTensorND host_y;
+        run_preprocess(host_y, 1);
+        PersistentCache::set_impl(prev);
+        MGB_ASSERT_TENSOR_NEAR(expect, host_y, 1e-4);
+        ASSERT_EQ(0u, bypassed->nr_entry("weight_preprocess:"));
+    }
+    {
+        auto graph = ComputingGraph::make();
+        GraphDumpConfig config;
+        config.compiled_cache = recorder;
+        auto dumper = GraphDumper::make(OutputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        dumper->dump({make_y(*graph, S::HEURISTIC)}, config);
+    }
+
+    auto load = [&](bool ignore_compiled_cache) {
+        GraphLoadConfig config;
+        config.ignore_compiled_cache = ignore_compiled_cache;
+        auto loader = GraphLoader::make(InputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        return loader->load(config);
+    };
+    ASSERT_EQ(nullptr, load(true).compiled_cache);
+
+    auto rst = load(false);
+    auto cache = rst.compiled_cache;
+    ASSERT_NE(nullptr, cache);
+    // the global cache is not replaced by loading
+    ASSERT_EQ(static_cast<PersistentCache*>(recorder.get()),
+              &PersistentCache::inst());
+    ASSERT_EQ(recorder->nr_entry(), cache->nr_entry());
+    // weight preprocessing is left to the caller installing the cache
+    ASSERT_FALSE(rst.graph->options().graph_opt.weight_preprocess);
+    ASSERT_FALSE(rst.graph->options().graph_opt.weight_preprocess_cache);
+    cache->install();
+    rst.graph->options()
+            .graph_opt.enable_weight_preprocess()
+            .enable_weight_preprocess_cache();
+    ASSERT_EQ(static_cast<PersistentCache*>(cache.get()),
+              &PersistentCache::inst());
+
+    auto y = rst.output_var_map.at("y");
+    size_t nr_conv = 0;
+    cg::DepOprIter iter{[&](cg::OperatorNodeBase* opr) {
+        if (auto conv = opr->try_cast_final<opr::Convolution>()) {
+            ++nr_conv;
+            ASSERT_EQ(S::PROFILE_HEURISTIC, conv->execution_policy().strategy);
+        }
+    }};
+    iter.add(y);
+    ASSERT_EQ(1u, nr_conv);
+
+    HostTensorND host_y;
+    rst.graph_compile({make_callback_copy(y, host_y)})->execute();
+    MGB_ASSERT_TENSOR_NEAR(expect, host_y, 1e-4);
+}
+
+#if defined(__unix__)
+TEST(TestSerializer2, ShmCache) {
+    auto fname = GET_OUTPUT_FILE();
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu0");
+    auto host_x = gen({2, 3, 12, 12}, cn), host_w = gen({8, 3, 3, 3}, cn),
+         host_b = gen({1, 8, 1, 1}, cn);
+    uint64_t hash;
+    {
+        auto graph = ComputingGraph::make();
+        auto x = opr::Host2DeviceCopy::make(*graph, host_x, {"x"}),
+             w = opr::SharedDeviceTensor::make(*graph, *host_w),
+             b = opr::SharedDeviceTensor::make(*graph, *host_b);
+        auto y = opr::Convolution::make(x, w) + b;
+        auto dumper = GraphDumper::make(OutputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        hash = dumper->dump({y.rename("y")}).content_hash;
+    }
+
+    // the global cache is restored by the hook on exit
+    PersistentCacheHook cache_hook{[](const std::string&, const void*,
+                                      size_t, const void*, size_t) {}};
+    auto prefix = ssprintf("mgbtest%d", static_cast<int>(getpid()));
+    ShmModelCache::remove(prefix, hash);
+
+    auto load = [&]() {
+        GraphLoadConfig config;
+        config.shm_cache.name = prefix;
+        config.shm_cache.timeout = 1;
+        auto loader = GraphLoader::make(InputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        return loader->load(config);
+    };
+    auto run = [&](GraphLoader::LoadResult& rst) {
+        EXPECT_FALSE(rst.graph->options().graph_opt.weight_preprocess_cache);
+        rst.graph->options()
+                .graph_opt.enable_weight_preprocess()
+                .enable_weight_preprocess_cache();
+        HostTensorND host_y;
+        // preprocessed weights are put into the cache by the worker
+        rst.graph_compile({make_callback_copy(rst.output_var_map.at("y"),
+                                              host_y)})
+                ->execute()
+                .wait();
+        return host_y;
+    };
+    // number of params used in place from the segment
+    auto nr_shm_param = [](GraphLoader::LoadResult& rst) {
+        size_t ret = 0;
+        cg::DepOprIter iter{[&ret](cg::OperatorNodeBase* opr) {
+            if (auto p = opr->try_cast_final<opr::SharedDeviceTensor>()) {
+                ret += ShmModelCache::is_shm_memory(
+                        p->get_dev_tensor().raw_ptr());
+            }
+        }};
+        for (auto&& i : rst.output_var_list) {
+            iter.add(i);
+        }
+        return ret;
+    };
+
+    // the first process is the writer, and others wait until it is sealed
+    auto rst0 = load();
+    auto writer = rst0.shm_cache;
+    ASSERT_NE(nullptr, writer);
+    ASSERT_TRUE(writer->is_writer());
+    // the loader does not replace the global cache
+    ASSERT_NE(static_cast<PersistentCache*>(writer.get()),
+              &PersistentCache::inst());
+    writer->install();
+    ASSERT_EQ(static_cast<PersistentCache*>(writer.get()),
+              &PersistentCache::inst());
+    ASSERT_EQ(2u, nr_shm_param(rst0));
+    auto expect = run(rst0);
+    auto used = writer->used_bytes();
+    ASSERT_GT(used, (host_w->layout().span().dist_byte() +
+                     host_b->layout().span().dist_byte()));
+    writer->seal();
+    ASSERT_TRUE(writer->sealed());
+
+    auto rst1 = load();
+    auto reader = rst1.shm_cache;
+    ASSERT_NE(nullptr, reader);
+    ASSERT_FALSE(reader->is_writer());
+    ASSERT_EQ(used, reader->used_bytes());
+    ASSERT_EQ(2u, nr_shm_param(rst1));
+    // values in the segment are read-only
+    ASSERT_THROW(ParamSwapper{rst1.output_var_list}, GraphError);
+    reader->install();
+    auto host_y = run(rst1);
+    MGB_ASSERT_TENSOR_NEAR(expect, host_y, 1e-4);
+    // nothing is appended after sealing
+    ASSERT_EQ(used, reader->used_bytes());
+
+    // another process attaches the sealed segment; graphs are not run in
+    // the child since the worker threads of comp nodes are not forked
+    auto pid = fork();
+    ASSERT_GE(pid, 0);
+    if (!pid) {
+        int code = 0;
+        auto child = ShmModelCache::open(prefix, hash, 4096, 1);
+        if (!child || child->is_writer() || !child->sealed()) {
+            code = 1;
+        } else if (child->used_bytes() != used) {
+            code = 2;
+        }
+        // params are keyed by their index among the shared tensors
+        for (auto param : {host_w.get(), host_b.get()}) {
+            auto size = param->layout().span().dist_byte();
+            bool found = false;
+            for (size_t i = 0; i < 2 && !code && !found; ++i) {
+                auto key = std::to_string(i);
+                auto value = child->get_shared("param", {key.data(),
+                                                         key.size()});
+                found = value.valid() && value->size() == size &&
+                        ShmModelCache::is_shm_memory(value->data()) &&
+                        !memcmp(value->data(), param->raw_ptr(), size);
+            }
+            if (!code && !found) {
+                code = 3;
+            }
+        }
+        _exit(code);
+    }
+    int status;
+    ASSERT_EQ(pid, waitpid(pid, &status, 0));
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(0, WEXITSTATUS(status));
+
+    ShmModelCache::remove(prefix, hash);
+
+    // a segment left unsealed by a dead writer (whose lock is released when
+    // the segment is closed) is recreated by the next process
+    auto dead = ShmModelCache::open(prefix, hash + 1, 4096, 1);
+    ASSERT_NE(nullptr, dead);
+    ASSERT_TRUE(dead->is_writer());
+    ASSERT_EQ(nullptr, ShmModelCache::open(prefix, hash + 1, 4096, 0.01));
+    dead.reset();
+    auto recreated = ShmModelCache::open(prefix, hash + 1, 4096, 1);
+    ASSERT_NE(nullptr, recreated);
+    ASSERT_TRUE(recreated->is_writer());
+    ShmModelCache::remove(prefix, hash + 1);
+}
+#endif
+
+TEST(TestSerializer2, ParamSwap) {
+    using S = opr::Convolution::ExecutionPolicy::Strategy;
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu0");
+    auto host_x = gen({2, 3, 12, 12}, cn), host_w0 = gen({8, 3, 3, 3}, cn),
+         host_w1 = gen({8, 3, 3, 3}, cn), host_b = gen({1, 8, 1, 1}, cn),
+         host_c0 = gen({1}, cn), host_c1 = gen({1}, cn);
+
+    auto dump = [&](const char* name,
+                    const std::shared_ptr<HostTensorND>& host_w,
+                    const std::shared_ptr<HostTensorND>& host_c) {
+        auto fname =
+                output_file(ssprintf("TestSerializer2.ParamSwap.%s", name));
+        auto make_dv = [](const HostTensorND& hv) {
+            auto ret = std::make_shared<DeviceTensorND>();
+            ret->copy_from(hv);
+            return ret;
+        };
+        auto graph = ComputingGraph::make();
+        // params are bundled as by optimize_for_inference, so the filter can
+        // be preprocessed
+        SymbolVar w, b;
+        unpack_vector(opr::MultipleDeviceTensorHolder::make(
+                              *graph, {make_dv(*host_w), make_dv(*host_b)}),
+                      w, b);
+        auto x = opr::Host2DeviceCopy::make(*graph, host_x, {"x"}),
+             c = opr::ImmutableTensor::make(*graph, *host_c);
+        opr::Convolution::ExecutionPolicy policy;
+#if MGB_ENABLE_FASTRUN
+        policy.strategy = S::PROFILE;
+#else
+        policy.strategy = S::HEURISTIC;
+#endif
+        auto y = opr::Convolution::make(x, w, {}, policy) + b + c;
+        auto dumper = GraphDumper::make(OutputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        dumper->dump({y.rename("y")});
+        return fname;
+    };
+    auto fname_a = dump("a", host_w0, host_c0),
+         fname_b = dump("b", host_w1, host_c0),
+         fname_c = dump("c", host_w0, host_c1);
+
+    auto load = [](const std::string& fname) {
+        auto loader = GraphLoader::make(InputFile::make_fs(fname.c_str()),
+                                        GraphDumpFormat::FLATBUFFERS);
+        return loader->load();
+    };
+    auto run_direct = [&](const std::string& fname) {
+        auto rst = load(fname);
+        HostTensorND host_y;
+        rst.graph_compile({make_callback_copy(rst.output_var_map.at("y"),
+                                              host_y)})
+                ->execute();
+        return host_y;
+    };
+
+    // preprocessed weights are recorded to check that they are computed
+    // again from the new params; the global cache is restored on exit
+    PersistentCacheHook cache_hook{[](const std::string&, const void*,
+                                      size_t, const void*, size_t) {}};
+    auto recorder = std::make_shared<CompiledModelCache>();
+    recorder->install();
+
+    auto rst = load(fname_a);
+    rst.graph->options()
+            .graph_opt.enable_weight_preprocess()
+            .enable_weight_preprocess_cache();
+    HostTensorND host_y;
+    auto func = rst.graph_compile(
+            {make_callback_copy(rst.output_var_map.at("y"), host_y)});
+    // created before the first execution to keep the weights resident
+    ParamSwapper swapper{rst.output_var_list};
+    func->execute().wait();
+    auto nr_preprocessed = recorder->nr_entry("weight_preprocess:");
+    ASSERT_GT(nr_preprocessed, 0u);
+    MGB_ASSERT_TENSOR_NEAR(run_direct(fname_a), host_y, 1e-4);
+
+    auto stats = swapper.prepare(InputFile::make_fs(fname_b.c_str()));
+    ASSERT_EQ(3u, stats.nr_param);
+    ASSERT_EQ(1u, stats.nr_changed);
+    ASSERT_EQ(host_w1->layout().span().dist_byte(), stats.changed_bytes);
+    ASSERT_TRUE(swapper.has_staged());
+    swapper.commit();
+    ASSERT_FALSE(swapper.has_staged());
+    func->execute().wait();
+    // the filter is preprocessed again, with a new cache key for its value
+    ASSERT_GT(recorder->nr_entry("weight_preprocess:"), nr_preprocessed);
+    MGB_ASSERT_TENSOR_NEAR(run_direct(fname_b), host_y, 1e-4);
+
+    // constants of the compiled graph can not be swapped
+    ASSERT_THROW(swapper.prepare(InputFile::make_fs(fname_c.c_str())),
+                 GraphError);
+
+    // recorded kernels would keep using the preprocessed weights
+    auto rst_rec = load(fname_a);
+    rst_rec.graph->options().comp_node_seq_record_level = 1;
+    rst_rec.graph->options().graph_opt.enable_weight_preprocess();
+    ASSERT_THROW(ParamSwapper{rst_rec.output_var_list}, GraphError);
+    rst_rec.graph->options().graph_opt.weight_preprocess = false;
+    ParamSwapper{rst_rec.output_var_list};
+}
+
+TEST(TestSerializer2, ModelBundle) {
+    auto fname = GET_OUTPUT_FILE();
+    HostTensorGenerator<> gen;
+    auto cn = CompNode::load("cpu0");
+    auto host_w = gen({32, 16, 3, 3}, cn), host_b = gen({1, 32, 1, 1}, cn);
+    auto w_bytes = host_w->layout().span().dist_byte();
+
+    auto make_y = [&](ComputingGraph& graph,
+                      const std::shared_ptr<HostTensorND>& host_x) {
+        auto x = opr::Host2DeviceCopy::make(graph, host_x, {"x"}),
+             w = opr::SharedDeviceTensor::make(graph, *host_w),
+             b = opr::SharedDeviceTensor::make(graph, *host_b);
+        return (opr::Convolution::make(x, w) + b).rename("y");
+    };
+    auto compute = [&](SymbolVar y) {
+        HostTensorND host_y;
+        y.node()->owner_graph()
+                ->compile({make_callback_copy(y, host_y)})
+                ->execute();
+        return host_y;
+    };
+
+    TensorShape shape0{1, 16, 8, 8}, shape1{4, 16, 12, 12},
+            shape_other{2, 16, 10, 10};
+    {
+        ModelBundleWriter writer{OutputFile::make_fs(fname.c_str())};
+        for (auto&& shape : {shape0, shape1}) {
+            auto graph = ComputingGraph::make();
+            writer.add_variant({make_y(*graph, gen(shape, cn))});
+        }
+        auto graph = ComputingGraph::make();
+        auto y = make_y(*graph, gen({1, 16, 1, 1}, cn));
+        ASSERT_THROW(writer.add_variant({make_y(*graph, gen(shape0, cn))}),
+                     SerializationError);
+        writer.add_generic({y});
+        writer.finish();
+    }
+
+    auto file = InputFile::make_fs(fname.c_str());
+    ASSERT_TRUE(ModelBundle::is_bundle(*file));
+    ASSERT_EQ(0u, file->tell());
+    {
+        // too short to hold the magic
+        uint8_t buf[2] = {0x4d, 0x47};
+        auto short_file = InputFile::make_mem_proxy(buf, sizeof(buf));
+        ASSERT_FALSE(ModelBundle::is_bundle(*short_file));
+        ASSERT_EQ(0u, short_file->tell());
+    }
+    // the params are written once for all the graphs
+    size_t file_size = 0;
+    {
+        FILE* fp = fopen(fname.c_str(), "rb");
+        fseek(fp, 0, SEEK_END);
+        file_size = ftell(fp);
+        fclose(fp);
+    }
+    ASSERT_LT(file_size, w_bytes * 2);
+
+    auto bundle = ModelBundle::open(std::move(file));
+    ASSERT_EQ(2u, bundle->nr_variant());
+    ASSERT_TRUE(bundle->has_generic());
+    ASSERT_TRUE(bundle->variant_shapes(1).at("x").eq_shape(shape1));
+
+    // address of the value of w in a loaded graph
+    auto get_w_ptr = [&](GraphLoader::LoadResult& rst) {
+        const void* ret = nullptr;
+        cg::DepOprIter iter{[&](cg::OperatorNodeBase* opr) {
+            if (auto p = opr->try_cast_final<opr::SharedDeviceTensor>()) {
+                auto&& val = p->get_dev_tensor();
+                if (val.shape().eq_shape(host_w->shape())) {
+                    ret = val.raw_ptr();
+                }
+            }
+        }};
+        for (auto&& i : rst.output_var_list) {
+            iter.add(i);
+        }
+        mgb_assert(ret);
+        return ret;
+    };
+
+    // CPU params of all the graphs are proxies into the pool, which is read
+    // only once; loading a graph again reuses its params
+    std::vector<const void*> w_ptrs;
+    for (auto&& shape : {shape0, shape1, shape_other, shape0}) {
+        Maybe<size_t> variant;
+        auto rst = bundle->load({{"x", shape}}, {}, &variant);
+        w_ptrs.push_back(get_w_ptr(rst));
+        ASSERT_EQ(w_ptrs[0], w_ptrs.back());
+        if (shape.eq_shape(shape_other)) {
+            ASSERT_FALSE(variant.valid());
+        } else {
+            ASSERT_TRUE(variant.valid());
+            ASSERT_TRUE(bundle->variant_shapes(variant.val())
+                                .at("x")
+                                .eq_shape(shape));
+        }
+        auto host_x = gen(shape, cn);
+        rst.tensor_map.at("x")->copy_from(*host_x);
+        auto graph = ComputingGraph::make();
+        MGB_ASSERT_TENSOR_NEAR(compute(make_y(*graph, host_x)),
+                               compute(rst.output_var_map.at("y")), 1e-4);
+    }
+}
+
 TEST(TestSerializer2, Immutable) {
     auto fname = GET_OUTPUT_FILE();
     TensorShape shape{2, 3};